@@ -0,0 +1,46 @@
+#!/bin/sh
+
+# Builds Debug, Release and RAM hot path Release firmware, flashes each one
+# using a Pico debugger, and prints the main loop time distribution measured
+# while MIDI traffic is being passed through the YouMe Transformer.
+# If a traffic file (.syx or raw MIDI bytes) is given, it's sent to the
+# device on every run, so that each build is measured with the same
+# traffic; otherwise, traffic must be sent by hand while it runs.
+
+if [ -z "$1" ]; then
+    echo "Error: No MIDI port specified."
+    echo "Usage: $0 <amidi port> [seconds] [traffic file]"
+    exit 1
+fi
+
+PORT=$1
+SECONDS_PER_RUN=${2:-10}
+TRAFFIC=$3
+
+run() {
+    NAME=$1
+    shift
+
+    echo "== $NAME =="
+    cmake -B build-benchmark/$NAME "$@" && (cd build-benchmark/$NAME && make -j4) || exit 1
+    ./flash-firmware.sh build-benchmark/$NAME/youme-transformer.elf || exit 1
+
+    # Give the firmware time to boot and the USB ports time to mount,
+    # then start measuring from a clean histogram.
+    sleep 2
+    amidi -p "$PORT" -S 'F0 7D 59 4D 03 F7'
+    echo "Measuring for $SECONDS_PER_RUN seconds..."
+    if [ -n "$TRAFFIC" ]; then
+        amidi -p "$PORT" -s "$TRAFFIC" &
+    fi
+    sleep "$SECONDS_PER_RUN"
+    wait
+
+    amidi -p "$PORT" -S 'F0 7D 59 4D 02 05 F7' -r build-benchmark/$NAME/loop.syx -t 1
+    ./tools/loop-report.py build-benchmark/$NAME/loop.syx
+    echo
+}
+
+run debug -DCMAKE_BUILD_TYPE=Debug -DRAM_HOT_PATH=OFF
+run release -DCMAKE_BUILD_TYPE=Release -DRAM_HOT_PATH=OFF
+run release-ram -DCMAKE_BUILD_TYPE=Release -DRAM_HOT_PATH=ON
@@ -1 +1 @@
-rm -rf build && rm -rf build-docker
+rm -rf build && rm -rf build-docker && rm -rf build-benchmark
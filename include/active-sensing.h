@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+struct ActiveSensingConfig {
+    // How long a source that has been sending active sensing can go
+    // without sending anything before its connection counts as lost.
+    // The MIDI specification allows 300 ms between messages, so this
+    // leaves a little room for jitter.
+    uint32_t timeoutUs = 330000;
+
+    // How often active sensing is written to an output that
+    // has had no other traffic; 0 doesn't regenerate it.
+    uint32_t intervalUs = 300000;
+};
+
+/**
+ * @brief Terminates active sensing at each port, rather than passing
+ * it through to every output.
+ *
+ * Active sensing from a source is absorbed, and only used to watch that
+ * the source is still connected. Once a source has sent it, the source
+ * must keep sending something, or it's treated as disconnected, so that
+ * its notes can be released. Each output gets its own active sensing,
+ * which is only sent when nothing else has been written to it for
+ * a while, so a synth's timeout reflects the link it's plugged into.
+ */
+template<size_t numPorts>
+class ActiveSensing {
+public:
+    ActiveSensingConfig config;
+
+    bool isSensing[numPorts] = {false};
+    uint32_t lastReceivedUs[numPorts] = {0};
+    uint32_t lastWrittenUs[numPorts] = {0};
+
+    uint32_t numAbsorbed[numPorts] = {0};
+    uint32_t numTimeouts[numPorts] = {0};
+    uint32_t numRegenerated[numPorts] = {0};
+
+    void init(uint32_t nowUs,
+        ActiveSensingConfig config = ActiveSensingConfig()) {
+        this->config = config;
+
+        for (size_t i = 0; i < numPorts; i++) {
+            isSensing[i] = false;
+            lastWrittenUs[i] = nowUs;
+            numAbsorbed[i] = 0;
+            numTimeouts[i] = 0;
+            numRegenerated[i] = 0;
+        }
+    }
+
+    /**
+     * @brief Records a message received from a source.
+     *
+     * @return true if the message is active sensing,
+     * in which case it shouldn't be routed
+     */
+    inline bool handleReceived(uint8_t source, uint8_t status,
+        uint32_t nowUs) {
+        lastReceivedUs[source] = nowUs;
+
+        if (status != sig_MIDI_STATUS_ACTIVE_SENSING) {
+            return false;
+        }
+
+        isSensing[source] = true;
+        numAbsorbed[source]++;
+
+        return true;
+    }
+
+    // Records that something other than active sensing
+    // (such as SysEx) was received from a source.
+    inline void recordReceived(uint8_t source, uint32_t nowUs) {
+        lastReceivedUs[source] = nowUs;
+    }
+
+    // Records that something was written to an output.
+    inline void recordWritten(uint8_t destination, uint32_t nowUs) {
+        lastWrittenUs[destination] = nowUs;
+    }
+
+    // Forgets that a source was sending active sensing,
+    // such as when it has been unplugged.
+    inline void reset(uint8_t source) {
+        isSensing[source] = false;
+    }
+
+    /**
+     * @brief Calls onTimeout(source) for every source that has stopped
+     * sending. A source isn't watched again until it next sends
+     * active sensing.
+     */
+    template<typename TimeoutFn>
+    inline void checkSources(uint32_t nowUs, TimeoutFn onTimeout) {
+        for (size_t i = 0; i < numPorts; i++) {
+            if (isSensing[i] &&
+                nowUs - lastReceivedUs[i] > config.timeoutUs) {
+                isSensing[i] = false;
+                numTimeouts[i]++;
+                onTimeout(i);
+            }
+        }
+    }
+
+    // Whether active sensing is due on an output that has been quiet.
+    inline bool isDue(uint8_t destination, uint32_t nowUs) {
+        return config.intervalUs > 0 &&
+            nowUs - lastWrittenUs[destination] >= config.intervalUs;
+    }
+
+    inline void recordRegenerated(uint8_t destination, uint32_t nowUs) {
+        lastWrittenUs[destination] = nowUs;
+        numRegenerated[destination]++;
+    }
+};
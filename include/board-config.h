@@ -0,0 +1,208 @@
+#pragma once
+
+// The size of every statically-allocated MIDI buffer on the board.
+// These are plain defines so that they can be used by the C
+// configuration headers for TinyUSB, and each can be overridden
+// for a particular deployment with a compile definition.
+
+// Per-port parser and read buffers.
+#ifndef BOARD_UART_MESSAGE_BUFFER_SIZE
+#define BOARD_UART_MESSAGE_BUFFER_SIZE 4
+#endif
+
+#ifndef BOARD_UART_SYSEX_BUFFER_SIZE
+#define BOARD_UART_SYSEX_BUFFER_SIZE 32
+#endif
+
+#ifndef BOARD_UART_READ_BUFFER_SIZE
+#define BOARD_UART_READ_BUFFER_SIZE 4
+#endif
+
+#ifndef BOARD_USB_DEVICE_MESSAGE_BUFFER_SIZE
+#define BOARD_USB_DEVICE_MESSAGE_BUFFER_SIZE 4
+#endif
+
+#ifndef BOARD_USB_DEVICE_SYSEX_BUFFER_SIZE
+#define BOARD_USB_DEVICE_SYSEX_BUFFER_SIZE 32
+#endif
+
+#ifndef BOARD_USB_DEVICE_READ_BUFFER_SIZE
+#define BOARD_USB_DEVICE_READ_BUFFER_SIZE 4
+#endif
+
+#ifndef BOARD_USB_HOST_MESSAGE_BUFFER_SIZE
+#define BOARD_USB_HOST_MESSAGE_BUFFER_SIZE 4
+#endif
+
+#ifndef BOARD_USB_HOST_SYSEX_BUFFER_SIZE
+#define BOARD_USB_HOST_SYSEX_BUFFER_SIZE 32
+#endif
+
+#ifndef BOARD_USB_HOST_READ_BUFFER_SIZE
+#define BOARD_USB_HOST_READ_BUFFER_SIZE 4
+#endif
+
+// TinyUSB MIDI FIFOs. The host FIFOs are allocated
+// for each hosted MIDI device.
+#ifndef BOARD_USB_DEVICE_MIDI_RX_BUFSIZE
+#define BOARD_USB_DEVICE_MIDI_RX_BUFSIZE 64
+#endif
+
+#ifndef BOARD_USB_DEVICE_MIDI_TX_BUFSIZE
+#define BOARD_USB_DEVICE_MIDI_TX_BUFSIZE 64
+#endif
+
+#ifndef BOARD_USB_HOST_MIDI_RX_BUFSIZE
+#define BOARD_USB_HOST_MIDI_RX_BUFSIZE 64
+#endif
+
+#ifndef BOARD_USB_HOST_MIDI_TX_BUFSIZE
+#define BOARD_USB_HOST_MIDI_TX_BUFSIZE 64
+#endif
+
+// The number of messages that can be waiting in each port's
+// scheduled output queue.
+#ifndef BOARD_OUTPUT_QUEUE_SIZE
+#define BOARD_OUTPUT_QUEUE_SIZE 48
+#endif
+
+// The number of messages from each source that can be waiting
+// to be merged into each destination. Must be a power of two.
+#ifndef BOARD_MERGE_QUEUE_SIZE
+#define BOARD_MERGE_QUEUE_SIZE 16
+#endif
+
+// The bytes charged for a note when merging (see include/fair-merge.h);
+// less than three favors notes over continuous data.
+#ifndef BOARD_MERGE_NOTE_COST
+#define BOARD_MERGE_NOTE_COST 1
+#endif
+
+// The chunks of SysEx (each up to a parser's SysEx buffer long)
+// that can be held for each destination while it's being paced.
+// Must be a power of two.
+#ifndef BOARD_SYSEX_PACER_CHUNKS
+#define BOARD_SYSEX_PACER_CHUNKS 16
+#endif
+
+// Queued messages are stored once in a shared pool of slots, however
+// many destinations they're queued for (see include/message-pool.h).
+// There can be at most 254 slots; SysEx uses several.
+#ifndef BOARD_MESSAGE_POOL_SIZE
+#define BOARD_MESSAGE_POOL_SIZE 192
+#endif
+
+#ifndef BOARD_MESSAGE_POOL_SLOT_SIZE
+#define BOARD_MESSAGE_POOL_SLOT_SIZE 8
+#endif
+
+// The number of SysEx routes, which send SysEx to particular
+// destinations based on its header (see include/sysex-router.h).
+#ifndef BOARD_SYSEX_ROUTES
+#define BOARD_SYSEX_ROUTES 8
+#endif
+
+// The constant latency added to every route, in microseconds;
+// 0 writes messages as soon as they are received.
+#ifndef BOARD_OUTPUT_LATENCY_US
+#define BOARD_OUTPUT_LATENCY_US 0
+#endif
+
+// Whether notes sent to the USB host port are distributed across
+// every hosted device, rather than all going to the first one.
+#ifndef BOARD_HOST_DISTRIBUTE_VOICES
+#define BOARD_HOST_DISTRIBUTE_VOICES 0
+#endif
+
+// Whether output to the USB ports is held until the start of the next
+// USB frame, and the bytes held for the device port and each hosted
+// device. 48 bytes of three-byte messages fill a 64-byte USB packet.
+#ifndef BOARD_USB_FRAME_ALIGNED
+#define BOARD_USB_FRAME_ALIGNED 0
+#endif
+
+#ifndef BOARD_USB_FRAME_BATCH_SIZE
+#define BOARD_USB_FRAME_BATCH_SIZE 48
+#endif
+
+// How often active sensing is written to an output that has had no
+// other traffic, in microseconds; 0 stops it being regenerated.
+// Active sensing received from a source is never passed through.
+#ifndef BOARD_ACTIVE_SENSING_INTERVAL_US
+#define BOARD_ACTIVE_SENSING_INTERVAL_US 300000
+#endif
+
+// The cached controllers replayed each millisecond to a USB port
+// that has just been plugged in (see include/controller-cache.h).
+#ifndef BOARD_CONTROLLER_REPLAY_MESSAGES_PER_MS
+#define BOARD_CONTROLLER_REPLAY_MESSAGES_PER_MS 4
+#endif
+
+// The control changes each USB port's cache can hold, across every
+// channel. There can be at most 255.
+#ifndef BOARD_CONTROLLER_CACHE_SIZE
+#define BOARD_CONTROLLER_CACHE_SIZE 128
+#endif
+
+// Whether MIDI Time Code quarter frames from the master source are
+// regenerated, evenly spaced, rather than being forwarded as they
+// arrive (see include/midi-time-code.h).
+#ifndef BOARD_MTC_REGENERATE
+#define BOARD_MTC_REGENERATE 0
+#endif
+
+// The flight recorder (see include/flight-recorder.h): the number of
+// recent events it keeps, which must be a power of two, and the route
+// latency (beyond the time a backed-up port needs to send what was
+// queued ahead) and main loop iteration time, in microseconds, that
+// freeze them into a recording. 0 disables a trigger.
+#ifndef BOARD_FLIGHT_RECORDER_SIZE
+#define BOARD_FLIGHT_RECORDER_SIZE 128
+#endif
+
+#ifndef BOARD_FLIGHT_RECORDER_LATENCY_US
+#define BOARD_FLIGHT_RECORDER_LATENCY_US 10000
+#endif
+
+#ifndef BOARD_FLIGHT_RECORDER_LOOP_TIME_US
+#define BOARD_FLIGHT_RECORDER_LOOP_TIME_US 5000
+#endif
+
+// How long the main loop may stall before the watchdog resets the
+// device, in milliseconds; 0 leaves the watchdog off. This must be
+// longer than any step of starting up USB.
+#ifndef BOARD_WATCHDOG_TIMEOUT_MS
+#define BOARD_WATCHDOG_TIMEOUT_MS 0
+#endif
+
+// Whether firmware built with SELF_TEST runs the throughput self-test
+// (see include/self-test.h) from the first DIN input as soon as it
+// boots. It can always be started with a SysEx command.
+#ifndef BOARD_SELF_TEST_AT_BOOT
+#define BOARD_SELF_TEST_AT_BOOT 0
+#endif
+
+// Telemetry (see include/telemetry.h): the number of trace records
+// that can be waiting to be sent, which must be a power of two,
+// and the TinyUSB CDC FIFOs.
+#ifndef BOARD_TRACE_RING_SIZE
+#define BOARD_TRACE_RING_SIZE 256
+#endif
+
+#ifndef BOARD_TELEMETRY_RX_BUFSIZE
+#define BOARD_TELEMETRY_RX_BUFSIZE 64
+#endif
+
+#ifndef BOARD_TELEMETRY_TX_BUFSIZE
+#define BOARD_TELEMETRY_TX_BUFSIZE 512
+#endif
+
+// Depth of the debugging MIDI log; 0 disables it.
+#ifndef BOARD_LOG_BUFFER_SIZE
+#define BOARD_LOG_BUFFER_SIZE 0
+#endif
+
+// The most RAM that the planned buffers may use.
+#ifndef BOARD_RAM_BUDGET
+#define BOARD_RAM_BUDGET (64 * 1024)
+#endif
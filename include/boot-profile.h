@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum BootPhase {
+    BOOT_PHASE_SYSTEM_CLOCK = 0,
+    BOOT_PHASE_UART,
+    BOOT_PHASE_LEDS,
+    BOOT_PHASE_USB_DEVICE,
+    BOOT_PHASE_USB_HOST,
+    BOOT_PHASE_FIRST_MESSAGE,
+    NUM_BOOT_PHASES
+};
+
+/**
+ * @brief Records the time, in microseconds since power-on,
+ * at which each startup phase completed.
+ */
+class BootProfile {
+public:
+    uint32_t phaseCompletedUs[NUM_BOOT_PHASES] = {0};
+    uint32_t completedPhases = 0;
+
+    void mark(BootPhase phase, uint32_t nowUs) {
+        if (hasCompleted(phase)) {
+            return;
+        }
+
+        phaseCompletedUs[phase] = nowUs;
+        completedPhases |= 1UL << phase;
+    }
+
+    inline bool hasCompleted(BootPhase phase) {
+        return completedPhases & (1UL << phase);
+    }
+};
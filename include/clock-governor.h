@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ClockGovernorConfig {
+    // How long the YouMe Transformer must go without routing a message
+    // before each step down.
+    uint32_t stepDownHoldUs = 2000000;
+
+    // How often the time spent at each frequency is brought up to date.
+    uint32_t accumulateIntervalUs = 100000;
+};
+
+/**
+ * @brief Chooses a system clock frequency based on whether the YouMe
+ * Transformer is being played through. The clock goes up to the highest
+ * frequency with the first message, or anything waiting to be written,
+ * or anything that requires full speed, and comes down one step at a
+ * time after no messages have been routed for a while. Even a single
+ * note every second keeps it at full speed.
+ *
+ * The governor doesn't change the clock itself; it only decides.
+ * Frequencies must be listed from highest to lowest, and each one
+ * must already be known to work with the board's peripherals.
+ */
+template<size_t numFrequencies>
+class ClockGovernor {
+public:
+    static_assert(numFrequencies > 0, "At least one frequency is needed.");
+
+    ClockGovernorConfig config;
+    const uint32_t* frequenciesKHz = NULL;
+    uint8_t level = 0;
+
+    uint32_t lastActiveUs = 0;
+
+    uint32_t numChanges = 0;
+    uint32_t levelStartUs = 0;
+    // The time spent at each frequency, up to the last accumulation.
+    uint32_t levelTimeMs[numFrequencies] = {0};
+
+    void init(const uint32_t (&frequenciesKHz)[numFrequencies],
+        uint32_t nowUs,
+        ClockGovernorConfig config = ClockGovernorConfig()) {
+        this->frequenciesKHz = frequenciesKHz;
+        this->config = config;
+        level = 0;
+        lastActiveUs = nowUs;
+        numChanges = 0;
+        levelStartUs = nowUs;
+
+        for (size_t i = 0; i < numFrequencies; i++) {
+            levelTimeMs[i] = 0;
+        }
+    }
+
+    inline uint32_t frequencyKHz() {
+        return frequenciesKHz[level];
+    }
+
+    /**
+     * @brief Decides whether the clock should change.
+     * Called once per main loop iteration.
+     *
+     * @param mustRunAtMax true when something (such as a hosted USB
+     * device) requires the highest frequency
+     * @param numMessages the number of messages routed since the
+     * last update
+     * @param queueDepth the number of output messages that are waiting
+     * @return the frequency to switch to, in kHz, or 0 to stay
+     */
+    inline uint32_t update(uint32_t nowUs, bool mustRunAtMax,
+        uint32_t numMessages, size_t queueDepth) {
+        if (nowUs - levelStartUs >= config.accumulateIntervalUs) {
+            accumulateLevelTime(nowUs);
+        }
+
+        // Going up doesn't wait for anything.
+        if (mustRunAtMax || numMessages > 0 || queueDepth > 0) {
+            lastActiveUs = nowUs;
+            return changeLevel(0, nowUs);
+        }
+
+        if (nowUs - lastActiveUs < config.stepDownHoldUs ||
+            level + 1 >= (int) numFrequencies) {
+            return 0;
+        }
+
+        // Each step down needs another full hold period.
+        lastActiveUs = nowUs;
+        return changeLevel(level + 1, nowUs);
+    }
+
+private:
+    // Time is accumulated regularly, so that it's
+    // counted correctly when the microsecond timer wraps.
+    inline void accumulateLevelTime(uint32_t nowUs) {
+        uint32_t elapsedMs = (nowUs - levelStartUs) / 1000;
+        levelTimeMs[level] += elapsedMs;
+        levelStartUs += elapsedMs * 1000;
+    }
+
+    inline uint32_t changeLevel(uint8_t newLevel, uint32_t nowUs) {
+        if (newLevel == level) {
+            return 0;
+        }
+
+        accumulateLevelTime(nowUs);
+        level = newLevel;
+        numChanges++;
+
+        return frequenciesKHz[level];
+    }
+};
@@ -0,0 +1,454 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-controllers.h"
+#include "midi-parser.h"
+
+#define CONTROLLER_CACHE_NUM_CHANNELS 16
+#define CONTROLLER_CACHE_WORDS_PER_CHANNEL 4
+
+struct ControllerReplayConfig {
+    // How long after a device is mounted before replay starts,
+    // so that it has time to get ready.
+    uint32_t delayUs = 100000;
+
+    // Replay is paced at this many messages per interval.
+    uint8_t messagesPerInterval = 4;
+    uint32_t intervalUs = 1000;
+};
+
+/**
+ * @brief Caches the controller state sent to a destination on each
+ * channel (bank select, program change, control changes, pitch bend
+ * and channel pressure), so it can be replayed to a device that has
+ * just been plugged in.
+ *
+ * Only the controllers that have been set to something other than
+ * their defaults take up room: each channel has a 128-bit set of the
+ * controllers it has stored, and their values are packed into one
+ * array of up to capacity entries, ordered by channel and controller.
+ * A controller's entry is found by counting the bits below it. Once
+ * stored, a controller keeps its entry until the cache is cleared, so
+ * a controller that keeps returning to its default (such as a
+ * modulation wheel) doesn't move the others around. Controllers that
+ * don't fit are counted, and aren't replayed.
+ *
+ * Data entry, increment/decrement and parameter numbers aren't cached,
+ * since they're only meaningful in sequence, and neither are channel
+ * mode messages.
+ *
+ * Replay walks the cache with a cursor, a few messages at a time,
+ * so that it neither floods the new device nor stalls the main loop.
+ * Each channel's bank select is replayed before its program change,
+ * which comes before its other controllers.
+ */
+template<size_t capacity>
+class ControllerCache {
+public:
+    static_assert(capacity < 256, "Entries are indexed with a single byte.");
+
+    // Replay positions within a channel.
+    enum ReplayStep {
+        REPLAY_STEP_BANK_MSB = 0,
+        REPLAY_STEP_BANK_LSB,
+        REPLAY_STEP_PROGRAM,
+        REPLAY_STEP_CONTROLLERS,
+        REPLAY_STEP_PITCH_BEND,
+        REPLAY_STEP_PRESSURE,
+        REPLAY_STEP_DONE
+    };
+
+    uint32_t stored[CONTROLLER_CACHE_NUM_CHANNELS]
+        [CONTROLLER_CACHE_WORDS_PER_CHANNEL] = {{0}};
+    uint8_t values[capacity] = {0};
+    // The entry of each channel's first controller. The last
+    // is the number of entries in use.
+    uint8_t channelStarts[CONTROLLER_CACHE_NUM_CHANNELS + 1] = {0};
+    uint32_t numDropped = 0;
+    uint16_t pitchBends[CONTROLLER_CACHE_NUM_CHANNELS] = {0};
+    uint8_t programs[CONTROLLER_CACHE_NUM_CHANNELS] = {0};
+    uint8_t pressures[CONTROLLER_CACHE_NUM_CHANNELS] = {0};
+    // One bit per channel.
+    uint16_t touchedPrograms = 0;
+    uint16_t touchedPitchBends = 0;
+    uint16_t touchedPressures = 0;
+
+    ControllerReplayConfig replayConfig;
+    bool isReplaying = false;
+    uint32_t nextReplayUs = 0;
+    uint8_t replayChannel = 0;
+    uint8_t replayStep = REPLAY_STEP_BANK_MSB;
+    uint8_t replayController = 0;
+
+    uint32_t numReplays = 0;
+    uint32_t numReplayed = 0;
+    uint32_t lastReplayDurationUs = 0;
+    uint32_t replayStartUs = 0;
+
+    void init(ControllerReplayConfig replayConfig =
+        ControllerReplayConfig()) {
+        this->replayConfig = replayConfig;
+        clear();
+        isReplaying = false;
+        numDropped = 0;
+        numReplays = 0;
+        numReplayed = 0;
+        lastReplayDurationUs = 0;
+    }
+
+    void clear() {
+        for (uint8_t channel = 0; channel < CONTROLLER_CACHE_NUM_CHANNELS;
+            channel++) {
+            for (size_t i = 0; i < CONTROLLER_CACHE_WORDS_PER_CHANNEL; i++) {
+                stored[channel][i] = 0;
+            }
+        }
+
+        for (uint8_t& start : channelStarts) {
+            start = 0;
+        }
+
+        touchedPrograms = 0;
+        touchedPitchBends = 0;
+        touchedPressures = 0;
+    }
+
+    // The number of entries that would be replayed.
+    uint16_t count() {
+        uint16_t total = __builtin_popcount(touchedPrograms) +
+            __builtin_popcount(touchedPitchBends) +
+            __builtin_popcount(touchedPressures);
+
+        for (uint8_t channel = 0; channel < CONTROLLER_CACHE_NUM_CHANNELS;
+            channel++) {
+            for (uint8_t controller = nextTouchedController(channel, 0);
+                controller < 128; controller =
+                nextTouchedController(channel, controller + 1)) {
+                total++;
+            }
+        }
+
+        return total;
+    }
+
+    // The number of entries in use.
+    inline size_t numStored() {
+        return channelStarts[CONTROLLER_CACHE_NUM_CHANNELS];
+    }
+
+    inline bool isStored(uint8_t channel, uint8_t controller) {
+        return (stored[channel][controller >> 5] >> (controller & 31)) & 1;
+    }
+
+    // Whether a controller differs from its default,
+    // and so would be replayed.
+    inline bool isTouched(uint8_t channel, uint8_t controller) {
+        return isStored(channel, controller) &&
+            values[entryFor(channel, controller)] !=
+            defaultValue(controller);
+    }
+
+    // The value a controller has when a device starts up.
+    static inline uint8_t defaultValue(uint8_t controller) {
+        switch (controller) {
+            case MIDI_CC_VOLUME:
+                return 100;
+            case MIDI_CC_BALANCE:
+            case MIDI_CC_PAN:
+                return 64;
+            case MIDI_CC_EXPRESSION:
+                return 127;
+            default:
+                return 0;
+        }
+    }
+
+    static inline bool isCached(uint8_t controller) {
+        return controller != MIDI_CC_DATA_ENTRY_MSB &&
+            controller != MIDI_CC_DATA_ENTRY_LSB &&
+            (controller < MIDI_CC_DATA_INCREMENT ||
+            controller > MIDI_CC_RPN_MSB) &&
+            controller < MIDI_CC_FIRST_CHANNEL_MODE;
+    }
+
+    /**
+     * @brief Updates the cache for a complete, non-SysEx MIDI message.
+     */
+    void handleMessage(uint8_t* message, size_t size) {
+        uint8_t status = message[0];
+
+        if (status == sig_MIDI_STATUS_SYSTEM_RESET) {
+            clear();
+            return;
+        }
+
+        if (status >= sig_MIDI_STATUS_SYSEX_START || size < 2) {
+            return;
+        }
+
+        uint8_t type = sig_MIDI_MESSAGE_TYPE(status);
+        uint8_t channel = sig_MIDI_CHANNEL(status);
+        uint16_t channelBit = 1U << channel;
+
+        switch (type) {
+            case sig_MIDI_STATUS_CONTROL_CHANGE:
+                if (size == 3) {
+                    setController(channel, message[1], message[2]);
+                }
+                break;
+            case sig_MIDI_STATUS_PROGRAM_CHANGE:
+                programs[channel] = message[1];
+                touchedPrograms |= channelBit;
+                break;
+            case sig_MIDI_STATUS_CHANNEL_AFTERTOUCH:
+                pressures[channel] = message[1];
+                touchedPressures = message[1] == 0 ?
+                    touchedPressures & ~channelBit :
+                    touchedPressures | channelBit;
+                break;
+            case sig_MIDI_STATUS_PITCH_BEND:
+                if (size == 3) {
+                    setPitchBend(channel, message[1] | (message[2] << 7));
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    inline void setController(uint8_t channel, uint8_t controller,
+        uint8_t value) {
+        if (controller == MIDI_CC_RESET_ALL_CONTROLLERS) {
+            resetControllers(channel);
+            return;
+        }
+
+        if (!isCached(controller)) {
+            return;
+        }
+
+        uint8_t entry = entryFor(channel, controller);
+        if (isStored(channel, controller)) {
+            values[entry] = value;
+            return;
+        }
+
+        if (value == defaultValue(controller)) {
+            return;
+        }
+
+        if (numStored() >= capacity) {
+            numDropped++;
+            return;
+        }
+
+        // Entries are rarely added, so making room is a simple shift.
+        for (size_t i = numStored(); i > entry; i--) {
+            values[i] = values[i - 1];
+        }
+
+        for (uint8_t i = channel + 1; i <= CONTROLLER_CACHE_NUM_CHANNELS;
+            i++) {
+            channelStarts[i]++;
+        }
+
+        stored[channel][controller >> 5] |= 1UL << (controller & 31);
+        values[entry] = value;
+    }
+
+    inline void setPitchBend(uint8_t channel, uint16_t value) {
+        uint16_t channelBit = 1U << channel;
+
+        pitchBends[channel] = value;
+        touchedPitchBends = value == MIDI_PITCH_BEND_CENTER ?
+            touchedPitchBends & ~channelBit :
+            touchedPitchBends | channelBit;
+    }
+
+    // Follows the controllers that Reset All Controllers resets
+    // (RP-015); volume, pan, bank and program are left alone.
+    void resetControllers(uint8_t channel) {
+        uint16_t channelBit = 1U << channel;
+
+        setController(channel, MIDI_CC_MODULATION, 0);
+        setController(channel, MIDI_CC_EXPRESSION, 127);
+        for (uint8_t cc = MIDI_CC_SUSTAIN; cc <= MIDI_CC_SOFT_PEDAL; cc++) {
+            setController(channel, cc, 0);
+        }
+
+        touchedPitchBends &= ~channelBit;
+        touchedPressures &= ~channelBit;
+    }
+
+    /**
+     * @brief Starts replaying the cache from the beginning, once
+     * the replay delay has passed. A replay that is already under way
+     * starts again, so that every device gets the whole cache.
+     */
+    void startReplay(uint32_t nowUs) {
+        isReplaying = true;
+        nextReplayUs = nowUs + replayConfig.delayUs;
+        replayStartUs = nextReplayUs;
+        replayChannel = 0;
+        replayStep = REPLAY_STEP_BANK_MSB;
+        replayController = 0;
+        numReplays++;
+    }
+
+    /**
+     * @brief Writes the next few cached messages with
+     * write(message, size), if they're due.
+     *
+     * @return true while the replay is still under way
+     */
+    template<typename WriteFn>
+    inline bool replay(uint32_t nowUs, WriteFn write) {
+        if (!isReplaying || (int32_t) (nowUs - nextReplayUs) < 0) {
+            return isReplaying;
+        }
+
+        uint8_t message[3];
+        for (uint8_t i = 0; i < replayConfig.messagesPerInterval; i++) {
+            size_t size = nextReplayMessage(message);
+            if (size == 0) {
+                isReplaying = false;
+                lastReplayDurationUs = nowUs - replayStartUs;
+                return false;
+            }
+
+            write(message, size);
+            numReplayed++;
+        }
+
+        nextReplayUs = nowUs + replayConfig.intervalUs;
+
+        return true;
+    }
+
+private:
+    // The entry a controller has, or would have if it were stored:
+    // its channel's first entry, plus the controllers stored below it.
+    inline uint8_t entryFor(uint8_t channel, uint8_t controller) {
+        uint8_t entry = channelStarts[channel];
+        uint8_t word = controller >> 5;
+
+        for (uint8_t i = 0; i < word; i++) {
+            entry += __builtin_popcount(stored[channel][i]);
+        }
+
+        uint32_t below = (1UL << (controller & 31)) - 1;
+        return entry + __builtin_popcount(stored[channel][word] & below);
+    }
+
+    // The next touched controller at or after the specified one,
+    // or 128 if there isn't one.
+    inline uint8_t nextTouchedController(uint8_t channel, uint16_t from) {
+        for (uint8_t i = from >> 5; i < CONTROLLER_CACHE_WORDS_PER_CHANNEL;
+            i++) {
+            uint32_t word = stored[channel][i];
+            if (i == from >> 5) {
+                word &= ~0UL << (from & 31);
+            }
+
+            while (word != 0) {
+                uint8_t controller = (i << 5) | __builtin_ctz(word);
+                if (values[entryFor(channel, controller)] !=
+                    defaultValue(controller)) {
+                    return controller;
+                }
+
+                word &= word - 1;
+            }
+        }
+
+        return 128;
+    }
+
+    inline size_t controllerMessage(uint8_t* message, uint8_t channel,
+        uint8_t controller) {
+        message[0] = sig_MIDI_CHANNEL_MESSAGE(
+            sig_MIDI_STATUS_CONTROL_CHANGE, channel);
+        message[1] = controller;
+        message[2] = values[entryFor(channel, controller)];
+
+        return 3;
+    }
+
+    // Advances the cursor to the next cached entry and fills in its
+    // message, returning its size, or 0 once the cache is exhausted.
+    inline size_t nextReplayMessage(uint8_t* message) {
+        while (replayChannel < CONTROLLER_CACHE_NUM_CHANNELS) {
+            uint8_t channel = replayChannel;
+            uint16_t channelBit = 1U << channel;
+            uint8_t step = replayStep++;
+
+            switch (step) {
+                case REPLAY_STEP_BANK_MSB:
+                    if (isTouched(channel, MIDI_CC_BANK_SELECT_MSB)) {
+                        return controllerMessage(message, channel,
+                            MIDI_CC_BANK_SELECT_MSB);
+                    }
+                    break;
+                case REPLAY_STEP_BANK_LSB:
+                    if (isTouched(channel, MIDI_CC_BANK_SELECT_LSB)) {
+                        return controllerMessage(message, channel,
+                            MIDI_CC_BANK_SELECT_LSB);
+                    }
+                    break;
+                case REPLAY_STEP_PROGRAM:
+                    if (touchedPrograms & channelBit) {
+                        message[0] = sig_MIDI_CHANNEL_MESSAGE(
+                            sig_MIDI_STATUS_PROGRAM_CHANGE, channel);
+                        message[1] = programs[channel];
+                        return 2;
+                    }
+                    break;
+                case REPLAY_STEP_CONTROLLERS: {
+                    uint8_t controller = nextTouchedController(channel,
+                        replayController);
+                    if (controller == MIDI_CC_BANK_SELECT_LSB) {
+                        controller = nextTouchedController(channel,
+                            controller + 1);
+                    }
+
+                    if (controller < 128) {
+                        // Stay on this step until every controller
+                        // has been replayed.
+                        replayStep = REPLAY_STEP_CONTROLLERS;
+                        replayController = controller + 1;
+                        if (controller != MIDI_CC_BANK_SELECT_MSB) {
+                            return controllerMessage(message, channel,
+                                controller);
+                        }
+                    }
+                    break;
+                }
+                case REPLAY_STEP_PITCH_BEND:
+                    if (touchedPitchBends & channelBit) {
+                        message[0] = sig_MIDI_CHANNEL_MESSAGE(
+                            sig_MIDI_STATUS_PITCH_BEND, channel);
+                        message[1] = pitchBends[channel] & 0x7F;
+                        message[2] = pitchBends[channel] >> 7;
+                        return 3;
+                    }
+                    break;
+                case REPLAY_STEP_PRESSURE:
+                    if (touchedPressures & channelBit) {
+                        message[0] = sig_MIDI_CHANNEL_MESSAGE(
+                            sig_MIDI_STATUS_CHANNEL_AFTERTOUCH, channel);
+                        message[1] = pressures[channel];
+                        return 2;
+                    }
+                    break;
+                default:
+                    replayChannel++;
+                    replayStep = REPLAY_STEP_BANK_MSB;
+                    replayController = 0;
+                    break;
+            }
+        }
+
+        return 0;
+    }
+};
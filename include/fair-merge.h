@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+// By default, each source may send one three-byte message per round.
+#define FAIR_MERGE_DEFAULT_WEIGHT 3
+
+struct FairMergeConfig {
+    // The bytes charged against a source's deficit for a Note On or
+    // Note Off, which are three bytes long. Charging less than three
+    // favors notes over continuous data such as control changes.
+    uint8_t noteCost = 1;
+};
+
+/**
+ * @brief Statistics for the messages from one source
+ * that had to wait to be merged.
+ */
+struct FairMergeSourceStats {
+    uint32_t numQueued = 0;
+    uint32_t numDropped = 0;
+    uint32_t maxDelayUs = 0;
+    uint64_t totalDelayUs = 0;
+};
+
+/**
+ * @brief Merges the messages from several sources into one destination
+ * that can't keep up with all of them, using deficit round robin.
+ *
+ * Messages are only queued while the destination is backed up. Each
+ * source has its own queue, and on each round a source may write up to
+ * its weight in bytes (plus whatever it didn't use on its last round),
+ * so a chatty source can't starve the others. Messages are always
+ * written whole, and the messages from a source stay in order.
+ *
+ * Queues hold the index of each message in the message pool (see
+ * include/message-pool.h), along with its status byte and size.
+ */
+template<size_t numSources, size_t capacity>
+class FairMerge {
+public:
+    static_assert((capacity & (capacity - 1)) == 0,
+        "The capacity must be a power of two.");
+
+    struct Entry {
+        uint32_t queuedUs;
+        uint8_t message;
+        uint8_t status;
+        uint8_t size;
+        // The bytes already waiting when it was queued, at most 255.
+        uint8_t bytesAhead;
+    };
+
+    FairMergeConfig config;
+    Entry queues[numSources][capacity];
+    uint8_t readIdx[numSources] = {0};
+    uint8_t writeIdx[numSources] = {0};
+    uint8_t weights[numSources] = {0};
+    uint16_t deficits[numSources] = {0};
+    size_t numEntries = 0;
+    size_t numBytes = 0;
+
+    // The source whose turn it is, and whether
+    // it has already been given its weight this round.
+    uint8_t currentSource = 0;
+    bool hasQuantum = false;
+
+    FairMergeSourceStats stats[numSources];
+
+    void init(FairMergeConfig config = FairMergeConfig()) {
+        this->config = config;
+
+        for (size_t i = 0; i < numSources; i++) {
+            readIdx[i] = 0;
+            writeIdx[i] = 0;
+            weights[i] = FAIR_MERGE_DEFAULT_WEIGHT;
+            deficits[i] = 0;
+        }
+
+        numEntries = 0;
+        numBytes = 0;
+        currentSource = 0;
+        hasQuantum = false;
+        resetStats();
+    }
+
+    void resetStats() {
+        for (size_t i = 0; i < numSources; i++) {
+            stats[i] = FairMergeSourceStats();
+        }
+    }
+
+    // Weights are in bytes per round, and are never less than one.
+    void setWeight(uint8_t source, uint8_t weight) {
+        if (source < numSources) {
+            weights[source] = weight > 0 ? weight : 1;
+        }
+    }
+
+    inline bool isEmpty() {
+        return numEntries == 0;
+    }
+
+    inline size_t queueSize(uint8_t source) {
+        return (uint8_t) (writeIdx[source] - readIdx[source]);
+    }
+
+    /**
+     * @brief Queues a message until the destination has room for it.
+     *
+     * @return false if the source's queue is full
+     */
+    inline bool enqueue(uint8_t source, uint8_t message, uint8_t status,
+        size_t size, uint32_t nowUs) {
+        if (queueSize(source) >= capacity) {
+            stats[source].numDropped++;
+            return false;
+        }
+
+        Entry* entry = &queues[source][writeIdx[source] & (capacity - 1)];
+        entry->queuedUs = nowUs;
+        entry->message = message;
+        entry->status = status;
+        entry->size = size;
+        entry->bytesAhead = numBytes < UINT8_MAX ? numBytes : UINT8_MAX;
+
+        writeIdx[source]++;
+        numEntries++;
+        numBytes += size;
+        stats[source].numQueued++;
+
+        return true;
+    }
+
+    /**
+     * @brief Writes queued messages, by calling
+     * write(message, source, delayUs, bytesAhead), for as long as
+     * canWrite(size) says the destination can take them. bytesAhead
+     * is how much was already waiting when the message was queued,
+     * which is about what it had to wait for while every source is
+     * backed up.
+     */
+    template<typename CanWriteFn, typename WriteFn>
+    inline void drain(uint32_t nowUs, CanWriteFn canWrite, WriteFn write) {
+        while (numEntries > 0) {
+            uint8_t source = currentSource;
+
+            if (queueSize(source) == 0) {
+                // Sources with nothing to send don't save up their turns.
+                deficits[source] = 0;
+                nextSource();
+                continue;
+            }
+
+            if (!hasQuantum) {
+                deficits[source] += weights[source];
+                hasQuantum = true;
+            }
+
+            Entry* entry = &queues[source][readIdx[source] & (capacity - 1)];
+            uint8_t cost = costOf(entry);
+
+            if (cost > deficits[source]) {
+                nextSource();
+                continue;
+            }
+
+            if (!canWrite(entry->size)) {
+                // Resume with this source when there's more room.
+                return;
+            }
+
+            deficits[source] -= cost;
+            uint32_t delayUs = nowUs - entry->queuedUs;
+            recordDelay(source, delayUs);
+            write(entry->message, source, delayUs, entry->bytesAhead);
+            readIdx[source]++;
+            numEntries--;
+            numBytes -= entry->size;
+        }
+    }
+
+private:
+    inline uint8_t costOf(Entry* entry) {
+        uint8_t type = entry->status & 0xF0;
+        bool isNote = type == sig_MIDI_STATUS_NOTE_ON ||
+            type == sig_MIDI_STATUS_NOTE_OFF;
+
+        return isNote && config.noteCost < entry->size ?
+            config.noteCost : entry->size;
+    }
+
+    inline void nextSource() {
+        currentSource = (currentSource + 1) % numSources;
+        hasQuantum = false;
+    }
+
+    inline void recordDelay(uint8_t source, uint32_t delayUs) {
+        stats[source].totalDelayUs += delayUs;
+        if (delayUs > stats[source].maxDelayUs) {
+            stats[source].maxDelayUs = delayUs;
+        }
+    }
+};
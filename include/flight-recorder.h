@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "trace-ring.h"
+
+// Marks a ring or recording that was written by this firmware,
+// rather than whatever was in RAM at power-on.
+#define FLIGHT_RECORDER_MAGIC 0x464C5452
+
+enum FlightRecordingReason {
+    FLIGHT_RECORDING_NONE = 0,
+    FLIGHT_RECORDING_ROUTE_LATENCY,
+    FLIGHT_RECORDING_LOOP_TIME,
+    FLIGHT_RECORDING_WATCHDOG
+};
+
+struct FlightRecorderConfig {
+    // A message that waits this much longer than it takes to send
+    // what was queued ahead of it on its way through a route freezes
+    // the recorder; 0 disables the check.
+    uint32_t routeLatencyUs = 10000;
+
+    // As does a main loop iteration that takes longer than this.
+    uint32_t loopTimeUs = 5000;
+};
+
+/**
+ * @brief A frozen copy of the flight recorder's ring, oldest first,
+ * along with what caused it to be frozen.
+ *
+ * It's meant to be kept in RAM that isn't cleared at boot, so it has no
+ * initializers; whether it holds a recording is told by its magic.
+ */
+template<size_t capacity>
+struct FlightRecording {
+    uint32_t magic;
+    uint8_t reason;
+    uint8_t source;
+    uint8_t destination;
+    uint32_t valueUs;
+    uint32_t triggerUs;
+    uint32_t numRecords;
+    TraceRecord records[capacity];
+
+    inline bool isValid() {
+        return magic == FLIGHT_RECORDER_MAGIC &&
+            reason != FLIGHT_RECORDING_NONE && numRecords <= capacity;
+    }
+
+    inline void clear() {
+        magic = 0;
+    }
+};
+
+/**
+ * @brief An always-on ring of the most recent events, which is frozen
+ * into a recording when a route's latency or a loop iteration goes over
+ * its threshold, or after the watchdog has reset the device.
+ *
+ * Recording an event is a handful of stores and never blocks; the oldest
+ * events are overwritten. There is a single producer (the main loop),
+ * and the ring is only read when it's frozen.
+ *
+ * The ring itself is also meant to be kept in RAM that isn't cleared at
+ * boot, so that what led up to a watchdog reset can be frozen once the
+ * device has restarted. Only one recording is kept: a later trigger only
+ * replaces it if it's worse, and nothing replaces a watchdog reset.
+ */
+template<size_t capacity>
+class FlightRecorder {
+public:
+    static_assert((capacity & (capacity - 1)) == 0,
+        "The capacity must be a power of two.");
+
+    FlightRecorderConfig config;
+    FlightRecording<capacity>* recording;
+
+    // These survive a reset, so they're only initialized by init().
+    uint32_t magic;
+    uint32_t writeIdx;
+    TraceRecord records[capacity];
+
+    /**
+     * @brief Starts recording, having first frozen what was recorded
+     * before the watchdog fired, if it did.
+     */
+    void init(FlightRecording<capacity>* recording, bool hasWatchdogFired,
+        FlightRecorderConfig config = FlightRecorderConfig()) {
+        this->config = config;
+        this->recording = recording;
+
+        if (!recording->isValid()) {
+            recording->clear();
+        }
+
+        if (hasWatchdogFired && magic == FLIGHT_RECORDER_MAGIC) {
+            TraceRecord& last = records[(writeIdx - 1) & (capacity - 1)];
+            freeze(FLIGHT_RECORDING_WATCHDOG, TRACE_NO_PORT, TRACE_NO_PORT,
+                0, writeIdx > 0 ? last.timeUs : 0);
+        }
+
+        writeIdx = 0;
+        magic = FLIGHT_RECORDER_MAGIC;
+    }
+
+    inline void record(uint8_t type, uint8_t port, uint32_t timeUs,
+        uint32_t value) {
+        uint32_t idx = writeIdx;
+        records[idx & (capacity - 1)] = {TRACE_RECORD_SYNC, type, port, 0,
+            timeUs, value};
+
+        // The record is complete before the ring includes it.
+        std::atomic_signal_fence(std::memory_order_release);
+        writeIdx = idx + 1;
+    }
+
+    /**
+     * @brief Freezes the ring if a message waited too long on a route.
+     * A destination that's backed up is expected to keep messages
+     * waiting while it sends what's ahead of them, for expectedUs.
+     *
+     * @return true if the recording was replaced
+     */
+    inline bool checkRouteLatency(uint8_t source, uint8_t destination,
+        uint32_t latencyUs, uint32_t expectedUs, uint32_t nowUs) {
+        if (config.routeLatencyUs == 0 ||
+            latencyUs <= expectedUs + config.routeLatencyUs) {
+            return false;
+        }
+
+        return freeze(FLIGHT_RECORDING_ROUTE_LATENCY, source, destination,
+            latencyUs, nowUs);
+    }
+
+    /**
+     * @brief Freezes the ring if a main loop iteration took too long.
+     *
+     * @return true if the recording was replaced
+     */
+    inline bool checkLoopTime(uint32_t loopUs, uint32_t nowUs) {
+        if (config.loopTimeUs == 0 || loopUs <= config.loopTimeUs) {
+            return false;
+        }
+
+        return freeze(FLIGHT_RECORDING_LOOP_TIME, TRACE_NO_PORT,
+            TRACE_NO_PORT, loopUs, nowUs);
+    }
+
+private:
+    bool freeze(uint8_t reason, uint8_t source, uint8_t destination,
+        uint32_t valueUs, uint32_t nowUs) {
+        if (recording->isValid() &&
+            (recording->reason == FLIGHT_RECORDING_WATCHDOG ||
+            (reason != FLIGHT_RECORDING_WATCHDOG &&
+            recording->valueUs >= valueUs))) {
+            return false;
+        }
+
+        uint32_t numRecords = writeIdx < capacity ? writeIdx : capacity;
+        uint32_t firstIdx = writeIdx - numRecords;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            recording->records[i] = records[(firstIdx + i) & (capacity - 1)];
+        }
+
+        recording->reason = reason;
+        recording->source = source;
+        recording->destination = destination;
+        recording->valueUs = valueUs;
+        recording->triggerUs = nowUs;
+        recording->numRecords = numRecords;
+        recording->magic = FLIGHT_RECORDER_MAGIC;
+
+        return true;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A batch that has waited this long is written even if no frame has
+// started, such as while the bus is suspended. USB frames are 1 ms.
+#define FRAME_BATCHER_MAX_AGE_US 2000
+
+#define FRAME_BATCHER_FRAME_US 1000
+
+// Batches are written this long after a frame starts, so that they're
+// ready by the time the next one starts, even after a slow iteration
+// of the main loop.
+#define FRAME_BATCHER_FLUSH_OFFSET_US 850
+
+/**
+ * @brief Statistics for the messages that waited for a USB frame.
+ */
+struct FrameBatcherStats {
+    uint32_t numFrames = 0;
+    uint32_t numMessages = 0;
+    uint32_t maxDelayUs = 0;
+    uint64_t totalDelayUs = 0;
+
+    void add(FrameBatcherStats& other) {
+        numFrames += other.numFrames;
+        numMessages += other.numMessages;
+        totalDelayUs += other.totalDelayUs;
+        if (other.maxDelayUs > maxDelayUs) {
+            maxDelayUs = other.maxDelayUs;
+        }
+    }
+};
+
+/**
+ * @brief Collects the bytes written to a USB MIDI port during a frame,
+ * so that they can all be written at once when the next frame starts,
+ * in as few full packets as possible.
+ *
+ * Each message's queuing delay is measured without storing a timestamp
+ * per message: the batch keeps the time its first message was added,
+ * and the sum of every later message's offset from it.
+ */
+template<size_t capacity>
+class FrameBatcher {
+public:
+    uint8_t buffer[capacity];
+    size_t size = 0;
+    uint32_t numMessages = 0;
+    uint32_t firstAddedUs = 0;
+    uint64_t addedOffsetsUs = 0;
+
+    FrameBatcherStats stats;
+
+    void init() {
+        clear();
+        resetStats();
+    }
+
+    // Discards the batch, such as when its device goes away.
+    void clear() {
+        size = 0;
+        numMessages = 0;
+    }
+
+    void resetStats() {
+        stats = FrameBatcherStats();
+    }
+
+    inline bool isEmpty() {
+        return size == 0;
+    }
+
+    // The time the oldest waiting message has been waiting.
+    inline uint32_t ageUs(uint32_t nowUs) {
+        return size == 0 ? 0 : nowUs - firstAddedUs;
+    }
+
+    /**
+     * @brief Adds a message to the batch. If it doesn't fit, the batch
+     * is written first with write(buffer, size).
+     *
+     * @return false if the message is larger than the whole batch,
+     * in which case the caller should write it immediately
+     */
+    template<typename WriteFn>
+    inline bool add(uint8_t* message, size_t messageSize, uint32_t nowUs,
+        WriteFn write) {
+        if (messageSize > capacity) {
+            flush(nowUs, write);
+            return false;
+        }
+
+        if (size + messageSize > capacity) {
+            flush(nowUs, write);
+        }
+
+        if (size == 0) {
+            firstAddedUs = nowUs;
+            addedOffsetsUs = 0;
+        } else {
+            addedOffsetsUs += nowUs - firstAddedUs;
+        }
+
+        for (size_t i = 0; i < messageSize; i++) {
+            buffer[size + i] = message[i];
+        }
+
+        size += messageSize;
+        numMessages++;
+
+        return true;
+    }
+
+    // Writes the whole batch with write(buffer, size).
+    template<typename WriteFn>
+    inline void flush(uint32_t nowUs, WriteFn write) {
+        if (size == 0) {
+            return;
+        }
+
+        write(buffer, size);
+
+        uint32_t oldestDelayUs = nowUs - firstAddedUs;
+        stats.numFrames++;
+        stats.numMessages += numMessages;
+        stats.totalDelayUs += (uint64_t) oldestDelayUs * numMessages -
+            addedOffsetsUs;
+        if (oldestDelayUs > stats.maxDelayUs) {
+            stats.maxDelayUs = oldestDelayUs;
+        }
+
+        size = 0;
+        numMessages = 0;
+    }
+};
+
+/**
+ * @brief Decides when a USB port's batches are written: once per frame,
+ * shortly before the next frame starts. Writing at the start of a frame
+ * instead would leave each batch waiting for most of the frame before
+ * it could go out.
+ */
+class FrameFlushTimer {
+public:
+    uint32_t frameStartUs = 0;
+    bool isFlushPending = false;
+
+    void init() {
+        isFlushPending = false;
+    }
+
+    /**
+     * @brief Records the start of a frame.
+     *
+     * @return true if the last frame's batches were never written,
+     * such as after a long main loop iteration, in which case
+     * the caller should write them now
+     */
+    inline bool frameStarted(uint32_t nowUs) {
+        bool wasMissed = isFlushPending;
+        frameStartUs = nowUs;
+        isFlushPending = true;
+
+        return wasMissed;
+    }
+
+    // Returns true once per frame, when it's time to write.
+    inline bool isFlushDue(uint32_t nowUs) {
+        if (!isFlushPending ||
+            nowUs - frameStartUs < FRAME_BATCHER_FLUSH_OFFSET_US) {
+            return false;
+        }
+
+        isFlushPending = false;
+        return true;
+    }
+};
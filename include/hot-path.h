@@ -0,0 +1,24 @@
+#ifndef YOUME_HOT_PATH_H
+#define YOUME_HOT_PATH_H
+
+/**
+ * Marks a function as part of the MIDI hot path.
+ *
+ * When the firmware is built with RAM_HOT_PATH, these functions are
+ * placed in a .time_critical section, which the Pico SDK copies into
+ * SRAM at startup. This avoids XIP cache misses when executing them.
+ * The total size of code in SRAM is checked after every build
+ * (see ram-report.sh).
+ *
+ * As with the SDK's __not_in_flash(group), functions are placed in a
+ * named group. Inline and non-inline functions can't share a group.
+ * GCC ignores section attributes on function templates, so templates
+ * only run from RAM when they are inlined into a HOT_PATH function.
+ */
+#if defined(RAM_HOT_PATH) && defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+#define HOT_PATH(group) __attribute__((section(".time_critical." #group)))
+#else
+#define HOT_PATH(group)
+#endif
+
+#endif // YOUME_HOT_PATH_H
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+// The kinds of traffic a load generator can produce; each message
+// slot is given to the next enabled pattern in turn.
+#define LOAD_PATTERN_NOTES 0x01
+#define LOAD_PATTERN_CC_RAMP 0x02
+#define LOAD_PATTERN_CLOCK 0x04
+#define LOAD_PATTERN_SYSEX 0x08
+#define LOAD_PATTERN_ALL 0x0F
+
+// SysEx is generated in chunks of at most this many bytes,
+// as a port's parser would deliver it.
+#define LOAD_GENERATOR_SYSEX_CHUNK_SIZE 32
+
+// Generated messages that fall further behind than this
+// are skipped rather than being sent in a burst.
+#define LOAD_GENERATOR_MAX_BACKLOG 32
+
+// Generated notes are numbered in sequence, so they can be matched
+// when they're written out; this many can be in flight at once.
+#define LOAD_GENERATOR_NUM_SEQUENCES 128
+
+struct LoadGeneratorConfig {
+    uint8_t patterns = LOAD_PATTERN_NOTES | LOAD_PATTERN_CC_RAMP;
+    uint8_t channel = 15;
+    uint32_t messagesPerSecond = 1000;
+
+    // The total size of each generated SysEx message, including F0
+    // and F7. It uses the non-commercial manufacturer ID.
+    uint16_t sysexSize = 64;
+};
+
+/**
+ * @brief Generates synthetic MIDI traffic at a steady rate: note storms,
+ * control change ramps, clock and SysEx.
+ *
+ * Each Note On's note number is its sequence number, and the time it
+ * was generated is kept, so the latency of every note can be measured
+ * where it's written out.
+ */
+class LoadGenerator {
+public:
+    LoadGeneratorConfig config;
+    uint32_t intervalUs = 0;
+    uint32_t nextUs = 0;
+
+    uint8_t nextPattern = 0;
+    uint8_t sequence = 0;
+    uint8_t ccValue = 0;
+    bool hasNoteOn = false;
+    uint8_t lastNote = 0;
+    uint32_t generatedUs[LOAD_GENERATOR_NUM_SEQUENCES] = {0};
+
+    uint32_t numNotes = 0;
+    uint32_t numMessages = 0;
+    uint32_t numSkipped = 0;
+
+    void init(uint32_t nowUs,
+        LoadGeneratorConfig config = LoadGeneratorConfig()) {
+        this->config = config;
+        this->config.channel &= 0x0F;
+        this->config.patterns &= LOAD_PATTERN_ALL;
+        if (this->config.patterns == 0) {
+            this->config.patterns = LOAD_PATTERN_NOTES;
+        }
+
+        if (this->config.sysexSize < 3) {
+            this->config.sysexSize = 3;
+        }
+
+        setRate(nowUs, config.messagesPerSecond);
+        nextPattern = 0;
+        sequence = 0;
+        ccValue = 0;
+        hasNoteOn = false;
+        numNotes = 0;
+        numMessages = 0;
+        numSkipped = 0;
+    }
+
+    void setRate(uint32_t nowUs, uint32_t messagesPerSecond) {
+        config.messagesPerSecond = messagesPerSecond;
+        intervalUs = messagesPerSecond > 0 ?
+            1000000 / messagesPerSecond : 0;
+        if (intervalUs == 0 && messagesPerSecond > 0) {
+            intervalUs = 1;
+        }
+
+        nextUs = nowUs;
+    }
+
+    /**
+     * @brief Generates every message that is due, calling
+     * emit(message, size) for each one, and
+     * emitSysex(chunk, size, isFinal) for each chunk of SysEx.
+     */
+    template<typename EmitFn, typename EmitSysexFn>
+    void generate(uint32_t nowUs, EmitFn emit, EmitSysexFn emitSysex) {
+        if (intervalUs == 0) {
+            return;
+        }
+
+        if ((int32_t) (nowUs - nextUs) < 0) {
+            return;
+        }
+
+        uint32_t numDue = (nowUs - nextUs) / intervalUs + 1;
+        nextUs += numDue * intervalUs;
+
+        if (numDue > LOAD_GENERATOR_MAX_BACKLOG) {
+            numSkipped += numDue - LOAD_GENERATOR_MAX_BACKLOG;
+            numDue = LOAD_GENERATOR_MAX_BACKLOG;
+        }
+
+        for (uint32_t i = 0; i < numDue; i++) {
+            generateNext(nowUs, emit, emitSysex);
+        }
+    }
+
+    /**
+     * @brief Checks whether a message being written out is one of this
+     * generator's notes.
+     *
+     * @return true if it is, along with how long ago it was generated
+     */
+    inline bool matchNote(uint8_t* message, size_t size, uint32_t nowUs,
+        uint32_t* latencyUs) {
+        if (size != 3 || message[0] != (sig_MIDI_STATUS_NOTE_ON |
+            config.channel) || message[2] == 0) {
+            return false;
+        }
+
+        *latencyUs = nowUs - generatedUs[message[1]];
+
+        return true;
+    }
+
+private:
+    template<typename EmitFn, typename EmitSysexFn>
+    void generateNext(uint32_t nowUs, EmitFn emit, EmitSysexFn emitSysex) {
+        // Find the next enabled pattern.
+        while (!(config.patterns & (1U << nextPattern))) {
+            nextPattern = (nextPattern + 1) & 3;
+        }
+
+        uint8_t pattern = 1U << nextPattern;
+        nextPattern = (nextPattern + 1) & 3;
+        numMessages++;
+
+        if (pattern == LOAD_PATTERN_NOTES) {
+            generateNote(nowUs, emit);
+        } else if (pattern == LOAD_PATTERN_CC_RAMP) {
+            uint8_t message[3] = {
+                (uint8_t) (sig_MIDI_STATUS_CONTROL_CHANGE | config.channel),
+                1,
+                ccValue
+            };
+            ccValue = (ccValue + 1) & 0x7F;
+            emit(message, 3);
+        } else if (pattern == LOAD_PATTERN_CLOCK) {
+            uint8_t message = sig_MIDI_STATUS_TIMING_CLOCK;
+            emit(&message, 1);
+        } else {
+            generateSysex(emitSysex);
+        }
+    }
+
+    // Notes alternate between a Note On and its Note Off,
+    // so no notes are left sounding.
+    template<typename EmitFn>
+    void generateNote(uint32_t nowUs, EmitFn emit) {
+        uint8_t message[3];
+
+        if (hasNoteOn) {
+            message[0] = sig_MIDI_STATUS_NOTE_OFF | config.channel;
+            message[1] = lastNote;
+            message[2] = 0;
+            hasNoteOn = false;
+        } else {
+            lastNote = sequence;
+            sequence = (sequence + 1) & (LOAD_GENERATOR_NUM_SEQUENCES - 1);
+            generatedUs[lastNote] = nowUs;
+            message[0] = sig_MIDI_STATUS_NOTE_ON | config.channel;
+            message[1] = lastNote;
+            message[2] = 100;
+            hasNoteOn = true;
+            numNotes++;
+        }
+
+        emit(message, 3);
+    }
+
+    // The manufacturer ID is followed by a byte that can't be
+    // the start of this device's signature, so it's never
+    // mistaken for a command.
+    template<typename EmitSysexFn>
+    void generateSysex(EmitSysexFn emitSysex) {
+        uint8_t chunk[LOAD_GENERATOR_SYSEX_CHUNK_SIZE];
+        size_t size = 0;
+
+        for (uint16_t i = 0; i < config.sysexSize; i++) {
+            uint8_t byte;
+            if (i == 0) {
+                byte = sig_MIDI_STATUS_SYSEX_START;
+            } else if (i + 1 == config.sysexSize) {
+                byte = sig_MIDI_STATUS_SYSEX_END;
+            } else if (i == 1) {
+                byte = 0x7D;
+            } else {
+                byte = i & 0x3F;
+            }
+
+            chunk[size++] = byte;
+            if (size == LOAD_GENERATOR_SYSEX_CHUNK_SIZE &&
+                i + 1 < config.sysexSize) {
+                emitSysex(chunk, size, false);
+                size = 0;
+            }
+        }
+
+        emitSysex(chunk, size, true);
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of recently-emitted messages remembered for each
+// destination. Must be a power of two.
+#define LOOP_DETECTOR_WINDOW_SIZE 16
+
+struct LoopDetectorConfig {
+    // How long after being sent a message can come back
+    // and still be considered an echo.
+    uint32_t echoTimeoutUs = 20000;
+
+    // How many echoes on a route it takes to declare a loop.
+    uint8_t echoThreshold = 8;
+
+    // Echo counts are reset when there haven't been any echoes
+    // on a route for this long.
+    uint32_t echoResetUs = 100000;
+
+    // How long a muted route has to go without echoes, and without
+    // any messages to drop, before it's unmuted. Muting breaks the
+    // loop, so echoes alone would stop while it's still there.
+    uint32_t muteHoldUs = 1000000;
+};
+
+/**
+ * @brief Detects MIDI feedback loops by matching incoming messages
+ * against the messages that were recently sent out the same port.
+ *
+ * When a message sent from source S out to port D comes back in on
+ * port D, the route D -> S is what closes the loop. A single echo is
+ * normal (a DAW's MIDI thru, or a synth's soft thru, sends each message
+ * back once), so an echo only counts once it has been passed on again
+ * and has come back a second time. Once enough echoes have been
+ * counted, the route is muted until it goes quiet.
+ *
+ * Recently-sent messages are kept in a small direct-mapped hash table
+ * per destination, so recording and matching are both constant time.
+ */
+template<size_t numPorts>
+class LoopDetector {
+public:
+    struct SentMessage {
+        uint32_t hash;
+        uint32_t sentUs;
+        uint8_t source;
+        // Whether the message had already come back once.
+        bool isEcho;
+        bool hasReturned;
+    };
+
+    LoopDetectorConfig config;
+    SentMessage sent[numPorts][LOOP_DETECTOR_WINDOW_SIZE];
+
+    uint8_t echoCounts[numPorts][numPorts] = {{0}};
+    uint32_t lastEchoUs[numPorts][numPorts] = {{0}};
+    bool routeIsMuted[numPorts][numPorts] = {{false}};
+    // The last echo on, or message dropped from, each muted route.
+    uint32_t lastMutedUs[numPorts][numPorts] = {{0}};
+
+    // The last message that was checked, if it was an echo, so that
+    // it's recorded as one as it's passed on.
+    uint32_t echoHash = 0;
+    uint8_t echoPort = 0;
+
+    uint32_t numLoopsDetected = 0;
+    uint32_t numMutedMessages = 0;
+
+    void init(LoopDetectorConfig config = LoopDetectorConfig()) {
+        this->config = config;
+
+        for (size_t i = 0; i < numPorts; i++) {
+            for (size_t j = 0; j < LOOP_DETECTOR_WINDOW_SIZE; j++) {
+                // A hash of zero never matches a real message,
+                // because hashes always have their top bit set.
+                sent[i][j] = {0, 0, 0, false, false};
+            }
+
+            for (size_t j = 0; j < numPorts; j++) {
+                echoCounts[i][j] = 0;
+                routeIsMuted[i][j] = false;
+            }
+        }
+
+        echoHash = 0;
+        numLoopsDetected = 0;
+        numMutedMessages = 0;
+    }
+
+    static inline uint32_t hash(uint8_t* message, size_t size) {
+        // FNV-1a
+        uint32_t h = 2166136261UL;
+        for (size_t i = 0; i < size; i++) {
+            h = (h ^ message[i]) * 16777619UL;
+        }
+
+        return h | 0x80000000UL;
+    }
+
+    /**
+     * @brief Remembers a message that was sent
+     * from a source out to a destination. A message's routes must be
+     * recorded right after it's checked, so that an echo is recorded
+     * as one.
+     */
+    inline void recordSent(uint8_t source, uint8_t destination,
+        uint32_t messageHash, uint32_t nowUs) {
+        SentMessage* slot = &sent[destination]
+            [messageHash & (LOOP_DETECTOR_WINDOW_SIZE - 1)];
+
+        // Once copies of a message are going round a loop, some
+        // arrive after the slot's copy has come back, and they stay
+        // echoes too.
+        bool wasEcho = slot->isEcho && slot->hash == messageHash &&
+            nowUs - slot->sentUs <= config.echoTimeoutUs;
+
+        slot->hash = messageHash;
+        slot->sentUs = nowUs;
+        slot->source = source;
+        slot->isEcho = wasEcho ||
+            (messageHash == echoHash && source == echoPort);
+        slot->hasReturned = false;
+    }
+
+    /**
+     * @brief Checks a message that arrived on a port
+     * to see if it is an echo of one that was sent out that port,
+     * and counts it if that was already an echo.
+     */
+    inline void checkReceived(uint8_t port, uint32_t messageHash,
+        uint32_t nowUs) {
+        SentMessage* slot = &sent[port]
+            [messageHash & (LOOP_DETECTOR_WINDOW_SIZE - 1)];
+
+        echoHash = 0;
+        if (slot->hash != messageHash || slot->hasReturned ||
+            nowUs - slot->sentUs > config.echoTimeoutUs) {
+            return;
+        }
+
+        // Each sent message only comes back once.
+        slot->hasReturned = true;
+        echoHash = messageHash;
+        echoPort = port;
+
+        if (!slot->isEcho) {
+            return;
+        }
+
+        // The route from the echoing port back to the original
+        // source is the one that closes the loop.
+        uint8_t source = slot->source;
+        if (nowUs - lastEchoUs[port][source] > config.echoResetUs) {
+            echoCounts[port][source] = 0;
+        }
+
+        lastEchoUs[port][source] = nowUs;
+        lastMutedUs[port][source] = nowUs;
+
+        if (echoCounts[port][source] < config.echoThreshold) {
+            echoCounts[port][source]++;
+            if (echoCounts[port][source] == config.echoThreshold &&
+                !routeIsMuted[port][source]) {
+                routeIsMuted[port][source] = true;
+                numLoopsDetected++;
+            }
+        }
+    }
+
+    /**
+     * @brief Determines if a message on a route should be dropped.
+     * Muted routes are unmuted once they have gone quiet: there
+     * have been no echoes, and nothing has been sent on the route.
+     */
+    inline bool isMuted(uint8_t source, uint8_t destination,
+        uint32_t nowUs) {
+        if (!routeIsMuted[source][destination]) {
+            return false;
+        }
+
+        if (nowUs - lastMutedUs[source][destination] > config.muteHoldUs) {
+            routeIsMuted[source][destination] = false;
+            echoCounts[source][destination] = 0;
+            return false;
+        }
+
+        lastMutedUs[source][destination] = nowUs;
+        numMutedMessages++;
+        return true;
+    }
+
+    uint32_t mutedRoutes() {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < numPorts; i++) {
+            for (size_t j = 0; j < numPorts; j++) {
+                if (routeIsMuted[i][j]) {
+                    mask |= 1UL << (i * numPorts + j);
+                }
+            }
+        }
+
+        return mask;
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bucket 0 counts iterations that took less than a microsecond;
+// bucket i counts iterations that took [2^(i-1), 2^i) microseconds.
+// The last bucket also counts anything longer.
+#define LOOP_TIMER_NUM_BUCKETS 20
+
+/**
+ * @brief A histogram of main loop iteration times.
+ */
+class LoopTimer {
+public:
+    uint32_t buckets[LOOP_TIMER_NUM_BUCKETS] = {0};
+    uint32_t numIterations = 0;
+    uint32_t maxUs = 0;
+    uint64_t totalUs = 0;
+    uint32_t iterationStartUs = 0;
+
+    void reset(uint32_t nowUs) {
+        for (size_t i = 0; i < LOOP_TIMER_NUM_BUCKETS; i++) {
+            buckets[i] = 0;
+        }
+
+        numIterations = 0;
+        maxUs = 0;
+        totalUs = 0;
+        iterationStartUs = nowUs;
+    }
+
+    static inline uint8_t bucketFor(uint32_t durationUs) {
+        uint8_t bucket = durationUs == 0 ? 0 :
+            32 - __builtin_clz(durationUs);
+
+        return bucket < LOOP_TIMER_NUM_BUCKETS ?
+            bucket : LOOP_TIMER_NUM_BUCKETS - 1;
+    }
+
+    /**
+     * @brief Records the end of one loop iteration
+     * and the start of the next.
+     *
+     * @return the duration of the iteration that just ended
+     */
+    inline uint32_t mark(uint32_t nowUs) {
+        uint32_t durationUs = nowUs - iterationStartUs;
+        iterationStartUs = nowUs;
+
+        buckets[bucketFor(durationUs)]++;
+        numIterations++;
+        totalUs += durationUs;
+
+        if (durationUs > maxUs) {
+            maxUs = durationUs;
+        }
+
+        return durationUs;
+    }
+};
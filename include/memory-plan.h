@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "board-config.h"
+
+// Minimum sizes needed for the parser to work correctly.
+// The longest non-SysEx message is three bytes. SysEx commands
+// must also fit in a single chunk, which is checked against
+// the longest command in sysex-commands.h.
+#define MIN_MESSAGE_BUFFER_SIZE 3
+#define MIN_SYSEX_BUFFER_SIZE 8
+#define MIN_READ_BUFFER_SIZE 1
+
+struct MidiPortBufferConfig {
+    size_t messageBufferSize;
+    size_t sysexBufferSize;
+    size_t readBufferSize;
+
+    constexpr size_t totalSize() const {
+        return messageBufferSize + sysexBufferSize + readBufferSize;
+    }
+
+    constexpr bool isValid() const {
+        return messageBufferSize >= MIN_MESSAGE_BUFFER_SIZE &&
+            sysexBufferSize >= MIN_SYSEX_BUFFER_SIZE &&
+            readBufferSize >= MIN_READ_BUFFER_SIZE;
+    }
+};
+
+/**
+ * @brief The compile-time memory plan for the board.
+ */
+struct BoardConfig {
+    MidiPortBufferConfig uart;
+    MidiPortBufferConfig usbDevice;
+    MidiPortBufferConfig usbHost;
+    size_t numUARTs;
+
+    size_t usbDeviceFIFOSize;
+    size_t usbHostFIFOSize;
+    size_t numHostedDevices;
+    size_t logBufferSize;
+    size_t ramBudget;
+
+    constexpr size_t portBufferSize() const {
+        return uart.totalSize() * numUARTs + usbDevice.totalSize() +
+            usbHost.totalSize();
+    }
+
+    constexpr size_t usbFIFOSize() const {
+        return usbDeviceFIFOSize + usbHostFIFOSize * numHostedDevices;
+    }
+
+    constexpr size_t totalSize() const {
+        return portBufferSize() + usbFIFOSize() + logBufferSize;
+    }
+};
+
+constexpr BoardConfig BOARD_CONFIG = {
+    .uart = {
+        .messageBufferSize = BOARD_UART_MESSAGE_BUFFER_SIZE,
+        .sysexBufferSize = BOARD_UART_SYSEX_BUFFER_SIZE,
+        .readBufferSize = BOARD_UART_READ_BUFFER_SIZE
+    },
+    .usbDevice = {
+        .messageBufferSize = BOARD_USB_DEVICE_MESSAGE_BUFFER_SIZE,
+        .sysexBufferSize = BOARD_USB_DEVICE_SYSEX_BUFFER_SIZE,
+        .readBufferSize = BOARD_USB_DEVICE_READ_BUFFER_SIZE
+    },
+    .usbHost = {
+        .messageBufferSize = BOARD_USB_HOST_MESSAGE_BUFFER_SIZE,
+        .sysexBufferSize = BOARD_USB_HOST_SYSEX_BUFFER_SIZE,
+        .readBufferSize = BOARD_USB_HOST_READ_BUFFER_SIZE
+    },
+    // Matches the UART ports in passthrough.cpp.
+    .numUARTs = 2,
+    .usbDeviceFIFOSize = BOARD_USB_DEVICE_MIDI_RX_BUFSIZE +
+        BOARD_USB_DEVICE_MIDI_TX_BUFSIZE,
+    .usbHostFIFOSize = BOARD_USB_HOST_MIDI_RX_BUFSIZE +
+        BOARD_USB_HOST_MIDI_TX_BUFSIZE,
+    // Matches CFG_TUH_MIDI in tusb_config.h.
+    .numHostedDevices = 4,
+    .logBufferSize = BOARD_LOG_BUFFER_SIZE,
+    .ramBudget = BOARD_RAM_BUDGET
+};
+
+static_assert(BOARD_CONFIG.uart.isValid(),
+    "The UART port's buffers are too small.");
+static_assert(BOARD_CONFIG.usbDevice.isValid(),
+    "The USB device port's buffers are too small.");
+static_assert(BOARD_CONFIG.usbHost.isValid(),
+    "The USB host port's buffers are too small.");
+static_assert(BOARD_CONFIG.totalSize() <= BOARD_CONFIG.ramBudget,
+    "The planned buffers exceed BOARD_RAM_BUDGET.");
+
+/**
+ * @brief Hands out buffers from a single, statically-allocated
+ * block of memory. Memory is never freed.
+ */
+class MemoryArena {
+public:
+    uint8_t* memory = NULL;
+    size_t capacity = 0;
+    size_t numBytesAllocated = 0;
+
+    void init(uint8_t* memory, size_t capacity) {
+        this->memory = memory;
+        this->capacity = capacity;
+        this->numBytesAllocated = 0;
+    }
+
+    // Returns NULL if the arena doesn't have enough space left.
+    uint8_t* allocate(size_t numBytes) {
+        if (numBytes > capacity - numBytesAllocated) {
+            return NULL;
+        }
+
+        uint8_t* block = memory + numBytesAllocated;
+        numBytesAllocated += numBytes;
+
+        return block;
+    }
+};
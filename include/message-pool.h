@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MESSAGE_POOL_NO_SLOT 0xFF
+
+/**
+ * @brief A fixed pool of reference-counted message slots, which lets
+ * every queue that holds a message share one copy of it.
+ *
+ * A message is copied into the pool once, and queues hold only the
+ * index of its first slot. Messages longer than a slot (i.e. SysEx)
+ * are stored in a chain of slots. The reference count of the first
+ * slot covers the whole chain, which is freed when the last reference
+ * is released. Nothing here is thread safe; the pool must only be used
+ * from the main loop.
+ */
+template<size_t numSlots, size_t slotSize>
+class MessagePool {
+public:
+    static_assert(numSlots < MESSAGE_POOL_NO_SLOT,
+        "Slots are indexed with a single byte.");
+    static_assert(slotSize < 256,
+        "Slot sizes are stored in a single byte.");
+
+    struct Slot {
+        uint8_t refCount;
+        uint8_t size;
+        uint8_t next;
+        uint8_t data[slotSize];
+    };
+
+    Slot slots[numSlots];
+    uint8_t freeList = MESSAGE_POOL_NO_SLOT;
+
+    size_t numInUse = 0;
+    size_t maxInUse = 0;
+    uint32_t numExhausted = 0;
+
+    void init() {
+        for (size_t i = 0; i < numSlots; i++) {
+            slots[i].refCount = 0;
+            slots[i].next = i + 1 < numSlots ? i + 1 : MESSAGE_POOL_NO_SLOT;
+        }
+
+        freeList = 0;
+        numInUse = 0;
+        resetStats();
+    }
+
+    void resetStats() {
+        maxInUse = numInUse;
+        numExhausted = 0;
+    }
+
+    /**
+     * @brief Copies a message into a chain of slots, with one reference.
+     *
+     * @return the first slot, or MESSAGE_POOL_NO_SLOT
+     * if there aren't enough free slots
+     */
+    inline uint8_t allocate(uint8_t* data, size_t size) {
+        size_t slotsNeeded = size == 0 ? 1 : (size + slotSize - 1) / slotSize;
+        if (slotsNeeded > numSlots - numInUse) {
+            numExhausted++;
+            return MESSAGE_POOL_NO_SLOT;
+        }
+
+        uint8_t head = freeList;
+        uint8_t idx = head;
+        size_t offset = 0;
+
+        for (size_t i = 0; i < slotsNeeded; i++) {
+            Slot* slot = &slots[idx];
+            size_t slotBytes = size - offset < slotSize ?
+                size - offset : slotSize;
+
+            for (size_t j = 0; j < slotBytes; j++) {
+                slot->data[j] = data[offset + j];
+            }
+
+            slot->size = slotBytes;
+            slot->refCount = 0;
+            offset += slotBytes;
+
+            if (i + 1 == slotsNeeded) {
+                freeList = slot->next;
+                slot->next = MESSAGE_POOL_NO_SLOT;
+            } else {
+                idx = slot->next;
+            }
+        }
+
+        slots[head].refCount = 1;
+        numInUse += slotsNeeded;
+        if (numInUse > maxInUse) {
+            maxInUse = numInUse;
+        }
+
+        return head;
+    }
+
+    inline void retain(uint8_t head) {
+        slots[head].refCount++;
+    }
+
+    // Frees the whole chain when its last reference is released.
+    inline void release(uint8_t head) {
+        if (--slots[head].refCount > 0) {
+            return;
+        }
+
+        uint8_t tail = head;
+        numInUse--;
+        while (slots[tail].next != MESSAGE_POOL_NO_SLOT) {
+            tail = slots[tail].next;
+            numInUse--;
+        }
+
+        slots[tail].next = freeList;
+        freeList = head;
+    }
+
+    inline Slot& operator[](uint8_t idx) {
+        return slots[idx];
+    }
+};
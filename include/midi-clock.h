@@ -0,0 +1,347 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shifts used by the clock tracking filter (a second-order PLL).
+// Phase errors are corrected by 1/2^PHASE_SHIFT per tick, and the
+// period estimate is corrected by 1/2^PERIOD_SHIFT of the phase error.
+#define MIDI_CLOCK_PHASE_SHIFT 3
+#define MIDI_CLOCK_PERIOD_SHIFT 5
+
+// Fractional bits used for the period estimate.
+#define MIDI_CLOCK_PERIOD_FRAC_BITS 8
+
+// Maximum number of regenerated ticks waiting to be sent. This covers
+// the longest output delay with the constant latency (about 67 ms)
+// at up to 590 BPM.
+#define MIDI_CLOCK_MAX_PENDING_TICKS 16
+
+#define MIDI_CLOCK_NO_SOURCE 0xFF
+
+enum class MidiClockSourcePolicy : uint8_t {
+    // The first source to send clock is the master
+    // until it stops sending clock.
+    FIRST_ACTIVE,
+
+    // The active source with the lowest index is the master.
+    PRIORITY,
+
+    // Only clock from the configured source is accepted.
+    FIXED
+};
+
+struct MidiClockConfig {
+    MidiClockSourcePolicy policy = MidiClockSourcePolicy::FIRST_ACTIVE;
+    uint8_t fixedSource = 0;
+
+    // A source that hasn't sent clock for this long is no longer active.
+    uint32_t sourceTimeoutUs = 500000;
+
+    // When true, the master's clock is smoothed and regenerated;
+    // otherwise it's forwarded as it arrives.
+    bool regenerate = true;
+
+    // How long regenerated ticks are held back after the filtered
+    // arrival time of the incoming tick. This should exceed the
+    // worst expected input jitter.
+    uint32_t outputDelayUs = 2000;
+};
+
+/**
+ * @brief Interval statistics for a stream of clock ticks.
+ *
+ * Jitter is measured as the deviation of each interval from
+ * the tracked tempo's period.
+ */
+struct MidiClockJitterStats {
+    uint32_t numIntervals = 0;
+    uint32_t lastIntervalUs = 0;
+    uint32_t minIntervalUs = UINT32_MAX;
+    uint32_t maxIntervalUs = 0;
+    uint32_t maxDeviationUs = 0;
+
+    // Exponentially-weighted mean absolute deviation,
+    // with four fractional bits.
+    uint32_t meanDeviationQ4 = 0;
+
+    void reset() {
+        *this = MidiClockJitterStats();
+    }
+
+    void addInterval(uint32_t intervalUs, uint32_t periodUs) {
+        uint32_t deviationUs = intervalUs > periodUs ?
+            intervalUs - periodUs : periodUs - intervalUs;
+
+        numIntervals++;
+        lastIntervalUs = intervalUs;
+
+        if (intervalUs < minIntervalUs) {
+            minIntervalUs = intervalUs;
+        }
+
+        if (intervalUs > maxIntervalUs) {
+            maxIntervalUs = intervalUs;
+        }
+
+        if (deviationUs > maxDeviationUs) {
+            maxDeviationUs = deviationUs;
+        }
+
+        // mean += (deviation - mean) / 16
+        int32_t errorQ4 = (int32_t) (deviationUs << 4) -
+            (int32_t) meanDeviationQ4;
+        meanDeviationQ4 = (uint32_t) ((int32_t) meanDeviationQ4 +
+            (errorQ4 >> 4));
+    }
+};
+
+/**
+ * @brief Selects a single master clock source, tracks its tempo
+ * and schedules evenly-spaced regenerated clock ticks.
+ *
+ * The engine is independent of the hardware; callers pass in
+ * timestamps from the microsecond timer. All arithmetic on
+ * timestamps is wrap-safe.
+ */
+template<size_t numSources>
+class MidiClockEngine {
+public:
+    MidiClockConfig config;
+    MidiClockJitterStats inputJitter;
+    MidiClockJitterStats outputJitter;
+
+    uint8_t masterSource = MIDI_CLOCK_NO_SOURCE;
+    uint32_t numDroppedTicks = 0;
+    uint32_t numOverflowedTicks = 0;
+    uint32_t numMasterChanges = 0;
+
+    bool sourceIsActive[numSources] = {false};
+    uint32_t lastSourceTickUs[numSources] = {0};
+
+    // Tracking filter state for the master source.
+    bool isLocked = false;
+    uint32_t numMasterTicks = 0;
+    uint32_t lastInputTickUs = 0;
+    uint32_t periodQ = 0;
+    uint32_t filteredTickUs = 0;
+
+    // Regenerated ticks that are waiting to be sent.
+    uint32_t pendingTicksUs[MIDI_CLOCK_MAX_PENDING_TICKS] = {0};
+    uint8_t pendingReadIdx = 0;
+    uint8_t numPendingTicks = 0;
+    bool hasSentTick = false;
+    uint32_t lastOutputTickUs = 0;
+
+    void init(MidiClockConfig config = MidiClockConfig()) {
+        this->config = config;
+        masterSource = MIDI_CLOCK_NO_SOURCE;
+        numDroppedTicks = 0;
+        numOverflowedTicks = 0;
+        numMasterChanges = 0;
+
+        for (size_t i = 0; i < numSources; i++) {
+            sourceIsActive[i] = false;
+            lastSourceTickUs[i] = 0;
+        }
+
+        resetTracking();
+    }
+
+    uint32_t periodUs() {
+        return periodQ >> MIDI_CLOCK_PERIOD_FRAC_BITS;
+    }
+
+    /**
+     * @brief Handles an incoming Timing Clock message.
+     *
+     * @return true if the message should be forwarded as is,
+     * false if it should be dropped (either because it came from
+     * a source other than the master, or because it will be
+     * regenerated).
+     */
+    bool acceptClock(uint8_t source, uint32_t nowUs) {
+        if (source >= numSources) {
+            return false;
+        }
+
+        sourceIsActive[source] = true;
+        lastSourceTickUs[source] = nowUs;
+
+        expireSources(nowUs);
+        selectMaster(source);
+
+        if (source != masterSource) {
+            numDroppedTicks++;
+            return false;
+        }
+
+        trackMasterTick(nowUs);
+
+        return !config.regenerate;
+    }
+
+    /**
+     * @brief Determines if a transport message (Start, Continue,
+     * Stop or Song Position) from the specified source
+     * should be forwarded.
+     */
+    bool acceptTransport(uint8_t source) {
+        return masterSource == MIDI_CLOCK_NO_SOURCE ||
+            source == masterSource;
+    }
+
+    /**
+     * @brief Releases the master if it has stopped sending clock.
+     * This should be called periodically.
+     */
+    void update(uint32_t nowUs) {
+        expireSources(nowUs);
+    }
+
+    bool hasPendingTick() {
+        return numPendingTicks > 0;
+    }
+
+    uint32_t nextTickUs() {
+        return pendingTicksUs[pendingReadIdx];
+    }
+
+    /**
+     * @brief Removes the next regenerated tick if it is due.
+     *
+     * @return true if a Timing Clock message should be sent now
+     */
+    bool popDueTick(uint32_t nowUs) {
+        if (numPendingTicks == 0 ||
+            (int32_t) (nowUs - nextTickUs()) < 0) {
+            return false;
+        }
+
+        pendingReadIdx = (pendingReadIdx + 1) % MIDI_CLOCK_MAX_PENDING_TICKS;
+        numPendingTicks--;
+
+        if (hasSentTick && isLocked) {
+            outputJitter.addInterval(nowUs - lastOutputTickUs, periodUs());
+        }
+
+        hasSentTick = true;
+        lastOutputTickUs = nowUs;
+
+        return true;
+    }
+
+protected:
+    // Ticks regenerated from the previous master are dropped,
+    // so they can't leak into the new master's stream.
+    void resetTracking() {
+        isLocked = false;
+        numMasterTicks = 0;
+        periodQ = 0;
+        numPendingTicks = 0;
+        hasSentTick = false;
+    }
+
+    void expireSources(uint32_t nowUs) {
+        for (size_t i = 0; i < numSources; i++) {
+            if (sourceIsActive[i] &&
+                nowUs - lastSourceTickUs[i] > config.sourceTimeoutUs) {
+                sourceIsActive[i] = false;
+            }
+        }
+
+        if (masterSource != MIDI_CLOCK_NO_SOURCE &&
+            !sourceIsActive[masterSource]) {
+            masterSource = MIDI_CLOCK_NO_SOURCE;
+            resetTracking();
+        }
+    }
+
+    void selectMaster(uint8_t source) {
+        uint8_t candidate = masterSource;
+
+        switch (config.policy) {
+            case MidiClockSourcePolicy::FIRST_ACTIVE:
+                if (candidate == MIDI_CLOCK_NO_SOURCE) {
+                    candidate = source;
+                }
+                break;
+            case MidiClockSourcePolicy::PRIORITY:
+                if (candidate == MIDI_CLOCK_NO_SOURCE ||
+                    source < candidate) {
+                    candidate = source;
+                }
+                break;
+            case MidiClockSourcePolicy::FIXED:
+                candidate = config.fixedSource;
+                break;
+        }
+
+        if (candidate != masterSource && candidate < numSources &&
+            sourceIsActive[candidate]) {
+            masterSource = candidate;
+            numMasterChanges++;
+            resetTracking();
+        }
+    }
+
+    void trackMasterTick(uint32_t nowUs) {
+        numMasterTicks++;
+
+        if (numMasterTicks == 1) {
+            // Nothing to measure against yet.
+            lastInputTickUs = nowUs;
+            filteredTickUs = nowUs;
+            scheduleTick(nowUs);
+            return;
+        }
+
+        uint32_t intervalUs = nowUs - lastInputTickUs;
+        lastInputTickUs = nowUs;
+
+        if (!isLocked) {
+            periodQ = intervalUs << MIDI_CLOCK_PERIOD_FRAC_BITS;
+            filteredTickUs = nowUs;
+            isLocked = true;
+            scheduleTick(nowUs);
+            return;
+        }
+
+        inputJitter.addInterval(intervalUs, periodUs());
+
+        uint32_t predictedUs = filteredTickUs + periodUs();
+        int32_t errorUs = (int32_t) (nowUs - predictedUs);
+        int32_t halfPeriodUs = (int32_t) (periodUs() / 2);
+
+        if (errorUs > halfPeriodUs || errorUs < -halfPeriodUs) {
+            // The tempo jumped; relock to the new interval
+            // rather than slowly slewing towards it.
+            periodQ = intervalUs << MIDI_CLOCK_PERIOD_FRAC_BITS;
+            filteredTickUs = nowUs;
+        } else {
+            int32_t periodCorrectionQ = (errorUs *
+                (1 << MIDI_CLOCK_PERIOD_FRAC_BITS)) >> MIDI_CLOCK_PERIOD_SHIFT;
+            periodQ = (uint32_t) ((int32_t) periodQ + periodCorrectionQ);
+            filteredTickUs = predictedUs +
+                (uint32_t) (errorUs >> MIDI_CLOCK_PHASE_SHIFT);
+        }
+
+        scheduleTick(filteredTickUs);
+    }
+
+    void scheduleTick(uint32_t filteredUs) {
+        if (!config.regenerate) {
+            return;
+        }
+
+        if (numPendingTicks >= MIDI_CLOCK_MAX_PENDING_TICKS) {
+            numOverflowedTicks++;
+            return;
+        }
+
+        uint8_t writeIdx = (pendingReadIdx + numPendingTicks) %
+            MIDI_CLOCK_MAX_PENDING_TICKS;
+        pendingTicksUs[writeIdx] = filteredUs + config.outputDelayUs;
+        numPendingTicks++;
+    }
+};
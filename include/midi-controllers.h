@@ -0,0 +1,26 @@
+#pragma once
+
+// Control change numbers, and other MIDI values, used by more than
+// one part of the firmware.
+
+#define MIDI_CC_BANK_SELECT_MSB 0
+#define MIDI_CC_MODULATION 1
+#define MIDI_CC_DATA_ENTRY_MSB 6
+#define MIDI_CC_VOLUME 7
+#define MIDI_CC_BALANCE 8
+#define MIDI_CC_PAN 10
+#define MIDI_CC_EXPRESSION 11
+#define MIDI_CC_BANK_SELECT_LSB 32
+#define MIDI_CC_DATA_ENTRY_LSB 38
+#define MIDI_CC_SUSTAIN 64
+#define MIDI_CC_SOFT_PEDAL 67
+#define MIDI_CC_DATA_INCREMENT 96
+#define MIDI_CC_RPN_MSB 101
+
+// Controllers from here on are channel mode messages.
+#define MIDI_CC_FIRST_CHANNEL_MODE 120
+#define MIDI_CC_ALL_SOUND_OFF 120
+#define MIDI_CC_RESET_ALL_CONTROLLERS 121
+#define MIDI_CC_ALL_NOTES_OFF 123
+
+#define MIDI_PITCH_BEND_CENTER 0x2000
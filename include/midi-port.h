@@ -1,6 +1,9 @@
 #pragma once
 
 #include "midi-parser.h"
+#include "memory-plan.h"
+#include "profiler.h"
+#include "hot-path.h"
 
 struct MidiParserConfig {
     sig_MidiParser_MessageCallback onMIDIMessage = sig_MidiParser_noOpMessageCallback;
@@ -8,29 +11,69 @@ struct MidiParserConfig {
     void* userData = NULL;
 };
 
-template<size_t messageBufferSize,
-         size_t sysexBufferSize,
-         size_t readBufferSize>
+HOT_PATH(feedMidiParser)
+inline void feedMidiParser(struct sig_MidiParser* parser,
+    uint8_t* buffer, size_t numBytes) {
+    PROFILE_SCOPE(PROFILE_PROBE_PARSER);
+    sig_MidiParser_feedBytes(parser, buffer, numBytes);
+}
+
 class MidiPort {
 public:
-    uint8_t messageBuffer[messageBufferSize] = {0};
-    uint8_t sysexBuffer[sysexBufferSize] = {0};
-    uint8_t readBuffer[readBufferSize] = {0};
+    uint8_t* messageBuffer = NULL;
+    size_t messageBufferSize = 0;
+    uint8_t* sysexBuffer = NULL;
+    size_t sysexBufferSize = 0;
+    uint8_t* readBuffer = NULL;
+    size_t readBufferSize = 0;
     size_t numTXBytesDropped = 0;
+    bool isInitialized = false;
     struct sig_MidiParser midiParser;
 
+    // Buffers must be allocated before the port is initialized.
+    void initBuffers(MemoryArena* arena, MidiPortBufferConfig config) {
+        this->messageBuffer = arena->allocate(config.messageBufferSize);
+        this->messageBufferSize = config.messageBufferSize;
+        this->sysexBuffer = arena->allocate(config.sysexBufferSize);
+        this->sysexBufferSize = config.sysexBufferSize;
+        this->readBuffer = arena->allocate(config.readBufferSize);
+        this->readBufferSize = config.readBufferSize;
+    }
+
+    // Called after the system clock's frequency has changed.
+    void clockChanged() {}
+
+    // Called before and after the system clock's frequency changes.
+    void holdTX(bool isHeld) {
+        (void) isHeld;
+    }
+
+    // How long each byte takes to send. Ports that don't model
+    // their output rate send in no time.
+    static constexpr uint32_t TX_BYTE_US = 0;
+
+    // When everything that has been written so far will have been sent.
+    inline uint32_t txIdleAt(uint32_t nowUs) {
+        return nowUs;
+    }
+
+    // The number of bytes that can be written without backing up.
+    // Ports that don't model their output rate are never backed up.
+    inline size_t writeCapacity(uint32_t nowUs) {
+        (void) nowUs;
+        return SIZE_MAX;
+    }
+
     void initParser(MidiParserConfig config) {
         sig_MidiParser_init(
             &this->midiParser,
             this->messageBuffer,
-            messageBufferSize,
+            this->messageBufferSize,
             this->sysexBuffer,
-            sysexBufferSize,
+            this->sysexBufferSize,
             config.onMIDIMessage,
             config.onSysexChunk,
             config.userData
         );
     }
 };
-
-
@@ -0,0 +1,483 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+// A full-frame message, which sets a receiver's position at once:
+//     F0 7F <device> 01 01 <rate and hours> <minutes> <seconds> <frames> F7
+#define MTC_FULL_FRAME_SIZE 10
+
+#define MTC_NUM_PIECES 8
+
+// The bits of each piece's nibble that carry the time.
+static constexpr uint8_t MTC_PIECE_MASKS[MTC_NUM_PIECES] = {
+    0x0F, 0x01, 0x0F, 0x03, 0x0F, 0x03, 0x0F, 0x07
+};
+
+// Maximum number of regenerated quarter frames waiting to be sent.
+// This covers the longest output delay with the constant latency
+// (about 67 ms) at 30 fps.
+#define MTC_MAX_PENDING_QUARTER_FRAMES 16
+
+// Shifts used to track the master's quarter frame period,
+// as for clock (see include/midi-clock.h).
+#define MTC_PHASE_SHIFT 3
+#define MTC_PERIOD_SHIFT 5
+#define MTC_PERIOD_FRAC_BITS 8
+
+#define MTC_NO_SOURCE 0xFF
+
+enum MidiTimeCodeRate {
+    MTC_RATE_24 = 0,
+    MTC_RATE_25,
+    MTC_RATE_30_DROP,
+    MTC_RATE_30
+};
+
+/**
+ * @brief A position in SMPTE time, as carried by MTC.
+ */
+struct MidiTimeCode {
+    uint8_t hours = 0;
+    uint8_t minutes = 0;
+    uint8_t seconds = 0;
+    uint8_t frames = 0;
+    uint8_t rate = MTC_RATE_24;
+
+    inline bool operator==(const MidiTimeCode& other) const {
+        return hours == other.hours && minutes == other.minutes &&
+            seconds == other.seconds && frames == other.frames &&
+            rate == other.rate;
+    }
+
+    inline uint8_t framesPerSecond() const {
+        return rate == MTC_RATE_24 ? 24 : rate == MTC_RATE_25 ? 25 : 30;
+    }
+
+    // Drop frame time skips frames 0 and 1 at the start of every
+    // minute, except every tenth minute.
+    void addFrame() {
+        if (++frames < framesPerSecond()) {
+            return;
+        }
+
+        frames = 0;
+        if (++seconds < 60) {
+            return;
+        }
+
+        seconds = 0;
+        if (++minutes == 60) {
+            minutes = 0;
+            hours = (hours + 1) % 24;
+        }
+
+        if (rate == MTC_RATE_30_DROP && minutes % 10 != 0) {
+            frames = 2;
+        }
+    }
+
+    // Each quarter frame carries one nibble of the time.
+    uint8_t quarterFrame(uint8_t piece) const {
+        uint8_t nibble;
+
+        switch (piece) {
+            case 0: nibble = frames & 0x0F; break;
+            case 1: nibble = frames >> 4; break;
+            case 2: nibble = seconds & 0x0F; break;
+            case 3: nibble = seconds >> 4; break;
+            case 4: nibble = minutes & 0x0F; break;
+            case 5: nibble = minutes >> 4; break;
+            case 6: nibble = hours & 0x0F; break;
+            default: nibble = (hours >> 4) | (rate << 1); break;
+        }
+
+        return (piece << 4) | nibble;
+    }
+
+    void writeFullFrame(uint8_t* message) const {
+        message[0] = sig_MIDI_STATUS_SYSEX_START;
+        message[1] = 0x7F;
+        message[2] = 0x7F;
+        message[3] = 0x01;
+        message[4] = 0x01;
+        message[5] = (rate << 5) | hours;
+        message[6] = minutes;
+        message[7] = seconds;
+        message[8] = frames;
+        message[9] = sig_MIDI_STATUS_SYSEX_END;
+    }
+};
+
+/**
+ * @brief Determines if a complete SysEx message is an MTC full frame.
+ */
+inline bool isMTCFullFrame(uint8_t* sysexData, size_t size) {
+    return size == MTC_FULL_FRAME_SIZE &&
+        sysexData[0] == sig_MIDI_STATUS_SYSEX_START &&
+        sysexData[1] == 0x7F && sysexData[3] == 0x01 &&
+        sysexData[4] == 0x01 &&
+        sysexData[9] == sig_MIDI_STATUS_SYSEX_END;
+}
+
+struct MidiTimeCodeConfig {
+    // A source that hasn't sent a quarter frame for this long
+    // has stopped.
+    uint32_t sourceTimeoutUs = 100000;
+
+    // When true, the master's quarter frames are regenerated at evenly
+    // spaced times from its position; otherwise they're forwarded.
+    bool regenerate = false;
+
+    // How long regenerated quarter frames are held back after
+    // the filtered arrival time of the incoming quarter frame.
+    uint32_t outputDelayUs = 2000;
+};
+
+/**
+ * @brief The time code being received from one source.
+ */
+struct MidiTimeCodeSource {
+    uint8_t pieces[MTC_NUM_PIECES] = {0};
+    // The piece expected next, or MTC_NUM_PIECES while waiting
+    // for the start of a set.
+    uint8_t nextPiece = MTC_NUM_PIECES;
+    bool isRunning = false;
+    uint32_t lastQuarterFrameUs = 0;
+
+    // The time the next complete set of quarter frames should carry,
+    // if the source keeps running without a jump.
+    bool hasPosition = false;
+    MidiTimeCode nextPosition;
+
+    uint32_t numQuarterFrames = 0;
+    uint32_t numLocates = 0;
+};
+
+/**
+ * @brief Reassembles MIDI Time Code from each source and detects
+ * when a source jumps to a new position.
+ *
+ * A receiver needs a complete set of eight quarter frames (two frames
+ * of time) to find its position, and usually needs another to lock.
+ * When the master source's time is discontinuous, the engine sees it
+ * in the first quarter frame that doesn't follow on, and stops any
+ * regenerated time code there. It reports a locate as soon as the
+ * first set at the new position is complete, so that a full-frame
+ * message can be sent to every output and the receivers can jump
+ * straight there.
+ *
+ * The first source to send quarter frames is the master until it stops.
+ * Quarter frames from the other sources are dropped, since interleaved
+ * sets from two sources can't be reassembled. The master's quarter
+ * frames can also be regenerated, evenly spaced, from its position.
+ */
+template<size_t numSources>
+class MidiTimeCodeEngine {
+public:
+    MidiTimeCodeConfig config;
+    MidiTimeCodeSource sources[numSources];
+    uint8_t masterSource = MTC_NO_SOURCE;
+    uint32_t numDroppedQuarterFrames = 0;
+
+    // Tracking filter state for the master's quarter frames.
+    uint32_t numMasterQuarterFrames = 0;
+    uint32_t lastInputUs = 0;
+    uint32_t filteredUs = 0;
+    uint32_t periodQ = 0;
+
+    // The regenerated time code, which starts again from each locate.
+    bool isOutputLocked = false;
+    MidiTimeCode outputPosition;
+    uint8_t outputPiece = 0;
+    uint32_t pendingUs[MTC_MAX_PENDING_QUARTER_FRAMES] = {0};
+    uint8_t pendingReadIdx = 0;
+    uint8_t numPending = 0;
+    uint32_t numRegenerated = 0;
+
+    void init(MidiTimeCodeConfig config = MidiTimeCodeConfig()) {
+        this->config = config;
+
+        for (size_t i = 0; i < numSources; i++) {
+            sources[i] = MidiTimeCodeSource();
+        }
+
+        masterSource = MTC_NO_SOURCE;
+        numDroppedQuarterFrames = 0;
+        numRegenerated = 0;
+        resetTracking();
+    }
+
+    uint32_t periodUs() {
+        return periodQ >> MTC_PERIOD_FRAC_BITS;
+    }
+
+    /**
+     * @brief Handles an incoming quarter frame.
+     *
+     * @param hasLocated set to true if this quarter frame completed
+     * the first set at a new position on the master source, in which
+     * case its position is in locatedPosition().
+     * @return true if the quarter frame should be forwarded as is,
+     * false if it should be dropped (either because it came from a
+     * source other than the master, or because it will be regenerated)
+     */
+    bool acceptQuarterFrame(uint8_t source, uint8_t data, uint32_t nowUs,
+        bool* hasLocated) {
+        *hasLocated = false;
+        if (source >= numSources) {
+            return false;
+        }
+
+        expireSources(nowUs);
+
+        MidiTimeCodeSource& state = sources[source];
+        state.numQuarterFrames++;
+        state.isRunning = true;
+        state.lastQuarterFrameUs = nowUs;
+
+        if (masterSource == MTC_NO_SOURCE) {
+            masterSource = source;
+        }
+
+        bool hasJumped = !isExpected(state, data);
+        if (hasJumped) {
+            // The set will be a locate once it's complete.
+            state.hasPosition = false;
+        }
+
+        bool isComplete = addPiece(state, data);
+        bool isLocate = isComplete && checkPosition(state);
+
+        if (source != masterSource) {
+            numDroppedQuarterFrames++;
+            return false;
+        }
+
+        if (hasJumped) {
+            // Rather than carrying on with the old time until the
+            // set at the new position is complete, the regenerated
+            // time code stops at once.
+            isOutputLocked = false;
+            numPending = 0;
+        }
+
+        trackMasterQuarterFrame(nowUs);
+        if (isLocate || (isComplete && !isOutputLocked)) {
+            locateOutput(state.nextPosition);
+        }
+
+        *hasLocated = isLocate;
+
+        return !config.regenerate;
+    }
+
+    /**
+     * @brief Handles an incoming full-frame message, which the source
+     * will be continuing on from.
+     */
+    void acceptFullFrame(uint8_t source, uint8_t* sysexData) {
+        if (source >= numSources) {
+            return;
+        }
+
+        MidiTimeCodeSource& state = sources[source];
+        state.hasPosition = true;
+        state.nextPosition.hours = sysexData[5] & 0x1F;
+        state.nextPosition.rate = (sysexData[5] >> 5) & 0x03;
+        state.nextPosition.minutes = sysexData[6];
+        state.nextPosition.seconds = sysexData[7];
+        state.nextPosition.frames = sysexData[8];
+        state.nextPiece = MTC_NUM_PIECES;
+
+        if (source == masterSource) {
+            locateOutput(state.nextPosition);
+        }
+    }
+
+    /**
+     * @brief The position the master reached at its last locate,
+     * which is the time of its next quarter frame.
+     */
+    inline MidiTimeCode& locatedPosition() {
+        return sources[masterSource].nextPosition;
+    }
+
+    /**
+     * @brief Releases the master if it has stopped sending quarter
+     * frames. This should be called periodically.
+     */
+    void update(uint32_t nowUs) {
+        expireSources(nowUs);
+    }
+
+    /**
+     * @brief Removes the next regenerated quarter frame if it's due.
+     *
+     * @return true if a quarter frame with the specified data byte
+     * should be sent now
+     */
+    bool popDueQuarterFrame(uint32_t nowUs, uint8_t* data) {
+        if (numPending == 0 ||
+            (int32_t) (nowUs - pendingUs[pendingReadIdx]) < 0) {
+            return false;
+        }
+
+        pendingReadIdx = (pendingReadIdx + 1) %
+            MTC_MAX_PENDING_QUARTER_FRAMES;
+        numPending--;
+
+        *data = outputPosition.quarterFrame(outputPiece);
+        if (++outputPiece == MTC_NUM_PIECES) {
+            outputPiece = 0;
+            outputPosition.addFrame();
+            outputPosition.addFrame();
+        }
+
+        numRegenerated++;
+
+        return true;
+    }
+
+protected:
+    void resetTracking() {
+        numMasterQuarterFrames = 0;
+        periodQ = 0;
+        isOutputLocked = false;
+        numPending = 0;
+    }
+
+    void expireSources(uint32_t nowUs) {
+        for (size_t i = 0; i < numSources; i++) {
+            MidiTimeCodeSource& state = sources[i];
+            if (state.isRunning &&
+                nowUs - state.lastQuarterFrameUs > config.sourceTimeoutUs) {
+                // Where it starts again will be a new position.
+                state.isRunning = false;
+                state.hasPosition = false;
+                state.nextPiece = MTC_NUM_PIECES;
+            }
+        }
+
+        if (masterSource != MTC_NO_SOURCE &&
+            !sources[masterSource].isRunning) {
+            masterSource = MTC_NO_SOURCE;
+            resetTracking();
+        }
+    }
+
+    // While a source is running, each quarter frame should carry the
+    // next nibble of its position, so a jump can be seen in the first
+    // quarter frame that doesn't, rather than at the end of the set.
+    bool isExpected(MidiTimeCodeSource& state, uint8_t data) {
+        uint8_t piece = (data >> 4) & 0x07;
+        if (!state.hasPosition ||
+            (piece != 0 && piece != state.nextPiece)) {
+            return true;
+        }
+
+        uint8_t expected = state.nextPosition.quarterFrame(piece);
+        return ((data ^ expected) & MTC_PIECE_MASKS[piece]) == 0;
+    }
+
+    // Returns true once a set of quarter frames is complete.
+    // Time code running backwards is never complete.
+    bool addPiece(MidiTimeCodeSource& state, uint8_t data) {
+        uint8_t piece = (data >> 4) & 0x07;
+
+        if (piece == 0) {
+            state.nextPiece = 0;
+        } else if (piece != state.nextPiece) {
+            state.nextPiece = MTC_NUM_PIECES;
+            return false;
+        }
+
+        state.pieces[piece] = data & 0x0F;
+        state.nextPiece++;
+
+        return piece == MTC_NUM_PIECES - 1;
+    }
+
+    // Moves the source's position on to the end of the set, and
+    // returns true if the source had jumped.
+    bool checkPosition(MidiTimeCodeSource& state) {
+        MidiTimeCode position;
+        position.frames = state.pieces[0] | ((state.pieces[1] & 0x01) << 4);
+        position.seconds = state.pieces[2] | ((state.pieces[3] & 0x03) << 4);
+        position.minutes = state.pieces[4] | ((state.pieces[5] & 0x03) << 4);
+        position.hours = state.pieces[6] | ((state.pieces[7] & 0x01) << 4);
+        position.rate = (state.pieces[7] >> 1) & 0x03;
+
+        bool isLocate = !state.hasPosition ||
+            !(position == state.nextPosition);
+        if (isLocate) {
+            state.numLocates++;
+        }
+
+        // The set took two frames to send.
+        position.addFrame();
+        position.addFrame();
+        state.hasPosition = true;
+        state.nextPosition = position;
+        state.nextPiece = MTC_NUM_PIECES;
+
+        return isLocate;
+    }
+
+    // The regenerated time code starts again from the next
+    // quarter frame, so anything still waiting is stale.
+    void locateOutput(MidiTimeCode& position) {
+        isOutputLocked = true;
+        outputPosition = position;
+        outputPiece = 0;
+        numPending = 0;
+    }
+
+    void trackMasterQuarterFrame(uint32_t nowUs) {
+        numMasterQuarterFrames++;
+
+        if (numMasterQuarterFrames == 1) {
+            lastInputUs = nowUs;
+            filteredUs = nowUs;
+            scheduleQuarterFrame();
+            return;
+        }
+
+        uint32_t intervalUs = nowUs - lastInputUs;
+        lastInputUs = nowUs;
+
+        uint32_t predictedUs = filteredUs + periodUs();
+        int32_t errorUs = (int32_t) (nowUs - predictedUs);
+        int32_t halfPeriodUs = (int32_t) (periodUs() / 2);
+
+        if (numMasterQuarterFrames == 2 || errorUs > halfPeriodUs ||
+            errorUs < -halfPeriodUs) {
+            // The frame rate or speed changed; relock to the new interval.
+            periodQ = intervalUs << MTC_PERIOD_FRAC_BITS;
+            filteredUs = nowUs;
+        } else {
+            int32_t periodCorrectionQ = (errorUs *
+                (1 << MTC_PERIOD_FRAC_BITS)) >> MTC_PERIOD_SHIFT;
+            periodQ = (uint32_t) ((int32_t) periodQ + periodCorrectionQ);
+            filteredUs = predictedUs +
+                (uint32_t) (errorUs >> MTC_PHASE_SHIFT);
+        }
+
+        scheduleQuarterFrame();
+    }
+
+    // Each quarter frame received from the master is regenerated once,
+    // so the output keeps pace with it.
+    void scheduleQuarterFrame() {
+        if (!config.regenerate || !isOutputLocked ||
+            numPending >= MTC_MAX_PENDING_QUARTER_FRAMES) {
+            return;
+        }
+
+        uint8_t writeIdx = (pendingReadIdx + numPending) %
+            MTC_MAX_PENDING_QUARTER_FRAMES;
+        pendingUs[writeIdx] = filteredUs + config.outputDelayUs;
+        numPending++;
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-controllers.h"
+#include "midi-parser.h"
+
+#define NOTE_TRACKER_NUM_CHANNELS 16
+#define NOTE_TRACKER_WORDS_PER_CHANNEL 4
+
+/**
+ * @brief Tracks which notes are sounding on each of a port's channels.
+ *
+ * Each channel has a 128-bit set of active notes (256 bytes per port);
+ * setting, clearing and counting are all constant time.
+ */
+class NoteTracker {
+public:
+    uint32_t activeNotes[NOTE_TRACKER_NUM_CHANNELS]
+        [NOTE_TRACKER_WORDS_PER_CHANNEL] = {{0}};
+    uint16_t numActiveNotes = 0;
+
+    void init() {
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < NOTE_TRACKER_NUM_CHANNELS; i++) {
+            clearChannel(i);
+        }
+
+        numActiveNotes = 0;
+    }
+
+    inline bool isActive(uint8_t channel, uint8_t note) {
+        return (activeNotes[channel][note >> 5] >> (note & 31)) & 1;
+    }
+
+    inline void set(uint8_t channel, uint8_t note) {
+        uint32_t mask = 1UL << (note & 31);
+        uint32_t* word = &activeNotes[channel][note >> 5];
+
+        if (!(*word & mask)) {
+            *word |= mask;
+            numActiveNotes++;
+        }
+    }
+
+    inline void unset(uint8_t channel, uint8_t note) {
+        uint32_t mask = 1UL << (note & 31);
+        uint32_t* word = &activeNotes[channel][note >> 5];
+
+        if (*word & mask) {
+            *word &= ~mask;
+            numActiveNotes--;
+        }
+    }
+
+    inline uint16_t count() {
+        return numActiveNotes;
+    }
+
+    void clearChannel(uint8_t channel) {
+        for (size_t i = 0; i < NOTE_TRACKER_WORDS_PER_CHANNEL; i++) {
+            numActiveNotes -= __builtin_popcount(activeNotes[channel][i]);
+            activeNotes[channel][i] = 0;
+        }
+    }
+
+    /**
+     * @brief Updates the active notes for a complete,
+     * non-SysEx MIDI message.
+     */
+    void handleMessage(uint8_t* message, size_t size) {
+        uint8_t status = message[0];
+
+        if (status == sig_MIDI_STATUS_SYSTEM_RESET) {
+            clear();
+            return;
+        }
+
+        if (size < 3) {
+            return;
+        }
+
+        uint8_t type = sig_MIDI_MESSAGE_TYPE(status);
+        uint8_t channel = sig_MIDI_CHANNEL(status);
+
+        if (type == sig_MIDI_STATUS_NOTE_ON && message[2] > 0) {
+            set(channel, message[1]);
+        } else if (sig_MidiParser_isNoteOff(message)) {
+            unset(channel, message[1]);
+        } else if (type == sig_MIDI_STATUS_CONTROL_CHANGE &&
+            (message[1] == MIDI_CC_ALL_NOTES_OFF ||
+            message[1] == MIDI_CC_ALL_SOUND_OFF)) {
+            clearChannel(channel);
+        }
+    }
+
+    /**
+     * @brief Sends a Note Off message for every active note,
+     * and then clears them all.
+     */
+    void flush(sig_MidiParser_MessageCallback writeNoteOff,
+        void* userData) {
+        uint8_t noteOff[3];
+
+        for (uint8_t channel = 0; channel < NOTE_TRACKER_NUM_CHANNELS;
+            channel++) {
+            noteOff[0] = sig_MIDI_CHANNEL_MESSAGE(
+                sig_MIDI_STATUS_NOTE_OFF, channel);
+
+            for (uint8_t i = 0; i < NOTE_TRACKER_WORDS_PER_CHANNEL; i++) {
+                uint32_t word = activeNotes[channel][i];
+
+                while (word != 0) {
+                    uint8_t bit = __builtin_ctz(word);
+                    word &= word - 1;
+
+                    noteOff[1] = (i << 5) | bit;
+                    noteOff[2] = 0;
+                    writeNoteOff(noteOff, 3, userData);
+                }
+
+                activeNotes[channel][i] = 0;
+            }
+        }
+
+        numActiveNotes = 0;
+    }
+};
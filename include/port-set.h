@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "memory-plan.h"
+
+/**
+ * @brief Owns a fixed set of MIDI ports of any type.
+ *
+ * A port's index is its position in the template's parameter list.
+ * Iterating over the ports is unrolled at compile time, and every call
+ * is made on a port's concrete type, so there are no virtual calls.
+ *
+ * Since GCC ignores section attributes on templates, these functions
+ * are only placed in RAM (see hot-path.h) when they are inlined into
+ * a HOT_PATH function.
+ *
+ * Each port type must provide init(), tick(), write(buffer, size),
+ * writeCapacity(now), txIdleAt(now), clockChanged(), holdTX(isHeld),
+ * a static TX_BYTE_US, a static bufferConfig() and a static
+ * ECHOES_INPUT flag, which
+ * determines whether messages read from a port are also written back
+ * out to it.
+ */
+template<typename... Ports>
+class PortSet {
+public:
+    static constexpr size_t numPorts = sizeof...(Ports);
+
+    template<size_t index>
+    using PortType = std::tuple_element_t<index, std::tuple<Ports...>>;
+
+    std::tuple<Ports...> ports;
+
+    // The total size of every port's buffers.
+    static constexpr size_t bufferSize() {
+        return (Ports::bufferConfig().totalSize() + ...);
+    }
+
+    // The number of ports of the specified type.
+    template<typename Port>
+    static constexpr size_t count() {
+        return (std::is_same_v<Port, Ports> + ...);
+    }
+
+    template<size_t index>
+    inline PortType<index>& get() {
+        return std::get<index>(ports);
+    }
+
+    /**
+     * @brief Calls fn(port, index) for every port. The index is
+     * passed as a std::integral_constant, so it can be used
+     * as a template argument or in an if constexpr.
+     */
+    template<typename Fn>
+    inline void forEach(Fn fn) {
+        forEach(fn, std::index_sequence_for<Ports...>());
+    }
+
+    /**
+     * @brief Calls fn(port, index) for the port at a runtime index.
+     * Out-of-range indices are ignored.
+     */
+    template<typename Fn>
+    inline void with(size_t index, Fn fn) {
+        with(index, fn, std::index_sequence_for<Ports...>());
+    }
+
+    void initBuffers(MemoryArena* arena) {
+        forEach([arena](auto& port, auto) {
+            port.initBuffers(arena, port.bufferConfig());
+        });
+    }
+
+    // Ports that haven't been initialized yet aren't ticked.
+    inline void tick() {
+        forEach([](auto& port, auto) {
+            if (port.isInitialized) {
+                port.tick();
+            }
+        });
+    }
+
+    // Ports that haven't been initialized yet will pick up
+    // the new clock when they are.
+    void clockChanged() {
+        forEach([](auto& port, auto) {
+            if (port.isInitialized) {
+                port.clockChanged();
+            }
+        });
+    }
+
+    void holdTX(bool isHeld) {
+        forEach([isHeld](auto& port, auto) {
+            port.holdTX(isHeld);
+        });
+    }
+
+    // Whether every port has finished sending what was written to it.
+    inline bool isTXIdle(uint32_t nowUs) {
+        bool isIdle = true;
+        forEach([nowUs, &isIdle](auto& port, auto) {
+            isIdle = isIdle && port.txIdleAt(nowUs) == nowUs;
+        });
+
+        return isIdle;
+    }
+
+    inline void write(size_t index, uint8_t* buffer,
+        size_t numBytes) {
+        with(index, [buffer, numBytes](auto& port, auto) {
+            port.write(buffer, numBytes);
+        });
+    }
+
+    inline void writeAll(uint8_t* buffer,
+        size_t numBytes) {
+        forEach([buffer, numBytes](auto& port, auto) {
+            port.write(buffer, numBytes);
+        });
+    }
+
+private:
+    template<typename Fn, size_t... indices>
+    inline void forEach(Fn& fn, std::index_sequence<indices...>) {
+        (fn(std::get<indices>(ports),
+            std::integral_constant<size_t, indices>()), ...);
+    }
+
+    template<typename Fn, size_t... indices>
+    inline void with(size_t index, Fn& fn,
+        std::index_sequence<indices...>) {
+        ((index == indices ?
+            fn(std::get<indices>(ports),
+                std::integral_constant<size_t, indices>()) :
+            (void) 0), ...);
+    }
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scoped cycle-count timers for the firmware's hot paths.
+// Probes are only compiled in when PROFILING is defined;
+// otherwise PROFILE_SCOPE expands to nothing.
+
+enum ProfileProbe {
+    PROFILE_PROBE_UART_TICK = 0,
+    PROFILE_PROBE_USB_DEVICE_TICK,
+    PROFILE_PROBE_USB_HOST_TICK,
+    PROFILE_PROBE_TUD_TASK,
+    PROFILE_PROBE_TUH_TASK,
+    PROFILE_PROBE_PARSER,
+    PROFILE_PROBE_ROUTE_MESSAGE,
+    PROFILE_PROBE_ROUTE_SYSEX,
+    PROFILE_PROBE_UART_WRITE,
+    PROFILE_PROBE_USB_DEVICE_WRITE,
+    PROFILE_PROBE_USB_HOST_WRITE,
+    NUM_PROFILE_PROBES
+};
+
+#ifdef PROFILING
+
+#if defined(PICO_ON_DEVICE) && PICO_ON_DEVICE
+#include "hardware/structs/m33.h"
+
+// Reads the Cortex-M33's DWT cycle counter.
+static inline void profilerInitCounter() {
+    m33_hw->demcr = m33_hw->demcr | M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl = m33_hw->dwt_ctrl | M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+
+static inline uint32_t profilerReadCounter() {
+    return m33_hw->dwt_cyccnt;
+}
+#elif defined(__x86_64__)
+#include <x86intrin.h>
+
+// On an x86 computer, such as when running the host tests,
+// the time stamp counter stands in for the cycle counter.
+static inline void profilerInitCounter() {}
+
+static inline uint32_t profilerReadCounter() {
+    return (uint32_t) __rdtsc();
+}
+#else
+#include <chrono>
+
+// On other computers, "cycles" are nanoseconds.
+static inline void profilerInitCounter() {}
+
+static inline uint32_t profilerReadCounter() {
+    return (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+struct ProfileProbeStats {
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+};
+
+inline ProfileProbeStats profileProbes[NUM_PROFILE_PROBES];
+
+static inline void profilerReset() {
+    for (size_t i = 0; i < NUM_PROFILE_PROBES; i++) {
+        profileProbes[i] = {0, 0, UINT32_MAX, 0};
+    }
+}
+
+static inline void profilerInit() {
+    profilerInitCounter();
+    profilerReset();
+}
+
+class ProfileScope {
+public:
+    ProfileProbe probe;
+    uint32_t startCycles;
+
+    inline ProfileScope(ProfileProbe probe) : probe(probe),
+        startCycles(profilerReadCounter()) {}
+
+    inline ~ProfileScope() {
+        uint32_t elapsed = profilerReadCounter() - startCycles;
+        ProfileProbeStats* stats = &profileProbes[probe];
+
+        stats->count++;
+        stats->totalCycles += elapsed;
+
+        if (elapsed < stats->minCycles) {
+            stats->minCycles = elapsed;
+        }
+
+        if (elapsed > stats->maxCycles) {
+            stats->maxCycles = elapsed;
+        }
+    }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(probe) \
+    ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(probe)
+
+#else
+
+#define PROFILE_SCOPE(probe)
+
+#endif
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "message-pool.h"
+
+// No real wait is ever this long, so a longer one means that the
+// microsecond timer has wrapped around since the last write.
+#define RATE_LIMITER_STALE_WAIT_US 8000000
+
+// SysEx is copied into a packet of at most this many bytes
+// before being written.
+#define SYSEX_PACER_MAX_PACKET_SIZE 128
+
+// Other messages stop waiting for the rest of a SysEx message
+// if none of it has been received for this long.
+#define SYSEX_PACER_RECEIVE_TIMEOUT_US 500000
+
+struct RateLimiterConfig {
+    // The most messages per second; 0 doesn't limit the rate.
+    uint32_t messagesPerSecond = 0;
+
+    // How many messages can be written back to back
+    // after the destination has been quiet.
+    uint8_t burst = 1;
+
+    // The least time between the end of one message
+    // and the start of the next.
+    uint32_t minGapUs = 0;
+
+    // SysEx is written in packets of this many bytes, each followed
+    // by the packet delay. 0 writes SysEx as soon as it's received.
+    uint16_t sysexPacketSize = 0;
+    uint32_t sysexPacketDelayUs = 0;
+};
+
+/**
+ * @brief Limits the rate at which messages are written to a destination,
+ * for synths that can't take back-to-back data at full speed.
+ *
+ * The rate is limited with a token bucket of burst messages, which is
+ * implemented by tracking when the bucket will next have a token.
+ * The limiter never waits itself; callers check whether a message is
+ * allowed and hold it back (see include/fair-merge.h) if not.
+ */
+class RateLimiter {
+public:
+    RateLimiterConfig config;
+    uint32_t intervalUs = 0;
+    // When the bucket would be full again if nothing else were written.
+    uint32_t fullAtUs = 0;
+    uint32_t nextAllowedUs = 0;
+    bool isWaiting = false;
+
+    uint32_t numDelayed = 0;
+
+    void init(RateLimiterConfig config = RateLimiterConfig()) {
+        this->config = config;
+        this->config.burst = config.burst > 0 ? config.burst : 1;
+        if (this->config.sysexPacketSize > SYSEX_PACER_MAX_PACKET_SIZE) {
+            this->config.sysexPacketSize = SYSEX_PACER_MAX_PACKET_SIZE;
+        }
+
+        intervalUs = config.messagesPerSecond > 0 ?
+            1000000 / config.messagesPerSecond : 0;
+        isWaiting = false;
+        numDelayed = 0;
+    }
+
+    inline bool isLimiting() {
+        return intervalUs > 0 || config.minGapUs > 0;
+    }
+
+    inline bool allows(uint32_t nowUs) {
+        return !isWaiting || isDue(nowUs, nextAllowedUs);
+    }
+
+    /**
+     * @brief Records that a message was written.
+     *
+     * @param idleUs when the destination will have finished sending it
+     */
+    inline void recordWrite(uint32_t nowUs, uint32_t idleUs) {
+        if (!isLimiting()) {
+            return;
+        }
+
+        uint32_t allowedUs = idleUs + config.minGapUs;
+
+        if (intervalUs > 0) {
+            if (isDue(nowUs, fullAtUs)) {
+                fullAtUs = nowUs;
+            }
+
+            fullAtUs += intervalUs;
+
+            // The bucket has a token as long as it's
+            // less than burst messages from being full.
+            uint32_t tokenAtUs = fullAtUs - intervalUs * config.burst;
+            if ((int32_t) (tokenAtUs - allowedUs) > 0) {
+                allowedUs = tokenAtUs;
+            }
+        }
+
+        nextAllowedUs = allowedUs;
+        isWaiting = true;
+    }
+
+    // Times that are implausibly far away are treated as having passed.
+    static inline bool isDue(uint32_t nowUs, uint32_t dueUs) {
+        int32_t waitUs = (int32_t) (dueUs - nowUs);
+        return waitUs <= 0 || waitUs > RATE_LIMITER_STALE_WAIT_US;
+    }
+};
+
+/**
+ * @brief Holds SysEx bound for a destination and writes it in packets,
+ * with a delay after each one. While SysEx is being held or is still
+ * being received, other messages must wait, so that they aren't
+ * written into the middle of it.
+ *
+ * Each chunk of SysEx is held as a chain of slots in the message pool
+ * (see include/message-pool.h), which is shared by every destination.
+ * The pacer owns one reference to each chunk it holds.
+ */
+template<size_t numChunks>
+class SysexPacer {
+public:
+    static_assert((numChunks & (numChunks - 1)) == 0 && numChunks < 256,
+        "The number of chunks must be a power of two below 256.");
+
+    uint8_t chunks[numChunks];
+    uint8_t chunkReadIdx = 0;
+    uint8_t chunkWriteIdx = 0;
+    // Where the next packet starts, within the oldest chunk.
+    uint8_t currentSlot = MESSAGE_POOL_NO_SLOT;
+    uint8_t slotOffset = 0;
+
+    bool isReceiving = false;
+    uint32_t lastReceivedUs = 0;
+    uint32_t nextPacketUs = 0;
+    bool isWaiting = false;
+
+    uint32_t numPackets = 0;
+
+    void init() {
+        chunkReadIdx = 0;
+        chunkWriteIdx = 0;
+        currentSlot = MESSAGE_POOL_NO_SLOT;
+        slotOffset = 0;
+        isReceiving = false;
+        isWaiting = false;
+        numPackets = 0;
+    }
+
+    inline size_t numChunksHeld() {
+        return (uint8_t) (chunkWriteIdx - chunkReadIdx);
+    }
+
+    inline bool isBusy(uint32_t nowUs) {
+        if (isReceiving &&
+            nowUs - lastReceivedUs > SYSEX_PACER_RECEIVE_TIMEOUT_US) {
+            isReceiving = false;
+        }
+
+        return isReceiving || numChunksHeld() > 0;
+    }
+
+    /**
+     * @brief Holds a chunk of SysEx. The caller must retain the chunk
+     * for the pacer if it's accepted. A chunk that couldn't be stored
+     * in the pool (MESSAGE_POOL_NO_SLOT) is still recorded as received.
+     *
+     * @return false if the chunk wasn't stored
+     * or too many chunks are already being held
+     */
+    inline bool push(uint8_t chunk, bool isFinal, uint32_t nowUs) {
+        isReceiving = !isFinal;
+        lastReceivedUs = nowUs;
+
+        if (chunk == MESSAGE_POOL_NO_SLOT || numChunksHeld() >= numChunks) {
+            return false;
+        }
+
+        chunks[chunkWriteIdx & (numChunks - 1)] = chunk;
+        chunkWriteIdx++;
+
+        return true;
+    }
+
+    /**
+     * @brief Writes the next packet if it's due, by calling
+     * write(packet, size), followed by idleAt(), which should return
+     * when the destination will have finished sending it. The next
+     * packet isn't due until then, plus the packet delay.
+     */
+    template<typename Pool, typename WriteFn, typename IdleAtFn>
+    inline void drain(uint32_t nowUs, RateLimiterConfig& config,
+        Pool& pool, WriteFn write, IdleAtFn idleAt) {
+        if (numChunksHeld() == 0 ||
+            (isWaiting && !RateLimiter::isDue(nowUs, nextPacketUs))) {
+            return;
+        }
+
+        size_t packetSize = config.sysexPacketSize > 0 ?
+            config.sysexPacketSize : SYSEX_PACER_MAX_PACKET_SIZE;
+        uint8_t packet[SYSEX_PACER_MAX_PACKET_SIZE];
+        size_t size = 0;
+
+        while (size < packetSize && numChunksHeld() > 0) {
+            uint8_t chunk = chunks[chunkReadIdx & (numChunks - 1)];
+            if (currentSlot == MESSAGE_POOL_NO_SLOT) {
+                currentSlot = chunk;
+                slotOffset = 0;
+            }
+
+            auto& slot = pool[currentSlot];
+            while (slotOffset < slot.size && size < packetSize) {
+                packet[size] = slot.data[slotOffset];
+                size++;
+                slotOffset++;
+            }
+
+            if (slotOffset == slot.size) {
+                currentSlot = slot.next;
+                slotOffset = 0;
+
+                if (currentSlot == MESSAGE_POOL_NO_SLOT) {
+                    pool.release(chunk);
+                    chunkReadIdx++;
+                }
+            }
+        }
+
+        if (size == 0) {
+            return;
+        }
+
+        write(packet, size);
+        numPackets++;
+
+        nextPacketUs = idleAt() + config.sysexPacketDelayUs;
+        isWaiting = true;
+    }
+};
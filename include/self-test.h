@@ -0,0 +1,242 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "load-generator.h"
+#include "loop-timer.h"
+
+struct SelfTestConfig {
+    // Bit n generates traffic as if it had been received on port n.
+    uint8_t sources = 0x01;
+    LoadGeneratorConfig load;
+
+    // The rate, in messages per second from each source, doubles on
+    // each step, until messages are dropped or the maximum is passed.
+    uint32_t startRate = 250;
+    uint32_t maxRate = 16000;
+    uint32_t stepUs = 1000000;
+
+    // After each step, the generators pause for this long,
+    // so that queued messages can drain before counting drops.
+    uint32_t settleUs = 200000;
+};
+
+/**
+ * @brief The latency of the generated notes on one route.
+ */
+struct SelfTestRouteStats {
+    uint32_t numReceived = 0;
+    uint32_t maxUs = 0;
+    // Bucket i counts latencies below 2^i microseconds
+    // (see include/loop-timer.h).
+    uint32_t buckets[LOOP_TIMER_NUM_BUCKETS] = {0};
+
+    inline void record(uint32_t latencyUs) {
+        buckets[LoopTimer::bucketFor(latencyUs)]++;
+        numReceived++;
+        if (latencyUs > maxUs) {
+            maxUs = latencyUs;
+        }
+    }
+
+    // An upper bound on the specified percentile of latency.
+    uint32_t percentileUs(uint8_t percentile) {
+        uint32_t target = ((uint64_t) numReceived * percentile + 99) / 100;
+        uint32_t count = 0;
+
+        for (uint8_t i = 0; i < LOOP_TIMER_NUM_BUCKETS; i++) {
+            count += buckets[i];
+            if (count >= target && count > 0) {
+                return i == 0 ? 1 : 1UL << i;
+            }
+        }
+
+        return maxUs;
+    }
+};
+
+enum SelfTestState {
+    SELF_TEST_IDLE = 0,
+    SELF_TEST_RUNNING,
+    SELF_TEST_SETTLING,
+    SELF_TEST_DONE
+};
+
+/**
+ * @brief Qualifies a unit by feeding it generated traffic, through the
+ * real routing and output paths, at increasing rates.
+ *
+ * Each step runs the generators at one rate, then pauses for the
+ * queues to drain, and checks whether every generated note made it out
+ * on every route. The highest rate at which none were lost is the
+ * maximum sustained throughput. Latency is measured for every note on
+ * every route, over the whole test.
+ *
+ * The test doesn't know how messages are routed, so the caller gives it
+ * a mask of the routes (bit source * numPorts + destination) that
+ * should carry each source's traffic.
+ */
+template<size_t numPorts>
+class SelfTest {
+public:
+    static_assert(numPorts * numPorts <= 32, "Routes are a 32-bit mask.");
+
+    SelfTestConfig config;
+    uint32_t routeMask = 0;
+    SelfTestState state = SELF_TEST_IDLE;
+    uint32_t rate = 0;
+    uint32_t stateStartUs = 0;
+
+    LoadGenerator generators[numPorts];
+    // The notes generated and received in the current step.
+    uint32_t stepSent[numPorts] = {0};
+    uint32_t stepReceived[numPorts][numPorts] = {{0}};
+
+    uint32_t maxSustainedRate = 0;
+    uint32_t numDropped[numPorts][numPorts] = {{0}};
+    SelfTestRouteStats routes[numPorts][numPorts];
+
+    inline bool isActive() {
+        return state == SELF_TEST_RUNNING || state == SELF_TEST_SETTLING;
+    }
+
+    void start(uint32_t nowUs, uint32_t routeMask,
+        SelfTestConfig config = SelfTestConfig()) {
+        this->config = config;
+        this->routeMask = routeMask;
+        maxSustainedRate = 0;
+
+        for (size_t source = 0; source < numPorts; source++) {
+            for (size_t destination = 0; destination < numPorts;
+                destination++) {
+                numDropped[source][destination] = 0;
+                routes[source][destination] = SelfTestRouteStats();
+            }
+        }
+
+        startStep(nowUs, config.startRate > 0 ? config.startRate : 1);
+    }
+
+    void stop() {
+        state = SELF_TEST_DONE;
+    }
+
+    /**
+     * @brief Generates whatever traffic is due, calling
+     * inject(source, message, size) and
+     * injectSysex(source, chunk, size, isFinal),
+     * and moves on to the next step when it's time.
+     */
+    template<typename InjectFn, typename InjectSysexFn>
+    void update(uint32_t nowUs, InjectFn inject,
+        InjectSysexFn injectSysex) {
+        if (state == SELF_TEST_RUNNING) {
+            for (size_t source = 0; source < numPorts; source++) {
+                if (!(config.sources & (1U << source))) {
+                    continue;
+                }
+
+                generators[source].generate(nowUs,
+                    [&](uint8_t* message, size_t size) {
+                        inject(source, message, size);
+                    },
+                    [&](uint8_t* chunk, size_t size, bool isFinal) {
+                        injectSysex(source, chunk, size, isFinal);
+                    });
+                stepSent[source] = generators[source].numNotes;
+            }
+
+            if (nowUs - stateStartUs >= config.stepUs) {
+                state = SELF_TEST_SETTLING;
+                stateStartUs = nowUs;
+            }
+        } else if (state == SELF_TEST_SETTLING &&
+            nowUs - stateStartUs >= config.settleUs) {
+            finishStep(nowUs);
+        }
+    }
+
+    /**
+     * @brief Records a message being written to a destination,
+     * and measures its latency if it's one of the generated notes.
+     */
+    inline void recordOutput(uint8_t destination, uint8_t* message,
+        size_t size, uint32_t nowUs) {
+        for (size_t source = 0; source < numPorts; source++) {
+            uint32_t latencyUs;
+            if ((config.sources & (1U << source)) &&
+                generators[source].matchNote(message, size, nowUs,
+                    &latencyUs)) {
+                stepReceived[source][destination]++;
+                routes[source][destination].record(latencyUs);
+                return;
+            }
+        }
+    }
+
+    inline bool isRouted(uint8_t source, uint8_t destination) {
+        return (config.sources & (1U << source)) &&
+            (routeMask & (1UL << (source * numPorts + destination)));
+    }
+
+private:
+    // Each source uses its own channel, so its notes can be told apart.
+    void startStep(uint32_t nowUs, uint32_t newRate) {
+        rate = newRate;
+        state = SELF_TEST_RUNNING;
+        stateStartUs = nowUs;
+
+        for (size_t source = 0; source < numPorts; source++) {
+            LoadGeneratorConfig load = config.load;
+            load.channel = (config.load.channel - source) & 0x0F;
+            load.messagesPerSecond = rate;
+            generators[source].init(nowUs, load);
+            stepSent[source] = 0;
+
+            for (size_t destination = 0; destination < numPorts;
+                destination++) {
+                stepReceived[source][destination] = 0;
+            }
+        }
+    }
+
+    void finishStep(uint32_t nowUs) {
+        bool hasDropped = false;
+
+        for (size_t source = 0; source < numPorts; source++) {
+            for (size_t destination = 0; destination < numPorts;
+                destination++) {
+                if (!isRouted(source, destination)) {
+                    continue;
+                }
+
+                uint32_t received = stepReceived[source][destination];
+                uint32_t sent = stepSent[source];
+                if (received < sent) {
+                    numDropped[source][destination] += sent - received;
+                    hasDropped = true;
+                }
+            }
+
+            if (generators[source].numSkipped > 0 &&
+                (config.sources & (1U << source))) {
+                // The loop couldn't keep up with the generator itself.
+                hasDropped = true;
+            }
+        }
+
+        if (hasDropped) {
+            state = SELF_TEST_DONE;
+            return;
+        }
+
+        maxSustainedRate = rate;
+        if (rate >= config.maxRate) {
+            state = SELF_TEST_DONE;
+            return;
+        }
+
+        startStep(nowUs, rate * 2 < config.maxRate ?
+            rate * 2 : config.maxRate);
+    }
+};
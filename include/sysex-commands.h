@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+#include "memory-plan.h"
+
+// SysEx messages addressed to the YouMe Transformer itself use
+// the non-commercial manufacturer ID, followed by a two-byte
+// device signature ("YM") and a command byte:
+//
+//     F0 7D 59 4D <command> [arguments...] F7
+#define SYSEX_MANUFACTURER_ID_NON_COMMERCIAL 0x7D
+#define SYSEX_DEVICE_SIGNATURE_0 0x59
+#define SYSEX_DEVICE_SIGNATURE_1 0x4D
+#define SYSEX_COMMAND_HEADER_SIZE 5
+
+enum SysexCommand {
+    SYSEX_COMMAND_NONE = 0x00,
+
+    // Sends Note Offs for every note that is sounding.
+    SYSEX_COMMAND_PANIC = 0x01,
+
+    // Replies with a page of statistics.
+    //     F0 7D 59 4D 02 <page> F7
+    SYSEX_COMMAND_GET_STATS = 0x02,
+
+    // Clears the profiler's probe table, the loop time histogram,
+    // and the output queue and message pool statistics.
+    SYSEX_COMMAND_RESET_TIMING = 0x03,
+
+    // Sets the delay of a route, in microseconds (three 7-bit bytes).
+    // A source and destination of 7F sets the constant latency.
+    //     F0 7D 59 4D 04 <source> <destination> <delay> F7
+    SYSEX_COMMAND_SET_ROUTE_DELAY = 0x04,
+
+    // Turns voice distribution across hosted USB devices on or off.
+    // The policy is 0 for round robin, or 1 for least recently used.
+    // If member channels is non-zero, notes are also rotated across
+    // that many MPE member channels on each device.
+    //     F0 7D 59 4D 05 <on> <policy> <member channels> F7
+    SYSEX_COMMAND_SET_VOICE_DISTRIBUTION = 0x05,
+
+    // Sets how many bytes a source may write to a destination
+    // on each round when the destination is backed up.
+    // A destination of 7F sets the weight for every destination.
+    //     F0 7D 59 4D 06 <destination> <source> <weight> F7
+    SYSEX_COMMAND_SET_MERGE_WEIGHT = 0x06,
+
+    // Limits the rate at which a destination is written to.
+    // Messages per second and the gap (in microseconds) are three
+    // 7-bit bytes, the SysEx packet size is two and the SysEx packet
+    // delay (in microseconds) is three, all least significant first.
+    // Zero turns each limit off. A destination of 7F sets every one.
+    //     F0 7D 59 4D 07 <destination> <messages per second> <burst>
+    //         <gap> <SysEx packet size> <SysEx packet delay> F7
+    SYSEX_COMMAND_SET_RATE_LIMIT = 0x07,
+
+    // Sends SysEx whose first bytes after F0 match the prefix (up to
+    // six bytes) only to the destinations in the mask (bit n is port
+    // n). Bit n of the wildcard mask lets prefix byte n match anything.
+    // An empty prefix removes the route.
+    //     F0 7D 59 4D 08 <route> <destinations> <wildcard mask>
+    //         [prefix...] F7
+    SYSEX_COMMAND_SET_SYSEX_ROUTE = 0x08,
+
+    // Starts the throughput self-test, in firmware built with SELF_TEST.
+    // Generated traffic is injected as if received on each source in the
+    // mask, and measured on the routes to the destinations in the mask.
+    // The patterns are the LOAD_PATTERN_ flags (see
+    // include/load-generator.h). Rates are messages per second, three
+    // 7-bit bytes, and the SysEx size is two. No sources stops the test.
+    //     F0 7D 59 4D 09 <sources> <destinations> <patterns>
+    //         <start rate> <max rate> <SysEx size> F7
+    SYSEX_COMMAND_SELF_TEST = 0x09,
+
+    // Replies with the recording frozen by the flight recorder, which
+    // is kept across resets, starting from the specified record (two
+    // 7-bit bytes). Records are sent a few at a time, so the command is
+    // repeated with the next record until they have all been read.
+    //     F0 7D 59 4D 0A <first record> F7
+    SYSEX_COMMAND_GET_FLIGHT_RECORDING = 0x0A,
+
+    // Discards the flight recording, so the next trigger freezes a new one.
+    SYSEX_COMMAND_CLEAR_FLIGHT_RECORDING = 0x0B
+};
+
+#define SYSEX_ALL_PORTS 0x7F
+
+// The longest command is SET_RATE_LIMIT, with 13 bytes of arguments.
+// Commands are only recognized when they arrive in a single chunk,
+// so every parser's SysEx buffer must be able to hold all of it.
+#define SYSEX_COMMAND_MAX_ARGUMENTS_SIZE 13
+#define SYSEX_COMMAND_MAX_SIZE (SYSEX_COMMAND_HEADER_SIZE + \
+    SYSEX_COMMAND_MAX_ARGUMENTS_SIZE + 1)
+
+static_assert(BOARD_CONFIG.uart.sysexBufferSize >= SYSEX_COMMAND_MAX_SIZE &&
+    BOARD_CONFIG.usbDevice.sysexBufferSize >= SYSEX_COMMAND_MAX_SIZE &&
+    BOARD_CONFIG.usbHost.sysexBufferSize >= SYSEX_COMMAND_MAX_SIZE,
+    "Every port's SysEx buffer must hold the longest SysEx command.");
+
+enum SysexStatsPage {
+    SYSEX_STATS_PAGE_BOOT = 0x00,
+    SYSEX_STATS_PAGE_PORTS = 0x01,
+    SYSEX_STATS_PAGE_CLOCK = 0x02,
+    SYSEX_STATS_PAGE_LOOPS = 0x03,
+    SYSEX_STATS_PAGE_PROFILE = 0x04,
+    SYSEX_STATS_PAGE_LOOP_TIME = 0x05,
+    SYSEX_STATS_PAGE_OUTPUT_QUEUES = 0x06,
+    SYSEX_STATS_PAGE_SYSTEM_CLOCK = 0x07,
+    SYSEX_STATS_PAGE_MERGE = 0x08,
+    SYSEX_STATS_PAGE_RATE_LIMITS = 0x09,
+    SYSEX_STATS_PAGE_MESSAGE_POOL = 0x0A,
+    SYSEX_STATS_PAGE_USB_FRAMES = 0x0B,
+    SYSEX_STATS_PAGE_ACTIVE_SENSING = 0x0C,
+    SYSEX_STATS_PAGE_CONTROLLER_CACHE = 0x0D,
+    SYSEX_STATS_PAGE_SYSEX_ROUTING = 0x0E,
+    SYSEX_STATS_PAGE_SELF_TEST = 0x0F,
+    SYSEX_STATS_PAGE_TIME_CODE = 0x10
+};
+
+#define SYSEX_REPLY_MAX_SIZE 512
+
+// Replies are written out in chunks of at most this many bytes.
+#define SYSEX_REPLY_CHUNK_SIZE 64
+
+/**
+ * @brief Determines if a SysEx chunk contains a complete
+ * command message addressed to this device.
+ *
+ * Commands are short enough to always be received in a single chunk,
+ * so chunks that don't contain a complete message are never commands.
+ *
+ * @return the command byte, or SYSEX_COMMAND_NONE
+ */
+inline uint8_t sysexCommandFor(uint8_t* sysexData, size_t size,
+    bool isFinal) {
+    if (!isFinal || size < SYSEX_COMMAND_HEADER_SIZE + 1 ||
+        sysexData[0] != sig_MIDI_STATUS_SYSEX_START ||
+        sysexData[1] != SYSEX_MANUFACTURER_ID_NON_COMMERCIAL ||
+        sysexData[2] != SYSEX_DEVICE_SIGNATURE_0 ||
+        sysexData[3] != SYSEX_DEVICE_SIGNATURE_1) {
+        return SYSEX_COMMAND_NONE;
+    }
+
+    return sysexData[4];
+}
+
+// Reads a value encoded as 7-bit bytes, least significant first.
+inline uint32_t sysexReadUInt(uint8_t* data, size_t numBytes) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < numBytes; i++) {
+        value |= (uint32_t) (data[i] & 0x7F) << (7 * i);
+    }
+
+    return value;
+}
+
+/**
+ * @brief Builds a SysEx reply to a command.
+ *
+ * Replies start with the same header as commands, followed by
+ * the command byte that is being replied to. Values are encoded
+ * as 7-bit bytes so that they are safe to send in SysEx.
+ */
+class SysexReply {
+public:
+    uint8_t buffer[SYSEX_REPLY_MAX_SIZE] = {0};
+    size_t size = 0;
+
+    void begin(uint8_t command) {
+        size = 0;
+        buffer[size++] = sig_MIDI_STATUS_SYSEX_START;
+        buffer[size++] = SYSEX_MANUFACTURER_ID_NON_COMMERCIAL;
+        buffer[size++] = SYSEX_DEVICE_SIGNATURE_0;
+        buffer[size++] = SYSEX_DEVICE_SIGNATURE_1;
+        buffer[size++] = command;
+    }
+
+    void addByte(uint8_t value) {
+        // Always leave room for the end of the message.
+        if (size < SYSEX_REPLY_MAX_SIZE - 1) {
+            buffer[size++] = value & 0x7F;
+        }
+    }
+
+    // Writes a 32-bit value as five 7-bit bytes, least significant first.
+    void addUInt32(uint32_t value) {
+        for (size_t i = 0; i < 5; i++) {
+            addByte(value & 0x7F);
+            value >>= 7;
+        }
+    }
+
+    // Writes a 64-bit value as ten 7-bit bytes, least significant first.
+    void addUInt64(uint64_t value) {
+        for (size_t i = 0; i < 10; i++) {
+            addByte(value & 0x7F);
+            value >>= 7;
+        }
+    }
+
+    void end() {
+        buffer[size++] = sig_MIDI_STATUS_SYSEX_END;
+    }
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+// Enough of the header to match a three-byte manufacturer ID and a
+// device ID, or a universal SysEx device ID and both sub-IDs.
+#define SYSEX_ROUTER_MAX_PREFIX_SIZE 6
+
+/**
+ * @brief A SysEx route: messages whose first bytes after F0 match the
+ * prefix are only sent to the destinations in the mask. Bit i of the
+ * wildcard mask lets byte i of the prefix match any value.
+ */
+struct SysexRoute {
+    uint8_t prefix[SYSEX_ROUTER_MAX_PREFIX_SIZE];
+    uint8_t prefixSize = 0;
+    uint8_t wildcardMask = 0;
+    uint8_t destinations = 0;
+};
+
+/**
+ * @brief Chooses the destinations of each SysEx message from its
+ * header (the manufacturer ID, device ID and, for universal SysEx,
+ * the sub-IDs), so that a dump meant for one synth doesn't tie up
+ * every other output.
+ *
+ * The decision is made from the first chunk of a message, which
+ * starts with F0, and is then held for each source until the message
+ * ends. Routes are checked in order and the first match wins; messages
+ * that don't match any route go everywhere. A first chunk too short
+ * to hold a route's prefix can't match that route.
+ */
+template<size_t numPorts, size_t numRoutes>
+class SysexRouter {
+public:
+    static_assert(numPorts <= 8, "Destinations are an 8-bit mask.");
+
+    static constexpr uint8_t ALL_DESTINATIONS = (1U << numPorts) - 1;
+
+    SysexRoute routes[numRoutes];
+    uint8_t currentDestinations[numPorts];
+
+    uint32_t numMatched = 0;
+    // The SysEx bytes that each destination wasn't sent.
+    uint32_t bytesSaved[numPorts] = {0};
+
+    void init() {
+        for (size_t i = 0; i < numRoutes; i++) {
+            routes[i].prefixSize = 0;
+        }
+
+        for (size_t i = 0; i < numPorts; i++) {
+            currentDestinations[i] = ALL_DESTINATIONS;
+            bytesSaved[i] = 0;
+        }
+
+        numMatched = 0;
+    }
+
+    /**
+     * @brief Sets or (with an empty prefix) removes a route.
+     */
+    void setRoute(uint8_t index, uint8_t* prefix, size_t prefixSize,
+        uint8_t wildcardMask, uint8_t destinations) {
+        if (index >= numRoutes) {
+            return;
+        }
+
+        SysexRoute* route = &routes[index];
+        route->prefixSize = prefixSize < SYSEX_ROUTER_MAX_PREFIX_SIZE ?
+            prefixSize : SYSEX_ROUTER_MAX_PREFIX_SIZE;
+        route->wildcardMask = wildcardMask;
+        route->destinations = destinations & ALL_DESTINATIONS;
+
+        for (size_t i = 0; i < route->prefixSize; i++) {
+            route->prefix[i] = prefix[i];
+        }
+    }
+
+    /**
+     * @brief Returns the destinations of a chunk of SysEx from a source,
+     * and counts the bytes that the other destinations are spared.
+     */
+    inline uint8_t route(uint8_t source, uint8_t* chunk, size_t size) {
+        if (size > 0 && chunk[0] == sig_MIDI_STATUS_SYSEX_START) {
+            currentDestinations[source] = match(chunk + 1, size - 1);
+        }
+
+        uint8_t destinations = currentDestinations[source];
+        if (destinations != ALL_DESTINATIONS) {
+            for (size_t i = 0; i < numPorts; i++) {
+                if (!(destinations & (1U << i))) {
+                    bytesSaved[i] += size;
+                }
+            }
+        }
+
+        return destinations;
+    }
+
+private:
+    inline uint8_t match(uint8_t* header, size_t size) {
+        for (size_t i = 0; i < numRoutes; i++) {
+            SysexRoute* route = &routes[i];
+            if (route->prefixSize == 0 || route->prefixSize > size) {
+                continue;
+            }
+
+            bool isMatch = true;
+            for (size_t j = 0; j < route->prefixSize && isMatch; j++) {
+                isMatch = (route->wildcardMask & (1U << j)) ||
+                    header[j] == route->prefix[j];
+            }
+
+            if (isMatch) {
+                numMatched++;
+                return route->destinations;
+            }
+        }
+
+        return ALL_DESTINATIONS;
+    }
+};
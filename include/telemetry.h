@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "board-config.h"
+#include "trace-ring.h"
+
+// Streams trace records to the host over a USB CDC interface,
+// alongside the MIDI interface. Telemetry is only compiled in when
+// TELEMETRY is defined; otherwise TRACE expands to nothing.
+
+#ifdef TELEMETRY
+#include "tusb.h"
+
+// The most records copied to the CDC FIFO at once.
+#define TELEMETRY_FLUSH_RECORDS 8
+
+inline TraceRing<BOARD_TRACE_RING_SIZE> traceRing;
+
+constexpr size_t TELEMETRY_RAM_SIZE = sizeof(traceRing) +
+    BOARD_TELEMETRY_RX_BUFSIZE + BOARD_TELEMETRY_TX_BUFSIZE;
+
+/**
+ * @brief Writes as many trace records as there is room for
+ * in the CDC interface's FIFO.
+ */
+static inline void telemetryFlush() {
+    if (!tud_cdc_connected()) {
+        // Nobody is listening, so don't hold on to stale records.
+        traceRing.clear();
+        return;
+    }
+
+    TraceRecord records[TELEMETRY_FLUSH_RECORDS];
+    size_t space = tud_cdc_write_available() / sizeof(TraceRecord);
+    bool wroteRecords = false;
+
+    while (space > 0) {
+        size_t numRecords = traceRing.pop(records,
+            space < TELEMETRY_FLUSH_RECORDS ? space : TELEMETRY_FLUSH_RECORDS);
+        if (numRecords == 0) {
+            break;
+        }
+
+        tud_cdc_write(records, numRecords * sizeof(TraceRecord));
+        space -= numRecords;
+        wroteRecords = true;
+    }
+
+    if (wroteRecords) {
+        tud_cdc_write_flush();
+    }
+}
+
+#define TRACE(type, port, timeUs, value) \
+    traceRing.push(type, port, timeUs, value)
+
+#else
+
+constexpr size_t TELEMETRY_RAM_SIZE = 0;
+
+#define TRACE(type, port, timeUs, value)
+
+#endif
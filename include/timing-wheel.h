@@ -0,0 +1,238 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMING_WHEEL_NO_ENTRY 0xFF
+
+/**
+ * @brief A queue of messages to be written at a scheduled time,
+ * implemented as a hashed timing wheel.
+ *
+ * Time is divided into ticks of 2^tickShift microseconds, and each tick
+ * maps to one of numSlots slots. Each slot holds a linked list of the
+ * messages due during that tick, in the order they were scheduled.
+ * Entries are stored in a fixed pool, so no memory is ever allocated,
+ * and each one holds only the index of its message in the message pool
+ * (see include/message-pool.h).
+ *
+ * Delays are limited to the span of the wheel (numSlots ticks), so every
+ * message in the current slot is due by the end of the current tick.
+ * This makes both scheduling and expiring a message constant time.
+ * Because each slot is written in order, a message can be up to a tick
+ * late if a message ahead of it in its slot is due after it.
+ */
+template<size_t numSlots, size_t capacity, uint8_t tickShift>
+class TimingWheel {
+public:
+    static_assert((numSlots & (numSlots - 1)) == 0,
+        "The number of slots must be a power of two.");
+    static_assert(capacity < TIMING_WHEEL_NO_ENTRY,
+        "Entries are indexed with a single byte.");
+
+    static constexpr uint32_t tickUs = 1UL << tickShift;
+    static constexpr uint32_t spanUs = numSlots << tickShift;
+
+    // The longest delay that is never brought in. The current tick may
+    // have started up to a tick ago, and may not have been expired yet.
+    static constexpr uint32_t maxDelayUs = spanUs - 2 * tickUs;
+
+    struct Entry {
+        uint32_t dueUs;
+        uint8_t next;
+        uint8_t source;
+        uint8_t message;
+    };
+
+    Entry entries[capacity];
+    uint8_t slotHeads[numSlots];
+    uint8_t slotTails[numSlots];
+    uint8_t freeList = TIMING_WHEEL_NO_ENTRY;
+    // The start of the tick that is currently being expired.
+    // Ticks are kept in microseconds so that they wrap
+    // around along with the microsecond timer.
+    uint32_t currentTickUs = 0;
+    size_t numEntries = 0;
+
+    uint32_t numScheduled = 0;
+    uint32_t numOverflows = 0;
+    uint32_t maxEntries = 0;
+    uint32_t maxLatenessUs = 0;
+
+    void init() {
+        for (size_t i = 0; i < numSlots; i++) {
+            slotHeads[i] = TIMING_WHEEL_NO_ENTRY;
+            slotTails[i] = TIMING_WHEEL_NO_ENTRY;
+        }
+
+        for (size_t i = 0; i < capacity; i++) {
+            entries[i].next = i + 1 < capacity ?
+                i + 1 : TIMING_WHEEL_NO_ENTRY;
+        }
+
+        freeList = 0;
+        currentTickUs = 0;
+        numEntries = 0;
+        resetStats();
+    }
+
+    void resetStats() {
+        numScheduled = 0;
+        numOverflows = 0;
+        maxEntries = 0;
+        maxLatenessUs = 0;
+    }
+
+    inline bool isEmpty() {
+        return numEntries == 0;
+    }
+
+    /**
+     * @brief Schedules a message from a source
+     * to be written at the specified time.
+     * Times further away than the span of the wheel are brought in
+     * to the last slot.
+     *
+     * @return false if the queue is full, in which case
+     * the caller should write the message immediately
+     */
+    inline bool schedule(uint8_t source, uint8_t message, uint32_t dueUs,
+        uint32_t nowUs) {
+        if (freeList == TIMING_WHEEL_NO_ENTRY) {
+            numOverflows++;
+            return false;
+        }
+
+        if (numEntries == 0) {
+            currentTickUs = startOfTick(nowUs);
+        }
+
+        // Ticks are compared as differences so that
+        // the microsecond timer can wrap around.
+        int32_t ticksAway =
+            (int32_t) (startOfTick(dueUs) - currentTickUs) >> tickShift;
+        if (ticksAway < 0) {
+            ticksAway = 0;
+        } else if (ticksAway >= (int32_t) numSlots) {
+            ticksAway = numSlots - 1;
+            dueUs = currentTickUs + (ticksAway << tickShift);
+        }
+
+        uint8_t idx = freeList;
+        Entry* entry = &entries[idx];
+        freeList = entry->next;
+
+        entry->dueUs = dueUs;
+        entry->next = TIMING_WHEEL_NO_ENTRY;
+        entry->source = source;
+        entry->message = message;
+
+        size_t slot = slotFor(currentTickUs + (ticksAway << tickShift));
+        if (slotTails[slot] == TIMING_WHEEL_NO_ENTRY) {
+            slotHeads[slot] = idx;
+        } else {
+            entries[slotTails[slot]].next = idx;
+        }
+        slotTails[slot] = idx;
+
+        numEntries++;
+        numScheduled++;
+        if (numEntries > maxEntries) {
+            maxEntries = numEntries;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Writes every message that has come due,
+     * by calling write(source, message, latenessUs) for each one.
+     */
+    template<typename WriteFn>
+    inline void expire(uint32_t nowUs, WriteFn write) {
+        uint32_t nowTickUs = startOfTick(nowUs);
+
+        while (numEntries > 0) {
+            size_t slot = slotFor(currentTickUs);
+
+            while (slotHeads[slot] != TIMING_WHEEL_NO_ENTRY) {
+                uint8_t idx = slotHeads[slot];
+                Entry* entry = &entries[idx];
+                uint32_t latenessUs = nowUs - entry->dueUs;
+
+                // Messages in the current tick may not be due yet.
+                if (currentTickUs == nowTickUs &&
+                    (int32_t) latenessUs < 0) {
+                    return;
+                }
+
+                slotHeads[slot] = entry->next;
+                if (slotHeads[slot] == TIMING_WHEEL_NO_ENTRY) {
+                    slotTails[slot] = TIMING_WHEEL_NO_ENTRY;
+                }
+
+                if ((int32_t) latenessUs < 0) {
+                    latenessUs = 0;
+                }
+
+                if (latenessUs > maxLatenessUs) {
+                    maxLatenessUs = latenessUs;
+                }
+
+                write(entry->source, entry->message, latenessUs);
+
+                entry->next = freeList;
+                freeList = idx;
+                numEntries--;
+            }
+
+            if (currentTickUs == nowTickUs) {
+                return;
+            }
+
+            currentTickUs += tickUs;
+        }
+    }
+
+    static inline uint32_t startOfTick(uint32_t timeUs) {
+        return timeUs & ~(tickUs - 1);
+    }
+
+    static inline size_t slotFor(uint32_t tickStartUs) {
+        return (tickStartUs >> tickShift) & (numSlots - 1);
+    }
+};
+
+/**
+ * @brief The delay added to each route. Every route is delayed by the
+ * constant latency, plus its own offset (e.g. to line up a slow synth
+ * with a faster one). Routes with no delay are written immediately.
+ */
+template<size_t numPorts>
+class RouteDelays {
+public:
+    uint32_t constantLatencyUs = 0;
+    uint32_t routeOffsetsUs[numPorts][numPorts] = {{0}};
+    // The longest delay the output queues can hold. The latency and
+    // an offset can each be up to this long, but not together.
+    uint32_t maxDelayUs = UINT32_MAX;
+
+    void init(uint32_t constantLatencyUs = 0,
+        uint32_t maxDelayUs = UINT32_MAX) {
+        this->constantLatencyUs = constantLatencyUs;
+        this->maxDelayUs = maxDelayUs;
+
+        for (size_t i = 0; i < numPorts; i++) {
+            for (size_t j = 0; j < numPorts; j++) {
+                routeOffsetsUs[i][j] = 0;
+            }
+        }
+    }
+
+    inline uint32_t delayFor(uint8_t source, uint8_t destination) {
+        uint32_t delayUs =
+            constantLatencyUs + routeOffsetsUs[source][destination];
+
+        return delayUs < maxDelayUs ? delayUs : maxDelayUs;
+    }
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Every record starts with this byte, so that a reader
+// that starts in the middle of the stream can find its place.
+#define TRACE_RECORD_SYNC 0xA5
+
+enum TraceRecordType {
+    // value: the message's first three bytes, then its size.
+    TRACE_RECORD_MESSAGE = 0x01,
+
+    // value: the total number of bytes dropped writing to the port.
+    TRACE_RECORD_DROP = 0x02,
+
+    // value: the number of messages waiting in the port's output queue.
+    TRACE_RECORD_QUEUE_DEPTH = 0x03,
+
+    // value: the longest main loop iteration since the last sample.
+    TRACE_RECORD_LOOP_TIME = 0x04,
+
+    // value: the number of records that were dropped
+    // because the trace ring was full.
+    TRACE_RECORD_OVERFLOW = 0x05,
+
+    // value: as for TRACE_RECORD_MESSAGE, written to the port.
+    TRACE_RECORD_WRITE = 0x06,
+
+    // value: 1 when the port is plugged in and 0 when it's unplugged,
+    // plus the index of the hosted device shifted left by one.
+    TRACE_RECORD_USB_MOUNT = 0x07
+};
+
+#define TRACE_NO_PORT 0x7F
+
+/**
+ * @brief A compact, fixed-size trace record.
+ * Multi-byte fields are little-endian, as they are on the RP2350.
+ */
+struct TraceRecord {
+    uint8_t sync;
+    uint8_t type;
+    uint8_t port;
+    uint8_t reserved;
+    uint32_t timeUs;
+    uint32_t value;
+};
+
+static_assert(sizeof(TraceRecord) == 12,
+    "Trace records must be packed into twelve bytes.");
+
+// Packs a message's first three bytes and its size into a record's value.
+static inline uint32_t traceMessageValue(uint8_t* message, size_t size) {
+    uint32_t value = (uint32_t) (size > 255 ? 255 : size) << 24;
+    for (size_t i = 0; i < size && i < 3; i++) {
+        value |= (uint32_t) message[i] << (8 * i);
+    }
+
+    return value;
+}
+
+/**
+ * @brief A lock-free, single-producer, single-consumer ring of trace
+ * records. Pushing never blocks: when the ring is full, records are
+ * dropped and counted, and the next record that fits reports the loss.
+ */
+template<size_t capacity>
+class TraceRing {
+public:
+    static_assert((capacity & (capacity - 1)) == 0,
+        "The capacity must be a power of two.");
+
+    TraceRecord records[capacity];
+    std::atomic<uint32_t> writeIdx{0};
+    std::atomic<uint32_t> readIdx{0};
+    uint32_t numDropped = 0;
+    uint32_t numUnreportedDrops = 0;
+
+    void init() {
+        writeIdx.store(0, std::memory_order_relaxed);
+        readIdx.store(0, std::memory_order_relaxed);
+        numDropped = 0;
+        numUnreportedDrops = 0;
+    }
+
+    inline size_t size() {
+        return writeIdx.load(std::memory_order_acquire) -
+            readIdx.load(std::memory_order_acquire);
+    }
+
+    inline bool push(uint8_t type, uint8_t port, uint32_t timeUs,
+        uint32_t value) {
+        uint32_t write = writeIdx.load(std::memory_order_relaxed);
+        uint32_t read = readIdx.load(std::memory_order_acquire);
+
+        // Keep room for the overflow record.
+        size_t needed = numUnreportedDrops > 0 ? 2 : 1;
+        if (write - read + needed > capacity) {
+            numDropped++;
+            numUnreportedDrops++;
+            return false;
+        }
+
+        if (numUnreportedDrops > 0) {
+            records[write & (capacity - 1)] = {TRACE_RECORD_SYNC,
+                TRACE_RECORD_OVERFLOW, TRACE_NO_PORT, 0, timeUs,
+                numUnreportedDrops};
+            write++;
+            numUnreportedDrops = 0;
+        }
+
+        records[write & (capacity - 1)] = {TRACE_RECORD_SYNC, type, port, 0,
+            timeUs, value};
+        writeIdx.store(write + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Discards every record. Only the consumer may call this.
+    inline void clear() {
+        readIdx.store(writeIdx.load(std::memory_order_acquire),
+            std::memory_order_release);
+    }
+
+    /**
+     * @brief Copies up to maxRecords of the oldest records
+     * into the output and removes them from the ring.
+     *
+     * @return the number of records copied
+     */
+    inline size_t pop(TraceRecord* output, size_t maxRecords) {
+        uint32_t read = readIdx.load(std::memory_order_relaxed);
+        uint32_t write = writeIdx.load(std::memory_order_acquire);
+        size_t numRecords = write - read;
+
+        if (numRecords > maxRecords) {
+            numRecords = maxRecords;
+        }
+
+        for (size_t i = 0; i < numRecords; i++) {
+            output[i] = records[(read + i) & (capacity - 1)];
+        }
+
+        readIdx.store(read + numRecords, std::memory_order_release);
+
+        return numRecords;
+    }
+};
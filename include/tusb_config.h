@@ -30,6 +30,8 @@
 extern "C" {
 #endif
 
+#include "board-config.h"
+
 //--------------------------------------------------------------------
 // COMMON CONFIGURATION
 //--------------------------------------------------------------------
@@ -88,15 +90,24 @@ extern "C" {
 #endif
 
 //------------- CLASS -------------//
+// Telemetry builds add a CDC interface for streaming trace records.
+#ifdef TELEMETRY
+#define CFG_TUD_CDC             1
+#else
 #define CFG_TUD_CDC             0
+#endif
 #define CFG_TUD_MSC             0
 #define CFG_TUD_HID             0
 #define CFG_TUD_MIDI            1
 #define CFG_TUD_VENDOR          0
 
 // MIDI FIFO size of TX and RX
-#define CFG_TUD_MIDI_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_MIDI_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
+#define CFG_TUD_MIDI_RX_BUFSIZE   BOARD_USB_DEVICE_MIDI_RX_BUFSIZE
+#define CFG_TUD_MIDI_TX_BUFSIZE   BOARD_USB_DEVICE_MIDI_TX_BUFSIZE
+
+// CDC FIFO size of TX and RX
+#define CFG_TUD_CDC_RX_BUFSIZE    BOARD_TELEMETRY_RX_BUFSIZE
+#define CFG_TUD_CDC_TX_BUFSIZE    BOARD_TELEMETRY_TX_BUFSIZE
 
 //--------------------------------------------------------------------
 // HOST CONFIGURATION
@@ -135,6 +146,10 @@ extern "C" {
 
 #define CFG_TUH_MIDI                CFG_TUH_DEVICE_MAX
 
+// MIDI FIFO size of TX and RX, for each hosted device
+#define CFG_TUH_MIDI_RX_BUFSIZE     BOARD_USB_HOST_MIDI_RX_BUFSIZE
+#define CFG_TUH_MIDI_TX_BUFSIZE     BOARD_USB_HOST_MIDI_TX_BUFSIZE
+
 #ifdef __cplusplus
 }
 #endif
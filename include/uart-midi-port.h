@@ -1,8 +1,23 @@
 #pragma once
 
+#include "hardware/uart.h"
 #include "midi_uart_lib.h"
+#include "midi_uart_lib_config.h"
 #include "midi-port.h"
 
+// The time it takes to send one byte: a start bit,
+// eight data bits and a stop bit.
+#define UART_MIDI_BYTE_US (10 * 1000000 / MIDI_UART_LIB_BAUD_RATE)
+
+// The most bytes that are allowed to wait in the UART's transmit buffer.
+// Keeping this small keeps the rest waiting in the merge queues,
+// where messages from different sources can be interleaved fairly.
+#define UART_MIDI_MAX_TX_BACKLOG 6
+
+// No real backlog is ever this long, so a longer one means that the
+// microsecond timer has wrapped around since the last write.
+#define UART_MIDI_STALE_BACKLOG_US 1000000
+
 struct UARTConfig {
     uint8_t uartNum;
     uint8_t txGPIO;
@@ -15,44 +30,108 @@ static const UARTConfig DEFAULT_UART_CONFIG = {
     .rxGPIO = 7
 };
 
-template<size_t messageBufferSize = 4,
-    size_t sysexBufferSize = 32,
-    size_t readBufferSize = 4>
-class UARTMidiPort: public MidiPort<
-    messageBufferSize, sysexBufferSize, readBufferSize> {
+class UARTMidiPort: public MidiPort {
 public:
+    // DIN MIDI ports act as a MIDI Thru.
+    static constexpr bool ECHOES_INPUT = true;
+    static constexpr uint32_t TX_BYTE_US = UART_MIDI_BYTE_US;
+
     void* midi_uart;
+    uint8_t uartNum = 0;
+    // When everything that has been written will have been sent.
+    uint32_t txIdleUs = 0;
+    // Held while the system clock is about to change, so that the
+    // transmit buffer drains first (see holdTX()).
+    bool isTXHeld = false;
+
+    static constexpr MidiPortBufferConfig bufferConfig() {
+        return BOARD_CONFIG.uart;
+    }
 
     void init(UARTConfig uartConfig = DEFAULT_UART_CONFIG,
         MidiParserConfig parserConfig = MidiParserConfig()) {
+        this->uartNum = uartConfig.uartNum;
         this->midi_uart = midi_uart_configure(
             uartConfig.uartNum, uartConfig.txGPIO, uartConfig.rxGPIO);
         this->initParser(parserConfig);
+        this->isInitialized = true;
     }
 
-    void tick() {
+    // The UART's baud rate is derived from the peripheral clock,
+    // which follows the system clock.
+    void clockChanged() {
+        uart_set_baudrate(uart_get_instance(this->uartNum),
+            MIDI_UART_LIB_BAUD_RATE);
+    }
+
+    // Changing the clock corrupts the byte that's being sent, so no
+    // more is queued behind it until the change has been made.
+    void holdTX(bool isHeld) {
+        this->isTXHeld = isHeld;
+    }
+
+    HOT_PATH(UARTMidiPort) void tick() {
+        PROFILE_SCOPE(PROFILE_PROBE_UART_TICK);
         read();
     }
 
-    inline size_t readBlock() {
+    HOT_PATH(UARTMidiPort) inline size_t readBlock() {
         return midi_uart_poll_rx_buffer(midi_uart,
-            this->readBuffer, readBufferSize);
+            this->readBuffer, this->readBufferSize);
     }
 
-    void read() {
+    HOT_PATH(UARTMidiPort) void read() {
         size_t numBytesRead = readBlock();
 
         while (numBytesRead > 0) {
-            sig_MidiParser_feedBytes(&this->midiParser,
+            feedMidiParser(&this->midiParser,
                 this->readBuffer, numBytesRead);
 
             numBytesRead = readBlock();
         }
     }
 
-    void write(uint8_t* buffer, uint32_t numBytes) {
-        uint8_t bytesWritten = midi_uart_write_tx_buffer(
-                midi_uart, buffer, numBytes);
+    HOT_PATH(UARTMidiPort) inline uint32_t txIdleAt(uint32_t nowUs) {
+        int32_t backlogUs = (int32_t) (txIdleUs - nowUs);
+
+        return backlogUs <= 0 || backlogUs > UART_MIDI_STALE_BACKLOG_US ?
+            nowUs : txIdleUs;
+    }
+
+    HOT_PATH(UARTMidiPort) inline size_t writeCapacity(uint32_t nowUs) {
+        if (isTXHeld) {
+            return 0;
+        }
+
+        uint32_t backlogUs = txIdleAt(nowUs) - nowUs;
+        size_t backlog = (backlogUs + UART_MIDI_BYTE_US - 1) /
+            UART_MIDI_BYTE_US;
+
+        return backlog < UART_MIDI_MAX_TX_BACKLOG ?
+            UART_MIDI_MAX_TX_BACKLOG - backlog : 0;
+    }
+
+    HOT_PATH(UARTMidiPort) void write(uint8_t* buffer, uint32_t numBytes) {
+        PROFILE_SCOPE(PROFILE_PROBE_UART_WRITE);
+        // The UART library takes at most 255 bytes at a time.
+        uint32_t bytesWritten = 0;
+        while (bytesWritten < numBytes) {
+            uint32_t pieceSize = numBytes - bytesWritten;
+            if (pieceSize > UINT8_MAX) {
+                pieceSize = UINT8_MAX;
+            }
+
+            uint32_t pieceWritten = midi_uart_write_tx_buffer(midi_uart,
+                &buffer[bytesWritten], pieceSize);
+            bytesWritten += pieceWritten;
+
+            if (pieceWritten < pieceSize) {
+                break;
+            }
+        }
+
+        txIdleUs = txIdleAt(time_us_32()) +
+            bytesWritten * UART_MIDI_BYTE_US;
 
         if (bytesWritten < numBytes) {
             this->numTXBytesDropped += (numBytes - bytesWritten);
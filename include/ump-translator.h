@@ -0,0 +1,569 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-parser.h"
+
+// Universal MIDI Packet message types.
+#define UMP_TYPE_UTILITY 0x0
+#define UMP_TYPE_SYSTEM 0x1
+#define UMP_TYPE_MIDI1_CHANNEL_VOICE 0x2
+#define UMP_TYPE_SYSEX7 0x3
+#define UMP_TYPE_MIDI2_CHANNEL_VOICE 0x4
+
+// SysEx7 packet status, which says where a packet is in its message.
+#define UMP_SYSEX7_COMPLETE 0x0
+#define UMP_SYSEX7_START 0x1
+#define UMP_SYSEX7_CONTINUE 0x2
+#define UMP_SYSEX7_END 0x3
+#define UMP_SYSEX7_MAX_BYTES 6
+
+// MIDI 2.0 channel voice opcodes that have MIDI 1.0 equivalents,
+// besides the ones that share MIDI 1.0's status nibbles.
+#define UMP_MIDI2_REGISTERED_CONTROLLER 0x2
+#define UMP_MIDI2_ASSIGNABLE_CONTROLLER 0x3
+#define UMP_MIDI2_PROGRAM_BANK_VALID 0x01
+
+#define UMP_MIDI_CC_DATA_ENTRY_MSB 6
+#define UMP_MIDI_CC_DATA_ENTRY_LSB 38
+#define UMP_MIDI_CC_NRPN_LSB 98
+#define UMP_MIDI_CC_NRPN_MSB 99
+#define UMP_MIDI_CC_RPN_LSB 100
+#define UMP_MIDI_CC_RPN_MSB 101
+#define UMP_MIDI_CC_BANK_SELECT_MSB 0
+#define UMP_MIDI_CC_BANK_SELECT_LSB 32
+
+// The number of 32-bit words in a packet of each message type.
+static constexpr uint8_t UMP_PACKET_WORDS[16] = {
+    1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4
+};
+
+enum class UmpProtocol {
+    // Channel voice messages are sent as MIDI 1.0 packets.
+    MIDI1,
+    // Channel voice messages are upscaled to MIDI 2.0 packets.
+    MIDI2
+};
+
+struct UmpTranslatorConfig {
+    UmpProtocol protocol = UmpProtocol::MIDI2;
+
+    // The group that byte stream messages are sent on, and the only
+    // group whose packets are translated into the byte stream.
+    uint8_t group = 0;
+};
+
+/**
+ * @brief Translates between Universal MIDI Packets and the MIDI 1.0
+ * byte stream used by the DIN ports and the parser.
+ *
+ * Packets are translated whole, a word at a time, without any byte
+ * level parsing. Values are scaled following the MIDI 2.0 translation
+ * rules: downscaling keeps the most significant bits, and upscaling
+ * uses the min-center-max algorithm, so that minimum, center and
+ * maximum values map exactly in both directions.
+ *
+ * MIDI 1.0 sends bank select, and registered and non-registered
+ * parameters, as several control changes, while MIDI 2.0 sends each as
+ * one message. The translator remembers those control changes on each
+ * channel so it can combine them. Messages without an equivalent (such
+ * as per-note controllers, or 128-bit data packets) are counted and
+ * dropped.
+ *
+ * Nothing in the firmware uses the translator yet: it's waiting for a
+ * USB MIDI 2.0 class driver, and until then it's only built by the host
+ * tests.
+ */
+class UmpTranslator {
+public:
+    UmpTranslatorConfig config;
+
+    // Byte stream to packets: the controllers that MIDI 2.0 combines.
+    uint8_t bankMSB[16] = {0};
+    uint8_t bankLSB[16] = {0};
+    uint16_t hasBank = 0;
+    uint8_t parameterMSB[16] = {0};
+    uint8_t parameterLSB[16] = {0};
+    uint8_t dataEntryMSB[16] = {0};
+    uint16_t isRegistered = 0;
+    uint16_t hasParameter = 0;
+
+    // Byte stream to packets: SysEx data that hasn't been packed yet.
+    // A packet is only sent once it's known whether it's the last.
+    uint8_t sysexBytes[UMP_SYSEX7_MAX_BYTES];
+    uint8_t sysexSize = 0;
+    bool hasSentSysexStart = false;
+
+    uint32_t numPacketsIn = 0;
+    uint32_t numPacketsOut = 0;
+    uint32_t numDropped = 0;
+
+    void init(UmpTranslatorConfig config = UmpTranslatorConfig()) {
+        this->config = config;
+        hasBank = 0;
+        isRegistered = 0;
+        hasParameter = 0;
+        sysexSize = 0;
+        hasSentSysexStart = false;
+        numPacketsIn = 0;
+        numPacketsOut = 0;
+        numDropped = 0;
+    }
+
+    static inline uint8_t packetWords(uint32_t word0) {
+        return UMP_PACKET_WORDS[word0 >> 28];
+    }
+
+    static inline uint32_t scaleDown(uint32_t value, uint8_t fromBits,
+        uint8_t toBits) {
+        return value >> (fromBits - toBits);
+    }
+
+    // The MIDI 2.0 min-center-max upscaling algorithm.
+    static inline uint32_t scaleUp(uint32_t value, uint8_t fromBits,
+        uint8_t toBits) {
+        uint8_t scaleBits = toBits - fromBits;
+        uint32_t shifted = value << scaleBits;
+        uint32_t center = 1UL << (fromBits - 1);
+
+        if (value <= center) {
+            return shifted;
+        }
+
+        // Above the center, the bits below the top one are repeated
+        // to fill the new low bits, so the maximum stays the maximum.
+        uint8_t repeatBits = fromBits - 1;
+        uint32_t repeat = value & ((1UL << repeatBits) - 1);
+        repeat = scaleBits > repeatBits ?
+            repeat << (scaleBits - repeatBits) :
+            repeat >> (repeatBits - scaleBits);
+
+        while (repeat != 0) {
+            shifted |= repeat;
+            repeat >>= repeatBits;
+        }
+
+        return shifted;
+    }
+
+    /**
+     * @brief Translates one packet into the byte stream, by calling
+     * write(bytes, size) for each message. SysEx is written in chunks,
+     * as the parser delivers it.
+     *
+     * @param words a whole packet (see packetWords())
+     */
+    template<typename WriteFn>
+    void toBytes(const uint32_t* words, WriteFn write) {
+        uint32_t word0 = words[0];
+        uint8_t type = word0 >> 28;
+        uint8_t group = (word0 >> 24) & 0x0F;
+        numPacketsIn++;
+
+        if (type == UMP_TYPE_UTILITY) {
+            return;
+        }
+
+        if (group != config.group) {
+            numDropped++;
+            return;
+        }
+
+        switch (type) {
+            case UMP_TYPE_SYSTEM:
+                systemToBytes(word0, write);
+                break;
+            case UMP_TYPE_MIDI1_CHANNEL_VOICE:
+                midi1ToBytes(word0, write);
+                break;
+            case UMP_TYPE_SYSEX7:
+                sysex7ToBytes(words, write);
+                break;
+            case UMP_TYPE_MIDI2_CHANNEL_VOICE:
+                midi2ToBytes(words, write);
+                break;
+            default:
+                numDropped++;
+                break;
+        }
+    }
+
+    /**
+     * @brief Translates a complete, non-SysEx message from the byte
+     * stream into packets, by calling write(words, numWords).
+     */
+    template<typename WriteFn>
+    void fromMessage(uint8_t* message, size_t size, WriteFn write) {
+        uint8_t status = message[0];
+        uint32_t data1 = size > 1 ? message[1] : 0;
+        uint32_t data2 = size > 2 ? message[2] : 0;
+
+        if (status >= sig_MIDI_STATUS_SYSEX_START) {
+            uint32_t word = header(UMP_TYPE_SYSTEM) | (status << 16) |
+                (data1 << 8) | data2;
+            writePacket(&word, 1, write);
+            return;
+        }
+
+        if (config.protocol == UmpProtocol::MIDI1) {
+            uint32_t word = header(UMP_TYPE_MIDI1_CHANNEL_VOICE) |
+                (status << 16) | (data1 << 8) | data2;
+            writePacket(&word, 1, write);
+            return;
+        }
+
+        messageToMidi2(status, data1, data2, write);
+    }
+
+    /**
+     * @brief Packs a chunk of SysEx from the parser (which includes the
+     * F0 and F7 bytes) into SysEx7 packets, by calling
+     * write(words, numWords).
+     */
+    template<typename WriteFn>
+    void fromSysexChunk(uint8_t* chunk, size_t size, bool isFinal,
+        WriteFn write) {
+        for (size_t i = 0; i < size; i++) {
+            if (chunk[i] == sig_MIDI_STATUS_SYSEX_START) {
+                sysexSize = 0;
+                hasSentSysexStart = false;
+                continue;
+            }
+
+            if (chunk[i] & 0x80) {
+                continue;
+            }
+
+            // A full packet is only sent once there's more data after it.
+            if (sysexSize == UMP_SYSEX7_MAX_BYTES) {
+                writeSysex7(hasSentSysexStart ?
+                    UMP_SYSEX7_CONTINUE : UMP_SYSEX7_START, write);
+                hasSentSysexStart = true;
+            }
+
+            sysexBytes[sysexSize] = chunk[i];
+            sysexSize++;
+        }
+
+        if (isFinal) {
+            writeSysex7(hasSentSysexStart ?
+                UMP_SYSEX7_END : UMP_SYSEX7_COMPLETE, write);
+            hasSentSysexStart = false;
+        }
+    }
+
+private:
+    inline uint32_t header(uint8_t type) {
+        return ((uint32_t) type << 28) | ((uint32_t) config.group << 24);
+    }
+
+    template<typename WriteFn>
+    inline void writePacket(uint32_t* words, uint8_t numWords,
+        WriteFn write) {
+        write(words, numWords);
+        numPacketsOut++;
+    }
+
+    template<typename WriteFn>
+    inline void writeSysex7(uint8_t sysexStatus, WriteFn write) {
+        uint32_t words[2] = {
+            header(UMP_TYPE_SYSEX7) | ((uint32_t) sysexStatus << 20) |
+                ((uint32_t) sysexSize << 16),
+            0
+        };
+
+        for (uint8_t i = 0; i < sysexSize; i++) {
+            // Bytes fill the packet from the third byte onwards.
+            uint8_t position = i + 2;
+            words[position >> 2] |= (uint32_t) sysexBytes[i] <<
+                (24 - 8 * (position & 3));
+        }
+
+        sysexSize = 0;
+        writePacket(words, 2, write);
+    }
+
+    template<typename WriteFn>
+    inline void writeMidi2(uint8_t opcode, uint8_t channel,
+        uint32_t index, uint32_t data, WriteFn write) {
+        uint32_t words[2] = {
+            header(UMP_TYPE_MIDI2_CHANNEL_VOICE) |
+                ((uint32_t) opcode << 20) | ((uint32_t) channel << 16) |
+                index,
+            data
+        };
+        writePacket(words, 2, write);
+    }
+
+    template<typename WriteFn>
+    void messageToMidi2(uint8_t status, uint32_t data1, uint32_t data2,
+        WriteFn write) {
+        uint8_t opcode = status >> 4;
+        uint8_t channel = status & 0x0F;
+        uint16_t channelBit = 1U << channel;
+
+        switch (status & 0xF0) {
+            case sig_MIDI_STATUS_NOTE_ON:
+                if (data2 == 0) {
+                    // Note On with a velocity of 0 is a Note Off.
+                    writeMidi2(sig_MIDI_STATUS_NOTE_OFF >> 4, channel,
+                        data1 << 8, 0, write);
+                    return;
+                }
+                [[fallthrough]];
+            case sig_MIDI_STATUS_NOTE_OFF:
+                writeMidi2(opcode, channel, data1 << 8,
+                    scaleUp(data2, 7, 16) << 16, write);
+                return;
+            case sig_MIDI_STATUS_POLY_AFTERTOUCH:
+                writeMidi2(opcode, channel, data1 << 8,
+                    scaleUp(data2, 7, 32), write);
+                return;
+            case sig_MIDI_STATUS_CONTROL_CHANGE:
+                controlChangeToMidi2(channel, data1, data2, write);
+                return;
+            case sig_MIDI_STATUS_PROGRAM_CHANGE: {
+                uint32_t flags = 0;
+                uint32_t bank = 0;
+                if (hasBank & channelBit) {
+                    flags = UMP_MIDI2_PROGRAM_BANK_VALID;
+                    bank = (bankMSB[channel] << 8) | bankLSB[channel];
+                }
+
+                writeMidi2(opcode, channel, flags, (data1 << 24) | bank,
+                    write);
+                return;
+            }
+            case sig_MIDI_STATUS_CHANNEL_AFTERTOUCH:
+                writeMidi2(opcode, channel, 0, scaleUp(data1, 7, 32),
+                    write);
+                return;
+            case sig_MIDI_STATUS_PITCH_BEND:
+                writeMidi2(opcode, channel, 0,
+                    scaleUp(data1 | (data2 << 7), 14, 32), write);
+                return;
+            default:
+                numDropped++;
+                return;
+        }
+    }
+
+    template<typename WriteFn>
+    void controlChangeToMidi2(uint8_t channel, uint32_t controller,
+        uint32_t value, WriteFn write) {
+        uint16_t channelBit = 1U << channel;
+
+        switch (controller) {
+            // Bank select is sent along with the next program change.
+            case UMP_MIDI_CC_BANK_SELECT_MSB:
+                bankMSB[channel] = value;
+                hasBank |= channelBit;
+                return;
+            case UMP_MIDI_CC_BANK_SELECT_LSB:
+                bankLSB[channel] = value;
+                hasBank |= channelBit;
+                return;
+            case UMP_MIDI_CC_RPN_MSB:
+            case UMP_MIDI_CC_NRPN_MSB:
+                parameterMSB[channel] = value;
+                selectParameter(channel,
+                    controller == UMP_MIDI_CC_RPN_MSB);
+                return;
+            case UMP_MIDI_CC_RPN_LSB:
+            case UMP_MIDI_CC_NRPN_LSB:
+                parameterLSB[channel] = value;
+                selectParameter(channel,
+                    controller == UMP_MIDI_CC_RPN_LSB);
+                return;
+            case UMP_MIDI_CC_DATA_ENTRY_MSB:
+            case UMP_MIDI_CC_DATA_ENTRY_LSB:
+                if (hasParameter & channelBit) {
+                    // The parameter is written when its MSB arrives,
+                    // and again with its full value if an LSB follows.
+                    uint32_t lsb = 0;
+                    if (controller == UMP_MIDI_CC_DATA_ENTRY_MSB) {
+                        dataEntryMSB[channel] = value;
+                    } else {
+                        lsb = value;
+                    }
+
+                    writeMidi2((isRegistered & channelBit) ?
+                        UMP_MIDI2_REGISTERED_CONTROLLER :
+                        UMP_MIDI2_ASSIGNABLE_CONTROLLER, channel,
+                        (parameterMSB[channel] << 8) |
+                            parameterLSB[channel],
+                        scaleUp((dataEntryMSB[channel] << 7) | lsb, 14, 32),
+                        write);
+                    return;
+                }
+                break;
+            default:
+                break;
+        }
+
+        writeMidi2(sig_MIDI_STATUS_CONTROL_CHANGE >> 4, channel,
+            controller << 8, scaleUp(value, 7, 32), write);
+    }
+
+    inline void selectParameter(uint8_t channel, bool isRPN) {
+        uint16_t channelBit = 1U << channel;
+
+        isRegistered = isRPN ? isRegistered | channelBit :
+            isRegistered & ~channelBit;
+        // 7F 7F is the null parameter, which deselects it.
+        hasParameter = parameterMSB[channel] == 0x7F &&
+            parameterLSB[channel] == 0x7F ?
+            hasParameter & ~channelBit : hasParameter | channelBit;
+    }
+
+    template<typename WriteFn>
+    void systemToBytes(uint32_t word0, WriteFn write) {
+        uint8_t bytes[3] = {
+            (uint8_t) (word0 >> 16),
+            (uint8_t) ((word0 >> 8) & 0x7F),
+            (uint8_t) (word0 & 0x7F)
+        };
+
+        switch (bytes[0]) {
+            case sig_MIDI_STATUS_MTC_QUARTER_FRAME:
+            case sig_MIDI_STATUS_SONG_SELECT:
+                write(bytes, 2);
+                break;
+            case sig_MIDI_STATUS_SONG_POSITION:
+                write(bytes, 3);
+                break;
+            default:
+                write(bytes, 1);
+                break;
+        }
+    }
+
+    template<typename WriteFn>
+    void midi1ToBytes(uint32_t word0, WriteFn write) {
+        uint8_t bytes[3] = {
+            (uint8_t) (word0 >> 16),
+            (uint8_t) ((word0 >> 8) & 0x7F),
+            (uint8_t) (word0 & 0x7F)
+        };
+        uint8_t type = bytes[0] & 0xF0;
+
+        write(bytes, type == sig_MIDI_STATUS_PROGRAM_CHANGE ||
+            type == sig_MIDI_STATUS_CHANNEL_AFTERTOUCH ? 2 : 3);
+    }
+
+    template<typename WriteFn>
+    void sysex7ToBytes(const uint32_t* words, WriteFn write) {
+        uint8_t sysexStatus = (words[0] >> 20) & 0x0F;
+        uint8_t numBytes = (words[0] >> 16) & 0x0F;
+        uint8_t bytes[UMP_SYSEX7_MAX_BYTES + 2];
+        uint8_t size = 0;
+
+        if (numBytes > UMP_SYSEX7_MAX_BYTES) {
+            numDropped++;
+            return;
+        }
+
+        if (sysexStatus == UMP_SYSEX7_COMPLETE ||
+            sysexStatus == UMP_SYSEX7_START) {
+            bytes[size++] = sig_MIDI_STATUS_SYSEX_START;
+        }
+
+        for (uint8_t i = 0; i < numBytes; i++) {
+            uint8_t position = i + 2;
+            bytes[size++] = (words[position >> 2] >>
+                (24 - 8 * (position & 3))) & 0x7F;
+        }
+
+        if (sysexStatus == UMP_SYSEX7_COMPLETE ||
+            sysexStatus == UMP_SYSEX7_END) {
+            bytes[size++] = sig_MIDI_STATUS_SYSEX_END;
+        }
+
+        if (size > 0) {
+            write(bytes, size);
+        }
+    }
+
+    template<typename WriteFn>
+    void midi2ToBytes(const uint32_t* words, WriteFn write) {
+        uint8_t opcode = (words[0] >> 20) & 0x0F;
+        uint8_t channel = (words[0] >> 16) & 0x0F;
+        uint8_t index = (words[0] >> 8) & 0x7F;
+        uint32_t data = words[1];
+        uint8_t bytes[3] = {(uint8_t) ((opcode << 4) | channel), index, 0};
+
+        switch (opcode << 4) {
+            case sig_MIDI_STATUS_NOTE_ON:
+                bytes[2] = scaleDown(data >> 16, 16, 7);
+                // A velocity that rounds down to 0 would be a Note Off.
+                if (bytes[2] == 0) {
+                    bytes[2] = 1;
+                }
+                write(bytes, 3);
+                return;
+            case sig_MIDI_STATUS_NOTE_OFF:
+                bytes[2] = scaleDown(data >> 16, 16, 7);
+                write(bytes, 3);
+                return;
+            case sig_MIDI_STATUS_POLY_AFTERTOUCH:
+            case sig_MIDI_STATUS_CONTROL_CHANGE:
+                bytes[2] = scaleDown(data, 32, 7);
+                write(bytes, 3);
+                return;
+            case sig_MIDI_STATUS_PROGRAM_CHANGE:
+                if (words[0] & UMP_MIDI2_PROGRAM_BANK_VALID) {
+                    writeControlChange(channel, UMP_MIDI_CC_BANK_SELECT_MSB,
+                        (data >> 8) & 0x7F, write);
+                    writeControlChange(channel, UMP_MIDI_CC_BANK_SELECT_LSB,
+                        data & 0x7F, write);
+                }
+                bytes[1] = (data >> 24) & 0x7F;
+                write(bytes, 2);
+                return;
+            case sig_MIDI_STATUS_CHANNEL_AFTERTOUCH:
+                bytes[1] = scaleDown(data, 32, 7);
+                write(bytes, 2);
+                return;
+            case sig_MIDI_STATUS_PITCH_BEND: {
+                uint32_t bend = scaleDown(data, 32, 14);
+                bytes[1] = bend & 0x7F;
+                bytes[2] = bend >> 7;
+                write(bytes, 3);
+                return;
+            }
+            default:
+                break;
+        }
+
+        if (opcode == UMP_MIDI2_REGISTERED_CONTROLLER ||
+            opcode == UMP_MIDI2_ASSIGNABLE_CONTROLLER) {
+            bool isRPN = opcode == UMP_MIDI2_REGISTERED_CONTROLLER;
+            uint32_t value = scaleDown(data, 32, 14);
+
+            writeControlChange(channel, isRPN ?
+                UMP_MIDI_CC_RPN_MSB : UMP_MIDI_CC_NRPN_MSB, index, write);
+            writeControlChange(channel, isRPN ?
+                UMP_MIDI_CC_RPN_LSB : UMP_MIDI_CC_NRPN_LSB,
+                words[0] & 0x7F, write);
+            writeControlChange(channel, UMP_MIDI_CC_DATA_ENTRY_MSB,
+                value >> 7, write);
+            writeControlChange(channel, UMP_MIDI_CC_DATA_ENTRY_LSB,
+                value & 0x7F, write);
+            return;
+        }
+
+        // Per-note and relative controllers have no MIDI 1.0 equivalent.
+        numDropped++;
+    }
+
+    template<typename WriteFn>
+    inline void writeControlChange(uint8_t channel, uint8_t controller,
+        uint8_t value, WriteFn write) {
+        uint8_t bytes[3] = {
+            (uint8_t) (sig_MIDI_STATUS_CONTROL_CHANGE | channel),
+            controller,
+            value
+        };
+        write(bytes, 3);
+    }
+};
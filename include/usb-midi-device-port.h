@@ -2,42 +2,134 @@
 
 #include "tusb.h"
 #include "midi-port.h"
+#include "frame-batcher.h"
 
-template<size_t messageBufferSize = 4,
-    size_t sysexBufferSize = 32,
-    size_t readBufferSize = 4>
-class USBMidiDevicePort: public MidiPort<
-    messageBufferSize, sysexBufferSize, readBufferSize> {
+// tud_sof_cb_enable() was added in TinyUSB 0.16. With older versions,
+// output is still batched, but once every millisecond of the
+// microsecond timer, rather than in step with the bus's frames.
+#if TUSB_VERSION_MAJOR > 0 || TUSB_VERSION_MINOR >= 16
+#define USB_DEVICE_HAS_SOF_CALLBACK 1
+#else
+#define USB_DEVICE_HAS_SOF_CALLBACK 0
+#endif
+
+class USBMidiDevicePort: public MidiPort {
 public:
+    static constexpr bool ECHOES_INPUT = false;
+
+    // When output is aligned to USB frames, everything written during
+    // a frame is held and written together just before the next one
+    // starts.
+    bool isFrameAligned = false;
+    FrameBatcher<BOARD_USB_FRAME_BATCH_SIZE> frameBatcher;
+    FrameFlushTimer frameTimer;
+
+    static constexpr MidiPortBufferConfig bufferConfig() {
+        return BOARD_CONFIG.usbDevice;
+    }
+
     void init(MidiParserConfig parserConfig = MidiParserConfig()) {
         tud_init(0);
         this->initParser(parserConfig);
+#if USB_DEVICE_HAS_SOF_CALLBACK
+        tud_sof_cb_enable(isFrameAligned);
+#endif
+        this->isInitialized = true;
+    }
+
+    void alignToFrames(bool isEnabled) {
+        frameBatcher.init();
+        frameTimer.init();
+        isFrameAligned = isEnabled;
+
+#if USB_DEVICE_HAS_SOF_CALLBACK
+        if (this->isInitialized) {
+            tud_sof_cb_enable(isEnabled);
+        }
+#endif
     }
 
-    void tick() {
-        tud_task();
+    // Invoked at every start of frame while output is aligned to frames.
+    HOT_PATH(USBMidiDevicePort) void frameStarted() {
+        uint32_t now = time_us_32();
+
+        if (frameTimer.frameStarted(now)) {
+            flushFrame(now);
+        }
+    }
+
+    HOT_PATH(USBMidiDevicePort) void tick() {
+        PROFILE_SCOPE(PROFILE_PROBE_USB_DEVICE_TICK);
+
+        {
+            PROFILE_SCOPE(PROFILE_PROBE_TUD_TASK);
+            tud_task();
+        }
+
         read();
+
+        if (isFrameAligned) {
+            flushFrameIfDue(time_us_32());
+        }
     }
 
-    void read() {
+    // Start of frame interrupts stop while the bus is suspended.
+    HOT_PATH(USBMidiDevicePort) void flushFrameIfDue(uint32_t now) {
+#if !USB_DEVICE_HAS_SOF_CALLBACK
+        if (now - frameTimer.frameStartUs >= FRAME_BATCHER_FRAME_US) {
+            frameTimer.frameStarted(now);
+        }
+#endif
+
+        if (frameTimer.isFlushDue(now) ||
+            frameBatcher.ageUs(now) > FRAME_BATCHER_MAX_AGE_US) {
+            flushFrame(now);
+        }
+    }
+
+    HOT_PATH(USBMidiDevicePort) void read() {
         size_t bytesRead = tud_midi_stream_read(this->readBuffer,
-            readBufferSize);
+            this->readBufferSize);
 
         while (bytesRead > 0) {
-            sig_MidiParser_feedBytes(&this->midiParser,
+            feedMidiParser(&this->midiParser,
                             this->readBuffer, bytesRead);
             bytesRead = tud_midi_stream_read(this->readBuffer,
-                readBufferSize);
+                this->readBufferSize);
         }
     }
 
-    void write(uint8_t* buffer, size_t numBytes) {
+    HOT_PATH(USBMidiDevicePort) void write(uint8_t* buffer, size_t numBytes) {
+        PROFILE_SCOPE(PROFILE_PROBE_USB_DEVICE_WRITE);
+
         if (!tud_midi_mounted()) {
             // Bytes that can't be written because the USB port
             // isn't mounted don't count as dropped.
             return;
         }
 
+        if (isFrameAligned && frameBatcher.add(buffer, numBytes,
+            time_us_32(), [this](uint8_t* batch, size_t size) {
+                writeNow(batch, size);
+            })) {
+            return;
+        }
+
+        writeNow(buffer, numBytes);
+    }
+
+    HOT_PATH(USBMidiDevicePort) void flushFrame(uint32_t now) {
+        frameBatcher.flush(now, [this](uint8_t* batch, size_t size) {
+            writeNow(batch, size);
+        });
+    }
+
+    HOT_PATH(USBMidiDevicePort) void writeNow(uint8_t* buffer,
+        size_t numBytes) {
+        if (!tud_midi_mounted()) {
+            return;
+        }
+
         // TODO: Handle virtual cables correctly.
         // For now, just write MIDI data to the first virtual cable.
         uint32_t bytesWritten = tud_midi_stream_write(
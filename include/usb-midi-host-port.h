@@ -3,7 +3,10 @@
 #include "pio_usb.h"
 #include "tusb.h"
 #include "class/midi/midi_host.h"
+#include "host/hcd.h"
 #include "midi-port.h"
+#include "voice-allocator.h"
+#include "frame-batcher.h"
 
 struct USBMidiHostPortCallbackState {
     uint8_t* readBuffer;
@@ -13,14 +16,30 @@ struct USBMidiHostPortCallbackState {
 
 static USBMidiHostPortCallbackState* USBMidiHostPort_stateSingleton;
 
-template<size_t messageBufferSize = 4,
-    size_t sysexBufferSize = 32,
-    size_t readBufferSize = 4>
-class USBMidiHostPort: public MidiPort<
-    messageBufferSize, sysexBufferSize, readBufferSize> {
+class USBMidiHostPort: public MidiPort {
 public:
+    static constexpr bool ECHOES_INPUT = false;
+
     USBMidiHostPortCallbackState callbackState;
 
+    // When voices are distributed, notes are spread across every
+    // hosted device; otherwise, everything goes to the first device.
+    bool isDistributingVoices = false;
+    VoiceAllocator<CFG_TUH_MIDI> voiceAllocator;
+
+    // When output is aligned to USB frames, everything written to a
+    // device during a frame is held and written just before the next
+    // one starts. The host has no start of frame callback, so the frame
+    // number is polled instead.
+    bool isFrameAligned = false;
+    uint32_t lastFrameNumber = 0;
+    FrameBatcher<BOARD_USB_FRAME_BATCH_SIZE> frameBatchers[CFG_TUH_MIDI];
+    FrameFlushTimer frameTimer;
+
+    static constexpr MidiPortBufferConfig bufferConfig() {
+        return BOARD_CONFIG.usbHost;
+    }
+
     void init(uint8_t usbDPPin,
         MidiParserConfig parserConfig = MidiParserConfig()) {
         this->initParser(parserConfig);
@@ -31,12 +50,13 @@ public:
         tuh_init(1);
 
         setupCallbackState();
+        this->isInitialized = true;
     }
 
     void setupCallbackState() {
         callbackState.midiParser = &this->midiParser;
         callbackState.readBuffer = this->readBuffer;
-        callbackState.readBufferSize = readBufferSize;
+        callbackState.readBufferSize = this->readBufferSize;
 
         USBMidiHostPort_stateSingleton = &this->callbackState;
     }
@@ -45,37 +65,148 @@ public:
         return this->readBuffer;
     }
 
-    void tick() {
-        tuh_task();
+    HOT_PATH(USBMidiHostPort) void tick() {
+        PROFILE_SCOPE(PROFILE_PROBE_USB_HOST_TICK);
+
+        {
+            PROFILE_SCOPE(PROFILE_PROBE_TUH_TASK);
+            tuh_task();
+        }
+
+        if (isFrameAligned) {
+            flushFrameIfDue();
+        }
+    }
+
+    void alignToFrames(bool isEnabled) {
+        for (auto& batcher : frameBatchers) {
+            batcher.init();
+        }
+
+        frameTimer.init();
+        isFrameAligned = isEnabled;
+    }
+
+    HOT_PATH(USBMidiHostPort) void flushFrameIfDue() {
+        uint32_t now = time_us_32();
+        uint32_t frameNumber = hcd_frame_number(1);
+        bool isFlushDue = false;
+
+        if (frameNumber != lastFrameNumber) {
+            lastFrameNumber = frameNumber;
+            isFlushDue = frameTimer.frameStarted(now);
+        }
+
+        isFlushDue = frameTimer.isFlushDue(now) || isFlushDue;
+
+        for (uint8_t i = 0; i < CFG_TUH_MIDI; i++) {
+            if (isFlushDue ||
+                frameBatchers[i].ageUs(now) > FRAME_BATCHER_MAX_AGE_US) {
+                flushFrame(i, now);
+            }
+        }
+    }
+
+    HOT_PATH(USBMidiHostPort) void flushFrame(uint8_t idx, uint32_t now) {
+        frameBatchers[idx].flush(now, [this, idx](uint8_t* batch,
+            size_t size) {
+            writeNow(idx, batch, size);
+        });
+    }
+
+    void distributeVoices(bool isEnabled,
+        VoiceAllocatorConfig config = VoiceAllocatorConfig()) {
+        voiceAllocator.init(config);
+        isDistributingVoices = isEnabled;
     }
 
-    void write(uint8_t* buffer, uint32_t numBytes) {
+    // Invoked when a hosted device is unplugged.
+    void deviceUnmounted(uint8_t idx) {
+        frameBatchers[idx].clear();
+
+        if (isDistributingVoices) {
+            voiceAllocator.releaseDevice(idx);
+        }
+    }
+
+    HOT_PATH(USBMidiHostPort) uint32_t mountedDevices() {
+        uint32_t mask = 0;
+        for (uint8_t i = 0; i < CFG_TUH_MIDI; i++) {
+            if (tuh_midi_mounted(i)) {
+                mask |= 1UL << i;
+            }
+        }
+
+        return mask;
+    }
+
+    HOT_PATH(USBMidiHostPort) void write(uint8_t* buffer, uint32_t numBytes) {
+        PROFILE_SCOPE(PROFILE_PROBE_USB_HOST_WRITE);
+
+        if (!isDistributingVoices) {
+            writeToDevice(0, buffer, numBytes);
+            return;
+        }
+
+        voiceAllocator.route(buffer, numBytes, mountedDevices(),
+            [this](uint8_t idx, uint8_t* message, size_t size) {
+                writeToDevice(idx, message, size);
+            });
+    }
+
+    HOT_PATH(USBMidiHostPort) void writeToDevice(uint8_t idx,
+        uint8_t* buffer, uint32_t numBytes) {
+        if (!tuh_midi_mounted(idx)) {
+            // As with the device port, bytes that can't be written
+            // because no device is mounted don't count as dropped.
+            return;
+        }
+
+        if (isFrameAligned && frameBatchers[idx].add(buffer, numBytes,
+            time_us_32(), [this, idx](uint8_t* batch, size_t size) {
+                writeNow(idx, batch, size);
+            })) {
+            return;
+        }
+
+        writeNow(idx, buffer, numBytes);
+    }
+
+    HOT_PATH(USBMidiHostPort) void writeNow(uint8_t idx,
+        uint8_t* buffer, uint32_t numBytes) {
+        if (!tuh_midi_mounted(idx)) {
+            return;
+        }
+
         // TODO: Handle virtual cables correctly.
-        // For now, just write MIDI data to the first device's
+        // For now, just write MIDI data to each device's
         // first virtual cable.
-        uint32_t bytesWritten = tuh_midi_stream_write(0, 0, buffer, numBytes);
+        uint32_t bytesWritten = tuh_midi_stream_write(idx, 0, buffer,
+            numBytes);
 
         if (bytesWritten < numBytes) {
             this->numTXBytesDropped += (numBytes - bytesWritten);
         }
 
-        tuh_midi_write_flush(0);
+        tuh_midi_write_flush(idx);
     }
 };
 
+HOT_PATH(readCable)
 inline void readCable(uint8_t idx, uint8_t cableNum,
     USBMidiHostPortCallbackState* state) {
     size_t bytesRead = tuh_midi_stream_read(idx, &cableNum, state->readBuffer,
         state->readBufferSize);
 
     while (bytesRead > 0) {
-        sig_MidiParser_feedBytes(state->midiParser, state->readBuffer,
+        feedMidiParser(state->midiParser, state->readBuffer,
             bytesRead);
         bytesRead = tuh_midi_stream_read(idx, &cableNum, state->readBuffer,
             state->readBufferSize);
     }
 }
 
+HOT_PATH(tuh_midi_rx_cb)
 void tuh_midi_rx_cb(uint8_t idx, uint32_t xferredBytes) {
     (void) xferredBytes;
 
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "midi-controllers.h"
+#include "midi-parser.h"
+#include "note-tracker.h"
+
+#define VOICE_ALLOCATOR_NUM_CHANNELS 16
+#define VOICE_ALLOCATOR_NUM_NOTES 128
+#define VOICE_ALLOCATOR_NO_VOICE 0xFF
+
+// In MPE-style rotation, channel-wide messages are sent on
+// the manager channel, and notes are spread across the member
+// channels that follow it.
+#define VOICE_ALLOCATOR_MPE_MANAGER_CHANNEL 0
+
+enum class VoiceAllocationPolicy {
+    // Each note goes to the next mounted device in turn.
+    ROUND_ROBIN,
+
+    // Each note goes to the device with the fewest sounding notes,
+    // or if there is a tie, the one that least recently got a note.
+    LEAST_RECENTLY_USED
+};
+
+struct VoiceAllocatorConfig {
+    VoiceAllocationPolicy policy = VoiceAllocationPolicy::ROUND_ROBIN;
+
+    // When greater than zero, notes are also rotated across this many
+    // MPE member channels on each device, starting at channel 2.
+    uint8_t numMemberChannels = 0;
+};
+
+/**
+ * @brief Distributes notes across several devices, so that a group of
+ * small synths can be played as one larger instrument.
+ *
+ * A voice is a device and an output channel. Each source channel and
+ * note maps to the voice that is playing it in a fixed table, so note
+ * lookups are constant time. Control changes, pitch bend and channel
+ * pressure go to every device holding voices for their channel.
+ * Sustain, channel mode messages and everything else go to every
+ * mounted device, so that a device that gets a voice later is already
+ * in the right state.
+ */
+template<size_t maxDevices>
+class VoiceAllocator {
+public:
+    static_assert(maxDevices < 16, "Voices are packed into a single byte.");
+
+    VoiceAllocatorConfig config;
+
+    // (device << 4) | output channel, or VOICE_ALLOCATOR_NO_VOICE.
+    uint8_t voices[VOICE_ALLOCATOR_NUM_CHANNELS][VOICE_ALLOCATOR_NUM_NOTES];
+
+    // The number of notes from each source channel held by each device.
+    uint8_t sourceVoiceCounts[VOICE_ALLOCATOR_NUM_CHANNELS][maxDevices];
+    uint16_t channelVoiceCounts[maxDevices][VOICE_ALLOCATOR_NUM_CHANNELS];
+    uint16_t deviceVoiceCounts[maxDevices];
+
+    // When each device and channel last got a note,
+    // in allocations rather than time.
+    uint32_t deviceLastUsed[maxDevices];
+    uint32_t channelLastUsed[maxDevices][VOICE_ALLOCATOR_NUM_CHANNELS];
+    uint32_t numAllocations = 0;
+    uint8_t nextDevice = 0;
+
+    void init(VoiceAllocatorConfig config = VoiceAllocatorConfig()) {
+        if (config.numMemberChannels > VOICE_ALLOCATOR_NUM_CHANNELS - 1) {
+            config.numMemberChannels = VOICE_ALLOCATOR_NUM_CHANNELS - 1;
+        }
+
+        this->config = config;
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < VOICE_ALLOCATOR_NUM_CHANNELS; i++) {
+            for (size_t j = 0; j < VOICE_ALLOCATOR_NUM_NOTES; j++) {
+                voices[i][j] = VOICE_ALLOCATOR_NO_VOICE;
+            }
+
+            for (size_t j = 0; j < maxDevices; j++) {
+                sourceVoiceCounts[i][j] = 0;
+            }
+        }
+
+        for (size_t i = 0; i < maxDevices; i++) {
+            for (size_t j = 0; j < VOICE_ALLOCATOR_NUM_CHANNELS; j++) {
+                channelVoiceCounts[i][j] = 0;
+                channelLastUsed[i][j] = 0;
+            }
+
+            deviceVoiceCounts[i] = 0;
+            deviceLastUsed[i] = 0;
+        }
+
+        numAllocations = 0;
+        nextDevice = 0;
+    }
+
+    inline bool isRotatingChannels() {
+        return config.numMemberChannels > 0;
+    }
+
+    /**
+     * @brief Forgets every voice held by a device that has been
+     * unplugged, without sending any Note Offs.
+     */
+    void releaseDevice(uint8_t device) {
+        for (uint8_t channel = 0; channel < VOICE_ALLOCATOR_NUM_CHANNELS;
+            channel++) {
+            for (uint8_t note = 0; note < VOICE_ALLOCATOR_NUM_NOTES;
+                note++) {
+                uint8_t voice = voices[channel][note];
+                if (voice != VOICE_ALLOCATOR_NO_VOICE &&
+                    voiceDevice(voice) == device) {
+                    release(channel, note);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Routes a complete message, or a SysEx chunk, by calling
+     * write(device, message, size) for each device it should go to.
+     *
+     * @param mountedDevices a bitmask of the devices that are mounted
+     */
+    template<typename WriteFn>
+    void route(uint8_t* message, size_t size, uint32_t mountedDevices,
+        WriteFn write) {
+        uint8_t status = message[0];
+
+        if (status == sig_MIDI_STATUS_SYSTEM_RESET) {
+            clear();
+        }
+
+        // SysEx chunks and system messages go to every device.
+        if (status < sig_MIDI_STATUS_NOTE_OFF ||
+            status >= sig_MIDI_STATUS_SYSEX_START || size < 2) {
+            writeToDevices(mountedDevices, message, size, write);
+            return;
+        }
+
+        uint8_t type = sig_MIDI_MESSAGE_TYPE(status);
+        uint8_t channel = sig_MIDI_CHANNEL(status);
+        uint8_t data = message[1];
+
+        switch (type) {
+            case sig_MIDI_STATUS_NOTE_ON:
+                if (size >= 3 && message[2] > 0) {
+                    noteOn(channel, message, size, mountedDevices, write);
+                    return;
+                }
+
+                noteOff(channel, message, size, mountedDevices, write);
+                return;
+            case sig_MIDI_STATUS_NOTE_OFF:
+                noteOff(channel, message, size, mountedDevices, write);
+                return;
+            case sig_MIDI_STATUS_POLY_AFTERTOUCH:
+                if (voices[channel][data] != VOICE_ALLOCATOR_NO_VOICE) {
+                    writeToVoice(voices[channel][data], message, size, write);
+                }
+                return;
+            case sig_MIDI_STATUS_CONTROL_CHANGE:
+                // Channel mode messages (120 and up) go to every device.
+                if (data == MIDI_CC_ALL_NOTES_OFF ||
+                    data == MIDI_CC_ALL_SOUND_OFF) {
+                    releaseChannel(channel);
+                    writeChannelWide(mountedDevices, message, size, write);
+                } else if (data == MIDI_CC_SUSTAIN || data >= 120) {
+                    writeChannelWide(mountedDevices, message, size, write);
+                } else {
+                    writeChannelWide(
+                        devicesHoldingVoices(channel) & mountedDevices,
+                        message, size, write);
+                }
+                return;
+            case sig_MIDI_STATUS_PITCH_BEND:
+            case sig_MIDI_STATUS_CHANNEL_AFTERTOUCH:
+                writeChannelWide(
+                    devicesHoldingVoices(channel) & mountedDevices,
+                    message, size, write);
+                return;
+            default:
+                writeChannelWide(mountedDevices, message, size, write);
+                return;
+        }
+    }
+
+    static inline uint8_t voiceDevice(uint8_t voice) {
+        return voice >> 4;
+    }
+
+    static inline uint8_t voiceChannel(uint8_t voice) {
+        return voice & 0x0F;
+    }
+
+    inline uint32_t devicesHoldingVoices(uint8_t sourceChannel) {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < maxDevices; i++) {
+            if (sourceVoiceCounts[sourceChannel][i] > 0) {
+                mask |= 1UL << i;
+            }
+        }
+
+        return mask;
+    }
+
+private:
+    template<typename WriteFn>
+    inline void noteOn(uint8_t channel, uint8_t* message, size_t size,
+        uint32_t mountedDevices, WriteFn write) {
+        uint8_t note = message[1];
+        uint8_t voice = voices[channel][note];
+
+        // A retriggered note stays on the voice that's already playing it.
+        if (voice == VOICE_ALLOCATOR_NO_VOICE) {
+            voice = allocate(channel, mountedDevices);
+            if (voice == VOICE_ALLOCATOR_NO_VOICE) {
+                return;
+            }
+
+            hold(channel, note, voice);
+        }
+
+        writeToVoice(voice, message, size, write);
+    }
+
+    template<typename WriteFn>
+    inline void noteOff(uint8_t channel, uint8_t* message, size_t size,
+        uint32_t mountedDevices, WriteFn write) {
+        uint8_t note = message[1];
+        uint8_t voice = voices[channel][note];
+
+        if (voice == VOICE_ALLOCATOR_NO_VOICE) {
+            // The note wasn't allocated (e.g. it started before
+            // distribution was turned on), so release it everywhere.
+            writeChannelWide(mountedDevices, message, size, write);
+            return;
+        }
+
+        release(channel, note);
+        writeToVoice(voice, message, size, write);
+    }
+
+    inline uint8_t allocate(uint8_t sourceChannel, uint32_t mountedDevices) {
+        uint8_t device = config.policy == VoiceAllocationPolicy::ROUND_ROBIN ?
+            nextRoundRobinDevice(mountedDevices) :
+            leastRecentlyUsedDevice(mountedDevices);
+
+        if (device >= maxDevices) {
+            return VOICE_ALLOCATOR_NO_VOICE;
+        }
+
+        uint8_t channel = isRotatingChannels() ?
+            leastRecentlyUsedMemberChannel(device) : sourceChannel;
+
+        numAllocations++;
+        deviceLastUsed[device] = numAllocations;
+        channelLastUsed[device][channel] = numAllocations;
+
+        return (device << 4) | channel;
+    }
+
+    inline uint8_t nextRoundRobinDevice(uint32_t mountedDevices) {
+        for (size_t i = 0; i < maxDevices; i++) {
+            uint8_t device = (nextDevice + i) % maxDevices;
+            if (mountedDevices & (1UL << device)) {
+                nextDevice = (device + 1) % maxDevices;
+                return device;
+            }
+        }
+
+        return maxDevices;
+    }
+
+    inline uint8_t leastRecentlyUsedDevice(uint32_t mountedDevices) {
+        uint8_t best = maxDevices;
+
+        for (uint8_t device = 0; device < maxDevices; device++) {
+            if (!(mountedDevices & (1UL << device))) {
+                continue;
+            }
+
+            if (best == maxDevices ||
+                deviceVoiceCounts[device] < deviceVoiceCounts[best] ||
+                (deviceVoiceCounts[device] == deviceVoiceCounts[best] &&
+                deviceLastUsed[device] < deviceLastUsed[best])) {
+                best = device;
+            }
+        }
+
+        return best;
+    }
+
+    inline uint8_t leastRecentlyUsedMemberChannel(uint8_t device) {
+        uint8_t first = VOICE_ALLOCATOR_MPE_MANAGER_CHANNEL + 1;
+        uint8_t best = first;
+
+        for (uint8_t channel = first;
+            channel < first + config.numMemberChannels; channel++) {
+            uint16_t count = channelVoiceCounts[device][channel];
+            uint16_t bestCount = channelVoiceCounts[device][best];
+
+            if (count < bestCount || (count == bestCount &&
+                channelLastUsed[device][channel] <
+                channelLastUsed[device][best])) {
+                best = channel;
+            }
+        }
+
+        return best;
+    }
+
+    inline void hold(uint8_t sourceChannel, uint8_t note, uint8_t voice) {
+        uint8_t device = voiceDevice(voice);
+
+        voices[sourceChannel][note] = voice;
+        sourceVoiceCounts[sourceChannel][device]++;
+        channelVoiceCounts[device][voiceChannel(voice)]++;
+        deviceVoiceCounts[device]++;
+    }
+
+    inline void release(uint8_t sourceChannel, uint8_t note) {
+        uint8_t voice = voices[sourceChannel][note];
+        uint8_t device = voiceDevice(voice);
+
+        voices[sourceChannel][note] = VOICE_ALLOCATOR_NO_VOICE;
+        sourceVoiceCounts[sourceChannel][device]--;
+        channelVoiceCounts[device][voiceChannel(voice)]--;
+        deviceVoiceCounts[device]--;
+    }
+
+    void releaseChannel(uint8_t sourceChannel) {
+        for (uint8_t note = 0; note < VOICE_ALLOCATOR_NUM_NOTES; note++) {
+            if (voices[sourceChannel][note] != VOICE_ALLOCATOR_NO_VOICE) {
+                release(sourceChannel, note);
+            }
+        }
+    }
+
+    // Writes a channel message on a voice's output channel.
+    template<typename WriteFn>
+    inline void writeToVoice(uint8_t voice, uint8_t* message, size_t size,
+        WriteFn write) {
+        uint8_t remapped[3];
+        size_t numBytes = size < 3 ? size : 3;
+
+        for (size_t i = 0; i < numBytes; i++) {
+            remapped[i] = message[i];
+        }
+
+        remapped[0] = sig_MIDI_CHANNEL_MESSAGE(
+            sig_MIDI_MESSAGE_TYPE(message[0]), voiceChannel(voice));
+        write(voiceDevice(voice), remapped, numBytes);
+    }
+
+    // Writes a channel-wide message to each of the specified devices,
+    // on the manager channel if notes are being rotated.
+    template<typename WriteFn>
+    inline void writeChannelWide(uint32_t devices, uint8_t* message,
+        size_t size, WriteFn write) {
+        if (!isRotatingChannels()) {
+            writeToDevices(devices, message, size, write);
+            return;
+        }
+
+        for (uint8_t device = 0; device < maxDevices; device++) {
+            if (devices & (1UL << device)) {
+                writeToVoice((device << 4) |
+                    VOICE_ALLOCATOR_MPE_MANAGER_CHANNEL, message, size,
+                    write);
+            }
+        }
+    }
+
+    template<typename WriteFn>
+    inline void writeToDevices(uint32_t devices, uint8_t* message,
+        size_t size, WriteFn write) {
+        for (uint8_t device = 0; device < maxDevices; device++) {
+            if (devices & (1UL << device)) {
+                write(device, message, size);
+            }
+        }
+    }
+};
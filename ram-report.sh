@@ -0,0 +1,81 @@
+#!/bin/sh
+
+# Prints the statically-allocated RAM used by each subsystem
+# of the firmware, based on the symbols in its ELF file.
+# If a budget is given, fails when the code that has been
+# placed in SRAM (see include/hot-path.h) exceeds it.
+
+if [ -z "$1" ]; then
+    echo "Error: No firmware file specified."
+    echo "Usage: $0 <firmware-file>.elf [nm] [RAM code budget in bytes]"
+    exit 1
+fi
+
+NM=${2:-arm-none-eabi-nm}
+RAM_CODE_BUDGET=${3:-0}
+
+$NM --size-sort -S -t d "$1" | awk -v ramCodeBudget="$RAM_CODE_BUDGET" '
+    # The globals in src/passthrough.cpp and include/profiler.h that hold
+    # routing state, matched whole, with the suffix LTO gives to those it
+    # makes local. The LEDs and anything else not listed count as other.
+    BEGIN {
+        routing = "^(noteTrackers|clockEngine|timeCodeEngine|bootProfile|" \
+            "sysexReply|loopDetector|loopTimer|messagePool|outputQueues|" \
+            "routeDelays|outputMerges|rateLimiters|sysexPacers|" \
+            "sysexRouter|activeSensing|usbDeviceControllers|" \
+            "usbHostControllers|usbHostReplayDevices|flightRecorder|" \
+            "flightRecording|lastFlightRecorderSampleUs|" \
+            "maxLoopUsSinceFlightRecorderSample|selfTest|clockGovernor|" \
+            "numMessagesRouted|lastNumMessagesRouted|pendingClockKHz|" \
+            "profileProbes)(\\.lto_priv\\.[0-9]+)?$"
+    }
+
+    # Code that has been copied into SRAM (0x20000000 to 0x20082000).
+    NF == 4 && $3 ~ /^[tT]$/ && $1 + 0 >= 536870912 && $1 + 0 < 537403392 {
+        totals["Code in RAM"] += $2
+        total += $2
+        ramCode += $2
+        next
+    }
+
+    # Only initialized and zeroed data live in RAM.
+    NF == 4 && $3 ~ /^[bBdD]$/ {
+        name = $4
+        size = $2 + 0
+
+        if (name ~ /^(ports|portBufferMemory|portArena)/) {
+            subsystem = "Ports"
+        } else if (name ~ /^midiLogger/) {
+            subsystem = "MIDI logger"
+        } else if (name ~ /^traceRing/) {
+            subsystem = "Telemetry"
+        } else if (name ~ /^(t[ud]h?_|_usb[dh]|usb[dh]_|_midi[dh]|midi[dh]_|_hub|hub_|_ctrl|[dh]cd_|_[dh]cd|tu_|_tusb)/) {
+            subsystem = "TinyUSB"
+        } else if (name ~ /pio_usb|^pio_port|^root_port|^usb_device|^ep_pool/) {
+            subsystem = "PIO USB"
+        } else if (name ~ /^(midi_uart|ring_buffer)/) {
+            subsystem = "MIDI UART"
+        } else if (name ~ routing) {
+            subsystem = "Routing"
+        } else {
+            subsystem = "SDK and other"
+        }
+
+        totals[subsystem] += size
+        total += size
+    }
+
+    END {
+        printf "%-16s %10s\n", "Subsystem", "RAM (bytes)"
+        for (subsystem in totals) {
+            printf "%-16s %10d\n", subsystem, totals[subsystem]
+        }
+        printf "%-16s %10d\n", "Total", total
+
+        if (ramCodeBudget > 0 && ramCode > ramCodeBudget) {
+            printf "Error: %d bytes of code in RAM exceeds the budget of %d bytes.\n",
+                ramCode, ramCodeBudget
+            exit 1
+        }
+    }
+'
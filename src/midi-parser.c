@@ -1,5 +1,7 @@
 #include "midi-parser.h"
+#include "hot-path.h"
 
+HOT_PATH(midi_parser)
 bool sig_MidiParser_isNoteOff(uint8_t* message) {
     uint8_t status = message[0];
     if (sig_MIDI_MESSAGE_TYPE(status) == sig_MIDI_STATUS_NOTE_OFF) {
@@ -69,6 +71,7 @@ void sig_MidiParser_init(struct sig_MidiParser* self,
     sig_MidiParser_reset(self);
 }
 
+HOT_PATH(midi_parser)
 uint8_t sig_MidiParser_messageDataSize(uint8_t status) {
     // Not a status byte.
     if (status < 0x80) {
@@ -97,20 +100,20 @@ uint8_t sig_MidiParser_messageDataSize(uint8_t status) {
             return 0;
         // Time Code Quarter Frame
         case 0xF1:
-            return 2;
+            return 1;
         // Song Position Pointer
         case 0xF2:
-            return 3;
+            return 2;
         // Song Select
         case 0xF3:
-            return 2;
+            return 1;
         // Reserved
         case 0xF4:
         case 0xF5:
             return 0;
         // Tune Request
         case 0xF6:
-            return 1;
+            return 0;
         // System Exclusive End
         case 0xF7:
             return 0;
@@ -136,6 +139,7 @@ uint8_t sig_MidiParser_messageDataSize(uint8_t status) {
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_startSysexMessage(
     struct sig_MidiParser* self,
     uint8_t byte) {
@@ -149,6 +153,7 @@ void sig_MidiParser_startSysexMessage(
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_endSysexMessage(
     struct sig_MidiParser* self) {
     self->isParsingSysex = 0;
@@ -158,10 +163,11 @@ void sig_MidiParser_endSysexMessage(
     self->sysexWriteIdx = 0;
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_handleSysexChunk(
     struct sig_MidiParser* self, uint8_t byte) {
     self->sysexCallback(self->sysexBuffer, self->sysexWriteIdx,
-        false, self->userData);
+        self->userData, false);
     self->sysexWriteIdx = 0;
     if (self->sysexWriteIdx < self->sysexBufferSize) {
         self->sysexBuffer[self->sysexWriteIdx] = byte;
@@ -169,6 +175,7 @@ void sig_MidiParser_handleSysexChunk(
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_handleSysexByte(
     struct sig_MidiParser* self, uint8_t byte) {
     if (self->sysexWriteIdx < self->sysexBufferSize) {
@@ -183,6 +190,7 @@ void sig_MidiParser_handleSysexByte(
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_handleNonRealtimeStatusByte(struct sig_MidiParser* self,
     uint8_t byte) {
     self->runningStatusByte = byte;
@@ -197,15 +205,24 @@ void sig_MidiParser_handleNonRealtimeStatusByte(struct sig_MidiParser* self,
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_handleCompleteMIDIMessage(struct sig_MidiParser* self) {
     self->callback(self->messageBuffer, self->msgLen, self->userData);
 
+    // System common messages cancel running status.
+    if (self->runningStatusByte >= 0xF0) {
+        self->msgLen = 0;
+        self->runningStatusByte = 0;
+        return;
+    }
+
     // Set up in case of running status.
     self->msgLen = 1;
     self->messageBuffer[0] = self->runningStatusByte;
 }
 
-inline void sig_MidiParser_feedByte(struct sig_MidiParser* self,
+HOT_PATH(midi_parser)
+void sig_MidiParser_feedByte(struct sig_MidiParser* self,
     uint8_t byte) {
     // Real-time messages (0xF8-0xFF) can occur at any time,
     // and are only single byte messages, so can be dispatched immediately.
@@ -240,7 +257,7 @@ inline void sig_MidiParser_feedByte(struct sig_MidiParser* self,
     }
 
     // Add data byte
-    if (self->msgLen < sizeof(self->messageBuffer)) {
+    if (self->msgLen < self->messageBufferSize) {
         self->messageBuffer[self->msgLen] = byte;
         self->msgLen++;
     }
@@ -250,6 +267,7 @@ inline void sig_MidiParser_feedByte(struct sig_MidiParser* self,
     }
 }
 
+HOT_PATH(midi_parser)
 void sig_MidiParser_feedBytes(struct sig_MidiParser* self,
     uint8_t* buffer, size_t len) {
     for (size_t i = 0; i < len; ++i) {
@@ -1,5 +1,6 @@
 #include "pico/stdlib.h"
 #include "hardware/clocks.h"
+#include "hardware/watchdog.h"
 #include "midi_uart_lib_config.h"
 #include "led.h"
 #include "midi-port.h"
@@ -7,6 +8,32 @@
 #include "usb-midi-device-port.h"
 #include "usb-midi-host-port.h"
 #include "midi-logger.h"
+#include "midi-clock.h"
+#include "note-tracker.h"
+#include "sysex-commands.h"
+#include "boot-profile.h"
+#include "board-config.h"
+#include "memory-plan.h"
+#include "loop-detector.h"
+#include "profiler.h"
+#include "hot-path.h"
+#include "loop-timer.h"
+#include "port-set.h"
+#include "timing-wheel.h"
+#include "telemetry.h"
+#include "clock-governor.h"
+#include "fair-merge.h"
+#include "rate-limiter.h"
+#include "message-pool.h"
+#include "active-sensing.h"
+#include "controller-cache.h"
+#include "sysex-router.h"
+#include "midi-time-code.h"
+#include "flight-recorder.h"
+
+#ifdef SELF_TEST
+#include "self-test.h"
+#endif
 
 #define CPU_CLOCK_SPEED_KHZ 240000
 
@@ -14,76 +41,1554 @@
 #define MIDI_UART_TX_GPIO 0
 #define MIDI_UART_RX_GPIO 1
 #define USB_HOST_DP_GPIO 12
-#define LOG_BUFFER_SIZE 1024 * 100
+#define NOTE_LED_UPDATE_INTERVAL_US 10000
+
+// Output queues have 256 ticks of 256 us each,
+// so routes can be delayed by up to 65 ms.
+#define OUTPUT_QUEUE_NUM_SLOTS 256
+#define OUTPUT_QUEUE_TICK_SHIFT 8
+
+#define TELEMETRY_SAMPLE_INTERVAL_US 10000
+
+// How often the longest loop iteration and the queue depths
+// are recorded in the flight recorder.
+#define FLIGHT_RECORDER_SAMPLE_INTERVAL_US 1000
+
+// The most flight recorder records sent in each reply.
+#define FLIGHT_RECORDING_RECORDS_PER_REPLY 32
+
+// PIO-USB's timing is set up for the highest frequency.
+// The others have only been validated with the UART and USB device ports.
+#define CLOCK_GOVERNOR_NUM_FREQUENCIES 3
+
+// The order of the ports must match the order of the MidiPorts types.
+enum PortIndex {
+    UART_PORT = 0,
+    UART_2_PORT,
+    USB_DEVICE_PORT,
+    USB_HOST_PORT
+};
+
+typedef PortSet<UARTMidiPort, UARTMidiPort, USBMidiDevicePort,
+    USBMidiHostPort> MidiPorts;
+
+constexpr size_t NUM_PORTS = MidiPorts::numPorts;
+
+static_assert(MidiPorts::count<UARTMidiPort>() == BOARD_CONFIG.numUARTs,
+    "BOARD_CONFIG.numUARTs doesn't match the number of UART ports.");
+static_assert(MidiPorts::bufferSize() == BOARD_CONFIG.portBufferSize(),
+    "The ports' buffers don't match BOARD_CONFIG.");
+static_assert(BOARD_CONFIG.numHostedDevices == CFG_TUH_MIDI,
+    "BOARD_CONFIG.numHostedDevices doesn't match CFG_TUH_MIDI.");
+
+// Every port's buffers are allocated from this arena.
+uint8_t portBufferMemory[MidiPorts::bufferSize()];
+MemoryArena portArena;
 
 LED mainLED;
 LED noteLED;
-UARTMidiPort uartMidiPort;
-USBMidiDevicePort usbDevice;
-USBMidiHostPort usbHost;
+MidiPorts ports;
+MidiClockEngine<NUM_PORTS> clockEngine;
+MidiTimeCodeEngine<NUM_PORTS> timeCodeEngine;
+
+// The notes each source has turned on.
+NoteTracker noteTrackers[NUM_PORTS];
+uint32_t lastNoteLEDUpdateUs = 0;
+
+BootProfile bootProfile;
+SysexReply sysexReply;
+LoopDetector<NUM_PORTS> loopDetector;
+LoopTimer loopTimer;
+
+// Every queue holds the index of its messages in this pool,
+// so each message is only copied once, however many destinations
+// it's queued for.
+typedef MessagePool<BOARD_MESSAGE_POOL_SIZE,
+    BOARD_MESSAGE_POOL_SLOT_SIZE> OutputMessagePool;
+OutputMessagePool messagePool;
+
+static_assert(BOARD_MESSAGE_POOL_SLOT_SIZE >= 3,
+    "Every channel message must fit in a single slot.");
+
+// Messages on delayed routes wait in their destination's queue.
+typedef TimingWheel<OUTPUT_QUEUE_NUM_SLOTS, BOARD_OUTPUT_QUEUE_SIZE,
+    OUTPUT_QUEUE_TICK_SHIFT> OutputQueue;
+OutputQueue outputQueues[NUM_PORTS];
+RouteDelays<NUM_PORTS> routeDelays;
+
+static_assert(BOARD_OUTPUT_LATENCY_US <= OutputQueue::maxDelayUs,
+    "BOARD_OUTPUT_LATENCY_US is longer than the output queues can hold.");
+
+// Messages wait in their destination's merge stage
+// while the destination is backed up.
+typedef FairMerge<NUM_PORTS, BOARD_MERGE_QUEUE_SIZE> OutputMerge;
+OutputMerge outputMerges[NUM_PORTS];
+
+// Fragile destinations can be paced.
+RateLimiter rateLimiters[NUM_PORTS];
+typedef SysexPacer<BOARD_SYSEX_PACER_CHUNKS> OutputSysexPacer;
+OutputSysexPacer sysexPacers[NUM_PORTS];
+
+// SysEx is only sent to the destinations its header is routed to.
+typedef SysexRouter<NUM_PORTS, BOARD_SYSEX_ROUTES> OutputSysexRouter;
+OutputSysexRouter sysexRouter;
+
+// Active sensing ends at each port, and is regenerated on outputs.
+ActiveSensing<NUM_PORTS> activeSensing;
+
+// The controller state sent to each USB port, which is replayed to
+// the computer or a hosted device when it's plugged in.
+typedef ControllerCache<BOARD_CONTROLLER_CACHE_SIZE> OutputControllerCache;
+OutputControllerCache usbDeviceControllers;
+OutputControllerCache usbHostControllers;
+// The hosted devices that are being replayed to.
+uint32_t usbHostReplayDevices = 0;
+
+// The most recent events, and the recording frozen from them when
+// something was slow, are both kept in RAM that survives a reset.
+FlightRecorder<BOARD_FLIGHT_RECORDER_SIZE> __uninitialized_ram(flightRecorder);
+FlightRecording<BOARD_FLIGHT_RECORDER_SIZE>
+    __uninitialized_ram(flightRecording);
+uint32_t lastFlightRecorderSampleUs = 0;
+uint32_t maxLoopUsSinceFlightRecorderSample = 0;
+
+#if BOARD_LOG_BUFFER_SIZE > 0
+MIDILogger<BOARD_LOG_BUFFER_SIZE> midiLogger;
+#endif
+
+// A throughput self-test injects generated traffic as if it had been
+// received, and measures it as it's written out.
+#ifdef SELF_TEST
+SelfTest<NUM_PORTS> selfTest;
+constexpr size_t SELF_TEST_RAM_SIZE = sizeof(selfTest);
+#else
+constexpr size_t SELF_TEST_RAM_SIZE = 0;
+#endif
+
+#ifdef CLOCK_GOVERNOR
+const uint32_t CLOCK_GOVERNOR_FREQUENCIES_KHZ[
+    CLOCK_GOVERNOR_NUM_FREQUENCIES] = {CPU_CLOCK_SPEED_KHZ, 120000, 48000};
+ClockGovernor<CLOCK_GOVERNOR_NUM_FREQUENCIES> clockGovernor;
+uint32_t numMessagesRouted = 0;
+uint32_t lastNumMessagesRouted = 0;
+// A frequency the governor has chosen, waiting for the UARTs to
+// finish sending, or 0.
+uint32_t pendingClockKHz = 0;
+#endif
+
+static_assert(BOARD_CONFIG.totalSize() + sizeof(noteTrackers) +
+    sizeof(clockEngine) + sizeof(timeCodeEngine) + sizeof(loopDetector) +
+    sizeof(outputQueues) + sizeof(routeDelays) + sizeof(outputMerges) +
+    sizeof(rateLimiters) + sizeof(sysexPacers) + sizeof(messagePool) +
+    sizeof(ports) +
+    sizeof(activeSensing) + sizeof(usbDeviceControllers) +
+    sizeof(usbHostControllers) + sizeof(sysexRouter) +
+    sizeof(flightRecorder) + sizeof(flightRecording) +
+    TELEMETRY_RAM_SIZE + SELF_TEST_RAM_SIZE <=
+    BOARD_CONFIG.ramBudget,
+    "The routing state and planned buffers exceed BOARD_RAM_BUDGET.");
+
+bool isTransportMessage(uint8_t status) {
+    return status == sig_MIDI_STATUS_START ||
+        status == sig_MIDI_STATUS_CONTINUE ||
+        status == sig_MIDI_STATUS_STOP ||
+        status == sig_MIDI_STATUS_SONG_POSITION;
+}
+
+// Returns true if a clock or transport message from the specified
+// source should be dropped, either because another source is the
+// clock master or because the clock will be regenerated.
+HOT_PATH(routing)
+bool filterClockMessage(PortIndex source, uint8_t* message, uint32_t now) {
+    if (message[0] == sig_MIDI_STATUS_TIMING_CLOCK) {
+        return !clockEngine.acceptClock(source, now);
+    }
+
+    if (isTransportMessage(message[0])) {
+        return !clockEngine.acceptTransport(source);
+    }
+
+    return false;
+}
+
+// Real-time messages and time code repeat constantly, so they
+// aren't used for detecting feedback loops.
+HOT_PATH(routing)
+uint32_t loopDetectionHash(uint8_t* message, size_t size) {
+    return message[0] >= sig_MIDI_STATUS_TIMING_CLOCK ||
+        message[0] == sig_MIDI_STATUS_MTC_QUARTER_FRAME ?
+        0 : LoopDetector<NUM_PORTS>::hash(message, size);
+}
+
+// A message being routed. It's only copied into
+// the message pool the first time it needs to be queued.
+struct RoutedMessage {
+    uint8_t* bytes;
+    size_t size;
+    uint8_t slot = MESSAGE_POOL_NO_SLOT;
+};
+
+// Returns a new reference to the message's slot for a queue to hold,
+// or MESSAGE_POOL_NO_SLOT if the pool is exhausted.
+HOT_PATH(routing)
+uint8_t retainMessage(RoutedMessage& message) {
+    if (message.slot == MESSAGE_POOL_NO_SLOT) {
+        // This first reference belongs to whoever is routing the
+        // message, and is released once routing is done.
+        message.slot = messagePool.allocate(message.bytes, message.size);
+        if (message.slot == MESSAGE_POOL_NO_SLOT) {
+            return MESSAGE_POOL_NO_SLOT;
+        }
+    }
+
+    messagePool.retain(message.slot);
+
+    return message.slot;
+}
+
+HOT_PATH(routing)
+void releaseMessage(RoutedMessage& message) {
+    if (message.slot != MESSAGE_POOL_NO_SLOT) {
+        messagePool.release(message.slot);
+    }
+}
+
+template<typename Port>
+__force_inline void writeLimited(uint8_t destination, Port& port,
+    uint8_t* message, size_t size, uint32_t now) {
+    port.write(message, size);
+    rateLimiters[destination].recordWrite(now, port.txIdleAt(now));
+    activeSensing.recordWritten(destination, now);
+    flightRecorder.record(TRACE_RECORD_WRITE, destination, now,
+        traceMessageValue(message, size));
+
+#ifdef SELF_TEST
+    if (selfTest.isActive()) {
+        selfTest.recordOutput(destination, message, size, now);
+    }
+#endif
+}
+
+// Holds a chunk of SysEx in a destination's pacer,
+// which writes it out in packets (see writePacedSysex()).
+template<typename Port>
+__force_inline void holdSysexChunk(uint8_t destination, Port& port,
+    RoutedMessage& chunk, bool isFinal, uint32_t now) {
+    uint8_t slot = retainMessage(chunk);
+    if (!sysexPacers[destination].push(slot, isFinal, now)) {
+        if (slot != MESSAGE_POOL_NO_SLOT) {
+            messagePool.release(slot);
+        }
 
-void handleLEDStateForMIDIMessage(uint8_t* message) {
-    // Light up the LED when notes are on.
-    if (sig_MIDI_MESSAGE_TYPE(message[0]) == sig_MIDI_STATUS_NOTE_ON &&
-        message[2] > 0) {
-        noteLED.on();
-    } else if (sig_MidiParser_isNoteOff(message)) {
-        noteLED.off();
+        port.numTXBytesDropped += chunk.size;
     }
 }
 
-void writeMessageFromUART(uint8_t* message, size_t size,
-    void* userData) {
-    (void) userData;
+// SysEx goes straight out to destinations that don't pace it.
+template<typename Port>
+__force_inline void writeSysexChunk(uint8_t destination, Port& port,
+    RoutedMessage& chunk, bool isFinal, uint32_t now) {
+    if (rateLimiters[destination].config.sysexPacketSize == 0 &&
+        !sysexPacers[destination].isBusy(now)) {
+        port.write(chunk.bytes, chunk.size);
+        activeSensing.recordWritten(destination, now);
+        return;
+    }
+
+    holdSysexChunk(destination, port, chunk, isFinal, now);
+}
+
+// Writes a message to a destination right away if it has room and
+// isn't being paced, or otherwise merges it in fairly with the other
+// sources. Messages also wait while SysEx is being paced out.
+template<typename Port>
+__force_inline void writeMerged(uint8_t source, uint8_t destination,
+    Port& port, RoutedMessage& message, uint32_t now) {
+    OutputMerge& merge = outputMerges[destination];
+    RateLimiter& limiter = rateLimiters[destination];
+    bool isAllowed = limiter.allows(now);
+
+    if (!isAllowed) {
+        limiter.numDelayed++;
+    }
+
+    if (merge.isEmpty() && isAllowed &&
+        !sysexPacers[destination].isBusy(now) &&
+        port.writeCapacity(now) >= message.size) {
+        writeLimited(destination, port, message.bytes, message.size, now);
+        return;
+    }
+
+    uint8_t slot = retainMessage(message);
+    if (slot == MESSAGE_POOL_NO_SLOT) {
+        port.numTXBytesDropped += message.size;
+    } else if (!merge.enqueue(source, slot, message.bytes[0], message.size,
+        now)) {
+        messagePool.release(slot);
+        port.numTXBytesDropped += message.size;
+    }
+}
+
+// Only the USB ports can be plugged in again
+// with their state lost, so only they have caches.
+HOT_PATH(routing)
+void cacheControllers(uint8_t destination, uint8_t* message, size_t size) {
+    if (destination == USB_DEVICE_PORT) {
+        usbDeviceControllers.handleMessage(message, size);
+    } else if (destination == USB_HOST_PORT) {
+        usbHostControllers.handleMessage(message, size);
+    }
+}
+
+// Writes a message to a destination, unless the route
+// has been muted because it's part of a feedback loop.
+// Messages on delayed routes are queued, unless the queue is full.
+template<typename Port>
+__force_inline void writeToRoute(uint8_t source, uint8_t destination,
+    Port& port, RoutedMessage& message, uint32_t messageHash,
+    uint32_t now) {
+    if (loopDetector.isMuted(source, destination, now)) {
+        return;
+    }
 
-    handleLEDStateForMIDIMessage(message);
+    cacheControllers(destination, message.bytes, message.size);
 
-    // Write to all output ports.
-    uartMidiPort.write(message, size);
-    usbDevice.write(message, size);
-    usbHost.write(message, size);
+    if (messageHash != 0) {
+        loopDetector.recordSent(source, destination, messageHash, now);
+    }
+
+    uint32_t delayUs = routeDelays.delayFor(source, destination);
+    if (delayUs > 0) {
+        uint8_t slot = retainMessage(message);
+        if (slot != MESSAGE_POOL_NO_SLOT) {
+            if (outputQueues[destination].schedule(source, slot,
+                now + delayUs, now)) {
+                return;
+            }
+
+            messagePool.release(slot);
+        }
+    }
+
+    writeMerged(source, destination, port, message, now);
 }
 
-void writeMessageFromUSBDevice(uint8_t* message, size_t size,
-    void* userData) {
-    (void) userData;
+// Writes a message to every port except the one it came from,
+// unless that port echoes its input (as DIN MIDI ports do).
+template<size_t source>
+__force_inline void writeToDestinations(uint8_t* message, size_t size,
+    uint32_t messageHash, uint32_t now) {
+    RoutedMessage routed = {message, size};
 
-    handleLEDStateForMIDIMessage(message);
+    ports.forEach([&](auto& port, auto destination) {
+        if constexpr (destination != source ||
+            MidiPorts::PortType<source>::ECHOES_INPUT) {
+            writeToRoute(source, destination, port, routed, messageHash,
+                now);
+        }
+    });
 
-    // Only write to the UART and USB host port;
-    // don't echo the message back to the USB device port.
-    uartMidiPort.write(message, size);
-    usbHost.write(message, size);
+    releaseMessage(routed);
 }
 
-void writeMessageFromUSBHost(uint8_t* message, size_t size,
-    void* userData) {
-    (void) userData;
+// Sends a full frame with the time code master's new position to every
+// output, but doesn't echo it back to a USB port the time code is
+// coming from.
+void writeFullFrame(uint32_t now) {
+    uint8_t message[MTC_FULL_FRAME_SIZE];
+    timeCodeEngine.locatedPosition().writeFullFrame(message);
+
+    RoutedMessage fullFrame = {message, sizeof(message)};
+    uint8_t master = timeCodeEngine.masterSource;
 
-    handleLEDStateForMIDIMessage(message);
+    ports.forEach([&](auto& port, auto destination) {
+        if (port.ECHOES_INPUT || destination != master) {
+            writeSysexChunk(destination, port, fullFrame, true, now);
+        }
+    });
 
-    // Only write to the UART and USB device port;
-    // don't echo the message back to the USB host port.
-    uartMidiPort.write(message, size);
-    usbDevice.write(message, size);
+    releaseMessage(fullFrame);
 }
 
-void onSysexChunk(uint8_t* sysexData, size_t size, void* userData,
+// Returns true if a quarter frame from the specified source should be
+// dropped, either because another source is the time code master or
+// because the time code will be regenerated.
+HOT_PATH(routing)
+bool filterTimeCode(PortIndex source, uint8_t* message, size_t size,
+    uint32_t now) {
+    if (message[0] != sig_MIDI_STATUS_MTC_QUARTER_FRAME || size < 2) {
+        return false;
+    }
+
+    bool hasLocated;
+    bool isForwarded = timeCodeEngine.acceptQuarterFrame(source, message[1],
+        now, &hasLocated);
+
+    if (hasLocated) {
+        writeFullFrame(now);
+    }
+
+    return !isForwarded;
+}
+
+template<size_t source>
+__force_inline void routeMessageFrom(uint8_t* message, size_t size) {
+    uint32_t now = time_us_32();
+
+    if (!bootProfile.hasCompleted(BOOT_PHASE_FIRST_MESSAGE)) {
+        bootProfile.mark(BOOT_PHASE_FIRST_MESSAGE, now);
+    }
+
+    if (activeSensing.handleReceived(source, message[0], now)) {
+        return;
+    }
+
+    if (filterClockMessage((PortIndex) source, message, now) ||
+        filterTimeCode((PortIndex) source, message, size, now)) {
+        return;
+    }
+
+#ifdef CLOCK_GOVERNOR
+    numMessagesRouted++;
+#endif
+
+    uint32_t messageHash = loopDetectionHash(message, size);
+    if (messageHash != 0) {
+        loopDetector.checkReceived(source, messageHash, now);
+    }
+
+    TRACE(TRACE_RECORD_MESSAGE, source, now,
+        traceMessageValue(message, size));
+    flightRecorder.record(TRACE_RECORD_MESSAGE, source, now,
+        traceMessageValue(message, size));
+    noteTrackers[source].handleMessage(message, size);
+    writeToDestinations<source>(message, size, messageHash, now);
+
+#if BOARD_LOG_BUFFER_SIZE > 0
+    midiLogger.write(message, size);
+#endif
+}
+
+// Every port's parser calls this, with the port's index as its user data.
+// The routing for each source is unrolled at compile time and
+// inlined here, because GCC ignores section attributes on templates.
+HOT_PATH(routing)
+void writeMessageFromPort(uint8_t* message, size_t size, void* userData) {
+    PROFILE_SCOPE(PROFILE_PROBE_ROUTE_MESSAGE);
+    PortIndex source = (PortIndex) (uintptr_t) userData;
+
+    ports.with(source, [&](auto&, auto sourceIndex) {
+        routeMessageFrom<sourceIndex>(message, size);
+    });
+}
+
+void writeFlushedNoteOff(uint8_t* message, size_t size, void* userData) {
+    PortIndex source = (PortIndex) (uintptr_t) userData;
+    uint32_t messageHash = loopDetectionHash(message, size);
+    uint32_t now = time_us_32();
+
+    ports.with(source, [&](auto&, auto sourceIndex) {
+        writeToDestinations<sourceIndex>(message, size, messageHash, now);
+    });
+}
+
+// Sends Note Offs for every note that the specified source
+// left sounding on its destinations.
+void flushNotesFromSource(PortIndex source) {
+    noteTrackers[source].flush(writeFlushedNoteOff,
+        (void*) (uintptr_t) source);
+}
+
+void flushAllNotes() {
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        flushNotesFromSource((PortIndex) i);
+    }
+}
+
+void addBootStats(SysexReply* reply) {
+    for (uint8_t i = 0; i < NUM_BOOT_PHASES; i++) {
+        reply->addUInt32(bootProfile.phaseCompletedUs[i]);
+    }
+}
+
+void addPortStats(SysexReply* reply) {
+    ports.forEach([reply](auto& port, auto) {
+        reply->addUInt32(port.numTXBytesDropped);
+    });
+}
+
+void addClockStats(SysexReply* reply) {
+    MidiClockJitterStats* jitterStats[] = {
+        &clockEngine.inputJitter,
+        &clockEngine.outputJitter
+    };
+
+    reply->addByte(clockEngine.masterSource);
+    reply->addUInt32(clockEngine.periodUs());
+    reply->addUInt32(clockEngine.numDroppedTicks);
+
+    for (MidiClockJitterStats* stats : jitterStats) {
+        reply->addUInt32(stats->numIntervals);
+        reply->addUInt32(stats->minIntervalUs);
+        reply->addUInt32(stats->maxIntervalUs);
+        reply->addUInt32(stats->maxDeviationUs);
+        reply->addUInt32(stats->meanDeviationQ4);
+    }
+}
+
+void addTimeCodeStats(SysexReply* reply) {
+    MidiTimeCode position;
+    if (timeCodeEngine.masterSource != MTC_NO_SOURCE) {
+        position = timeCodeEngine.locatedPosition();
+    }
+
+    reply->addByte(timeCodeEngine.masterSource);
+    reply->addByte(position.rate);
+    reply->addByte(position.hours);
+    reply->addByte(position.minutes);
+    reply->addByte(position.seconds);
+    reply->addByte(position.frames);
+    reply->addUInt32(timeCodeEngine.periodUs());
+    reply->addUInt32(timeCodeEngine.numDroppedQuarterFrames);
+    reply->addUInt32(timeCodeEngine.numRegenerated);
+
+    for (MidiTimeCodeSource& source : timeCodeEngine.sources) {
+        reply->addUInt32(source.numQuarterFrames);
+        reply->addUInt32(source.numLocates);
+    }
+}
+
+void addLoopStats(SysexReply* reply) {
+    reply->addUInt32(loopDetector.numLoopsDetected);
+    reply->addUInt32(loopDetector.numMutedMessages);
+    reply->addUInt32(loopDetector.mutedRoutes());
+}
+
+// Probes are only included when the firmware is built with PROFILING.
+void addProfileStats(SysexReply* reply) {
+#ifdef PROFILING
+    reply->addUInt32(clock_get_hz(clk_sys));
+    reply->addByte(NUM_PROFILE_PROBES);
+
+    for (uint8_t i = 0; i < NUM_PROFILE_PROBES; i++) {
+        reply->addUInt32(profileProbes[i].count);
+        reply->addUInt64(profileProbes[i].totalCycles);
+        reply->addUInt32(profileProbes[i].minCycles);
+        reply->addUInt32(profileProbes[i].maxCycles);
+    }
+#else
+    reply->addUInt32(clock_get_hz(clk_sys));
+    reply->addByte(0);
+#endif
+}
+
+void addOutputQueueStats(SysexReply* reply) {
+    reply->addUInt32(routeDelays.constantLatencyUs);
+
+    for (OutputQueue& queue : outputQueues) {
+        reply->addUInt32(queue.numScheduled);
+        reply->addUInt32(queue.numOverflows);
+        reply->addUInt32(queue.maxEntries);
+        reply->addUInt32(queue.maxLatenessUs);
+    }
+}
+
+void addLoopTimeStats(SysexReply* reply) {
+    reply->addUInt32(loopTimer.numIterations);
+    reply->addUInt32(loopTimer.maxUs);
+    reply->addUInt64(loopTimer.totalUs);
+    reply->addByte(LOOP_TIMER_NUM_BUCKETS);
+
+    for (uint8_t i = 0; i < LOOP_TIMER_NUM_BUCKETS; i++) {
+        reply->addUInt32(loopTimer.buckets[i]);
+    }
+}
+
+// The frequencies are only included when the
+// firmware is built with CLOCK_GOVERNOR.
+void addSystemClockStats(SysexReply* reply) {
+    reply->addUInt32(clock_get_hz(clk_sys));
+#ifdef CLOCK_GOVERNOR
+    reply->addUInt32(clockGovernor.numChanges);
+    reply->addByte(CLOCK_GOVERNOR_NUM_FREQUENCIES);
+
+    for (uint8_t i = 0; i < CLOCK_GOVERNOR_NUM_FREQUENCIES; i++) {
+        reply->addUInt32(CLOCK_GOVERNOR_FREQUENCIES_KHZ[i]);
+        reply->addUInt32(clockGovernor.levelTimeMs[i]);
+    }
+#else
+    reply->addUInt32(0);
+    reply->addByte(0);
+#endif
+}
+
+// Each source's counters are combined across every destination.
+void addMergeStats(SysexReply* reply) {
+    for (uint8_t source = 0; source < NUM_PORTS; source++) {
+        FairMergeSourceStats combined;
+
+        for (OutputMerge& merge : outputMerges) {
+            FairMergeSourceStats& stats = merge.stats[source];
+            combined.numQueued += stats.numQueued;
+            combined.numDropped += stats.numDropped;
+            combined.totalDelayUs += stats.totalDelayUs;
+            if (stats.maxDelayUs > combined.maxDelayUs) {
+                combined.maxDelayUs = stats.maxDelayUs;
+            }
+        }
+
+        reply->addUInt32(combined.numQueued);
+        reply->addUInt32(combined.numDropped);
+        reply->addUInt32(combined.maxDelayUs);
+        reply->addUInt32(combined.numQueued == 0 ? 0 :
+            combined.totalDelayUs / combined.numQueued);
+    }
+}
+
+void addRateLimitStats(SysexReply* reply) {
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        reply->addUInt32(rateLimiters[i].numDelayed);
+        reply->addUInt32(sysexPacers[i].numPackets);
+    }
+}
+
+void addMessagePoolStats(SysexReply* reply) {
+    reply->addUInt32(BOARD_MESSAGE_POOL_SIZE);
+    reply->addUInt32(BOARD_MESSAGE_POOL_SLOT_SIZE);
+    reply->addUInt32(messagePool.numInUse);
+    reply->addUInt32(messagePool.maxInUse);
+    reply->addUInt32(messagePool.numExhausted);
+}
+
+void resetUSBFrameStats() {
+    ports.get<USB_DEVICE_PORT>().frameBatcher.resetStats();
+
+    for (auto& batcher : ports.get<USB_HOST_PORT>().frameBatchers) {
+        batcher.resetStats();
+    }
+}
+
+// The host port's counters are combined across every hosted device.
+void addUSBFrameStats(SysexReply* reply) {
+    FrameBatcherStats stats[] = {
+        ports.get<USB_DEVICE_PORT>().frameBatcher.stats,
+        FrameBatcherStats()
+    };
+
+    for (auto& batcher : ports.get<USB_HOST_PORT>().frameBatchers) {
+        stats[1].add(batcher.stats);
+    }
+
+    for (FrameBatcherStats& portStats : stats) {
+        reply->addUInt32(portStats.numFrames);
+        reply->addUInt32(portStats.numMessages);
+        reply->addUInt32(portStats.maxDelayUs);
+        reply->addUInt32(portStats.numMessages == 0 ? 0 :
+            portStats.totalDelayUs / portStats.numMessages);
+    }
+}
+
+void addActiveSensingStats(SysexReply* reply) {
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        reply->addByte(activeSensing.isSensing[i]);
+        reply->addUInt32(activeSensing.numAbsorbed[i]);
+        reply->addUInt32(activeSensing.numTimeouts[i]);
+        reply->addUInt32(activeSensing.numRegenerated[i]);
+    }
+}
+
+void addControllerCacheStats(SysexReply* reply) {
+    OutputControllerCache* caches[] = {
+        &usbDeviceControllers, &usbHostControllers
+    };
+
+    for (OutputControllerCache* cache : caches) {
+        reply->addUInt32(cache->count());
+        reply->addUInt32(cache->numReplays);
+        reply->addUInt32(cache->numReplayed);
+        reply->addUInt32(cache->lastReplayDurationUs);
+        reply->addUInt32(cache->numDropped);
+    }
+}
+
+void addSysexRoutingStats(SysexReply* reply) {
+    reply->addUInt32(sysexRouter.numMatched);
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        reply->addUInt32(sysexRouter.bytesSaved[i]);
+    }
+}
+
+// The self-test is only included when the firmware is built with SELF_TEST.
+void addSelfTestStats(SysexReply* reply) {
+#ifdef SELF_TEST
+    reply->addByte(selfTest.state);
+    reply->addUInt32(selfTest.maxSustainedRate);
+    reply->addUInt32(selfTest.rate);
+
+    uint8_t numRoutes = 0;
+    for (uint8_t source = 0; source < NUM_PORTS; source++) {
+        for (uint8_t destination = 0; destination < NUM_PORTS;
+            destination++) {
+            numRoutes += selfTest.isRouted(source, destination);
+        }
+    }
+
+    reply->addByte(numRoutes);
+
+    for (uint8_t source = 0; source < NUM_PORTS; source++) {
+        for (uint8_t destination = 0; destination < NUM_PORTS;
+            destination++) {
+            if (!selfTest.isRouted(source, destination)) {
+                continue;
+            }
+
+            SelfTestRouteStats& route = selfTest.routes[source][destination];
+            reply->addByte(source);
+            reply->addByte(destination);
+            reply->addUInt32(route.numReceived);
+            reply->addUInt32(selfTest.numDropped[source][destination]);
+            reply->addUInt32(route.percentileUs(50));
+            reply->addUInt32(route.percentileUs(99));
+            reply->addUInt32(route.maxUs);
+        }
+    }
+#else
+    (void) reply;
+#endif
+}
+
+// Replies can be longer than a UART's transmit buffer, so they're held
+// in the destination's SysEx pacer, which writes each packet once the
+// last one has been sent, and holds other messages back until then.
+void writeSysexReply(PortIndex destination) {
+    static_assert((SYSEX_REPLY_MAX_SIZE + SYSEX_REPLY_CHUNK_SIZE - 1) /
+        SYSEX_REPLY_CHUNK_SIZE <= BOARD_SYSEX_PACER_CHUNKS,
+        "A whole reply must fit in a SysEx pacer.");
+
+    uint32_t now = time_us_32();
+
+    ports.with(destination, [&](auto& port, auto index) {
+        for (size_t offset = 0; offset < sysexReply.size;
+            offset += SYSEX_REPLY_CHUNK_SIZE) {
+            size_t size = sysexReply.size - offset;
+            if (size > SYSEX_REPLY_CHUNK_SIZE) {
+                size = SYSEX_REPLY_CHUNK_SIZE;
+            }
+
+            RoutedMessage chunk = {&sysexReply.buffer[offset], size};
+            holdSysexChunk(index, port, chunk,
+                offset + size == sysexReply.size, now);
+            releaseMessage(chunk);
+        }
+    });
+}
+
+void writeStats(PortIndex destination, uint8_t page) {
+    sysexReply.begin(SYSEX_COMMAND_GET_STATS);
+    sysexReply.addByte(page);
+
+    switch (page) {
+        case SYSEX_STATS_PAGE_BOOT:
+            addBootStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_PORTS:
+            addPortStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_CLOCK:
+            addClockStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_LOOPS:
+            addLoopStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_PROFILE:
+            addProfileStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_LOOP_TIME:
+            addLoopTimeStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_OUTPUT_QUEUES:
+            addOutputQueueStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_SYSTEM_CLOCK:
+            addSystemClockStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_MERGE:
+            addMergeStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_RATE_LIMITS:
+            addRateLimitStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_MESSAGE_POOL:
+            addMessagePoolStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_USB_FRAMES:
+            addUSBFrameStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_ACTIVE_SENSING:
+            addActiveSensingStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_CONTROLLER_CACHE:
+            addControllerCacheStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_SYSEX_ROUTING:
+            addSysexRoutingStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_SELF_TEST:
+            addSelfTestStats(&sysexReply);
+            break;
+        case SYSEX_STATS_PAGE_TIME_CODE:
+            addTimeCodeStats(&sysexReply);
+            break;
+        default:
+            break;
+    }
+
+    sysexReply.end();
+    writeSysexReply(destination);
+}
+
+// Regenerated clock and time code are held back by the constant
+// latency along with everything else, so they stay lined up with the
+// notes. They're written to every output at once, so route offsets
+// don't apply to them. SysEx is never delayed (see README.md).
+void setConstantLatency(uint32_t latencyUs) {
+    routeDelays.constantLatencyUs = latencyUs;
+    clockEngine.config.outputDelayUs =
+        MidiClockConfig().outputDelayUs + latencyUs;
+    timeCodeEngine.config.outputDelayUs =
+        MidiTimeCodeConfig().outputDelayUs + latencyUs;
+}
+
+void setRouteDelay(uint8_t* arguments, size_t size) {
+    if (size < 5) {
+        return;
+    }
+
+    uint8_t source = arguments[0];
+    uint8_t destination = arguments[1];
+    uint32_t delayUs = sysexReadUInt(&arguments[2], 3);
+
+    if (delayUs > OutputQueue::maxDelayUs) {
+        delayUs = OutputQueue::maxDelayUs;
+    }
+
+    if (source == SYSEX_ALL_PORTS && destination == SYSEX_ALL_PORTS) {
+        setConstantLatency(delayUs);
+    } else if (source < NUM_PORTS && destination < NUM_PORTS) {
+        routeDelays.routeOffsetsUs[source][destination] = delayUs;
+    }
+}
+
+void setVoiceDistribution(uint8_t* arguments, size_t size) {
+    if (size < 3) {
+        return;
+    }
+
+    VoiceAllocatorConfig config = {
+        .policy = arguments[1] == 1 ?
+            VoiceAllocationPolicy::LEAST_RECENTLY_USED :
+            VoiceAllocationPolicy::ROUND_ROBIN,
+        .numMemberChannels = arguments[2]
+    };
+
+    ports.get<USB_HOST_PORT>().distributeVoices(arguments[0] != 0, config);
+}
+
+void setMergeWeight(uint8_t* arguments, size_t size) {
+    if (size < 3) {
+        return;
+    }
+
+    uint8_t destination = arguments[0];
+    uint8_t source = arguments[1];
+    uint8_t weight = arguments[2];
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        if (destination == SYSEX_ALL_PORTS || destination == i) {
+            outputMerges[i].setWeight(source, weight);
+        }
+    }
+}
+
+void setRateLimit(uint8_t* arguments, size_t size) {
+    if (size < SYSEX_COMMAND_MAX_ARGUMENTS_SIZE) {
+        return;
+    }
+
+    uint8_t destination = arguments[0];
+    RateLimiterConfig config = {
+        .messagesPerSecond = sysexReadUInt(&arguments[1], 3),
+        .burst = arguments[4],
+        .minGapUs = sysexReadUInt(&arguments[5], 3),
+        .sysexPacketSize = (uint16_t) sysexReadUInt(&arguments[8], 2),
+        .sysexPacketDelayUs = sysexReadUInt(&arguments[10], 3)
+    };
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        if (destination == SYSEX_ALL_PORTS || destination == i) {
+            rateLimiters[i].init(config);
+        }
+    }
+}
+
+void setSysexRoute(uint8_t* arguments, size_t size) {
+    if (size < 3) {
+        return;
+    }
+
+    sysexRouter.setRoute(arguments[0], &arguments[3], size - 3,
+        arguments[2], arguments[1]);
+}
+
+#ifdef SELF_TEST
+// Generated traffic is sent to the routes from each source to the
+// destinations in the mask, as long as a port's input would be.
+uint32_t selfTestRouteMask(uint8_t destinations) {
+    uint32_t routeMask = 0;
+
+    ports.forEach([&](auto&, auto source) {
+        ports.forEach([&](auto&, auto destination) {
+            if ((destination != source ||
+                MidiPorts::PortType<source>::ECHOES_INPUT) &&
+                (destinations & (1U << destination))) {
+                routeMask |= 1UL << (source * NUM_PORTS + destination);
+            }
+        });
+    });
+
+    return routeMask;
+}
+
+void startSelfTest(uint8_t* arguments, size_t size) {
+    if (size < 11) {
+        return;
+    }
+
+    if (arguments[0] == 0) {
+        selfTest.stop();
+        return;
+    }
+
+    SelfTestConfig config;
+    config.sources = arguments[0];
+    config.load.patterns = arguments[2];
+    config.startRate = sysexReadUInt(&arguments[3], 3);
+    config.maxRate = sysexReadUInt(&arguments[6], 3);
+    config.load.sysexSize = (uint16_t) sysexReadUInt(&arguments[9], 2);
+
+    selfTest.start(time_us_32(), selfTestRouteMask(arguments[1]), config);
+}
+#endif
+
+// Replies with the frozen flight recording's trigger, and as many of
+// its records as fit, starting from the specified one.
+void writeFlightRecording(PortIndex destination, uint32_t firstRecord) {
+    bool isValid = flightRecording.isValid();
+    uint32_t numRecords = isValid ? flightRecording.numRecords : 0;
+    uint32_t numReplyRecords = numRecords > firstRecord ?
+        numRecords - firstRecord : 0;
+    if (numReplyRecords > FLIGHT_RECORDING_RECORDS_PER_REPLY) {
+        numReplyRecords = FLIGHT_RECORDING_RECORDS_PER_REPLY;
+    }
+
+    sysexReply.begin(SYSEX_COMMAND_GET_FLIGHT_RECORDING);
+    sysexReply.addByte(isValid ? flightRecording.reason :
+        (uint8_t) FLIGHT_RECORDING_NONE);
+    sysexReply.addByte(isValid ? flightRecording.source : TRACE_NO_PORT);
+    sysexReply.addByte(isValid ? flightRecording.destination : TRACE_NO_PORT);
+    sysexReply.addUInt32(isValid ? flightRecording.valueUs : 0);
+    sysexReply.addUInt32(isValid ? flightRecording.triggerUs : 0);
+    sysexReply.addUInt32(numRecords);
+    sysexReply.addUInt32(firstRecord);
+    sysexReply.addByte(numReplyRecords);
+
+    for (uint32_t i = 0; i < numReplyRecords; i++) {
+        TraceRecord& record = flightRecording.records[firstRecord + i];
+        sysexReply.addByte(record.type);
+        sysexReply.addByte(record.port);
+        sysexReply.addUInt32(record.timeUs);
+        sysexReply.addUInt32(record.value);
+    }
+
+    sysexReply.end();
+    writeSysexReply(destination);
+}
+
+// Returns true if the chunk was a command addressed to this device,
+// in which case it shouldn't be forwarded.
+bool handleSysexCommand(PortIndex source, uint8_t* sysexData, size_t size,
     bool isFinal) {
-    (void) userData;
-    (void) isFinal;
+    switch (sysexCommandFor(sysexData, size, isFinal)) {
+        case SYSEX_COMMAND_NONE:
+            return false;
+        case SYSEX_COMMAND_PANIC:
+            flushAllNotes();
+            return true;
+        case SYSEX_COMMAND_GET_STATS:
+            // Replies go back to the port that asked for them.
+            writeStats(source, size > SYSEX_COMMAND_HEADER_SIZE + 1 ?
+                sysexData[SYSEX_COMMAND_HEADER_SIZE] : 0);
+            return true;
+        case SYSEX_COMMAND_RESET_TIMING:
+            loopTimer.reset(time_us_32());
+            for (OutputQueue& queue : outputQueues) {
+                queue.resetStats();
+            }
+            for (OutputMerge& merge : outputMerges) {
+                merge.resetStats();
+            }
+            messagePool.resetStats();
+            resetUSBFrameStats();
+#ifdef PROFILING
+            profilerReset();
+#endif
+            return true;
+        case SYSEX_COMMAND_SET_ROUTE_DELAY:
+            // The arguments are followed by the end of the message.
+            setRouteDelay(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+            return true;
+        case SYSEX_COMMAND_SET_VOICE_DISTRIBUTION:
+            setVoiceDistribution(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+            return true;
+        case SYSEX_COMMAND_SET_MERGE_WEIGHT:
+            setMergeWeight(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+            return true;
+        case SYSEX_COMMAND_SET_RATE_LIMIT:
+            setRateLimit(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+            return true;
+        case SYSEX_COMMAND_SET_SYSEX_ROUTE:
+            setSysexRoute(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+            return true;
+        case SYSEX_COMMAND_SELF_TEST:
+#ifdef SELF_TEST
+            startSelfTest(&sysexData[SYSEX_COMMAND_HEADER_SIZE],
+                size - SYSEX_COMMAND_HEADER_SIZE - 1);
+#endif
+            return true;
+        case SYSEX_COMMAND_GET_FLIGHT_RECORDING:
+            writeFlightRecording(source,
+                size >= SYSEX_COMMAND_HEADER_SIZE + 3 ?
+                sysexReadUInt(&sysexData[SYSEX_COMMAND_HEADER_SIZE], 2) : 0);
+            return true;
+        case SYSEX_COMMAND_CLEAR_FLIGHT_RECORDING:
+            flightRecording.clear();
+            return true;
+        default:
+            // Unknown commands are ignored, but still aren't forwarded.
+            return true;
+    }
+}
+
+HOT_PATH(routing)
+void routeSysexChunk(PortIndex source, uint8_t* sysexData, size_t size,
+    bool isFinal) {
+    PROFILE_SCOPE(PROFILE_PROBE_ROUTE_SYSEX);
+
+#ifdef CLOCK_GOVERNOR
+    numMessagesRouted++;
+#endif
+
+    uint32_t now = time_us_32();
+    activeSensing.recordReceived(source, now);
+
+    if (handleSysexCommand(source, sysexData, size, isFinal)) {
+        return;
+    }
+
+    if (isFinal && isMTCFullFrame(sysexData, size)) {
+        timeCodeEngine.acceptFullFrame(source, sysexData);
+    }
 
-    // TODO: Correctly handle sysex routing.
-    uartMidiPort.write(sysexData, size);
-    usbDevice.write(sysexData, size);
-    usbHost.write(sysexData, size);
+    RoutedMessage chunk = {sysexData, size};
+    uint8_t destinations = sysexRouter.route(source, sysexData, size);
+
+    ports.forEach([&](auto& port, auto index) {
+        if (destinations & (1U << index)) {
+            writeSysexChunk(index, port, chunk, isFinal, now);
+        }
+    });
+
+    releaseMessage(chunk);
 }
 
-int main() {
+HOT_PATH(routing)
+void writeSysexFromPort(uint8_t* sysexData, size_t size, void* userData,
+    bool isFinal) {
+    routeSysexChunk((PortIndex) (uintptr_t) userData, sysexData, size,
+        isFinal);
+}
+
+MidiParserConfig parserConfigFor(PortIndex port) {
+    return {
+        .onMIDIMessage = writeMessageFromPort,
+        .onSysexChunk = writeSysexFromPort,
+        .userData = (void*) (uintptr_t) port
+    };
+}
+
+// Invoked by TinyUSB at every start of frame on the device port,
+// which is only enabled while its output is aligned to frames.
+HOT_PATH(tud_sof_cb)
+void tud_sof_cb(uint32_t frameCount) {
+    (void) frameCount;
+    ports.get<USB_DEVICE_PORT>().frameStarted();
+}
+
+// Writes the next few cached controllers to a USB port
+// that has just been plugged in.
+void replayControllers() {
+    uint32_t now = time_us_32();
+    USBMidiDevicePort& devicePort = ports.get<USB_DEVICE_PORT>();
+    USBMidiHostPort& hostPort = ports.get<USB_HOST_PORT>();
+
+    usbDeviceControllers.replay(now, [&](uint8_t* message, size_t size) {
+        devicePort.write(message, size);
+        activeSensing.recordWritten(USB_DEVICE_PORT, now);
+    });
+
+    bool isReplaying = usbHostControllers.replay(now,
+        [&](uint8_t* message, size_t size) {
+            for (uint8_t i = 0; i < CFG_TUH_MIDI; i++) {
+                if (usbHostReplayDevices & (1UL << i)) {
+                    hostPort.writeToDevice(i, message, size);
+                }
+            }
+
+            activeSensing.recordWritten(USB_HOST_PORT, now);
+        });
+
+    if (!isReplaying) {
+        usbHostReplayDevices = 0;
+    }
+}
+
+// Invoked by TinyUSB when the computer connects to the device port.
+void tud_mount_cb(void) {
+    flightRecorder.record(TRACE_RECORD_USB_MOUNT, USB_DEVICE_PORT,
+        time_us_32(), 1);
+    usbDeviceControllers.startReplay(time_us_32());
+}
+
+// Invoked by TinyUSB when a MIDI device is plugged into the host port.
+// Replay starts again from the beginning for every device
+// that is plugged in while another is still being replayed to.
+void tuh_midi_mount_cb(uint8_t idx, const tuh_midi_mount_cb_t* mountData) {
+    (void) mountData;
+    flightRecorder.record(TRACE_RECORD_USB_MOUNT, USB_HOST_PORT,
+        time_us_32(), (idx << 1) | 1);
+    usbHostReplayDevices |= 1UL << idx;
+    usbHostControllers.startReplay(time_us_32());
+}
+
+// Invoked by TinyUSB when the computer disconnects from the device port.
+void tud_umount_cb(void) {
+    flightRecorder.record(TRACE_RECORD_USB_MOUNT, USB_DEVICE_PORT,
+        time_us_32(), 0);
+    activeSensing.reset(USB_DEVICE_PORT);
+    flushNotesFromSource(USB_DEVICE_PORT);
+}
+
+// Invoked by TinyUSB when a hosted MIDI device is unplugged.
+// Notes from all hosted devices are merged into one source,
+// so all of them are released.
+void tuh_midi_umount_cb(uint8_t idx) {
+    flightRecorder.record(TRACE_RECORD_USB_MOUNT, USB_HOST_PORT,
+        time_us_32(), idx << 1);
+    ports.get<USB_HOST_PORT>().deviceUnmounted(idx);
+    usbHostReplayDevices &= ~(1UL << idx);
+    activeSensing.reset(USB_HOST_PORT);
+    flushNotesFromSource(USB_HOST_PORT);
+}
+
+void updateNoteLED() {
+    // The LED is updated at a decimated rate,
+    // rather than for every message.
+    uint32_t now = time_us_32();
+    if (now - lastNoteLEDUpdateUs < NOTE_LED_UPDATE_INTERVAL_US) {
+        return;
+    }
+
+    lastNoteLEDUpdateUs = now;
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        if (noteTrackers[i].count() > 0) {
+            noteLED.on();
+            return;
+        }
+    }
+
+    noteLED.off();
+}
+
+// Writes the messages that have come due on delayed routes.
+HOT_PATH(routing)
+void writeScheduledMessages() {
+    uint32_t now = time_us_32();
+
+    ports.forEach([now](auto& port, auto index) {
+        outputQueues[index].expire(now, [&port, index, now](uint8_t source,
+            uint8_t slot, uint32_t latenessUs) {
+            flightRecorder.checkRouteLatency(source, index, latenessUs, 0,
+                now);
+
+            // The queue's reference is released
+            // once the message has been passed on.
+            RoutedMessage routed = {messagePool[slot].data,
+                messagePool[slot].size, slot};
+            writeMerged(source, index, port, routed, now);
+            releaseMessage(routed);
+        });
+    });
+}
+
+// Writes as many of the messages waiting to be merged
+// as each destination has room for and its pacing allows.
+HOT_PATH(routing)
+void writeMergedMessages() {
+    uint32_t now = time_us_32();
+
+    ports.forEach([now](auto& port, auto index) {
+        OutputMerge& merge = outputMerges[index];
+        if (merge.isEmpty() || sysexPacers[index].isBusy(now)) {
+            return;
+        }
+
+        RateLimiter& limiter = rateLimiters[index];
+        merge.drain(now,
+            [&port, &limiter, now](size_t size) {
+                return limiter.allows(now) &&
+                    port.writeCapacity(now) >= size;
+            },
+            [&port, index, now](uint8_t slot, uint8_t source,
+                uint32_t delayUs, uint8_t bytesAhead) {
+                flightRecorder.checkRouteLatency(source, index, delayUs,
+                    (bytesAhead + messagePool[slot].size) * port.TX_BYTE_US,
+                    now);
+                writeLimited(index, port, messagePool[slot].data,
+                    messagePool[slot].size, now);
+                messagePool.release(slot);
+            });
+    });
+}
+
+// Writes the next packet of any SysEx that is being paced.
+// Nothing here waits; packets are written once they're due.
+HOT_PATH(routing)
+void writePacedSysex() {
+    uint32_t now = time_us_32();
+
+    ports.forEach([now](auto& port, auto index) {
+        sysexPacers[index].drain(now, rateLimiters[index].config,
+            messagePool, [&port, index, now](uint8_t* packet, size_t size) {
+                port.write(packet, size);
+                activeSensing.recordWritten(index, now);
+            },
+            [&port, now]() {
+                return port.txIdleAt(now);
+            });
+    });
+}
+
+#ifdef TELEMETRY
+uint32_t lastTelemetrySampleUs = 0;
+uint32_t maxLoopUsSinceSample = 0;
+size_t lastNumTXBytesDropped[NUM_PORTS] = {0};
+
+// Samples the drop counts, queue depths and loop time,
+// and streams them to the host along with the message events.
+void writeTelemetry(uint32_t loopUs) {
+    if (loopUs > maxLoopUsSinceSample) {
+        maxLoopUsSinceSample = loopUs;
+    }
+
+    uint32_t now = time_us_32();
+    if (now - lastTelemetrySampleUs >= TELEMETRY_SAMPLE_INTERVAL_US) {
+        lastTelemetrySampleUs = now;
+
+        ports.forEach([now](auto& port, auto index) {
+            if (port.numTXBytesDropped != lastNumTXBytesDropped[index]) {
+                lastNumTXBytesDropped[index] = port.numTXBytesDropped;
+                TRACE(TRACE_RECORD_DROP, index, now, port.numTXBytesDropped);
+            }
+
+            TRACE(TRACE_RECORD_QUEUE_DEPTH, index, now,
+                outputQueues[index].numEntries);
+        });
+
+        TRACE(TRACE_RECORD_LOOP_TIME, TRACE_NO_PORT, now,
+            maxLoopUsSinceSample);
+        maxLoopUsSinceSample = 0;
+    }
+
+    telemetryFlush();
+}
+#endif
+
+#ifdef CLOCK_GOVERNOR
+// A hosted device pulls up one of the host port's data lines
+// as soon as it's plugged in, well before it has been enumerated.
+bool isUSBHostActive() {
+    USBMidiHostPort& hostPort = ports.get<USB_HOST_PORT>();
+
+    return !hostPort.isInitialized || hostPort.mountedDevices() != 0 ||
+        gpio_get(USB_HOST_DP_GPIO) || gpio_get(USB_HOST_DP_GPIO + 1);
+}
+
+size_t outputQueueDepth() {
+    size_t depth = 0;
+    for (OutputQueue& queue : outputQueues) {
+        depth += queue.numEntries;
+    }
+
+    for (OutputMerge& merge : outputMerges) {
+        depth += merge.numEntries;
+    }
+
+    return depth;
+}
+
+// Lowers the system clock while the YouMe Transformer is idle,
+// and raises it again as soon as there's anything to do.
+// The UARTs are held until the change has been made.
+void governClock() {
+    uint32_t numMessages = numMessagesRouted - lastNumMessagesRouted;
+    lastNumMessagesRouted = numMessagesRouted;
+
+    uint32_t frequencyKHz = clockGovernor.update(time_us_32(),
+        isUSBHostActive(), numMessages, outputQueueDepth());
+    if (frequencyKHz != 0) {
+        pendingClockKHz = frequencyKHz;
+        ports.holdTX(true);
+    }
+}
+
+// Changing the clock corrupts any byte that a UART is sending at the
+// time, so the change waits until they have all finished. This runs
+// before anything is read or written in an iteration, since paced
+// SysEx and regenerated clock are written as soon as a UART is idle.
+void changeClockWhenIdle() {
+    if (pendingClockKHz == 0 || !ports.isTXIdle(time_us_32())) {
+        return;
+    }
+
+    set_sys_clock_khz(pendingClockKHz, true);
+    ports.clockChanged();
+    ports.holdTX(false);
+    pendingClockKHz = 0;
+}
+#endif
+
+void writeRegeneratedClock() {
+    uint32_t now = time_us_32();
+    clockEngine.update(now);
+
+    if (!clockEngine.popDueTick(now)) {
+        return;
+    }
+
+    // Send the regenerated clock to every output, but don't
+    // echo it back to a USB port the master clock is coming from.
+    uint8_t tick = sig_MIDI_STATUS_TIMING_CLOCK;
+    uint8_t master = clockEngine.masterSource;
+
+    ports.forEach([&](auto& port, auto destination) {
+        if (port.ECHOES_INPUT || destination != master) {
+            port.write(&tick, 1);
+            activeSensing.recordWritten(destination, now);
+        }
+    });
+}
+
+// Regenerated quarter frames aren't written in the middle of paced
+// SysEx, which they would cut short.
+void writeRegeneratedTimeCode() {
+    uint32_t now = time_us_32();
+    timeCodeEngine.update(now);
+
+    uint8_t quarterFrame[2] = {sig_MIDI_STATUS_MTC_QUARTER_FRAME};
+    if (!timeCodeEngine.popDueQuarterFrame(now, &quarterFrame[1])) {
+        return;
+    }
+
+    uint8_t master = timeCodeEngine.masterSource;
+
+    ports.forEach([&](auto& port, auto destination) {
+        if ((port.ECHOES_INPUT || destination != master) &&
+            !sysexPacers[destination].isBusy(now)) {
+            port.write(quarterFrame, sizeof(quarterFrame));
+            activeSensing.recordWritten(destination, now);
+        }
+    });
+}
+
+// Releases the notes from any source that has stopped sending
+// active sensing, and writes active sensing to each output that
+// has been quiet. It's only written once any queued messages
+// and paced SysEx have gone out, and pacing allows it.
+void updateActiveSensing() {
+    uint32_t now = time_us_32();
+
+    activeSensing.checkSources(now, [](uint8_t source) {
+        flushNotesFromSource((PortIndex) source);
+    });
+
+    ports.forEach([now](auto& port, auto index) {
+        if (!activeSensing.isDue(index, now) ||
+            !outputMerges[index].isEmpty() ||
+            sysexPacers[index].isBusy(now) ||
+            !rateLimiters[index].allows(now) ||
+            port.writeCapacity(now) < 1) {
+            return;
+        }
+
+        uint8_t sensing = sig_MIDI_STATUS_ACTIVE_SENSING;
+        port.write(&sensing, 1);
+        rateLimiters[index].recordWrite(now, port.txIdleAt(now));
+        activeSensing.recordRegenerated(index, now);
+    });
+}
+
+#ifdef SELF_TEST
+// Generated traffic takes the same path as messages from the ports.
+void runSelfTest() {
+    if (!selfTest.isActive()) {
+        return;
+    }
+
+    selfTest.update(time_us_32(),
+        [](uint8_t source, uint8_t* message, size_t size) {
+            writeMessageFromPort(message, size, (void*) (uintptr_t) source);
+        },
+        [](uint8_t source, uint8_t* chunk, size_t size, bool isFinal) {
+            routeSysexChunk((PortIndex) source, chunk, size, isFinal);
+        });
+}
+#endif
+
+// Samples the longest loop iteration and the depth of each port's
+// queues into the flight recorder, and freezes it if an iteration
+// was slow. Iterations that finish starting up USB aren't checked.
+void recordLoopTime(uint32_t loopUs) {
+    uint32_t now = time_us_32();
+
+    if (bootProfile.hasCompleted(BOOT_PHASE_USB_HOST)) {
+        flightRecorder.checkLoopTime(loopUs, now);
+    }
+
+    if (loopUs > maxLoopUsSinceFlightRecorderSample) {
+        maxLoopUsSinceFlightRecorderSample = loopUs;
+    }
+
+    if (now - lastFlightRecorderSampleUs <
+        FLIGHT_RECORDER_SAMPLE_INTERVAL_US) {
+        return;
+    }
+
+    lastFlightRecorderSampleUs = now;
+    flightRecorder.record(TRACE_RECORD_LOOP_TIME, TRACE_NO_PORT, now,
+        maxLoopUsSinceFlightRecorderSample);
+    maxLoopUsSinceFlightRecorderSample = 0;
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        size_t depth = outputQueues[i].numEntries +
+            outputMerges[i].numEntries;
+        if (depth > 0) {
+            flightRecorder.record(TRACE_RECORD_QUEUE_DEPTH, i, now, depth);
+        }
+    }
+}
+
+void initUSBDevice() {
+    ports.get<USB_DEVICE_PORT>().init(parserConfigFor(USB_DEVICE_PORT));
+
+    bootProfile.mark(BOOT_PHASE_USB_DEVICE, time_us_32());
+}
+
+void initUSBHost() {
+    ports.get<USB_HOST_PORT>().init(USB_HOST_DP_GPIO,
+        parserConfigFor(USB_HOST_PORT));
+
+    bootProfile.mark(BOOT_PHASE_USB_HOST, time_us_32());
+    mainLED.on();
+}
+
+// Runs the next USB initialization step that hasn't yet completed.
+// In fast start mode, this is called from the main loop so that
+// DIN MIDI can flow while USB is still starting up.
+void continueBoot() {
+    if (!bootProfile.hasCompleted(BOOT_PHASE_USB_DEVICE)) {
+        initUSBDevice();
+    } else if (!bootProfile.hasCompleted(BOOT_PHASE_USB_HOST)) {
+        initUSBHost();
+    }
+}
+
+// Initializes everything that's needed before the main loop starts.
+void boot() {
     set_sys_clock_khz(CPU_CLOCK_SPEED_KHZ, true);
+    bootProfile.mark(BOOT_PHASE_SYSTEM_CLOCK, time_us_32());
 
-    mainLED.init(25);
-    noteLED.init(24);
+    flightRecorder.init(&flightRecording, watchdog_enable_caused_reboot(), {
+        .routeLatencyUs = BOARD_FLIGHT_RECORDER_LATENCY_US,
+        .loopTimeUs = BOARD_FLIGHT_RECORDER_LOOP_TIME_US
+    });
+
+#ifdef PROFILING
+    profilerInit();
+#endif
+
+#ifdef TELEMETRY
+    traceRing.init();
+#endif
+
+    portArena.init(portBufferMemory, sizeof(portBufferMemory));
+    ports.initBuffers(&portArena);
+
+    clockEngine.init();
+    timeCodeEngine.init({.regenerate = BOARD_MTC_REGENERATE});
+    loopDetector.init();
+    routeDelays.init(0, OutputQueue::maxDelayUs);
+    setConstantLatency(BOARD_OUTPUT_LATENCY_US);
+    ports.get<USB_HOST_PORT>().distributeVoices(
+        BOARD_HOST_DISTRIBUTE_VOICES);
+    ports.get<USB_DEVICE_PORT>().alignToFrames(BOARD_USB_FRAME_ALIGNED);
+    ports.get<USB_HOST_PORT>().alignToFrames(BOARD_USB_FRAME_ALIGNED);
+
+    messagePool.init();
+    sysexRouter.init();
+    activeSensing.init(time_us_32(), {
+        .intervalUs = BOARD_ACTIVE_SENSING_INTERVAL_US
+    });
+
+    for (OutputQueue& queue : outputQueues) {
+        queue.init();
+    }
+
+    for (OutputMerge& merge : outputMerges) {
+        merge.init({.noteCost = BOARD_MERGE_NOTE_COST});
+    }
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        rateLimiters[i].init();
+        sysexPacers[i].init();
+    }
+
+    for (uint8_t i = 0; i < NUM_PORTS; i++) {
+        noteTrackers[i].init();
+    }
+
+    ControllerReplayConfig replayConfig = {
+        .messagesPerInterval = BOARD_CONTROLLER_REPLAY_MESSAGES_PER_MS,
+        .intervalUs = 1000
+    };
+    usbDeviceControllers.init(replayConfig);
+    usbHostControllers.init(replayConfig);
 
     UARTConfig uartConfig = {
         .uartNum = MIDI_UART_NUM,
@@ -91,33 +1596,91 @@ int main() {
         .rxGPIO = MIDI_UART_RX_GPIO
     };
 
-    MidiParserConfig uartParserConfig = {
-        .onMIDIMessage = writeMessageFromUART,
-        .onSysexChunk = onSysexChunk,
-        .userData = &uartMidiPort
-    };
-    uartMidiPort.init(uartConfig, uartParserConfig);
+    ports.get<UART_PORT>().init(uartConfig, parserConfigFor(UART_PORT));
 
-    MidiParserConfig usbDeviceParserConfig = {
-        .onMIDIMessage = writeMessageFromUSBDevice,
-        .onSysexChunk = onSysexChunk,
-        .userData = &usbDevice
-    };
-    usbDevice.init(usbDeviceParserConfig);
+    // The second DIN port uses uart1 on GPIO 6 and 7.
+    ports.get<UART_2_PORT>().init(DEFAULT_UART_CONFIG,
+        parserConfigFor(UART_2_PORT));
+    bootProfile.mark(BOOT_PHASE_UART, time_us_32());
 
-    MidiParserConfig usbHostParserConfig = {
-        .onMIDIMessage = writeMessageFromUSBHost,
-        .onSysexChunk = onSysexChunk,
-        .userData = &usbHost
-    };
-    usbHost.init(USB_HOST_DP_GPIO, usbHostParserConfig);
+    mainLED.init(25);
+    noteLED.init(24);
+    bootProfile.mark(BOOT_PHASE_LEDS, time_us_32());
 
-    mainLED.on();
+#ifndef FAST_START
+    initUSBDevice();
+    initUSBHost();
+#endif
+
+    loopTimer.reset(time_us_32());
+
+#if BOARD_WATCHDOG_TIMEOUT_MS > 0
+    // The watchdog is paused while a debugger has the device halted.
+    watchdog_enable(BOARD_WATCHDOG_TIMEOUT_MS, true);
+#endif
+
+#ifdef CLOCK_GOVERNOR
+    clockGovernor.init(CLOCK_GOVERNOR_FREQUENCIES_KHZ, time_us_32());
+#endif
+
+#if defined(SELF_TEST) && BOARD_SELF_TEST_AT_BOOT
+    // The DIN outputs can always be written to,
+    // whether or not anything is plugged in.
+    selfTest.start(time_us_32(), selfTestRouteMask(
+        (1U << UART_PORT) | (1U << UART_2_PORT)));
+#endif
+}
+
+// A single iteration of the main loop. The host tests
+// (see test/sim/) boot the firmware and run it one iteration
+// at a time, instead of calling main().
+void runMainLoopIteration() {
+#ifdef CLOCK_GOVERNOR
+    changeClockWhenIdle();
+#endif
+
+    // In fast start mode, the USB ports aren't
+    // ticked until they have been initialized.
+    ports.tick();
+
+#ifdef FAST_START
+    continueBoot();
+#endif
+
+    writeScheduledMessages();
+    writePacedSysex();
+    writeMergedMessages();
+    writeRegeneratedClock();
+    writeRegeneratedTimeCode();
+    updateActiveSensing();
+    replayControllers();
+    updateNoteLED();
+
+#ifdef SELF_TEST
+    runSelfTest();
+#endif
+
+    uint32_t loopUs = loopTimer.mark(time_us_32());
+    recordLoopTime(loopUs);
+
+#if BOARD_WATCHDOG_TIMEOUT_MS > 0
+    watchdog_update();
+#endif
+
+#ifdef TELEMETRY
+    writeTelemetry(loopUs);
+#endif
+
+#ifdef CLOCK_GOVERNOR
+    governClock();
+#endif
+}
+
+int main() {
+    boot();
 
     while (true) {
-        uartMidiPort.tick();
-        usbDevice.tick();
-        usbHost.tick();
+        runMainLoopIteration();
     }
 
     noteLED.off();
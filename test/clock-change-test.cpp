@@ -0,0 +1,91 @@
+#include "firmware-sim.h"
+#include "test.h"
+
+// Runs the firmware with the clock governor, and checks that the system
+// clock comes back up as soon as it's played through, but never changes
+// while a DIN port is sending, which would corrupt the byte being sent.
+
+#define LOWEST_KHZ 48000
+#define HIGHEST_KHZ 240000
+
+// Runs until the clock is back at full speed, and returns how long
+// that took, or 0 if it didn't happen within the limit.
+static uint32_t runUntilFullSpeed(uint32_t limitUs) {
+    uint32_t startUs = simNowUs();
+
+    while (simNowUs() - startUs < limitUs) {
+        simRunUntil(simNowUs() + SIM_LOOP_US);
+        if (simSystemClockKHz() == HIGHEST_KHZ) {
+            return simNowUs() - startUs;
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t numWritesTo(uint8_t port, uint32_t startUs) {
+    uint32_t numWrites = 0;
+    for (const SimWrite& write : simWrites()) {
+        numWrites += write.port == port && write.timeUs >= startUs;
+    }
+
+    return numWrites;
+}
+
+int main() {
+    // PIO-USB needs the full clock speed, so nothing
+    // can be plugged into the USB host port.
+    simPlugIn(SIM_USB_HOST, false);
+
+    simRunUntil(5000000);
+    printf("Idle: %u kHz after %u changes\n", simSystemClockKHz(),
+        simNumSystemClockChanges());
+    CHECK_EQUAL(simSystemClockKHz(), LOWEST_KHZ);
+
+    // A single note is written to the DIN ports straight away,
+    // and the clock changes once it has been sent.
+    simReceive(SIM_USB_DEVICE, simNowUs(), {0x90, 60, 100});
+    uint32_t speedUpUs = runUntilFullSpeed(100000);
+
+    printf("Single note: full speed after %u us\n", speedUpUs);
+    CHECK(speedUpUs > 0);
+    CHECK(speedUpUs < 2000);
+
+    simRunUntil(simNowUs() + 10000000);
+    CHECK_EQUAL(simSystemClockKHz(), LOWEST_KHZ);
+
+    // A flood of controllers keeps the DIN ports almost always busy.
+    // The clock waits for them to drain, which they do within a few
+    // bytes.
+    uint32_t floodStartUs = simNowUs();
+    for (uint32_t i = 0; i < 2000; i++) {
+        simReceive(SIM_USB_DEVICE, floodStartUs + i * 1000,
+            {0xB0, 1, (uint8_t) (i & 0x7F)});
+    }
+
+    speedUpUs = runUntilFullSpeed(100000);
+    printf("Controller flood: full speed after %u us\n", speedUpUs);
+    CHECK(speedUpUs > 0);
+    CHECK(speedUpUs < 5000);
+
+    simRunUntil(floodStartUs + 2500000);
+
+    // Playing lightly keeps the clock up.
+    uint32_t numChanges = simNumSystemClockChanges();
+    for (uint32_t i = 0; i < 10; i++) {
+        uint32_t noteUs = simNowUs();
+        simReceive(SIM_USB_DEVICE, noteUs, {0x90, 64, 90});
+        simRunUntil(noteUs + 1500000);
+    }
+
+    CHECK_EQUAL(simNumSystemClockChanges(), numChanges);
+
+    printf("%u clock changes, %u while a DIN port was sending, "
+        "%u bytes overflowed\n", simNumSystemClockChanges(),
+        simNumUnsafeClockChanges(), simNumUARTBytesOverflowed(SIM_DIN_1));
+    CHECK_EQUAL(simNumUnsafeClockChanges(), 0);
+    CHECK_EQUAL(simNumUARTBytesOverflowed(SIM_DIN_1), 0);
+    CHECK(numWritesTo(SIM_DIN_1, floodStartUs) >= 2010);
+
+    return testResult();
+}
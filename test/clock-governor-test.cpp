@@ -0,0 +1,161 @@
+#include <vector>
+#include "clock-governor.h"
+#include "test.h"
+
+// Plays traces of message times through the clock governor, updating
+// it the way the main loop does, and checks the frequencies it picks.
+
+#define NUM_FREQUENCIES 3
+
+// The main loop updates the governor at about this interval.
+#define LOOP_US 20
+
+static const uint32_t FREQUENCIES_KHZ[NUM_FREQUENCIES] = {
+    240000, 120000, 48000
+};
+
+struct GovernorSimulation {
+    ClockGovernor<NUM_FREQUENCIES> governor;
+    uint32_t nowUs = 1000;
+    uint32_t frequencyKHz = FREQUENCIES_KHZ[0];
+
+    // The longest time between a message and the clock
+    // being at full speed.
+    uint32_t maxSpeedUpUs = 0;
+
+    GovernorSimulation() {
+        governor.init(FREQUENCIES_KHZ, nowUs);
+    }
+
+    // Runs the main loop until the specified time, with messages
+    // routed at the times in the trace.
+    void play(const std::vector<uint32_t>& messageTimesUs, uint32_t endUs) {
+        size_t next = 0;
+        uint32_t firstWaitingUs = 0;
+        bool isWaiting = false;
+
+        for (; (int32_t) (endUs - nowUs) > 0; nowUs += LOOP_US) {
+            uint32_t numMessages = 0;
+            while (next < messageTimesUs.size() &&
+                (int32_t) (nowUs - messageTimesUs[next]) >= 0) {
+                if (!isWaiting && frequencyKHz != FREQUENCIES_KHZ[0]) {
+                    isWaiting = true;
+                    firstWaitingUs = messageTimesUs[next];
+                }
+
+                numMessages++;
+                next++;
+            }
+
+            uint32_t changedKHz = governor.update(nowUs, false,
+                numMessages, 0);
+            if (changedKHz != 0) {
+                frequencyKHz = changedKHz;
+            }
+
+            if (isWaiting && frequencyKHz == FREQUENCIES_KHZ[0]) {
+                isWaiting = false;
+                if (nowUs - firstWaitingUs > maxSpeedUpUs) {
+                    maxSpeedUpUs = nowUs - firstWaitingUs;
+                }
+            }
+        }
+    }
+};
+
+// A message every intervalUs, from startUs until endUs.
+static std::vector<uint32_t> evenTrace(uint32_t startUs, uint32_t endUs,
+    uint32_t intervalUs) {
+    std::vector<uint32_t> trace;
+    for (uint32_t timeUs = startUs; timeUs < endUs; timeUs += intervalUs) {
+        trace.push_back(timeUs);
+    }
+
+    return trace;
+}
+
+// With nothing to do, the clock comes down a step
+// after every two seconds, and stays at the lowest.
+void testStepsDownWhileIdle() {
+    GovernorSimulation sim;
+
+    sim.play({}, 2100000);
+    CHECK_EQUAL(sim.frequencyKHz, 120000);
+
+    sim.play({}, 4200000);
+    CHECK_EQUAL(sim.frequencyKHz, 48000);
+
+    sim.play({}, 20000000);
+    CHECK_EQUAL(sim.frequencyKHz, 48000);
+    CHECK_EQUAL(sim.governor.numChanges, 2);
+}
+
+// A slow, sparse melody takes only a tiny fraction of the loop's time,
+// but is still playing, so the clock stays at full speed.
+void testLightPlayingKeepsFullSpeed() {
+    GovernorSimulation sim;
+
+    sim.play(evenTrace(100000, 30000000, 1500000), 30000000);
+    CHECK_EQUAL(sim.frequencyKHz, 240000);
+    CHECK_EQUAL(sim.governor.numChanges, 0);
+}
+
+// The first message after a long rest brings
+// the clock straight back up.
+void testFirstMessageSpeedsUp() {
+    GovernorSimulation sim;
+
+    sim.play({}, 10000000);
+    CHECK_EQUAL(sim.frequencyKHz, 48000);
+
+    sim.play({10000000}, 10500000);
+    CHECK_EQUAL(sim.frequencyKHz, 240000);
+    CHECK(sim.maxSpeedUpUs <= LOOP_US);
+
+    sim.play({}, 12600000);
+    CHECK_EQUAL(sim.frequencyKHz, 120000);
+}
+
+// Bursts of playing with long rests in between:
+// every burst starts at full speed.
+void testBursts() {
+    GovernorSimulation sim;
+    std::vector<uint32_t> trace;
+
+    for (uint32_t burstUs = 5000000; burstUs < 60000000;
+        burstUs += 7000000) {
+        std::vector<uint32_t> burst = evenTrace(burstUs,
+            burstUs + 1000000, 5000);
+        trace.insert(trace.end(), burst.begin(), burst.end());
+    }
+
+    sim.play(trace, 60000000);
+
+    printf("Bursts: %u clock changes, slowest speed up %u us\n",
+        sim.governor.numChanges, sim.maxSpeedUpUs);
+    CHECK(sim.maxSpeedUpUs <= LOOP_US);
+    CHECK_EQUAL(sim.frequencyKHz, 48000);
+}
+
+// Anything that requires full speed, such as a hosted USB
+// device, holds the clock up with no messages at all.
+void testMustRunAtMax() {
+    ClockGovernor<NUM_FREQUENCIES> governor;
+    governor.init(FREQUENCIES_KHZ, 1000);
+
+    for (uint32_t nowUs = 1000; nowUs < 10000000; nowUs += LOOP_US) {
+        CHECK_EQUAL(governor.update(nowUs, true, 0, 0), 0);
+    }
+
+    CHECK_EQUAL(governor.frequencyKHz(), 240000);
+}
+
+int main() {
+    testStepsDownWhileIdle();
+    testLightPlayingKeepsFullSpeed();
+    testFirstMessageSpeedsUp();
+    testBursts();
+    testMustRunAtMax();
+
+    return testResult();
+}
@@ -0,0 +1,200 @@
+#include <chrono>
+#include <map>
+#include <vector>
+#include "controller-cache.h"
+#include "test.h"
+
+// Checks what the controller cache replays against a simple model of
+// every controller's value, and measures how much memory it takes and
+// how long replays take.
+
+// The cache, as it's set up in passthrough.cpp.
+typedef ControllerCache<128> Cache;
+
+// The rate replays are paced at in passthrough.cpp.
+#define REPLAY_MESSAGES_PER_MS 4
+
+typedef std::vector<std::vector<uint8_t>> Messages;
+
+static void send(Cache& cache, std::vector<uint8_t> message) {
+    cache.handleMessage(message.data(), message.size());
+}
+
+// Replays the whole cache at once.
+static Messages replayAll(Cache& cache) {
+    Messages replayed;
+    cache.replayConfig.delayUs = 0;
+    cache.replayConfig.messagesPerInterval = 255;
+    cache.startReplay(0);
+
+    for (uint32_t nowUs = 0; cache.replay(nowUs,
+        [&](uint8_t* message, size_t size) {
+            replayed.push_back(std::vector<uint8_t>(message,
+                message + size));
+        }); nowUs += 1000) {}
+
+    return replayed;
+}
+
+// Each channel's bank select goes before its program change,
+// which goes before its other controllers.
+void testReplayOrder() {
+    Cache cache;
+    cache.init();
+
+    send(cache, {0xB3, MIDI_CC_PAN, 20});
+    send(cache, {0xB0, MIDI_CC_VOLUME, 90});
+    send(cache, {0xE0, 0x00, 0x50});
+    send(cache, {0xC0, 5});
+    send(cache, {0xB0, MIDI_CC_BANK_SELECT_LSB, 2});
+    send(cache, {0xB0, MIDI_CC_MODULATION, 64});
+    send(cache, {0xB0, MIDI_CC_BANK_SELECT_MSB, 1});
+    send(cache, {0xD0, 30});
+
+    Messages expected = {
+        {0xB0, MIDI_CC_BANK_SELECT_MSB, 1},
+        {0xB0, MIDI_CC_BANK_SELECT_LSB, 2},
+        {0xC0, 5},
+        {0xB0, MIDI_CC_MODULATION, 64},
+        {0xB0, MIDI_CC_VOLUME, 90},
+        {0xE0, 0x00, 0x50},
+        {0xD0, 30},
+        {0xB3, MIDI_CC_PAN, 20}
+    };
+
+    CHECK(replayAll(cache) == expected);
+    CHECK_EQUAL(cache.count(), 8);
+}
+
+// A controller that goes back to its default keeps its entry, but
+// isn't replayed, and Reset All Controllers and System Reset are
+// followed.
+void testDefaults() {
+    Cache cache;
+    cache.init();
+
+    send(cache, {0xB1, MIDI_CC_MODULATION, 64});
+    send(cache, {0xB1, MIDI_CC_MODULATION, 0});
+    CHECK_EQUAL(cache.count(), 0);
+    CHECK_EQUAL(cache.numStored(), 1);
+    CHECK(replayAll(cache).empty());
+
+    send(cache, {0xB1, MIDI_CC_VOLUME, 100});
+    CHECK_EQUAL(cache.numStored(), 1);
+
+    send(cache, {0xB1, MIDI_CC_SUSTAIN, 127});
+    send(cache, {0xB1, MIDI_CC_VOLUME, 50});
+    send(cache, {0xB1, MIDI_CC_RESET_ALL_CONTROLLERS, 0});
+    Messages expected = {{0xB1, MIDI_CC_VOLUME, 50}};
+    CHECK(replayAll(cache) == expected);
+
+    send(cache, {0xFF});
+    CHECK_EQUAL(cache.numStored(), 0);
+    CHECK(replayAll(cache).empty());
+}
+
+// Random control changes, on a limited set of controllers so that some
+// are changed many times, replay the same values as a model of every
+// controller, until the cache is full.
+void testMatchesModel() {
+    Cache cache;
+    cache.init();
+    TestRandom random(11);
+    std::map<std::pair<uint8_t, uint8_t>, uint8_t> model;
+
+    for (uint32_t i = 0; i < 20000; i++) {
+        uint8_t channel = random.range(0, 15);
+        uint8_t controller = random.range(0, 7) * 9 + 1;
+        uint8_t value = random.range(0, 3) == 0 ?
+            Cache::defaultValue(controller) : random.range(0, 127);
+
+        send(cache, {(uint8_t) (0xB0 | channel), controller, value});
+        if (Cache::isCached(controller)) {
+            model[{channel, controller}] = value;
+        }
+    }
+
+    Messages expected;
+    for (auto& [key, value] : model) {
+        if (value != Cache::defaultValue(key.second)) {
+            expected.push_back({(uint8_t) (0xB0 | key.first), key.second,
+                value});
+        }
+    }
+
+    // 16 channels of 8 controllers just fits.
+    CHECK_EQUAL(cache.numDropped, 0);
+    CHECK(replayAll(cache) == expected);
+}
+
+// Once the cache is full, new controllers are counted and dropped,
+// and the ones already stored can still be changed.
+void testFull() {
+    Cache cache;
+    cache.init();
+
+    for (uint8_t channel = 0; channel < 16; channel++) {
+        for (uint8_t controller = 70; controller < 79; controller++) {
+            send(cache, {(uint8_t) (0xB0 | channel), controller, 1});
+        }
+    }
+
+    CHECK_EQUAL(cache.numStored(), 128);
+    CHECK_EQUAL(cache.numDropped, 16);
+    CHECK_EQUAL(cache.count(), 128);
+
+    send(cache, {0xB0, 70, 99});
+    Messages replayed = replayAll(cache);
+    CHECK_EQUAL(replayed.size(), 128);
+    CHECK(replayed[0] == std::vector<uint8_t>({0xB0, 70, 99}));
+}
+
+// A typical setup: every channel has a bank, a program, and its volume,
+// pan, expression, reverb and chorus set.
+void measureTypicalSetup() {
+    Cache cache;
+    cache.init();
+
+    auto startTime = std::chrono::steady_clock::now();
+    uint32_t numMessages = 0;
+
+    for (uint32_t pass = 0; pass < 10000; pass++) {
+        for (uint8_t channel = 0; channel < 16; channel++) {
+            uint8_t status = 0xB0 | channel;
+            uint8_t value = (pass + channel) % 60 + 1;
+            send(cache, {status, MIDI_CC_BANK_SELECT_MSB, 1});
+            send(cache, {(uint8_t) (0xC0 | channel), value});
+            send(cache, {status, MIDI_CC_VOLUME, value});
+            send(cache, {status, MIDI_CC_PAN, value});
+            send(cache, {status, MIDI_CC_EXPRESSION, value});
+            send(cache, {status, 91, value});
+            send(cache, {status, 93, value});
+            numMessages += 7;
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - startTime;
+    uint64_t elapsedNs = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(elapsed).count();
+
+    Messages replayed = replayAll(cache);
+    CHECK_EQUAL(replayed.size(), 16 * 7);
+    CHECK_EQUAL(cache.numDropped, 0);
+
+    printf("Cache: %zu bytes, %zu entries\n", sizeof(Cache),
+        sizeof(cache.values));
+    printf("Typical setup: %zu messages, %zu entries in use, "
+        "%llu ns per update, %zu ms to replay\n", replayed.size(),
+        cache.numStored(), (unsigned long long) elapsedNs / numMessages,
+        replayed.size() / REPLAY_MESSAGES_PER_MS);
+}
+
+int main() {
+    testReplayOrder();
+    testDefaults();
+    testMatchesModel();
+    testFull();
+    measureTypicalSetup();
+
+    return testResult();
+}
@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+"""Writes the traffic traces in this directory.
+
+The traces are scripted to follow what each kind of gear sends during
+a typical session, with the same timing, running status and packet
+sizes. Run this from the test/corpus/ directory after changing it, and
+then regenerate the expected output (see firmware-replay-test.cpp).
+"""
+
+import random
+
+DIN_BYTE_US = 320
+
+
+class Trace:
+    def __init__(self, name, description):
+        self.name = name
+        self.description = description
+        self.events = []
+
+    def add(self, time_us, port, data):
+        self.events.append((int(time_us), port, data))
+
+    def write(self):
+        # Events on each port stay in the order they were added.
+        self.events.sort(key=lambda event: event[0])
+
+        with open(self.name + ".trace", "w") as file:
+            for line in self.description:
+                file.write("# " + line + "\n")
+
+            for time_us, port, data in self.events:
+                if isinstance(data, str):
+                    value = data
+                else:
+                    value = " ".join("%02X" % byte for byte in data)
+
+                file.write("%d %s %s\n" % (time_us, port, value))
+
+
+def keyboard_performance():
+    """A keyboard on the first DIN port, played with the sustain pedal,
+    mod wheel, pitch bend and aftertouch. Like most keyboards, it uses
+    running status, sends Note Offs as Note Ons with zero velocity, and
+    sends active sensing. A hosted device is unplugged and plugged back
+    in part way through."""
+    trace = Trace("keyboard-performance", [
+        "A keyboard on DIN 1, using running status and active sensing,",
+        "with the sustain pedal, mod wheel, pitch bend and aftertouch.",
+        "The hosted device is unplugged at 6 s and plugged in at 6.5 s."
+    ])
+    rng = random.Random(1)
+    end_us = 9000000
+
+    # The DIN port is busy until the last byte has arrived,
+    # and running status lasts until another status byte is sent.
+    state = {"free_us": 100000, "status": None}
+
+    def send(time_us, message):
+        time_us = max(time_us, state["free_us"])
+        data = list(message)
+        if data[0] < 0xF8:
+            if data[0] == state["status"] and data[0] < 0xF0:
+                data = data[1:]
+            else:
+                state["status"] = data[0] if data[0] < 0xF0 else None
+
+        trace.add(time_us, "din1", data)
+        state["free_us"] = time_us + len(data) * DIN_BYTE_US
+        return state["free_us"]
+
+    events = []
+
+    for time_us in range(100000, end_us, 270000):
+        events.append((time_us, [0xFE]))
+
+    events.append((150000, [0xC0, 5]))
+
+    # Chords every half second, with a melody over the top.
+    melody = [72, 74, 76, 79, 77, 76, 74, 72]
+    for bar, root in enumerate([48, 53, 55, 48, 57, 53, 55, 48]):
+        start_us = 200000 + bar * 1000000
+        for beat in range(2):
+            chord_us = start_us + beat * 500000
+            for note in (root, root + 4, root + 7):
+                events.append((chord_us + rng.randint(0, 3000),
+                    [0x90, note, rng.randint(60, 100)]))
+                events.append((chord_us + 420000 + rng.randint(0, 5000),
+                    [0x90, note, 0]))
+
+        for step in range(4):
+            note_us = start_us + step * 250000 + 20000
+            note = melody[(bar + step) % len(melody)]
+            events.append((note_us, [0x90, note, rng.randint(70, 120)]))
+            events.append((note_us + 180000, [0x90, note, 0]))
+
+        events.append((start_us + 10000, [0xB0, 64, 127]))
+        events.append((start_us + 950000, [0xB0, 64, 0]))
+
+    # A mod wheel sweep, sent as fast as the wheel moves.
+    for step in range(128):
+        events.append((2500000 + step * 8000, [0xB0, 1, step]))
+
+    for step in range(128):
+        events.append((3600000 + step * 6000, [0xB0, 1, 127 - step]))
+
+    # Pitch bend up and back down.
+    for step in range(100):
+        value = 8192 + int(8191 * (step if step < 50 else 100 - step) / 50)
+        events.append((4500000 + step * 5000,
+            [0xE0, value & 0x7F, value >> 7]))
+
+    # Aftertouch on a held chord.
+    for step in range(60):
+        pressure = min(127, step * 4) if step < 30 else (60 - step) * 4
+        events.append((5300000 + step * 10000, [0xD0, pressure]))
+
+    for time_us, message in sorted(events, key=lambda event: event[0]):
+        send(time_us, message)
+
+    trace.add(6000000, "usb-host", "unplug")
+    trace.add(6500000, "usb-host", "plug")
+    trace.write()
+
+
+def daw_sequence():
+    """A DAW on the USB device port, sending clock and a sequence.
+    USB clock arrives with about a millisecond of jitter."""
+    trace = Trace("daw-sequence", [
+        "A DAW on the USB device port: clock at 120 BPM with about",
+        "a millisecond of jitter, Start, a drum and bass sequence with",
+        "volume automation, Stop, Song Position and Continue."
+    ])
+    rng = random.Random(2)
+    tick_us = 60000000 / (120 * 24)
+    end_us = 8000000
+
+    tick = 0
+    while True:
+        time_us = 100000 + tick * tick_us + rng.randint(-800, 800)
+        if time_us > end_us:
+            break
+
+        trace.add(time_us, "usb-device", [0xF8])
+        tick += 1
+
+    # The sequence starts on a tick, and each message is sent in the
+    # same USB packet as the tick it's on.
+    def on_tick(tick, offset_us=0):
+        return 100000 + tick * tick_us + 300 + offset_us
+
+    trace.add(on_tick(24) - 200, "usb-device", [0xFA])
+
+    for step in range(4 * 24 * 2):
+        tick = 24 + step * 6
+        if tick > 24 + 24 * 10:
+            break
+
+        step_us = on_tick(tick)
+        notes = []
+        if step % 4 == 0:
+            notes.append((0x99, 36, 110))
+        if step % 8 == 4:
+            notes.append((0x99, 38, 100))
+        notes.append((0x99, 42, 70 + rng.randint(0, 20)))
+        if step % 2 == 0:
+            notes.append((0x91, 36 + [0, 0, 7, 5][(step // 8) % 4], 90))
+
+        data = []
+        for status, note, velocity in notes:
+            data += [status, note, velocity]
+        trace.add(step_us, "usb-device", data)
+
+        off = []
+        for status, note, velocity in notes:
+            off += [status & 0xEF, note, 0]
+        trace.add(step_us + 60000, "usb-device", off)
+
+        trace.add(step_us + 1000, "usb-device", [0xB1, 7, 64 + step % 40])
+
+    trace.add(on_tick(24 + 24 * 11), "usb-device", [0xFC])
+    trace.add(on_tick(24 + 24 * 12), "usb-device", [0xF2, 16, 0])
+    trace.add(on_tick(24 + 24 * 13) - 200, "usb-device", [0xFB])
+    trace.add(on_tick(24 + 24 * 13), "usb-device", [0x99, 49, 120])
+    trace.add(on_tick(24 + 24 * 14), "usb-device", [0x89, 49, 0])
+    trace.add(on_tick(24 + 24 * 15), "usb-device", [0xFC])
+    trace.write()
+
+
+def sysex_librarian():
+    """A synth on the USB host port sending a bank dump, in full USB
+    packets, while a keyboard is played on DIN. The computer asks for
+    the feedback loop statistics part way through."""
+    trace = Trace("sysex-librarian", [
+        "A synth on the USB host port sends four 265 byte patches, in",
+        "48 byte USB packets a millisecond apart, while a keyboard is",
+        "played on DIN 1. The computer asks for the loop statistics."
+    ])
+    rng = random.Random(3)
+
+    dump = []
+    for patch in range(4):
+        body = [rng.randint(0, 127) for _ in range(256)]
+        checksum = (-sum(body)) & 0x7F
+        dump += [0xF0, 0x43, 0x00, 0x01, 0x02, 0x00, patch] + body + \
+            [checksum, 0xF7]
+
+    for packet in range(0, len(dump), 48):
+        trace.add(200000 + packet // 48 * 1000, "usb-host",
+            dump[packet:packet + 48])
+
+    for step in range(40):
+        note = 60 + (step * 5) % 24
+        time_us = 150000 + step * 15000
+        trace.add(time_us, "din1", [0x90, note, 100])
+        trace.add(time_us + 7000, "din1", [0x80, note, 64])
+
+    trace.add(300000, "usb-device", [0xF0, 0x7D, 0x59, 0x4D, 0x02, 0x03, 0xF7])
+    trace.write()
+
+
+def mtc_chase():
+    """A DAW on the USB device port sending 25 fps time code, which
+    jumps to a new position part way through."""
+    trace = Trace("mtc-chase", [
+        "A DAW on the USB device port sends 25 fps MIDI Time Code from",
+        "00:59:58:00, then locates to 01:10:00:00 with a full frame",
+        "message and plays on from there."
+    ])
+    rng = random.Random(4)
+    quarter_frame_us = 10000
+
+    def send_time_code(start_us, hours, minutes, seconds, frames, count):
+        for index in range(count):
+            # Every quarter frame set starts on an even frame.
+            frame = frames + (index // 8) * 2
+            total = ((hours * 60 + minutes) * 60 + seconds) * 25 + frame
+            f = total % 25
+            s = total // 25 % 60
+            m = total // (25 * 60) % 60
+            h = total // (25 * 3600)
+            piece = index % 8
+            values = [f & 0x0F, f >> 4, s & 0x0F, s >> 4,
+                m & 0x0F, m >> 4, h & 0x0F, (h >> 4) | (1 << 1)]
+            trace.add(start_us + index * quarter_frame_us +
+                rng.randint(-500, 500), "usb-device",
+                [0xF1, (piece << 4) | values[piece]])
+
+    send_time_code(100000, 0, 59, 58, 0, 200)
+    trace.add(2150000, "usb-device",
+        [0xF0, 0x7F, 0x7F, 0x01, 0x01, 0x21, 10, 0, 0, 0xF7])
+    send_time_code(2200000, 1, 10, 0, 0, 160)
+    trace.write()
+
+
+keyboard_performance()
+daw_sequence()
+sysex_librarian()
+mtc_chase()
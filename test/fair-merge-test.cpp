@@ -0,0 +1,156 @@
+#include "firmware-sim.h"
+#include "test.h"
+
+// Runs the firmware with a keyboard playing into the first DIN port
+// while a computer floods the USB device port with control changes,
+// three times faster than a DIN port can send them. Both are merged
+// into the second DIN port, and the keyboard's notes should get through
+// within a few milliseconds however long the flood goes on. The flood
+// keeps the merge backed up, which alone shouldn't freeze the flight
+// recorder.
+
+#define DIN_BYTE_US 320
+
+#define NOTE_INTERVAL_US 50000
+#define FLOOD_INTERVAL_US 300
+
+// A note waits for the control change that's being sent, the few bytes
+// waiting in the UART's transmit buffer, and at most one control change
+// per round from the flood.
+#define MAX_NOTE_LATENCY_US 5000
+
+#define PHASE_US 10000000
+
+struct PhaseResult {
+    uint32_t numNotes = 0;
+    uint32_t numNotesWritten = 0;
+    uint32_t maxLatencyUs = 0;
+    uint64_t totalLatencyUs = 0;
+    uint32_t numControllersWritten = 0;
+};
+
+// Plays notes and floods controllers from startUs for PHASE_US, then
+// lets the queues drain. A note's latency is measured from when its
+// last byte has arrived.
+static PhaseResult runPhase(uint32_t startUs) {
+    PhaseResult result;
+    std::vector<uint32_t> noteArrivalsUs;
+    size_t firstWrite = simWrites().size();
+
+    uint32_t nextNoteUs = startUs;
+    uint32_t nextControllerUs = startUs;
+    uint8_t controllerValue = 0;
+
+    while (nextNoteUs < startUs + PHASE_US) {
+        if (nextControllerUs < nextNoteUs) {
+            simRunUntil(nextControllerUs);
+            simReceive(SIM_USB_DEVICE, nextControllerUs,
+                {0xB0, 74, controllerValue});
+            controllerValue = (controllerValue + 1) & 0x7F;
+            nextControllerUs += FLOOD_INTERVAL_US;
+        } else {
+            simRunUntil(nextNoteUs);
+            uint8_t pitch = 36 + result.numNotes % 48;
+            simReceive(SIM_DIN_1, nextNoteUs, {0x90, pitch, 100});
+            noteArrivalsUs.push_back(nextNoteUs + 2 * DIN_BYTE_US);
+            result.numNotes++;
+            nextNoteUs += NOTE_INTERVAL_US;
+        }
+    }
+
+    simRunUntil(startUs + PHASE_US + 1000000);
+
+    std::vector<SimWrite>& writes = simWrites();
+    for (size_t i = firstWrite; i < writes.size(); i++) {
+        const SimWrite& write = writes[i];
+        if (write.port != SIM_DIN_2) {
+            continue;
+        }
+
+        uint8_t status = simBytesOf(write)[0];
+        if (status == 0xB0) {
+            result.numControllersWritten++;
+        } else if (status == 0x90 &&
+            result.numNotesWritten < noteArrivalsUs.size()) {
+            uint32_t latencyUs =
+                write.timeUs - noteArrivalsUs[result.numNotesWritten];
+            result.totalLatencyUs += latencyUs;
+            if (latencyUs > result.maxLatencyUs) {
+                result.maxLatencyUs = latencyUs;
+            }
+
+            result.numNotesWritten++;
+        }
+    }
+
+    return result;
+}
+
+// Reads the flight recording's reason, source and destination.
+static std::vector<uint8_t> readFlightRecording() {
+    uint32_t startUs = simNowUs();
+    size_t firstWrite = simWrites().size();
+    simReceive(SIM_USB_DEVICE, startUs, {0xF0, 0x7D, 0x59, 0x4D, 0x0A,
+        0x00, 0x00, 0xF7});
+    simRunUntil(startUs + 1000);
+
+    std::vector<SimWrite>& writes = simWrites();
+    for (size_t i = firstWrite; i < writes.size(); i++) {
+        const uint8_t* bytes = simBytesOf(writes[i]);
+        if (writes[i].port == SIM_USB_DEVICE && bytes[4] == 0x0A) {
+            return {bytes[5], bytes[6], bytes[7]};
+        }
+    }
+
+    return {};
+}
+
+static void printResult(const char* name, PhaseResult& result) {
+    printf("%s: %u of %u notes written, latency %llu us mean, "
+        "%u us max; %u of %u controllers written\n", name,
+        result.numNotesWritten, result.numNotes,
+        (unsigned long long) (result.numNotesWritten == 0 ? 0 :
+            result.totalLatencyUs / result.numNotesWritten),
+        result.maxLatencyUs, result.numControllersWritten,
+        PHASE_US / FLOOD_INTERVAL_US);
+}
+
+int main() {
+    simRunUntil(100000);
+
+    PhaseResult fair = runPhase(simNowUs());
+    printResult("Fair merge", fair);
+
+    CHECK_EQUAL(fair.numNotesWritten, fair.numNotes);
+    CHECK(fair.maxLatencyUs < MAX_NOTE_LATENCY_US);
+
+    // The flood really did saturate the port: it's sending
+    // about as much as it can.
+    uint32_t capacity = PHASE_US / (3 * DIN_BYTE_US);
+    CHECK(fair.numControllersWritten > capacity * 8 / 10);
+    CHECK(fair.numControllersWritten + fair.numNotesWritten <= capacity);
+
+    // The controllers waited as long as it took to send the ones queued
+    // ahead of them, which is more than the flight recorder's 10 ms.
+    std::vector<uint8_t> none = {0, 0x7F, 0x7F};
+    CHECK(readFlightRecording() == none);
+
+    // Letting the flood write 42 controllers on each round is almost
+    // first come, first served, and the notes wait behind them.
+    simReceive(SIM_USB_DEVICE, simNowUs(),
+        {0xF0, 0x7D, 0x59, 0x4D, 0x06, SIM_DIN_2, SIM_USB_DEVICE, 127,
+            0xF7});
+    simRunUntil(simNowUs() + 1000);
+
+    PhaseResult unfair = runPhase(simNowUs());
+    printResult("Flood weighted 127", unfair);
+
+    CHECK(unfair.maxLatencyUs > MAX_NOTE_LATENCY_US * 4);
+
+    // Notes waiting on so much more than was queued ahead of them
+    // do freeze it.
+    std::vector<uint8_t> noteLatency = {1, SIM_DIN_1, SIM_DIN_2};
+    CHECK(readFlightRecording() == noteLatency);
+
+    return testResult();
+}
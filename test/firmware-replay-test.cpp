@@ -0,0 +1,208 @@
+#include <fstream>
+#include <sstream>
+#include "firmware-sim.h"
+#include "profiler.h"
+#include "test.h"
+
+// Replays a traffic trace through the whole firmware, and checks that
+// everything it writes matches the trace's expected output byte for
+// byte, and that routing stays within its time budgets.
+//
+//   firmware-replay-test <trace> <expected output> [--update]
+//
+// Each line of a trace is a time in microseconds, a port, and then
+// either the bytes that arrive on the port, in hex, or "plug" or
+// "unplug" for the USB ports. The expected output has a line for every
+// write, in the same format. With --update, the expected output is
+// rewritten from the firmware's output instead of being checked.
+
+// How long the firmware is run after the last event in the trace,
+// so that everything queued has been written.
+#define REPLAY_TAIL_US 500000
+
+// Budgets for parsing and routing, in the profiler's cycles (see
+// profiler.h). These are cycles of the computer running the test, so
+// the budgets are loose, and only catch large regressions.
+#define REPLAY_MAX_CYCLES_PER_BYTE 4000
+#define REPLAY_MAX_CYCLES_PER_MESSAGE 8000
+
+struct ReplayEvent {
+    uint32_t timeUs;
+    uint8_t port;
+    bool isPlug;
+    bool isPluggedIn;
+    std::vector<uint8_t> bytes;
+};
+
+static bool readTrace(const char* path, std::vector<ReplayEvent>& events) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Can't open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    uint32_t lineNumber = 0;
+
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        ReplayEvent event = {};
+        std::string portName;
+        fields >> event.timeUs >> portName;
+        event.port = simPortNamed(portName);
+
+        if (fields.fail() || event.port == SIM_NUM_PORTS) {
+            printf("%s:%u: can't read \"%s\"\n", path, lineNumber,
+                line.c_str());
+            return false;
+        }
+
+        std::string value;
+        while (fields >> value) {
+            if (value == "plug" || value == "unplug") {
+                event.isPlug = true;
+                event.isPluggedIn = value == "plug";
+            } else {
+                event.bytes.push_back(
+                    (uint8_t) std::stoul(value, nullptr, 16));
+            }
+        }
+
+        events.push_back(event);
+    }
+
+    return true;
+}
+
+static std::string formatWrite(const SimWrite& write) {
+    std::string line = std::to_string(write.timeUs) + " " +
+        simPortName(write.port);
+
+    for (uint32_t i = 0; i < write.size; i++) {
+        char hex[4];
+        snprintf(hex, sizeof(hex), " %02X", simBytesOf(write)[i]);
+        line += hex;
+    }
+
+    return line;
+}
+
+static bool writeExpected(const char* path) {
+    std::ofstream file(path);
+    if (!file) {
+        printf("Can't write %s\n", path);
+        return false;
+    }
+
+    for (const SimWrite& write : simWrites()) {
+        file << formatWrite(write) << "\n";
+    }
+
+    printf("Wrote %zu lines to %s\n", simWrites().size(), path);
+    return true;
+}
+
+static void checkExpected(const char* path) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Can't open %s\n", path);
+        numFailedChecks++;
+        return;
+    }
+
+    std::vector<SimWrite>& writes = simWrites();
+    std::string expected;
+    size_t i = 0;
+
+    while (std::getline(file, expected)) {
+        if (i == writes.size()) {
+            printf("%s:%zu: expected \"%s\", but nothing more was "
+                "written\n", path, i + 1, expected.c_str());
+            numFailedChecks++;
+            return;
+        }
+
+        std::string actual = formatWrite(writes[i]);
+        if (actual != expected) {
+            printf("%s:%zu: expected \"%s\", but wrote \"%s\"\n",
+                path, i + 1, expected.c_str(), actual.c_str());
+            numFailedChecks++;
+            return;
+        }
+
+        i++;
+    }
+
+    if (i < writes.size()) {
+        printf("%s: %zu more writes than expected, starting with \"%s\"\n",
+            path, writes.size() - i, formatWrite(writes[i]).c_str());
+        numFailedChecks++;
+    }
+}
+
+static uint64_t averageCycles(ProfileProbe probe) {
+    ProfileProbeStats& stats = profileProbes[probe];
+    return stats.count == 0 ? 0 : stats.totalCycles / stats.count;
+}
+
+static void checkBudgets(uint32_t numBytesReceived) {
+    uint64_t totalCycles = profileProbes[PROFILE_PROBE_PARSER].totalCycles;
+    uint64_t cyclesPerByte = numBytesReceived == 0 ?
+        0 : totalCycles / numBytesReceived;
+    uint64_t cyclesPerMessage = averageCycles(PROFILE_PROBE_ROUTE_MESSAGE);
+
+    printf("%u bytes received, %u messages routed, %zu writes\n",
+        numBytesReceived, profileProbes[PROFILE_PROBE_ROUTE_MESSAGE].count,
+        simWrites().size());
+    printf("Parsing and routing: %llu cycles per byte, "
+        "%llu cycles per message\n", (unsigned long long) cyclesPerByte,
+        (unsigned long long) cyclesPerMessage);
+
+    // Unoptimized builds are far slower, and aren't held to the budgets.
+#ifdef NDEBUG
+    CHECK(cyclesPerByte <= REPLAY_MAX_CYCLES_PER_BYTE);
+    CHECK(cyclesPerMessage <= REPLAY_MAX_CYCLES_PER_MESSAGE);
+#endif
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        printf("Usage: %s <trace> <expected output> [--update]\n", argv[0]);
+        return 2;
+    }
+
+    bool isUpdating = argc > 3 && std::string(argv[3]) == "--update";
+
+    std::vector<ReplayEvent> events;
+    if (!readTrace(argv[1], events)) {
+        return 2;
+    }
+
+    uint32_t numBytesReceived = 0;
+    for (ReplayEvent& event : events) {
+        simRunUntil(event.timeUs);
+
+        if (event.isPlug) {
+            simPlugIn(event.port, event.isPluggedIn);
+        } else {
+            simReceive(event.port, event.timeUs, event.bytes);
+            numBytesReceived += event.bytes.size();
+        }
+    }
+
+    simRunUntil(simNowUs() + REPLAY_TAIL_US);
+
+    if (isUpdating) {
+        return writeExpected(argv[2]) ? 0 : 1;
+    }
+
+    checkExpected(argv[2]);
+    checkBudgets(numBytesReceived);
+
+    return testResult();
+}
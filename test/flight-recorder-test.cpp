@@ -0,0 +1,150 @@
+#include "flight-recorder.h"
+#include "test.h"
+
+// Checks what freezes the flight recorder, and what a later trigger
+// can replace, against synthetic traces of events.
+
+#define CAPACITY 16
+
+typedef FlightRecorder<CAPACITY> Recorder;
+typedef FlightRecording<CAPACITY> Recording;
+
+// Both are meant to be left alone at boot, so they start out zeroed
+// here rather than with whatever was in RAM.
+struct Device {
+    Recorder recorder = Recorder();
+    Recording recording = Recording();
+
+    explicit Device(FlightRecorderConfig config = FlightRecorderConfig()) {
+        recorder.init(&recording, false, config);
+    }
+
+    // Messages received every millisecond, from 1 ms on.
+    void receive(uint32_t numMessages) {
+        for (uint32_t i = 0; i < numMessages; i++) {
+            recorder.record(TRACE_RECORD_MESSAGE, 0, (i + 1) * 1000, i);
+        }
+    }
+};
+
+// Latency up to the threshold beyond what's expected doesn't freeze
+// the ring, and more does, with the route and latency that caused it.
+void testRouteLatency() {
+    Device device;
+    device.receive(4);
+
+    CHECK(!device.recorder.checkRouteLatency(0, 1, 10000, 0, 5000));
+    CHECK(!device.recording.isValid());
+
+    CHECK(device.recorder.checkRouteLatency(2, 1, 10001, 0, 6000));
+    CHECK(device.recording.isValid());
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_ROUTE_LATENCY);
+    CHECK_EQUAL(device.recording.source, 2);
+    CHECK_EQUAL(device.recording.destination, 1);
+    CHECK_EQUAL(device.recording.valueUs, 10001);
+    CHECK_EQUAL(device.recording.triggerUs, 6000);
+    CHECK_EQUAL(device.recording.numRecords, 4);
+}
+
+// A message merged into a backed-up DIN port waits for what's ahead of
+// it to be sent, which is 61 ms for a full merge of four sources, and
+// only waiting longer than that freezes the ring.
+void testExpectedLatency() {
+    Device device;
+    uint32_t expectedUs = 4 * 16 * 3 * 320;
+
+    CHECK(!device.recorder.checkRouteLatency(0, 1, expectedUs + 9000,
+        expectedUs, 1000));
+    CHECK(device.recorder.checkRouteLatency(0, 1, expectedUs + 11000,
+        expectedUs, 2000));
+}
+
+void testLoopTime() {
+    Device device;
+
+    CHECK(!device.recorder.checkLoopTime(5000, 1000));
+    CHECK(device.recorder.checkLoopTime(5001, 2000));
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_LOOP_TIME);
+    CHECK_EQUAL(device.recording.source, TRACE_NO_PORT);
+    CHECK_EQUAL(device.recording.valueUs, 5001);
+}
+
+// A threshold of 0 turns a trigger off.
+void testDisabled() {
+    Device device({.routeLatencyUs = 0, .loopTimeUs = 0});
+
+    CHECK(!device.recorder.checkRouteLatency(0, 1, 1000000, 0, 1000));
+    CHECK(!device.recorder.checkLoopTime(1000000, 1000));
+    CHECK(!device.recording.isValid());
+}
+
+// Only a worse trigger replaces the recording, until it's cleared.
+void testOnlyWorseReplaces() {
+    Device device;
+    device.receive(2);
+
+    CHECK(device.recorder.checkRouteLatency(0, 1, 20000, 0, 3000));
+    device.receive(3);
+    CHECK(!device.recorder.checkRouteLatency(0, 1, 15000, 0, 4000));
+    CHECK(!device.recorder.checkLoopTime(20000, 4000));
+    CHECK_EQUAL(device.recording.numRecords, 2);
+
+    CHECK(device.recorder.checkLoopTime(30000, 5000));
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_LOOP_TIME);
+    CHECK_EQUAL(device.recording.numRecords, 5);
+
+    device.recording.clear();
+    CHECK(device.recorder.checkRouteLatency(0, 1, 15000, 0, 6000));
+}
+
+// Once the ring has wrapped, the recording holds the newest events,
+// oldest first.
+void testRingWraps() {
+    Device device;
+    device.receive(CAPACITY + 5);
+
+    CHECK(device.recorder.checkLoopTime(10000, 100000));
+    CHECK_EQUAL(device.recording.numRecords, CAPACITY);
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+        CHECK_EQUAL(device.recording.records[i].value, i + 5);
+        CHECK_EQUAL(device.recording.records[i].sync, TRACE_RECORD_SYNC);
+    }
+}
+
+// After the watchdog fires, what was in the ring before the reset is
+// frozen, and nothing later replaces it.
+void testWatchdog() {
+    Device device;
+    device.receive(6);
+
+    // A reset without the watchdog records nothing.
+    device.recorder.init(&device.recording, false);
+    CHECK(!device.recording.isValid());
+
+    device.receive(6);
+    device.recorder.init(&device.recording, true);
+    CHECK(device.recording.isValid());
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_WATCHDOG);
+    CHECK_EQUAL(device.recording.numRecords, 6);
+    CHECK_EQUAL(device.recording.triggerUs, 6000);
+
+    CHECK(!device.recorder.checkRouteLatency(0, 1, 1000000, 0, 1000));
+    CHECK(!device.recorder.checkLoopTime(1000000, 1000));
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_WATCHDOG);
+
+    // The recording is still there after another reset.
+    device.recorder.init(&device.recording, false);
+    CHECK_EQUAL(device.recording.reason, FLIGHT_RECORDING_WATCHDOG);
+}
+
+int main() {
+    testRouteLatency();
+    testExpectedLatency();
+    testLoopTime();
+    testDisabled();
+    testOnlyWorseReplaces();
+    testRingWraps();
+    testWatchdog();
+
+    return testResult();
+}
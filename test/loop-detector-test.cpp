@@ -0,0 +1,187 @@
+#include <map>
+#include "loop-detector.h"
+#include "test.h"
+
+// Simulates feedback loops through external gear, with the loop
+// detector on the routing path the way passthrough.cpp uses it:
+// every message is routed to every other port, and the DIN ports
+// also echo their input.
+
+#define NUM_PORTS 4
+#define DIN_PORT 0
+#define USB_DEVICE_PORT 2
+
+struct LoopSimulation {
+    LoopDetector<NUM_PORTS> detector;
+
+    // How long after a message is written to a port it comes back
+    // in on that port, for ports with a MIDI thru on the other end.
+    // Zero means nothing comes back.
+    uint32_t echoLatencyUs[NUM_PORTS] = {0};
+
+    // Messages that will be received, by time.
+    std::multimap<uint32_t, std::pair<uint8_t, uint8_t>> arrivals;
+
+    uint32_t numWritten = 0;
+    uint32_t firstLoopUs = 0;
+
+    LoopSimulation() {
+        detector.init();
+    }
+
+    static bool echoesInput(uint8_t port) {
+        return port < 2;
+    }
+
+    // A note whose number identifies it.
+    static uint32_t hashNote(uint8_t note) {
+        uint8_t message[] = {0x90, note, 0x40};
+        return LoopDetector<NUM_PORTS>::hash(message, sizeof(message));
+    }
+
+    void receive(uint8_t port, uint8_t note, uint32_t nowUs) {
+        uint32_t messageHash = hashNote(note);
+        detector.checkReceived(port, messageHash, nowUs);
+
+        if (detector.numLoopsDetected > 0 && firstLoopUs == 0) {
+            firstLoopUs = nowUs;
+        }
+
+        for (uint8_t destination = 0; destination < NUM_PORTS;
+            destination++) {
+            if ((destination == port && !echoesInput(port)) ||
+                detector.isMuted(port, destination, nowUs)) {
+                continue;
+            }
+
+            detector.recordSent(port, destination, messageHash, nowUs);
+            numWritten++;
+
+            if (echoLatencyUs[destination] > 0) {
+                arrivals.insert({nowUs + echoLatencyUs[destination],
+                    {destination, note}});
+            }
+        }
+    }
+
+    // Delivers everything that arrives before the specified time.
+    void runUntil(uint32_t endUs) {
+        while (!arrivals.empty() && arrivals.begin()->first < endUs) {
+            auto arrival = *arrivals.begin();
+            arrivals.erase(arrivals.begin());
+            receive(arrival.second.first, arrival.second.second,
+                arrival.first);
+        }
+    }
+
+    bool isMuted(uint8_t source, uint8_t destination) {
+        return detector.routeIsMuted[source][destination];
+    }
+};
+
+// A DAW with MIDI thru on the USB device port, and a synth with MIDI
+// thru on the DIN port, pass a single note around until it's caught.
+// Both the synth's thru on its own (DIN -> DIN) and the two devices
+// together (DIN -> USB -> DIN) close a loop, and each doubles the
+// number of messages in flight.
+void testCatchesLoopBetweenTwoPorts() {
+    LoopSimulation sim;
+    sim.echoLatencyUs[USB_DEVICE_PORT] = 2000;
+    sim.echoLatencyUs[DIN_PORT] = 1000;
+
+    uint32_t startUs = 1000;
+    sim.receive(USB_DEVICE_PORT, 60, startUs);
+    sim.runUntil(startUs + 1000000);
+
+    printf("Two-port loop caught after %u us, %u messages written\n",
+        sim.firstLoopUs - startUs, sim.numWritten);
+
+    CHECK_EQUAL(sim.detector.numLoopsDetected, 2);
+    CHECK(sim.firstLoopUs - startUs < 30000);
+    CHECK(sim.numWritten < 500);
+
+    // The loop is broken, so nothing is left circulating.
+    CHECK(sim.arrivals.empty());
+}
+
+// A synth with local control and a soft thru on the DIN port sends
+// its own notes back in. The only route the notes echo on is the one
+// that's muted, so there are no more echoes while the loop is broken.
+// The route must stay muted while the synth is being played, rather
+// than being unmuted (and looping again) every hold period.
+void testHoldsMuteWhileLoopedTrafficContinues() {
+    LoopSimulation sim;
+    sim.echoLatencyUs[DIN_PORT] = 1000;
+
+    uint32_t nowUs = 1000;
+    for (uint8_t i = 0; i < 50; i++) {
+        sim.runUntil(nowUs);
+        sim.receive(DIN_PORT, 36 + i, nowUs);
+        nowUs += 100000;
+    }
+
+    sim.runUntil(nowUs);
+
+    printf("Self loop caught after %u us, %u messages written\n",
+        sim.firstLoopUs - 1000, sim.numWritten);
+
+    CHECK(sim.firstLoopUs - 1000 < 30000);
+    CHECK_EQUAL(sim.detector.numLoopsDetected, 1);
+    CHECK(sim.isMuted(DIN_PORT, DIN_PORT));
+
+    // Once the synth stops sending, the route is unmuted
+    // after the hold period.
+    nowUs += sim.detector.config.muteHoldUs + 1;
+    CHECK(!sim.detector.isMuted(DIN_PORT, DIN_PORT, nowUs));
+}
+
+// Notes that are only played through, with no thru on the other side,
+// never mute anything.
+void testIgnoresOrdinaryTraffic() {
+    LoopSimulation sim;
+
+    uint32_t nowUs = 1000;
+    for (uint8_t i = 0; i < 100; i++) {
+        sim.receive(i % 2 == 0 ? DIN_PORT : USB_DEVICE_PORT, i, nowUs);
+        nowUs += 1000;
+    }
+
+    CHECK_EQUAL(sim.detector.numLoopsDetected, 0);
+    CHECK_EQUAL(sim.detector.mutedRoutes(), 0);
+}
+
+// A keyboard on the DIN port plays a DAW on the USB device port, which
+// has MIDI thru on, so each message comes back once and goes on to a
+// sound module on the DIN output. Notes at a normal pace and a fast
+// knob sweep both echo many times a second, but nothing loops, so
+// nothing may be muted or dropped.
+void testIgnoresSingleEcho() {
+    LoopSimulation sim;
+    sim.echoLatencyUs[USB_DEVICE_PORT] = 2000;
+
+    uint32_t nowUs = 1000;
+    for (uint8_t i = 0; i < 100; i++) {
+        sim.runUntil(nowUs);
+        sim.receive(DIN_PORT, i, nowUs);
+        nowUs += i < 50 ? 90000 : 5000;
+    }
+
+    sim.runUntil(nowUs + 100000);
+
+    CHECK_EQUAL(sim.detector.numLoopsDetected, 0);
+    CHECK_EQUAL(sim.detector.mutedRoutes(), 0);
+    CHECK_EQUAL(sim.detector.numMutedMessages, 0);
+
+    // Each note went out to every port, and each echo to every port
+    // but the one it came from.
+    CHECK_EQUAL(sim.numWritten, 100 * 4 + 100 * 3);
+}
+
+int main() {
+    testCatchesLoopBetweenTwoPorts();
+    testHoldsMuteWhileLoopedTrafficContinues();
+    testIgnoresOrdinaryTraffic();
+    testIgnoresSingleEcho();
+
+    return testResult();
+}
@@ -0,0 +1,199 @@
+#include <chrono>
+#include "message-pool.h"
+#include "test.h"
+
+// Compares queueing every message for four destinations through the
+// shared message pool with copying it into a byte queue for each
+// destination, and checks that the pool gives back every slot.
+
+// The pool, as it's set up in passthrough.cpp.
+typedef MessagePool<192, 8> Pool;
+
+#define NUM_DESTINATIONS 4
+
+// Each destination has this many messages waiting,
+// as it would while it's backed up.
+#define BACKLOG 8
+
+#define NUM_MESSAGES 1000000
+
+// A queue of pool slots for one destination.
+struct SlotQueue {
+    uint8_t slots[BACKLOG];
+    uint8_t readIdx = 0;
+    uint8_t writeIdx = 0;
+
+    void push(uint8_t slot) {
+        slots[writeIdx++ % BACKLOG] = slot;
+    }
+
+    uint8_t pop() {
+        return slots[readIdx++ % BACKLOG];
+    }
+};
+
+// A queue of message bytes for one destination, each message
+// preceded by its size, as each destination would need
+// without a shared pool.
+struct ByteQueue {
+    static constexpr size_t size = 512;
+    uint8_t bytes[size];
+    uint32_t readIdx = 0;
+    uint32_t writeIdx = 0;
+
+    void push(uint8_t* message, uint8_t messageSize) {
+        bytes[writeIdx++ % size] = messageSize;
+        for (uint8_t i = 0; i < messageSize; i++) {
+            bytes[writeIdx++ % size] = message[i];
+        }
+    }
+
+    // Reads a message and returns the sum of its bytes.
+    uint32_t pop() {
+        uint8_t messageSize = bytes[readIdx++ % size];
+        uint32_t sum = 0;
+        for (uint8_t i = 0; i < messageSize; i++) {
+            sum += bytes[readIdx++ % size];
+        }
+
+        return sum;
+    }
+};
+
+static uint32_t sumOfChain(Pool& pool, uint8_t slot) {
+    uint32_t sum = 0;
+    for (; slot != MESSAGE_POOL_NO_SLOT; slot = pool[slot].next) {
+        for (uint8_t i = 0; i < pool[slot].size; i++) {
+            sum += pool[slot].data[i];
+        }
+    }
+
+    return sum;
+}
+
+static void makeMessage(uint8_t* message, size_t size, uint32_t i) {
+    message[0] = size > 3 ? 0xF0 : 0xB0;
+    for (size_t j = 1; j < size; j++) {
+        message[j] = (i + j) & 0x7F;
+    }
+}
+
+// Queues each message for every destination once the oldest message
+// in each queue has been written, and returns ns per message.
+static uint64_t benchmarkPool(size_t messageSize, uint32_t* checksum) {
+    Pool pool;
+    pool.init();
+    SlotQueue queues[NUM_DESTINATIONS];
+    uint8_t message[64];
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < NUM_MESSAGES; i++) {
+        if (i >= BACKLOG) {
+            for (SlotQueue& queue : queues) {
+                uint8_t slot = queue.pop();
+                *checksum += sumOfChain(pool, slot);
+                pool.release(slot);
+            }
+        }
+
+        makeMessage(message, messageSize, i);
+        uint8_t slot = pool.allocate(message, messageSize);
+        for (SlotQueue& queue : queues) {
+            pool.retain(slot);
+            queue.push(slot);
+        }
+
+        pool.release(slot);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - startTime;
+
+    CHECK_EQUAL(pool.numExhausted, 0);
+    CHECK_EQUAL(pool.numInUse,
+        BACKLOG * ((messageSize + 7) / 8));
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count() / NUM_MESSAGES;
+}
+
+static uint64_t benchmarkCopies(size_t messageSize, uint32_t* checksum) {
+    ByteQueue queues[NUM_DESTINATIONS];
+    uint8_t message[64];
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < NUM_MESSAGES; i++) {
+        if (i >= BACKLOG) {
+            for (ByteQueue& queue : queues) {
+                *checksum += queue.pop();
+            }
+        }
+
+        makeMessage(message, messageSize, i);
+        for (ByteQueue& queue : queues) {
+            queue.push(message, messageSize);
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - startTime;
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count() / NUM_MESSAGES;
+}
+
+void compare(size_t messageSize) {
+    uint32_t poolChecksum = 0;
+    uint32_t copyChecksum = 0;
+    uint64_t poolNs = benchmarkPool(messageSize, &poolChecksum);
+    uint64_t copyNs = benchmarkCopies(messageSize, &copyChecksum);
+
+    // Both read back the same bytes.
+    CHECK_EQUAL(poolChecksum, copyChecksum);
+
+    // The bytes each waiting message takes up: its slots, and an index
+    // in each queue, or a sized copy in each queue.
+    size_t poolBytes = (messageSize + 7) / 8 * sizeof(Pool::Slot) +
+        NUM_DESTINATIONS;
+    size_t copyBytes = (messageSize + 1) * NUM_DESTINATIONS;
+
+    printf("%zu-byte messages to %d destinations: pool %llu ns and "
+        "%zu bytes, copies %llu ns and %zu bytes per message\n",
+        messageSize, NUM_DESTINATIONS, (unsigned long long) poolNs,
+        poolBytes, (unsigned long long) copyNs, copyBytes);
+}
+
+// A SysEx chain is freed whole when its last reference is released,
+// and its slots can be used again.
+void testChainsAreFreed() {
+    Pool pool;
+    pool.init();
+    uint8_t sysex[20];
+    makeMessage(sysex, sizeof(sysex), 0);
+
+    uint8_t slot = pool.allocate(sysex, sizeof(sysex));
+    CHECK(slot != MESSAGE_POOL_NO_SLOT);
+    CHECK_EQUAL(pool.numInUse, 3);
+
+    pool.retain(slot);
+    pool.release(slot);
+    CHECK_EQUAL(pool.numInUse, 3);
+
+    pool.release(slot);
+    CHECK_EQUAL(pool.numInUse, 0);
+
+    for (uint32_t i = 0; i < 64; i++) {
+        CHECK(pool.allocate(sysex, sizeof(sysex)) != MESSAGE_POOL_NO_SLOT);
+    }
+
+    CHECK_EQUAL(pool.allocate(sysex, sizeof(sysex)), MESSAGE_POOL_NO_SLOT);
+    CHECK_EQUAL(pool.numExhausted, 1);
+}
+
+int main() {
+    testChainsAreFreed();
+    compare(3);
+    compare(48);
+
+    return testResult();
+}
@@ -0,0 +1,162 @@
+#include "midi-clock.h"
+#include "test.h"
+
+// Replays jittery input clock through the clock engine, polling for
+// regenerated ticks the way the main loop does, and measures how
+// evenly spaced the regenerated clock is.
+
+#define NUM_SOURCES 4
+#define USB_SOURCE 2
+#define DIN_SOURCE 0
+
+// The main loop polls for due ticks at about this interval.
+#define LOOP_US 40
+
+// 24 ticks per quarter note.
+static uint32_t periodForTempo(uint32_t bpm) {
+    return 60000000 / (bpm * 24);
+}
+
+struct ClockSimulation {
+    MidiClockEngine<NUM_SOURCES> engine;
+    TestRandom random{7};
+    uint32_t nowUs = 1000;
+    uint32_t numOutputTicks = 0;
+
+    // When the last tick would have arrived without any jitter.
+    uint32_t idealUs = 1000;
+
+    // Runs the main loop until the specified time.
+    void runUntil(uint32_t endUs) {
+        while ((int32_t) (endUs - nowUs) > 0) {
+            nowUs += random.range(LOOP_US / 2, LOOP_US * 3 / 2);
+            numOutputTicks += engine.popDueTick(nowUs);
+        }
+    }
+
+    // Sends clock at a tempo, with each tick arriving up to
+    // jitterUs early or late.
+    void sendClock(uint8_t source, uint32_t bpm, uint32_t numTicks,
+        int32_t jitterUs) {
+        uint32_t periodUs = periodForTempo(bpm);
+
+        for (uint32_t i = 0; i < numTicks; i++) {
+            idealUs += periodUs;
+            runUntil(idealUs + random.range(-jitterUs, jitterUs));
+            engine.acceptClock(source, nowUs);
+        }
+    }
+};
+
+// USB clock arrives with about a millisecond of jitter.
+// The regenerated clock should be far steadier.
+void testSmoothsJitteryClock() {
+    ClockSimulation sim;
+    sim.engine.init();
+
+    // The first locked period is a single raw interval,
+    // so the statistics only start once the filter has settled.
+    sim.sendClock(USB_SOURCE, 120, 200, 1000);
+    sim.engine.inputJitter.reset();
+    sim.engine.outputJitter.reset();
+
+    sim.sendClock(USB_SOURCE, 120, 2000, 1000);
+    sim.runUntil(sim.nowUs + 10000);
+
+    uint32_t periodUs = periodForTempo(120);
+    CHECK_EQUAL(sim.engine.masterSource, USB_SOURCE);
+    CHECK(sim.engine.periodUs() > periodUs - 20);
+    CHECK(sim.engine.periodUs() < periodUs + 20);
+
+    // Every incoming tick is regenerated exactly once.
+    CHECK_EQUAL(sim.numOutputTicks, 2200);
+    CHECK_EQUAL(sim.engine.numOverflowedTicks, 0);
+
+    MidiClockJitterStats& input = sim.engine.inputJitter;
+    MidiClockJitterStats& output = sim.engine.outputJitter;
+    printf("Input jitter: max %u us, mean %u us\n",
+        input.maxDeviationUs, input.meanDeviationQ4 >> 4);
+    printf("Output jitter: max %u us, mean %u us\n",
+        output.maxDeviationUs, output.meanDeviationQ4 >> 4);
+
+    CHECK(input.maxDeviationUs > 1000);
+    CHECK(output.maxDeviationUs < 250);
+    CHECK(output.meanDeviationQ4 * 4 < input.meanDeviationQ4);
+}
+
+// After a tempo change, the engine relocks rather than slewing.
+void testFollowsTempoChange() {
+    ClockSimulation sim;
+    sim.engine.init();
+
+    sim.sendClock(USB_SOURCE, 120, 200, 500);
+    sim.sendClock(USB_SOURCE, 150, 200, 500);
+
+    uint32_t periodUs = periodForTempo(150);
+    CHECK(sim.engine.periodUs() > periodUs - 20);
+    CHECK(sim.engine.periodUs() < periodUs + 20);
+}
+
+// Clock from a second source is dropped instead of being merged in.
+void testDropsClockFromOtherSources() {
+    ClockSimulation sim;
+    sim.engine.init();
+
+    uint32_t periodUs = periodForTempo(120);
+    for (uint32_t i = 0; i < 100; i++) {
+        sim.runUntil(sim.nowUs + periodUs / 2);
+        sim.engine.acceptClock(USB_SOURCE, sim.nowUs);
+        sim.runUntil(sim.nowUs + periodUs / 2);
+        CHECK(!sim.engine.acceptClock(DIN_SOURCE, sim.nowUs));
+    }
+
+    sim.runUntil(sim.nowUs + 10000);
+
+    CHECK_EQUAL(sim.engine.masterSource, USB_SOURCE);
+    CHECK_EQUAL(sim.engine.numDroppedTicks, 100);
+    CHECK_EQUAL(sim.numOutputTicks, 100);
+}
+
+// When a higher priority source takes over, ticks that were
+// regenerated from the old master are never sent.
+void testDropsPendingTicksOnMasterChange() {
+    ClockSimulation sim;
+    sim.engine.init({.policy = MidiClockSourcePolicy::PRIORITY});
+
+    sim.sendClock(USB_SOURCE, 120, 10, 0);
+    CHECK(sim.engine.hasPendingTick());
+
+    sim.nowUs += 100;
+    sim.engine.acceptClock(DIN_SOURCE, sim.nowUs);
+
+    CHECK_EQUAL(sim.engine.masterSource, DIN_SOURCE);
+    CHECK_EQUAL(sim.engine.numPendingTicks, 1);
+    CHECK_EQUAL(sim.engine.nextTickUs(),
+        sim.nowUs + sim.engine.config.outputDelayUs);
+
+    // The output jitter doesn't count the gap between the masters.
+    uint32_t numIntervals = sim.engine.outputJitter.numIntervals;
+    sim.runUntil(sim.nowUs + 5000);
+    CHECK_EQUAL(sim.engine.outputJitter.numIntervals, numIntervals);
+}
+
+// Without regeneration, the master's clock is forwarded as it arrives.
+void testForwardsWithoutRegeneration() {
+    ClockSimulation sim;
+    sim.engine.init({.regenerate = false});
+
+    CHECK(sim.engine.acceptClock(USB_SOURCE, 1000));
+    CHECK(sim.engine.acceptClock(USB_SOURCE, 21833));
+    CHECK(!sim.engine.acceptClock(DIN_SOURCE, 22000));
+    CHECK(!sim.engine.hasPendingTick());
+}
+
+int main() {
+    testSmoothsJitteryClock();
+    testFollowsTempoChange();
+    testDropsClockFromOtherSources();
+    testDropsPendingTicksOnMasterChange();
+    testForwardsWithoutRegeneration();
+
+    return testResult();
+}
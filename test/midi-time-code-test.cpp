@@ -0,0 +1,165 @@
+#include <vector>
+#include "midi-time-code.h"
+#include "test.h"
+
+// Sends time code through the time code engine, with jumps at the start
+// of a set and in the middle of one, and checks when each jump is seen,
+// what position it's reported at, and that regenerated time code never
+// carries on with the old time after a jump.
+
+#define NUM_SOURCES 4
+#define SOURCE 1
+
+// 25 fps, so a quarter frame every 10 ms.
+#define QUARTER_FRAME_US 10000
+
+struct TimeCodeSimulation {
+    MidiTimeCodeEngine<NUM_SOURCES> engine;
+    uint32_t nowUs = 1000;
+    uint32_t numLocates = 0;
+    MidiTimeCode lastLocate;
+    // Regenerated quarter frames, as data bytes.
+    std::vector<uint8_t> output;
+
+    explicit TimeCodeSimulation(bool regenerate) {
+        engine.init({.regenerate = regenerate, .outputDelayUs = 0});
+    }
+
+    void send(uint8_t data) {
+        bool hasLocated;
+        engine.acceptQuarterFrame(SOURCE, data, nowUs, &hasLocated);
+        if (hasLocated) {
+            numLocates++;
+            lastLocate = engine.locatedPosition();
+        }
+
+        uint8_t regenerated;
+        while (engine.popDueQuarterFrame(nowUs, &regenerated)) {
+            output.push_back(regenerated);
+        }
+
+        nowUs += QUARTER_FRAME_US;
+    }
+
+    // Sends the pieces of a position, from the first piece
+    // up to but not including the last.
+    void sendPieces(MidiTimeCode& position, uint8_t first = 0,
+        uint8_t last = MTC_NUM_PIECES) {
+        for (uint8_t piece = first; piece < last; piece++) {
+            send(position.quarterFrame(piece));
+        }
+    }
+
+    // Sends complete sets, moving the position on two frames each time.
+    void run(MidiTimeCode& position, uint32_t numSets) {
+        for (uint32_t i = 0; i < numSets; i++) {
+            sendPieces(position);
+            position.addFrame();
+            position.addFrame();
+        }
+    }
+};
+
+static MidiTimeCode timeCode(uint8_t hours, uint8_t minutes, uint8_t seconds,
+    uint8_t frames) {
+    MidiTimeCode position;
+    position.hours = hours;
+    position.minutes = minutes;
+    position.seconds = seconds;
+    position.frames = frames;
+    position.rate = MTC_RATE_25;
+    return position;
+}
+
+// Steady time code is one locate, when the first set is complete.
+void testSteady() {
+    TimeCodeSimulation simulation(false);
+    MidiTimeCode position = timeCode(1, 2, 3, 4);
+    simulation.run(position, 50);
+
+    CHECK_EQUAL(simulation.numLocates, 1);
+    CHECK_EQUAL(simulation.engine.sources[SOURCE].numLocates, 1);
+}
+
+// A jump at the start of a set is reported once that set is complete,
+// at the position after it.
+void testJumpBetweenSets() {
+    TimeCodeSimulation simulation(false);
+    MidiTimeCode position = timeCode(1, 2, 3, 4);
+    simulation.run(position, 10);
+
+    MidiTimeCode jump = timeCode(1, 40, 0, 0);
+    simulation.run(jump, 1);
+    CHECK_EQUAL(simulation.numLocates, 2);
+    CHECK(simulation.lastLocate == jump);
+
+    simulation.run(jump, 10);
+    CHECK_EQUAL(simulation.numLocates, 2);
+}
+
+// A source that jumps in the middle of a set, and carries on with the
+// rest of it at the new position, never has its old and new pieces
+// taken for one position without being reported.
+void testJumpWithinSet() {
+    TimeCodeSimulation simulation(false);
+    MidiTimeCode position = timeCode(1, 2, 3, 4);
+    simulation.run(position, 10);
+
+    MidiTimeCode jump = timeCode(1, 40, 0, 0);
+    simulation.sendPieces(position, 0, 4);
+    simulation.sendPieces(jump, 4);
+    jump.addFrame();
+    jump.addFrame();
+    CHECK_EQUAL(simulation.numLocates, 2);
+
+    // The next set puts it right.
+    simulation.run(jump, 1);
+    CHECK_EQUAL(simulation.numLocates, 3);
+    CHECK(simulation.lastLocate == jump);
+}
+
+// Regenerated time code stops at the first quarter frame that doesn't
+// follow on, rather than running on at the old time to the end of the
+// set, and starts again at the new position.
+void testRegeneratedStopsAtJump() {
+    TimeCodeSimulation simulation(true);
+    MidiTimeCode position = timeCode(1, 2, 3, 4);
+    simulation.run(position, 10);
+
+    size_t numBeforeJump = simulation.output.size();
+    MidiTimeCode jump = timeCode(1, 40, 0, 0);
+    MidiTimeCode expected = jump;
+    simulation.run(jump, 1);
+
+    // The old time stopped with the jump's first quarter frame.
+    CHECK_EQUAL(simulation.output.size(), numBeforeJump);
+
+    expected.addFrame();
+    expected.addFrame();
+    simulation.run(jump, 2);
+    CHECK(simulation.output.size() > numBeforeJump);
+    CHECK_EQUAL(simulation.output[numBeforeJump],
+        expected.quarterFrame(0));
+
+    // Once a set into the old time, and only the seconds jump, the
+    // quarter frames carrying the frames still follow on, but the
+    // seconds don't.
+    TimeCodeSimulation lateJump(true);
+    position = timeCode(1, 2, 3, 4);
+    lateJump.run(position, 10);
+    numBeforeJump = lateJump.output.size();
+
+    jump = position;
+    jump.seconds = 30;
+    lateJump.sendPieces(jump, 0, 3);
+    CHECK_EQUAL(lateJump.output.size(), numBeforeJump + 2);
+}
+
+int main() {
+    testSteady();
+    testJumpBetweenSets();
+    testJumpWithinSet();
+    testRegeneratedStopsAtJump();
+
+    return testResult();
+}
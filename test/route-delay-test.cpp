@@ -0,0 +1,144 @@
+#include "firmware-sim.h"
+#include "midi-time-code.h"
+#include "test.h"
+
+// Runs the firmware with a constant latency, set with the route delay
+// SysEx command, and checks what's held back by it: messages, and
+// regenerated clock and time code, but not SysEx.
+
+#define CLOCK_PERIOD_US 20833
+#define QUARTER_FRAME_PERIOD_US 10000
+
+// The regenerated clock and time code's own output delay.
+#define REGENERATION_DELAY_US 2000
+
+#define LATENCY_US 5000
+
+static std::vector<uint32_t> clockInputUs;
+static std::vector<uint32_t> timeCodeInputUs;
+
+// Sends clock from the USB device port and time code from the USB host
+// port until the specified time.
+static void sendClockAndTimeCode(uint32_t endUs) {
+    static uint32_t nextClockUs = 100000;
+    static uint32_t nextQuarterFrameUs = 100000;
+    static uint8_t piece = 0;
+    static MidiTimeCode position = {.rate = MTC_RATE_25};
+
+    while (true) {
+        uint32_t nextUs = nextClockUs < nextQuarterFrameUs ?
+            nextClockUs : nextQuarterFrameUs;
+        if (nextUs >= endUs) {
+            break;
+        }
+
+        simRunUntil(nextUs);
+
+        if (nextUs == nextClockUs) {
+            simReceive(SIM_USB_DEVICE, nextUs, {0xF8});
+            clockInputUs.push_back(nextUs);
+            nextClockUs += CLOCK_PERIOD_US;
+        } else {
+            simReceive(SIM_USB_HOST, nextUs,
+                {0xF1, position.quarterFrame(piece)});
+            timeCodeInputUs.push_back(nextUs);
+            piece = (piece + 1) % MTC_NUM_PIECES;
+            if (piece == 0) {
+                position.addFrame();
+                position.addFrame();
+            }
+            nextQuarterFrameUs += QUARTER_FRAME_PERIOD_US;
+        }
+    }
+
+    simRunUntil(endUs);
+}
+
+// The average time from each input to the first output of the same
+// status on the first DIN port, for outputs in the specified period.
+// Every delay is shorter than the input period.
+static uint32_t meanDelayUs(std::vector<uint32_t>& inputUs, uint8_t status,
+    uint32_t startUs, uint32_t endUs) {
+    uint64_t totalUs = 0;
+    uint32_t numOutputs = 0;
+    size_t input = 0;
+
+    for (const SimWrite& write : simWrites()) {
+        if (write.port != SIM_DIN_1 || simBytesOf(write)[0] != status ||
+            write.timeUs < startUs || write.timeUs >= endUs) {
+            continue;
+        }
+
+        while (input + 1 < inputUs.size() &&
+            inputUs[input + 1] <= write.timeUs) {
+            input++;
+        }
+
+        totalUs += write.timeUs - inputUs[input];
+        numOutputs++;
+    }
+
+    return numOutputs == 0 ? 0 : totalUs / numOutputs;
+}
+
+static uint32_t firstWriteUs(uint8_t port, uint8_t status,
+    uint32_t startUs) {
+    for (const SimWrite& write : simWrites()) {
+        if (write.port == port && simBytesOf(write)[0] == status &&
+            write.timeUs >= startUs) {
+            return write.timeUs;
+        }
+    }
+
+    return 0;
+}
+
+int main() {
+    sendClockAndTimeCode(1100000);
+    uint32_t clockDelayUs = meanDelayUs(clockInputUs, 0xF8, 600000, 1100000);
+    uint32_t timeCodeDelayUs = meanDelayUs(timeCodeInputUs, 0xF1, 600000,
+        1100000);
+
+    printf("Without latency: clock %u us, time code %u us behind\n",
+        clockDelayUs, timeCodeDelayUs);
+    CHECK(clockDelayUs > REGENERATION_DELAY_US - 300);
+    CHECK(clockDelayUs < REGENERATION_DELAY_US + 300);
+    CHECK(timeCodeDelayUs > REGENERATION_DELAY_US - 300);
+    CHECK(timeCodeDelayUs < REGENERATION_DELAY_US + 300);
+
+    // Sets the constant latency to 5 ms.
+    simReceive(SIM_USB_DEVICE, simNowUs(), {0xF0, 0x7D, 0x59, 0x4D, 0x04,
+        0x7F, 0x7F, LATENCY_US & 0x7F, (LATENCY_US >> 7) & 0x7F, 0, 0xF7});
+    sendClockAndTimeCode(2100000);
+
+    clockDelayUs = meanDelayUs(clockInputUs, 0xF8, 1600000, 2100000);
+    timeCodeDelayUs = meanDelayUs(timeCodeInputUs, 0xF1, 1600000, 2100000);
+
+    printf("With %u us latency: clock %u us, time code %u us behind\n",
+        LATENCY_US, clockDelayUs, timeCodeDelayUs);
+    CHECK(clockDelayUs > REGENERATION_DELAY_US + LATENCY_US - 300);
+    CHECK(clockDelayUs < REGENERATION_DELAY_US + LATENCY_US + 300);
+    CHECK(timeCodeDelayUs > REGENERATION_DELAY_US + LATENCY_US - 300);
+    CHECK(timeCodeDelayUs < REGENERATION_DELAY_US + LATENCY_US + 300);
+
+    // Messages are held back by the latency.
+    uint32_t noteUs = simNowUs();
+    simReceive(SIM_USB_DEVICE, noteUs, {0x90, 60, 100});
+    simRunUntil(noteUs + 20000);
+
+    uint32_t noteDelayUs = firstWriteUs(SIM_DIN_1, 0x90, noteUs) - noteUs;
+    printf("Note: %u us behind\n", noteDelayUs);
+    CHECK(noteDelayUs >= LATENCY_US);
+    CHECK(noteDelayUs < LATENCY_US + SIM_LOOP_US * 2);
+
+    // SysEx isn't.
+    uint32_t sysexUs = simNowUs();
+    simReceive(SIM_USB_DEVICE, sysexUs, {0xF0, 0x7E, 0x7F, 0x06, 0x01, 0xF7});
+    simRunUntil(sysexUs + 20000);
+
+    uint32_t sysexDelayUs = firstWriteUs(SIM_DIN_1, 0xF0, sysexUs) - sysexUs;
+    printf("SysEx: %u us behind\n", sysexDelayUs);
+    CHECK(sysexDelayUs < SIM_LOOP_US * 2);
+
+    return testResult();
+}
@@ -0,0 +1,97 @@
+#include "firmware-sim.h"
+#include "test.h"
+
+// Runs the firmware's throughput self-test from every port to every
+// port, until it's done, and reads its results back over both a USB
+// port and a DIN port. With every route, the results are several times
+// longer than a DIN port's transmit buffer, and must still arrive whole.
+
+#define STATS_PAGE_SELF_TEST 0x0F
+#define SELF_TEST_DONE 3
+
+// Every route but the USB ports back to themselves,
+// since they don't echo their input.
+#define NUM_ROUTES (SIM_NUM_PORTS * SIM_NUM_PORTS - 2)
+
+// The reply's header, page, state, rates and number of routes, then
+// each route's source, destination and five numbers, then F7.
+#define REPLY_SIZE (6 + 1 + 5 + 5 + 1 + NUM_ROUTES * (2 + 5 * 5) + 1)
+
+static uint32_t readUInt32(const std::vector<uint8_t>& bytes, size_t i) {
+    uint32_t value = 0;
+    for (size_t j = 0; j < 5; j++) {
+        value |= (uint32_t) bytes[i + j] << (7 * j);
+    }
+
+    return value;
+}
+
+// Asks for the self-test's results on a port, and returns everything
+// written back to that port within the specified time.
+static std::vector<uint8_t> requestResults(uint8_t port, uint32_t waitUs) {
+    uint32_t startUs = simNowUs();
+    size_t firstWrite = simWrites().size();
+    simReceive(port, startUs,
+        {0xF0, 0x7D, 0x59, 0x4D, 0x02, STATS_PAGE_SELF_TEST, 0xF7});
+    simRunUntil(startUs + waitUs);
+
+    std::vector<uint8_t> reply;
+    std::vector<SimWrite>& writes = simWrites();
+    for (size_t i = firstWrite; i < writes.size(); i++) {
+        if (writes[i].port == port) {
+            const uint8_t* bytes = simBytesOf(writes[i]);
+            reply.insert(reply.end(), bytes, bytes + writes[i].size);
+        }
+    }
+
+    return reply;
+}
+
+int main() {
+    simRunUntil(100000);
+
+    // Notes and control changes from every source to every destination,
+    // from 125 messages per second from each source up to 2000.
+    simReceive(SIM_USB_DEVICE, simNowUs(),
+        {0xF0, 0x7D, 0x59, 0x4D, 0x09, 0x0F, 0x0F, 0x03,
+            0x7D, 0x00, 0x00, 0x50, 0x0F, 0x00, 0x40, 0x00, 0xF7});
+
+    std::vector<uint8_t> results;
+    for (uint32_t i = 0; i < 20; i++) {
+        simRunUntil(simNowUs() + 1000000);
+        results = requestResults(SIM_USB_DEVICE, 10000);
+        if (results.size() > 6 && results[6] == SELF_TEST_DONE) {
+            break;
+        }
+    }
+
+    CHECK_EQUAL(results.size(), REPLY_SIZE);
+    CHECK_EQUAL(results[6], SELF_TEST_DONE);
+    CHECK_EQUAL(results[17], NUM_ROUTES);
+
+    uint32_t maxRate = readUInt32(results, 7);
+    printf("Self-test: sustained %u messages per second from each port\n",
+        maxRate);
+    CHECK(maxRate >= 125);
+
+    for (size_t route = 0; route < NUM_ROUTES; route++) {
+        size_t i = 18 + route * 27;
+        uint32_t numReceived = readUInt32(results, i + 2);
+        uint32_t p99Us = readUInt32(results, i + 2 + 15);
+        printf("%s to %s: %u notes, 99th percentile under %u us\n",
+            simPortName(results[i]), simPortName(results[i + 1]),
+            numReceived, p99Us);
+        CHECK(numReceived > 0);
+    }
+
+    // The same results come back over DIN, in packets the transmit
+    // buffer can take, without anything overflowing it. They take
+    // about 150 ms to send.
+    uint32_t numOverflowed = simNumUARTBytesOverflowed(SIM_DIN_1);
+    std::vector<uint8_t> dinResults = requestResults(SIM_DIN_1, 300000);
+    CHECK(REPLY_SIZE > SIM_UART_TX_BUFFER_SIZE * 3);
+    CHECK(dinResults == results);
+    CHECK_EQUAL(simNumUARTBytesOverflowed(SIM_DIN_1), numOverflowed);
+
+    return testResult();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t daddr;
+} tuh_midi_mount_cb_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool tuh_midi_mounted(uint8_t idx);
+uint8_t tuh_midi_get_rx_cable_count(uint8_t idx);
+uint32_t tuh_midi_stream_read(uint8_t idx, uint8_t* p_cable_num,
+    uint8_t* p_buffer, uint16_t bufsize);
+uint32_t tuh_midi_stream_write(uint8_t idx, uint8_t cable_num,
+    uint8_t const* p_buffer, uint32_t bufsize);
+uint32_t tuh_midi_write_flush(uint8_t idx);
+
+// Implemented by the firmware.
+void tuh_midi_mount_cb(uint8_t idx, const tuh_midi_mount_cb_t* mount_cb_data);
+void tuh_midi_umount_cb(uint8_t idx);
+void tuh_midi_rx_cb(uint8_t idx, uint32_t xferred_bytes);
+
+#ifdef __cplusplus
+}
+#endif
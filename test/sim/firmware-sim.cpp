@@ -0,0 +1,433 @@
+#include <deque>
+#include <utility>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/uart.h"
+#include "hardware/watchdog.h"
+#include "midi_uart_lib.h"
+#include "host/hcd.h"
+#include "tusb.h"
+#include "firmware-sim.h"
+
+// The time it takes a DIN port to send or receive one byte.
+#define SIM_UART_BYTE_US 320
+
+struct SimPortState {
+    // Bytes that will be received, with the time each one arrives.
+    std::deque<std::pair<uint32_t, uint8_t>> received;
+
+    // When the last byte received on a DIN port finishes arriving.
+    uint32_t lastReceivedUs = 0;
+
+    // When everything in a DIN port's transmit buffer will have been sent.
+    uint32_t txIdleUs = 0;
+    uint32_t numTXBytesOverflowed = 0;
+
+    bool isStarted = false;
+    bool isPluggedIn = true;
+    bool isMounted = false;
+};
+
+static uint64_t nowUs = 1000;
+static bool isBooted = false;
+static SimPortState portStates[SIM_NUM_PORTS];
+static std::vector<SimWrite> writes;
+static std::vector<uint8_t> writtenBytes;
+
+static uint32_t systemClockKHz = 125000;
+static uint32_t numSystemClockChanges = 0;
+static uint32_t numUnsafeClockChanges = 0;
+static bool gpioLevels[48];
+
+static bool isSOFEnabled = false;
+static uint32_t lastFrame = 0;
+
+static void recordWrite(uint8_t port, const uint8_t* bytes, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    writes.push_back({(uint32_t) nowUs, port,
+        (uint32_t) writtenBytes.size(), (uint32_t) size});
+    writtenBytes.insert(writtenBytes.end(), bytes, bytes + size);
+}
+
+// Copies the bytes that have arrived by now.
+static uint32_t readReceived(uint8_t port, uint8_t* buffer,
+    uint32_t bufferSize) {
+    auto& received = portStates[port].received;
+    uint32_t numBytes = 0;
+
+    while (numBytes < bufferSize && !received.empty() &&
+        (int32_t) ((uint32_t) nowUs - received.front().first) >= 0) {
+        buffer[numBytes] = received.front().second;
+        received.pop_front();
+        numBytes++;
+    }
+
+    return numBytes;
+}
+
+static bool hasReceived(uint8_t port) {
+    auto& received = portStates[port].received;
+
+    return !received.empty() &&
+        (int32_t) ((uint32_t) nowUs - received.front().first) >= 0;
+}
+
+// Mounts and unmounts a USB port to match whether it's plugged in.
+// Returns 1 if it was mounted, -1 if it was unmounted, or 0.
+static int updateMount(uint8_t port) {
+    SimPortState& state = portStates[port];
+
+    if (!state.isStarted || state.isPluggedIn == state.isMounted) {
+        return 0;
+    }
+
+    state.isMounted = state.isPluggedIn;
+    return state.isMounted ? 1 : -1;
+}
+
+uint32_t simNowUs() {
+    return (uint32_t) nowUs;
+}
+
+void simReceive(uint8_t port, uint32_t timeUs,
+    const std::vector<uint8_t>& bytes) {
+    SimPortState& state = portStates[port];
+
+    for (uint8_t byte : bytes) {
+        // DIN MIDI arrives one byte at a time.
+        if (port == SIM_DIN_1 || port == SIM_DIN_2) {
+            if ((int32_t) (timeUs - state.lastReceivedUs) <
+                SIM_UART_BYTE_US) {
+                timeUs = state.lastReceivedUs + SIM_UART_BYTE_US;
+            }
+
+            state.lastReceivedUs = timeUs;
+        }
+
+        state.received.push_back({timeUs, byte});
+    }
+}
+
+void simRunUntil(uint32_t timeUs) {
+    if (!isBooted) {
+        isBooted = true;
+        writes.reserve(1 << 16);
+        writtenBytes.reserve(1 << 20);
+        boot();
+    }
+
+    while ((int32_t) (timeUs - (uint32_t) nowUs) > 0) {
+        runMainLoopIteration();
+        nowUs += SIM_LOOP_US;
+    }
+}
+
+void simPlugIn(uint8_t port, bool isPluggedIn) {
+    portStates[port].isPluggedIn = isPluggedIn;
+}
+
+std::vector<SimWrite>& simWrites() {
+    return writes;
+}
+
+std::vector<uint8_t>& simWrittenBytes() {
+    return writtenBytes;
+}
+
+uint32_t simNumUARTBytesOverflowed(uint8_t port) {
+    return portStates[port].numTXBytesOverflowed;
+}
+
+uint32_t simSystemClockKHz() {
+    return systemClockKHz;
+}
+
+uint32_t simNumSystemClockChanges() {
+    return numSystemClockChanges;
+}
+
+uint32_t simNumUnsafeClockChanges() {
+    return numUnsafeClockChanges;
+}
+
+static const char* PORT_NAMES[SIM_NUM_PORTS] = {
+    "din1", "din2", "usb-device", "usb-host"
+};
+
+const char* simPortName(uint8_t port) {
+    return port < SIM_NUM_PORTS ? PORT_NAMES[port] : "?";
+}
+
+uint8_t simPortNamed(const std::string& name) {
+    for (uint8_t i = 0; i < SIM_NUM_PORTS; i++) {
+        if (name == PORT_NAMES[i]) {
+            return i;
+        }
+    }
+
+    return SIM_NUM_PORTS;
+}
+
+// The Pico SDK
+
+uint32_t time_us_32(void) {
+    return (uint32_t) nowUs;
+}
+
+uint64_t time_us_64(void) {
+    return nowUs;
+}
+
+void sleep_ms(uint32_t ms) {
+    nowUs += ms * 1000;
+}
+
+void gpio_init(uint gpio) {
+    gpioLevels[gpio] = false;
+}
+
+void gpio_set_dir(uint gpio, bool out) {
+    (void) gpio;
+    (void) out;
+}
+
+void gpio_put(uint gpio, bool value) {
+    gpioLevels[gpio] = value;
+}
+
+bool gpio_get(uint gpio) {
+    return gpioLevels[gpio];
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required) {
+    (void) required;
+
+    if (freq_khz != systemClockKHz) {
+        systemClockKHz = freq_khz;
+        numSystemClockChanges++;
+
+        // A byte that's being sent at the time is corrupted.
+        for (uint8_t port : {SIM_DIN_1, SIM_DIN_2}) {
+            uint32_t txIdleUs = portStates[port].txIdleUs;
+            if ((int32_t) (txIdleUs - (uint32_t) nowUs) > 0) {
+                numUnsafeClockChanges++;
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index) {
+    (void) clk_index;
+    return systemClockKHz * 1000;
+}
+
+uart_inst_t* uart_get_instance(uint num) {
+    return (uart_inst_t*) &portStates[num];
+}
+
+uint uart_set_baudrate(uart_inst_t* uart, uint baudrate) {
+    (void) uart;
+    return baudrate;
+}
+
+bool watchdog_enable_caused_reboot(void) {
+    return false;
+}
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) {
+    (void) delay_ms;
+    (void) pause_on_debug;
+}
+
+void watchdog_update(void) {}
+
+// The MIDI UART library. UART n is DIN port n.
+
+void* midi_uart_configure(uint8_t uartnum, uint8_t txgpio, uint8_t rxgpio) {
+    (void) txgpio;
+    (void) rxgpio;
+    return &portStates[uartnum];
+}
+
+static uint8_t uartPort(void* instance) {
+    return (uint8_t) ((SimPortState*) instance - portStates);
+}
+
+uint8_t midi_uart_poll_rx_buffer(void* instance, uint8_t* buffer,
+    RING_BUFFER_SIZE_TYPE buflen) {
+    return readReceived(uartPort(instance), buffer, buflen);
+}
+
+// Bytes leave the transmit buffer at the baud rate, and anything
+// that doesn't fit in it is dropped.
+RING_BUFFER_SIZE_TYPE midi_uart_write_tx_buffer(void* instance,
+    uint8_t* buffer, RING_BUFFER_SIZE_TYPE buflen) {
+    SimPortState* state = (SimPortState*) instance;
+    uint32_t now = (uint32_t) nowUs;
+
+    int32_t backlogUs = (int32_t) (state->txIdleUs - now);
+    if (backlogUs < 0) {
+        backlogUs = 0;
+        state->txIdleUs = now;
+    }
+
+    uint32_t numBuffered =
+        (backlogUs + SIM_UART_BYTE_US - 1) / SIM_UART_BYTE_US;
+    uint32_t numFree = SIM_UART_TX_BUFFER_SIZE - numBuffered;
+    uint32_t numBytes = buflen < numFree ? buflen : numFree;
+
+    state->numTXBytesOverflowed += buflen - numBytes;
+    state->txIdleUs += numBytes * SIM_UART_BYTE_US;
+    recordWrite(uartPort(instance), buffer, numBytes);
+
+    return numBytes;
+}
+
+void midi_uart_drain_tx_buffer(void* instance) {
+    (void) instance;
+}
+
+// TinyUSB's device stack, with a computer that is always reading.
+
+bool tud_init(uint8_t rhport) {
+    (void) rhport;
+    portStates[SIM_USB_DEVICE].isStarted = true;
+    lastFrame = (uint32_t) (nowUs / 1000);
+    return true;
+}
+
+// Start of frame interrupts are handled when the stack is next run.
+void tud_task(void) {
+    int mountChange = updateMount(SIM_USB_DEVICE);
+    if (mountChange > 0) {
+        tud_mount_cb();
+    } else if (mountChange < 0) {
+        tud_umount_cb();
+    }
+
+    uint32_t frame = (uint32_t) (nowUs / 1000);
+    if (frame != lastFrame) {
+        lastFrame = frame;
+
+        if (isSOFEnabled && portStates[SIM_USB_DEVICE].isMounted) {
+            tud_sof_cb(frame);
+        }
+    }
+}
+
+void tud_sof_cb_enable(bool en) {
+    isSOFEnabled = en;
+}
+
+bool tud_midi_mounted(void) {
+    return portStates[SIM_USB_DEVICE].isMounted;
+}
+
+uint32_t tud_midi_stream_read(void* buffer, uint32_t bufsize) {
+    if (!portStates[SIM_USB_DEVICE].isMounted) {
+        return 0;
+    }
+
+    return readReceived(SIM_USB_DEVICE, (uint8_t*) buffer, bufsize);
+}
+
+uint32_t tud_midi_stream_write(uint8_t cable_num, uint8_t const* buffer,
+    uint32_t bufsize) {
+    (void) cable_num;
+    recordWrite(SIM_USB_DEVICE, buffer, bufsize);
+    return bufsize;
+}
+
+bool tud_cdc_connected(void) {
+    return false;
+}
+
+uint32_t tud_cdc_write_available(void) {
+    return 0;
+}
+
+uint32_t tud_cdc_write(void const* buffer, uint32_t bufsize) {
+    (void) buffer;
+    (void) bufsize;
+    return 0;
+}
+
+uint32_t tud_cdc_write_flush(void) {
+    return 0;
+}
+
+// TinyUSB's host stack, with a single device plugged in.
+
+bool tuh_init(uint8_t rhport) {
+    (void) rhport;
+    portStates[SIM_USB_HOST].isStarted = true;
+    return true;
+}
+
+bool tuh_configure(uint8_t rhport, uint32_t cfg_id, const void* cfg_param) {
+    (void) rhport;
+    (void) cfg_id;
+    (void) cfg_param;
+    return true;
+}
+
+void tuh_task(void) {
+    int mountChange = updateMount(SIM_USB_HOST);
+    if (mountChange > 0) {
+        tuh_midi_mount_cb_t mountData = {1};
+        tuh_midi_mount_cb(0, &mountData);
+    } else if (mountChange < 0) {
+        tuh_midi_umount_cb(0);
+    }
+
+    if (portStates[SIM_USB_HOST].isMounted && hasReceived(SIM_USB_HOST)) {
+        tuh_midi_rx_cb(0,
+            (uint32_t) portStates[SIM_USB_HOST].received.size());
+    }
+}
+
+bool tuh_midi_mounted(uint8_t idx) {
+    return idx == 0 && portStates[SIM_USB_HOST].isMounted;
+}
+
+uint8_t tuh_midi_get_rx_cable_count(uint8_t idx) {
+    return tuh_midi_mounted(idx) ? 1 : 0;
+}
+
+uint32_t tuh_midi_stream_read(uint8_t idx, uint8_t* p_cable_num,
+    uint8_t* p_buffer, uint16_t bufsize) {
+    if (!tuh_midi_mounted(idx)) {
+        return 0;
+    }
+
+    *p_cable_num = 0;
+    return readReceived(SIM_USB_HOST, p_buffer, bufsize);
+}
+
+uint32_t tuh_midi_stream_write(uint8_t idx, uint8_t cable_num,
+    uint8_t const* p_buffer, uint32_t bufsize) {
+    (void) cable_num;
+
+    if (!tuh_midi_mounted(idx)) {
+        return 0;
+    }
+
+    recordWrite(SIM_USB_HOST, p_buffer, bufsize);
+    return bufsize;
+}
+
+uint32_t tuh_midi_write_flush(uint8_t idx) {
+    (void) idx;
+    return 0;
+}
+
+uint32_t hcd_frame_number(uint8_t rhport) {
+    (void) rhport;
+    return (uint32_t) (nowUs / 1000);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Runs the firmware on a computer. The Pico SDK and TinyUSB are
+// replaced by the headers in this directory, and their functions are
+// implemented in firmware-sim.cpp against simulated ports and a
+// simulated microsecond timer. The timer only moves on between main
+// loop iterations, so every run of the same input gives the same
+// output, byte for byte and microsecond for microsecond.
+
+// How long each main loop iteration takes in the simulation.
+#define SIM_LOOP_US 10
+
+// Bytes written to the DIN ports wait in a transmit buffer this size.
+#define SIM_UART_TX_BUFFER_SIZE 128
+
+// The ports, in the same order as PortIndex in passthrough.cpp.
+enum SimPort {
+    SIM_DIN_1 = 0,
+    SIM_DIN_2,
+    SIM_USB_DEVICE,
+    SIM_USB_HOST,
+    SIM_NUM_PORTS
+};
+
+/**
+ * @brief Something the firmware wrote to one of its ports. The bytes
+ * are kept in simWrittenBytes(), so that recording a write is cheap
+ * enough not to distort the firmware's profile.
+ */
+struct SimWrite {
+    uint32_t timeUs;
+    uint8_t port;
+    uint32_t start;
+    uint32_t size;
+};
+
+// Implemented in passthrough.cpp.
+void boot();
+void runMainLoopIteration();
+
+uint32_t simNowUs();
+
+// Queues bytes that arrive on a port at the specified time.
+void simReceive(uint8_t port, uint32_t timeUs,
+    const std::vector<uint8_t>& bytes);
+
+// Boots the firmware, if it hasn't been booted yet, and then runs
+// the main loop until the specified time.
+void simRunUntil(uint32_t timeUs);
+
+// Plugs the USB device port into a computer, or a device into the
+// USB host port, or unplugs them. Both are plugged in at first.
+void simPlugIn(uint8_t port, bool isPluggedIn);
+
+// Everything the firmware has written, in order.
+std::vector<SimWrite>& simWrites();
+std::vector<uint8_t>& simWrittenBytes();
+
+inline const uint8_t* simBytesOf(const SimWrite& write) {
+    return &simWrittenBytes()[write.start];
+}
+
+// Bytes the firmware tried to write to a DIN port's full transmit buffer.
+uint32_t simNumUARTBytesOverflowed(uint8_t port);
+
+uint32_t simSystemClockKHz();
+uint32_t simNumSystemClockChanges();
+
+// Clock changes made while a DIN port was sending, which would have
+// corrupted the byte being sent.
+uint32_t simNumUnsafeClockChanges();
+
+const char* simPortName(uint8_t port);
+
+// Returns SIM_NUM_PORTS if the name doesn't match a port.
+uint8_t simPortNamed(const std::string& name);
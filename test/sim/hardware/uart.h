@@ -0,0 +1,16 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+typedef struct uart_inst uart_inst_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uart_inst_t* uart_get_instance(uint num);
+uint uart_set_baudrate(uart_inst_t* uart, uint baudrate);
+
+#ifdef __cplusplus
+}
+#endif
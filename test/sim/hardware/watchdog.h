@@ -0,0 +1,15 @@
+#pragma once
+
+#include "pico/stdlib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool watchdog_enable_caused_reboot(void);
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update(void);
+
+#ifdef __cplusplus
+}
+#endif
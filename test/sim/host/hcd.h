@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t hcd_frame_number(uint8_t rhport);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// As in the ring buffer library, sizes are a single byte by default.
+#ifndef RING_BUFFER_SIZE_TYPE
+#define RING_BUFFER_SIZE_TYPE uint8_t
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* midi_uart_configure(uint8_t uartnum, uint8_t txgpio, uint8_t rxgpio);
+uint8_t midi_uart_poll_rx_buffer(void* instance, uint8_t* buffer,
+    RING_BUFFER_SIZE_TYPE buflen);
+RING_BUFFER_SIZE_TYPE midi_uart_write_tx_buffer(void* instance,
+    uint8_t* buffer, RING_BUFFER_SIZE_TYPE buflen);
+void midi_uart_drain_tx_buffer(void* instance);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,37 @@
+#pragma once
+
+// Stands in for the parts of the Pico SDK the firmware uses, which
+// are implemented against the simulation in firmware-sim.cpp.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define GPIO_OUT 1
+
+#define __not_in_flash_func(name) name
+#define __time_critical_func(name) name
+#define __uninitialized_ram(name) name
+#define __force_inline inline __attribute__((always_inline))
+
+typedef unsigned int uint;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint32_t time_us_32(void);
+uint64_t time_us_64(void);
+void sleep_ms(uint32_t ms);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t pin_dp;
+} pio_usb_configuration_t;
+
+#define PIO_USB_DEFAULT_CONFIG {0}
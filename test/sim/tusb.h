@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The firmware's own TinyUSB configuration is used, as if
+// it were being built for the RP2350.
+#define OPT_MCU_RP2040 1900
+#define CFG_TUSB_MCU OPT_MCU_RP2040
+#include "tusb_config.h"
+
+#define TUH_CFGID_RPI_PIO_USB_CONFIGURATION 100
+
+#ifndef TUSB_VERSION_MAJOR
+#define TUSB_VERSION_MAJOR 0
+#define TUSB_VERSION_MINOR 17
+#define TUSB_VERSION_REVISION 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool tud_init(uint8_t rhport);
+void tud_task(void);
+void tud_sof_cb_enable(bool en);
+bool tud_midi_mounted(void);
+uint32_t tud_midi_stream_read(void* buffer, uint32_t bufsize);
+uint32_t tud_midi_stream_write(uint8_t cable_num, uint8_t const* buffer,
+    uint32_t bufsize);
+
+bool tud_cdc_connected(void);
+uint32_t tud_cdc_write_available(void);
+uint32_t tud_cdc_write(void const* buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_flush(void);
+
+bool tuh_init(uint8_t rhport);
+bool tuh_configure(uint8_t rhport, uint32_t cfg_id, const void* cfg_param);
+void tuh_task(void);
+
+// Implemented by the firmware.
+void tud_mount_cb(void);
+void tud_umount_cb(void);
+void tud_sof_cb(uint32_t frame_count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "class/midi/midi_host.h"
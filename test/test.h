@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Just enough of a test framework for the host tests. Failed checks
+// are printed and counted, and main() returns testResult().
+
+inline int numFailedChecks = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                #condition); \
+            numFailedChecks++; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(actual, expected) \
+    do { \
+        long long actualValue = (long long) (actual); \
+        long long expectedValue = (long long) (expected); \
+        if (actualValue != expectedValue) { \
+            printf("%s:%d: check failed: %s is %lld, expected %lld\n", \
+                __FILE__, __LINE__, #actual, actualValue, expectedValue); \
+            numFailedChecks++; \
+        } \
+    } while (0)
+
+inline int testResult() {
+    if (numFailedChecks > 0) {
+        printf("%d checks failed.\n", numFailedChecks);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief A small, repeatable pseudo-random number generator,
+ * so that simulations give the same results on every run.
+ */
+struct TestRandom {
+    uint32_t state = 1;
+
+    explicit TestRandom(uint32_t seed = 1) : state(seed) {}
+
+    uint32_t next() {
+        // Numerical Recipes' LCG, using its better-mixed high bits.
+        state = state * 1664525 + 1013904223;
+        return state >> 8;
+    }
+
+    // A uniformly distributed value from min to max, inclusive.
+    int32_t range(int32_t min, int32_t max) {
+        return min + (int32_t) (next() % (uint32_t) (max - min + 1));
+    }
+};
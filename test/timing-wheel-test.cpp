@@ -0,0 +1,133 @@
+#include <chrono>
+#include "timing-wheel.h"
+#include "test.h"
+
+// The output queues, as they're set up in passthrough.cpp.
+typedef TimingWheel<256, 48, 8> OutputQueue;
+
+#define NUM_PORTS 4
+
+// The main loop expires the queues about this often.
+#define LOOP_US 10
+
+// The constant latency and a route's offset are each limited to the
+// span of the queues, so the delay of the route is limited too.
+void testClampsCombinedDelay() {
+    RouteDelays<NUM_PORTS> delays;
+    delays.init(2000, OutputQueue::maxDelayUs);
+    delays.routeOffsetsUs[0][1] = 3000;
+
+    CHECK_EQUAL(delays.delayFor(0, 1), 5000);
+    CHECK_EQUAL(delays.delayFor(1, 0), 2000);
+
+    delays.constantLatencyUs = OutputQueue::maxDelayUs;
+    delays.routeOffsetsUs[0][1] = OutputQueue::maxDelayUs;
+    CHECK_EQUAL(delays.delayFor(0, 1), OutputQueue::maxDelayUs);
+}
+
+// A message with the longest delay is written when it's due, rather
+// than being brought in, wherever in a tick it's scheduled, and even
+// when the queue hasn't been expired since the previous tick.
+void testLongestDelayIsNotBroughtIn() {
+    for (uint32_t offsetUs = 0; offsetUs < OutputQueue::tickUs;
+        offsetUs += 15) {
+        OutputQueue queue;
+        queue.init();
+
+        uint32_t nowUs = 100000 + offsetUs;
+        queue.schedule(0, 0, nowUs + 1000, nowUs - OutputQueue::tickUs);
+
+        uint32_t dueUs = nowUs + OutputQueue::maxDelayUs;
+        queue.schedule(1, 1, dueUs, nowUs);
+
+        uint32_t writtenUs = 0;
+        for (uint32_t timeUs = nowUs; writtenUs == 0 &&
+            timeUs < dueUs + OutputQueue::tickUs; timeUs += LOOP_US) {
+            queue.expire(timeUs, [&](uint8_t source, uint8_t, uint32_t) {
+                if (source == 1) {
+                    writtenUs = timeUs;
+                }
+            });
+        }
+
+        CHECK(writtenUs >= dueUs);
+        CHECK(writtenUs < dueUs + LOOP_US);
+    }
+}
+
+// Schedules 10,000 messages a second for ten seconds, spread over
+// every output, with the delays a constant latency and route offsets
+// give, and expires the queues as often as the main loop does.
+void benchmarkTenThousandEventsPerSecond() {
+    OutputQueue queues[NUM_PORTS];
+    for (OutputQueue& queue : queues) {
+        queue.init();
+    }
+
+    TestRandom random(3);
+    uint32_t numScheduled = 0;
+    uint32_t numWritten = 0;
+    uint32_t numExpires = 0;
+    uint32_t numEarly = 0;
+    uint32_t dueTimes[256] = {0};
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    uint32_t nextEventUs = 1000;
+    for (uint32_t nowUs = 1000; nowUs < 10001000; nowUs += LOOP_US) {
+        while ((int32_t) (nowUs - nextEventUs) >= 0) {
+            uint8_t destination = random.range(0, NUM_PORTS - 1);
+            uint32_t dueUs = nowUs + 2000 + random.range(0, 5000);
+            uint8_t message = numScheduled & 0xFF;
+            dueTimes[message] = dueUs;
+
+            queues[destination].schedule(0, message, dueUs, nowUs);
+            numScheduled++;
+            nextEventUs += 100;
+        }
+
+        for (OutputQueue& queue : queues) {
+            queue.expire(nowUs, [&](uint8_t, uint8_t message, uint32_t) {
+                numEarly += (int32_t) (nowUs - dueTimes[message]) < 0;
+                numWritten++;
+            });
+            numExpires++;
+        }
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - startTime;
+    uint64_t elapsedNs = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(elapsed).count();
+
+    uint32_t maxLatenessUs = 0;
+    uint32_t numOverflows = 0;
+    for (OutputQueue& queue : queues) {
+        if (queue.maxLatenessUs > maxLatenessUs) {
+            maxLatenessUs = queue.maxLatenessUs;
+        }
+
+        numOverflows += queue.numOverflows;
+    }
+
+    printf("%u messages through %u output queues in %llu us: "
+        "%llu ns per message, including %u expiries\n", numScheduled,
+        NUM_PORTS, (unsigned long long) elapsedNs / 1000,
+        (unsigned long long) elapsedNs / numScheduled, numExpires);
+    printf("Latest message: %u us\n", maxLatenessUs);
+
+    // Everything that came due was written, and nothing early.
+    // A message can be up to a tick late if one ahead of it
+    // in its slot isn't due yet.
+    CHECK(numScheduled - numWritten < 100);
+    CHECK_EQUAL(numEarly, 0);
+    CHECK_EQUAL(numOverflows, 0);
+    CHECK(maxLatenessUs < OutputQueue::tickUs + LOOP_US);
+}
+
+int main() {
+    testClampsCombinedDelay();
+    testLongestDelayIsNotBroughtIn();
+    benchmarkTenThousandEventsPerSecond();
+
+    return testResult();
+}
@@ -0,0 +1,331 @@
+#include <chrono>
+#include <vector>
+#include "ump-translator.h"
+#include "test.h"
+
+// Checks the UMP translator's value scaling and message translation
+// in both directions, and measures its throughput.
+
+typedef std::vector<uint8_t> Bytes;
+typedef std::vector<uint32_t> Words;
+
+struct Translation {
+    UmpTranslator translator;
+    Words packets;
+    std::vector<Bytes> messages;
+
+    explicit Translation(UmpProtocol protocol = UmpProtocol::MIDI2) {
+        translator.init({.protocol = protocol});
+    }
+
+    void fromMessage(Bytes message) {
+        translator.fromMessage(message.data(), message.size(),
+            [this](uint32_t* words, uint8_t numWords) {
+                packets.insert(packets.end(), words, words + numWords);
+            });
+    }
+
+    void fromSysexChunk(Bytes chunk, bool isFinal) {
+        translator.fromSysexChunk(chunk.data(), chunk.size(), isFinal,
+            [this](uint32_t* words, uint8_t numWords) {
+                packets.insert(packets.end(), words, words + numWords);
+            });
+    }
+
+    // Translates every packet so far back into the byte stream.
+    void toBytes() {
+        for (size_t i = 0; i < packets.size();
+            i += UmpTranslator::packetWords(packets[i])) {
+            translator.toBytes(&packets[i], [this](uint8_t* bytes,
+                size_t size) {
+                messages.push_back(Bytes(bytes, bytes + size));
+            });
+        }
+    }
+};
+
+void testScaleUp() {
+    // Minimum, center and maximum map exactly.
+    CHECK_EQUAL(UmpTranslator::scaleUp(0, 7, 32), 0);
+    CHECK_EQUAL(UmpTranslator::scaleUp(64, 7, 32), 0x80000000);
+    CHECK_EQUAL(UmpTranslator::scaleUp(127, 7, 32), 0xFFFFFFFF);
+    CHECK_EQUAL(UmpTranslator::scaleUp(0, 7, 16), 0);
+    CHECK_EQUAL(UmpTranslator::scaleUp(64, 7, 16), 0x8000);
+    CHECK_EQUAL(UmpTranslator::scaleUp(127, 7, 16), 0xFFFF);
+    CHECK_EQUAL(UmpTranslator::scaleUp(0, 14, 32), 0);
+    CHECK_EQUAL(UmpTranslator::scaleUp(0x2000, 14, 32), 0x80000000);
+    CHECK_EQUAL(UmpTranslator::scaleUp(0x3FFF, 14, 32), 0xFFFFFFFF);
+
+    // Below the center, values are shifted, and above it, the bits
+    // below the center's are repeated to fill out the range.
+    CHECK_EQUAL(UmpTranslator::scaleUp(1, 7, 16), 0x200);
+    CHECK_EQUAL(UmpTranslator::scaleUp(96, 7, 16), 0xC104);
+
+    uint32_t last = 0;
+    for (uint32_t value = 1; value < 128; value++) {
+        uint32_t scaled = UmpTranslator::scaleUp(value, 7, 32);
+        CHECK(scaled > last);
+        last = scaled;
+    }
+}
+
+void testScaleDown() {
+    CHECK_EQUAL(UmpTranslator::scaleDown(0, 32, 7), 0);
+    CHECK_EQUAL(UmpTranslator::scaleDown(0x80000000, 32, 7), 64);
+    CHECK_EQUAL(UmpTranslator::scaleDown(0xFFFFFFFF, 32, 7), 127);
+    CHECK_EQUAL(UmpTranslator::scaleDown(0x80000000, 32, 14), 0x2000);
+    CHECK_EQUAL(UmpTranslator::scaleDown(0xFFFFFFFF, 32, 14), 0x3FFF);
+    CHECK_EQUAL(UmpTranslator::scaleDown(0xFFFF, 16, 7), 127);
+
+    // Every value survives a round trip.
+    for (uint32_t value = 0; value < 128; value++) {
+        CHECK_EQUAL(UmpTranslator::scaleDown(
+            UmpTranslator::scaleUp(value, 7, 32), 32, 7), value);
+        CHECK_EQUAL(UmpTranslator::scaleDown(
+            UmpTranslator::scaleUp(value, 7, 16), 16, 7), value);
+    }
+
+    for (uint32_t value = 0; value < 0x4000; value++) {
+        CHECK_EQUAL(UmpTranslator::scaleDown(
+            UmpTranslator::scaleUp(value, 14, 32), 32, 14), value);
+    }
+}
+
+// A Note On with a velocity of 0 is sent as a MIDI 2.0 Note Off, and a
+// MIDI 2.0 Note On too quiet for MIDI 1.0 still sounds.
+void testNoteOnVelocityZero() {
+    Translation translation;
+    translation.fromMessage({0x93, 60, 0});
+
+    CHECK_EQUAL(translation.packets.size(), 2);
+    CHECK_EQUAL(translation.packets[0], 0x40833C00);
+    CHECK_EQUAL(translation.packets[1], 0);
+
+    translation.toBytes();
+    CHECK(translation.messages[0] == Bytes({0x83, 60, 0}));
+
+    uint32_t quietNoteOn[2] = {0x40933C00, 0x01000000};
+    translation.translator.toBytes(quietNoteOn, [](uint8_t* bytes,
+        size_t size) {
+        CHECK_EQUAL(size, 3);
+        CHECK_EQUAL(bytes[2], 1);
+    });
+}
+
+// Bank select is held until the program change, which then carries it.
+void testProgramChangeWithBank() {
+    Translation translation;
+    translation.fromMessage({0xB2, 0, 1});
+    translation.fromMessage({0xB2, 32, 2});
+    translation.fromMessage({0xC2, 5});
+
+    CHECK_EQUAL(translation.packets.size(), 2);
+    CHECK_EQUAL(translation.packets[0],
+        0x40C20000 | UMP_MIDI2_PROGRAM_BANK_VALID);
+    CHECK_EQUAL(translation.packets[1], 0x05000102);
+
+    translation.toBytes();
+    std::vector<Bytes> expected = {
+        {0xB2, 0, 1}, {0xB2, 32, 2}, {0xC2, 5}
+    };
+    CHECK(translation.messages == expected);
+
+    // Without a bank select, the bank isn't valid.
+    Translation noBank;
+    noBank.fromMessage({0xC0, 7});
+    CHECK_EQUAL(noBank.packets[0], 0x40C00000);
+    CHECK_EQUAL(noBank.packets[1], 0x07000000);
+}
+
+// Registered and non-registered parameters become one MIDI 2.0 message
+// each time data entry is sent, and go back to the same control changes.
+void testParameterRoundTrip() {
+    for (bool isRPN : {true, false}) {
+        uint8_t msb = isRPN ? UMP_MIDI_CC_RPN_MSB : UMP_MIDI_CC_NRPN_MSB;
+        uint8_t lsb = isRPN ? UMP_MIDI_CC_RPN_LSB : UMP_MIDI_CC_NRPN_LSB;
+
+        Translation translation;
+        translation.fromMessage({0xB1, msb, 3});
+        translation.fromMessage({0xB1, lsb, 9});
+        translation.fromMessage({0xB1, UMP_MIDI_CC_DATA_ENTRY_MSB, 0x40});
+        translation.fromMessage({0xB1, UMP_MIDI_CC_DATA_ENTRY_LSB, 0x11});
+
+        // Once for the MSB, and again with the LSB.
+        CHECK_EQUAL(translation.packets.size(), 4);
+        uint8_t opcode = isRPN ? UMP_MIDI2_REGISTERED_CONTROLLER :
+            UMP_MIDI2_ASSIGNABLE_CONTROLLER;
+        CHECK_EQUAL(translation.packets[2],
+            0x40010309 | (uint32_t) opcode << 20);
+        CHECK_EQUAL(translation.packets[3],
+            UmpTranslator::scaleUp(0x40 << 7 | 0x11, 14, 32));
+
+        translation.packets.erase(translation.packets.begin(),
+            translation.packets.begin() + 2);
+        translation.toBytes();
+        std::vector<Bytes> expected = {
+            {0xB1, msb, 3}, {0xB1, lsb, 9},
+            {0xB1, UMP_MIDI_CC_DATA_ENTRY_MSB, 0x40},
+            {0xB1, UMP_MIDI_CC_DATA_ENTRY_LSB, 0x11}
+        };
+        CHECK(translation.messages == expected);
+    }
+
+    // After the null parameter, data entry is an ordinary controller.
+    Translation nullParameter;
+    nullParameter.fromMessage({0xB0, UMP_MIDI_CC_RPN_MSB, 0x7F});
+    nullParameter.fromMessage({0xB0, UMP_MIDI_CC_RPN_LSB, 0x7F});
+    nullParameter.fromMessage({0xB0, UMP_MIDI_CC_DATA_ENTRY_MSB, 5});
+    CHECK_EQUAL(nullParameter.packets.size(), 2);
+    CHECK_EQUAL(nullParameter.packets[0], 0x40B00600);
+}
+
+static Bytes sysex(size_t numDataBytes) {
+    Bytes bytes = {0xF0};
+    for (size_t i = 0; i < numDataBytes; i++) {
+        bytes.push_back(i & 0x7F);
+    }
+
+    bytes.push_back(0xF7);
+    return bytes;
+}
+
+static std::vector<uint8_t> sysexStatuses(Words& packets) {
+    std::vector<uint8_t> statuses;
+    for (size_t i = 0; i < packets.size(); i += 2) {
+        statuses.push_back((packets[i] >> 20) & 0x0F);
+    }
+
+    return statuses;
+}
+
+// A full packet is only sent once there's more data after it, so six
+// bytes is one complete packet, and seven is a start and an end.
+void testSysex7Packing() {
+    struct Case {
+        size_t numDataBytes;
+        std::vector<uint8_t> statuses;
+    };
+
+    Case cases[] = {
+        {0, {UMP_SYSEX7_COMPLETE}},
+        {5, {UMP_SYSEX7_COMPLETE}},
+        {6, {UMP_SYSEX7_COMPLETE}},
+        {7, {UMP_SYSEX7_START, UMP_SYSEX7_END}},
+        {12, {UMP_SYSEX7_START, UMP_SYSEX7_END}},
+        {13, {UMP_SYSEX7_START, UMP_SYSEX7_CONTINUE, UMP_SYSEX7_END}},
+        {18, {UMP_SYSEX7_START, UMP_SYSEX7_CONTINUE, UMP_SYSEX7_END}}
+    };
+
+    for (Case& sysexCase : cases) {
+        Bytes message = sysex(sysexCase.numDataBytes);
+
+        // The parser delivers SysEx in chunks, which can split a packet.
+        Translation translation;
+        for (size_t i = 0; i < message.size(); i += 4) {
+            size_t end = i + 4 < message.size() ? i + 4 : message.size();
+            translation.fromSysexChunk(Bytes(message.begin() + i,
+                message.begin() + end), end == message.size());
+        }
+
+        CHECK(sysexStatuses(translation.packets) == sysexCase.statuses);
+
+        // Each packet says how many bytes it holds.
+        size_t lastPacket = translation.packets.size() - 2;
+        CHECK_EQUAL((translation.packets[lastPacket] >> 16) & 0x0F,
+            sysexCase.numDataBytes - (sysexCase.statuses.size() - 1) * 6);
+
+        translation.toBytes();
+        Bytes reassembled;
+        for (Bytes& chunk : translation.messages) {
+            reassembled.insert(reassembled.end(), chunk.begin(),
+                chunk.end());
+        }
+
+        CHECK(reassembled == message);
+    }
+
+    // The first packet's bytes are in order, from the third byte on.
+    Translation translation;
+    translation.fromSysexChunk({0xF0, 1, 2, 3, 4, 5, 6, 0xF7}, true);
+    CHECK_EQUAL(translation.packets[0], 0x30060102);
+    CHECK_EQUAL(translation.packets[1], 0x03040506);
+}
+
+// Translates a performance (notes, controllers and pitch bend) into
+// packets and back again.
+void benchmarkThroughput() {
+    std::vector<Bytes> messages;
+    TestRandom random(9);
+
+    // Bank select is held back, so it's left out.
+    uint8_t controllers[] = {1, 7, 10, 11, 64};
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint8_t channel = random.range(0, 15);
+        switch (random.range(0, 3)) {
+            case 0:
+                messages.push_back({(uint8_t) (0x90 | channel),
+                    (uint8_t) random.range(0, 127),
+                    (uint8_t) random.range(0, 127)});
+                break;
+            case 1:
+                messages.push_back({(uint8_t) (0x80 | channel),
+                    (uint8_t) random.range(0, 127), 64});
+                break;
+            case 2:
+                messages.push_back({(uint8_t) (0xB0 | channel),
+                    controllers[random.range(0, 4)],
+                    (uint8_t) random.range(0, 127)});
+                break;
+            default:
+                messages.push_back({(uint8_t) (0xE0 | channel),
+                    (uint8_t) random.range(0, 127),
+                    (uint8_t) random.range(0, 127)});
+                break;
+        }
+    }
+
+    for (UmpProtocol protocol : {UmpProtocol::MIDI1, UmpProtocol::MIDI2}) {
+        UmpTranslator translator;
+        translator.init({.protocol = protocol});
+        uint32_t numRoundTrips = 0;
+        uint32_t checksum = 0;
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        for (uint32_t pass = 0; pass < 1000; pass++) {
+            for (Bytes& message : messages) {
+                translator.fromMessage(message.data(), message.size(),
+                    [&](uint32_t* words, uint8_t) {
+                        translator.toBytes(words, [&](uint8_t* bytes,
+                            size_t size) {
+                            checksum += bytes[size - 1];
+                            numRoundTrips++;
+                        });
+                    });
+            }
+        }
+
+        auto elapsed = std::chrono::steady_clock::now() - startTime;
+        uint64_t elapsedNs = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(elapsed).count();
+
+        CHECK_EQUAL(numRoundTrips, messages.size() * 1000);
+        CHECK_EQUAL(translator.numDropped, 0);
+        printf("%s: %u messages to packets and back, %llu ns each "
+            "(checksum %u)\n", protocol == UmpProtocol::MIDI1 ?
+            "MIDI 1.0 packets" : "MIDI 2.0 packets", numRoundTrips,
+            (unsigned long long) elapsedNs / numRoundTrips, checksum);
+    }
+}
+
+int main() {
+    testScaleUp();
+    testScaleDown();
+    testNoteOnVelocityZero();
+    testProgramChangeWithBank();
+    testParameterRoundTrip();
+    testSysex7Packing();
+    benchmarkThroughput();
+
+    return testResult();
+}
@@ -0,0 +1,74 @@
+#include "firmware-sim.h"
+#include "test.h"
+
+// Runs the firmware with its USB output aligned to frames, and checks
+// that messages for the USB ports are written once per frame, just
+// before the next frame starts, and never wait more than a frame.
+
+#define FRAME_US 1000
+
+// When batches are written, after the start of a frame
+// (FRAME_BATCHER_FLUSH_OFFSET_US in frame-batcher.h).
+#define FLUSH_OFFSET_US 850
+
+#define START_US 100000
+#define NUM_NOTES 1000
+
+int main() {
+    simRunUntil(START_US);
+
+    // Notes from the computer go out to the hosted device,
+    // and notes from the hosted device go out to the computer.
+    TestRandom random(5);
+    std::vector<uint32_t> sentUs[SIM_NUM_PORTS];
+    uint32_t timeUs = START_US;
+
+    for (uint32_t i = 0; i < NUM_NOTES; i++) {
+        timeUs += random.range(100, 3000);
+        simRunUntil(timeUs);
+
+        uint8_t source = i % 2 == 0 ? SIM_USB_DEVICE : SIM_USB_HOST;
+        uint8_t destination = i % 2 == 0 ? SIM_USB_HOST : SIM_USB_DEVICE;
+        simReceive(source, timeUs, {0x90, (uint8_t) (36 + i % 48), 100});
+        sentUs[destination].push_back(timeUs);
+    }
+
+    simRunUntil(timeUs + 10000);
+
+    for (uint8_t port : {SIM_USB_DEVICE, SIM_USB_HOST}) {
+        uint32_t numBatches = 0;
+        uint32_t numEarly = 0;
+        uint32_t lastBatchUs = 0;
+        uint32_t maxWaitUs = 0;
+        size_t numNotes = 0;
+
+        for (const SimWrite& write : simWrites()) {
+            if (write.port != port || write.timeUs < START_US) {
+                continue;
+            }
+
+            numBatches++;
+            numEarly += write.timeUs % FRAME_US < FLUSH_OFFSET_US;
+            CHECK(write.timeUs - lastBatchUs > FRAME_US / 2);
+            lastBatchUs = write.timeUs;
+
+            for (uint32_t i = 0; i < write.size; i += 3) {
+                uint32_t waitUs = write.timeUs - sentUs[port][numNotes];
+                if (waitUs > maxWaitUs) {
+                    maxWaitUs = waitUs;
+                }
+
+                numNotes++;
+            }
+        }
+
+        printf("%s: %u batches, %u written early in a frame, "
+            "longest wait %u us\n", simPortName(port), numBatches, numEarly,
+            maxWaitUs);
+        CHECK_EQUAL(numNotes, NUM_NOTES / 2);
+        CHECK_EQUAL(numEarly, 0);
+        CHECK(maxWaitUs < FRAME_US + SIM_LOOP_US * 2);
+    }
+
+    return testResult();
+}
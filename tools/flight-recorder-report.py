@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+
+"""
+Prints the events leading up to a YouMe Transformer flight recording.
+
+The recording is read back in several replies to the flight recording
+SysEx command (F0 7D 59 4D 0A <first record> F7), saved as a .syx file.
+For example, on Linux, to read the default 128 records:
+
+    amidi -p hw:1,0,0 -S 'F0 7D 59 4D 0A 00 00 F7 F0 7D 59 4D 0A 20 00 F7
+        F0 7D 59 4D 0A 40 00 F7 F0 7D 59 4D 0A 60 00 F7' -r flight.syx -t 1
+    ./tools/flight-recorder-report.py flight.syx
+
+Times are shown relative to the moment the recording was frozen.
+"""
+
+import sys
+from youme_sysex import readReplies
+
+COMMAND_GET_FLIGHT_RECORDING = 0x0A
+NO_PORT = 0x7F
+
+REASONS = {
+    0: "none",
+    1: "route latency",
+    2: "loop time",
+    3: "watchdog reset",
+}
+
+MESSAGE = 0x01
+QUEUE_DEPTH = 0x03
+LOOP_TIME = 0x04
+WRITE = 0x06
+USB_MOUNT = 0x07
+
+TYPE_NAMES = {
+    MESSAGE: "received",
+    QUEUE_DEPTH: "queue",
+    LOOP_TIME: "loop",
+    WRITE: "written",
+    USB_MOUNT: "usb",
+}
+
+
+def describe(recordType, value):
+    if recordType in (MESSAGE, WRITE):
+        size = value >> 24
+        data = [(value >> (8 * i)) & 0xFF for i in range(min(size, 3))]
+        return " ".join("%02X" % b for b in data)
+    if recordType == QUEUE_DEPTH:
+        return "%d messages waiting" % value
+    if recordType == LOOP_TIME:
+        return "longest iteration %d us" % value
+    if recordType == USB_MOUNT:
+        state = "plugged in" if value & 1 else "unplugged"
+        return "device %d %s" % (value >> 1, state)
+    return "%08X" % value
+
+
+def parse(path):
+    replies = readReplies(path, COMMAND_GET_FLIGHT_RECORDING)
+    if not replies:
+        sys.exit("No flight recording replies found in %s." % path)
+
+    trigger = None
+    records = {}
+    for reader in replies:
+        reason = reader.byte()
+        source = reader.byte()
+        destination = reader.byte()
+        valueUs = reader.uint32()
+        triggerUs = reader.uint32()
+        numRecords = reader.uint32()
+        firstRecord = reader.uint32()
+        count = reader.byte()
+
+        trigger = (reason, source, destination, valueUs, triggerUs,
+            numRecords)
+        for i in range(count):
+            records[firstRecord + i] = (reader.byte(), reader.byte(),
+                reader.uint32(), reader.uint32())
+
+    return trigger, records
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s <flight>.syx" % sys.argv[0])
+
+    trigger, records = parse(sys.argv[1])
+    reason, source, destination, valueUs, triggerUs, numRecords = trigger
+
+    if reason == 0:
+        print("No recording has been frozen.")
+        return
+
+    print("Reason: %s" % REASONS.get(reason, reason))
+    if source != NO_PORT:
+        print("Route: port %d to port %d" % (source, destination))
+    if valueUs > 0:
+        print("Value: %d us" % valueUs)
+
+    missing = numRecords - len(records)
+    if missing > 0:
+        print("Records: %d of %d were read" % (len(records), numRecords))
+
+    print()
+    print("%10s %-9s %4s  %s" % ("us", "Event", "Port", ""))
+    for index in sorted(records):
+        recordType, port, timeUs, value = records[index]
+        relativeUs = (timeUs - triggerUs + 2**31) % 2**32 - 2**31
+        print("%10d %-9s %4s  %s" % (relativeUs,
+            TYPE_NAMES.get(recordType, recordType),
+            "" if port == NO_PORT else port, describe(recordType, value)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+"""
+Prints the distribution of main loop iteration times from a
+YouMe Transformer loop time dump.
+
+The dump is the reply to the statistics SysEx command for the loop time
+page (F0 7D 59 4D 02 05 F7), saved as a .syx file. For example, on Linux:
+
+    amidi -p hw:1,0,0 -S 'F0 7D 59 4D 02 05 F7' -r loop.syx -t 1
+    ./tools/loop-report.py loop.syx
+
+Percentiles are estimated from the power-of-two histogram buckets,
+so they are upper bounds.
+"""
+
+import sys
+from youme_sysex import readStatsPage
+
+LOOP_TIME_PAGE = 0x05
+PERCENTILES = [50, 90, 99, 99.9]
+
+
+def bucketUpperBoundUs(bucket):
+    return 1 if bucket == 0 else 1 << bucket
+
+
+def parse(path):
+    reader = readStatsPage(path, LOOP_TIME_PAGE)
+    numIterations = reader.uint32()
+    maxUs = reader.uint32()
+    totalUs = reader.uint64()
+    numBuckets = reader.byte()
+    buckets = [reader.uint32() for i in range(numBuckets)]
+
+    return numIterations, maxUs, totalUs, buckets
+
+
+def percentile(buckets, numIterations, p):
+    threshold = numIterations * p / 100
+    count = 0
+    for bucket, bucketCount in enumerate(buckets):
+        count += bucketCount
+        if count >= threshold:
+            return bucketUpperBoundUs(bucket)
+
+    return bucketUpperBoundUs(len(buckets) - 1)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s <loop>.syx" % sys.argv[0])
+
+    numIterations, maxUs, totalUs, buckets = parse(sys.argv[1])
+    if numIterations == 0:
+        sys.exit("No loop iterations were recorded.")
+
+    print("Iterations: %d" % numIterations)
+    print("Mean: %.2f us" % (totalUs / numIterations))
+    print("Max: %d us" % maxUs)
+
+    for p in PERCENTILES:
+        print("p%g: <= %d us" % (p, percentile(buckets, numIterations, p)))
+
+    print()
+    print("%12s %12s" % ("< us", "Iterations"))
+    for bucket, count in enumerate(buckets):
+        if count > 0:
+            print("%12d %12d" % (bucketUpperBoundUs(bucket), count))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+
+"""
+Prints a sorted profile from a YouMe Transformer profile dump.
+
+The dump is the reply to the statistics SysEx command for the profile page
+(F0 7D 59 4D 02 04 F7), saved as a .syx file. For example, on Linux:
+
+    amidi -p hw:1,0,0 -S 'F0 7D 59 4D 02 04 F7' -r profile.syx -t 1
+    ./tools/profile-report.py profile.syx
+
+Probes nest (e.g. the parser probe includes routing), so their
+times overlap and don't add up to the total loop time.
+
+If a budgets file is given, the report fails when any probe's mean
+cycles per call exceed its budget. Each line of the file names a probe
+and its budget, separated by an equals sign, e.g.:
+
+    Parser = 900
+    Route message = 1500
+
+Blank lines and lines starting with # are ignored.
+"""
+
+import sys
+from youme_sysex import readStatsPage
+
+PROFILE_PAGE = 0x04
+
+# Must match the ProfileProbe enum in include/profiler.h.
+PROBE_NAMES = [
+    "UART tick",
+    "USB device tick",
+    "USB host tick",
+    "tud_task",
+    "tuh_task",
+    "Parser",
+    "Route message",
+    "Route SysEx",
+    "UART write",
+    "USB device write",
+    "USB host write",
+]
+
+
+def parse(path):
+    reader = readStatsPage(path, PROFILE_PAGE)
+    hz = reader.uint32()
+    numProbes = reader.byte()
+    if numProbes == 0:
+        sys.exit("The firmware was built without PROFILING.")
+
+    probes = []
+    for i in range(numProbes):
+        name = PROBE_NAMES[i] if i < len(PROBE_NAMES) else "Probe %d" % i
+        count = reader.uint32()
+        total = reader.uint64()
+        minimum = reader.uint32()
+        maximum = reader.uint32()
+        probes.append((name, count, total, minimum, maximum))
+
+    return hz, probes
+
+
+def readBudgets(path):
+    budgets = {}
+    with open(path) as file:
+        for line in file:
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+
+            name, cycles = line.split("=")
+            budgets[name.strip()] = float(cycles)
+
+    return budgets
+
+
+# Returns the probes whose mean cycles per call are over budget.
+def checkBudgets(probes, budgets):
+    overBudget = []
+    for name, count, total, minimum, maximum in probes:
+        if name in budgets and count > 0 and total / count > budgets[name]:
+            overBudget.append((name, total / count, budgets[name]))
+
+    return overBudget
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.exit("Usage: %s <profile>.syx [budgets]" % sys.argv[0])
+
+    hz, probes = parse(sys.argv[1])
+
+    usPerCycle = 1e6 / hz
+    print("System clock: %.1f MHz" % (hz / 1e6))
+    print("%-18s %10s %12s %10s %10s %10s" %
+        ("Probe", "Count", "Total (ms)", "Mean (us)", "Min (us)", "Max (us)"))
+
+    for name, count, total, minimum, maximum in sorted(
+        probes, key=lambda probe: probe[2], reverse=True):
+        if count == 0:
+            print("%-18s %10d" % (name, 0))
+            continue
+
+        print("%-18s %10d %12.3f %10.3f %10.3f %10.3f" % (
+            name, count, total * usPerCycle / 1000,
+            total * usPerCycle / count, minimum * usPerCycle,
+            maximum * usPerCycle))
+
+    if len(sys.argv) == 3:
+        overBudget = checkBudgets(probes, readBudgets(sys.argv[2]))
+        for name, mean, budget in overBudget:
+            print("Over budget: %s takes %.0f cycles per call "
+                "(budget %.0f)" % (name, mean, budget))
+
+        if overBudget:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+
+"""
+Prints the results of a YouMe Transformer throughput self-test.
+
+The results are the reply to the statistics SysEx command for the
+self-test page (F0 7D 59 4D 02 0F F7), saved as a .syx file. For
+example, on Linux, to test from the first DIN input to both DIN outputs:
+
+    amidi -p hw:1,0,0 -S 'F0 7D 59 4D 09 01 03 03 7A 01 00 00 7D 00 40 00 F7'
+    amidi -p hw:1,0,0 -S 'F0 7D 59 4D 02 0F F7' -r self-test.syx -t 1
+    ./tools/self-test-report.py self-test.syx
+
+Latency percentiles are estimated from power-of-two histogram buckets,
+so they are upper bounds.
+"""
+
+import sys
+from youme_sysex import readStatsPage
+
+SELF_TEST_PAGE = 0x0F
+STATES = ["idle", "running", "settling", "done"]
+
+
+def parse(path):
+    reader = readStatsPage(path, SELF_TEST_PAGE)
+    state = reader.byte()
+    maxSustainedRate = reader.uint32()
+    rate = reader.uint32()
+    numRoutes = reader.byte()
+
+    routes = []
+    for i in range(numRoutes):
+        routes.append({
+            "source": reader.byte(),
+            "destination": reader.byte(),
+            "received": reader.uint32(),
+            "dropped": reader.uint32(),
+            "p50": reader.uint32(),
+            "p99": reader.uint32(),
+            "max": reader.uint32(),
+        })
+
+    return state, maxSustainedRate, rate, routes
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s <self-test>.syx" % sys.argv[0])
+
+    state, maxSustainedRate, rate, routes = parse(sys.argv[1])
+
+    print("State: %s" % (STATES[state] if state < len(STATES) else state))
+    print("Current rate: %d messages/s per source" % rate)
+    print("Max sustained rate: %d messages/s per source" % maxSustainedRate)
+
+    if not routes:
+        return
+
+    print()
+    print("%6s %11s %10s %10s %10s %10s %10s" % ("Source", "Destination",
+        "Notes", "Dropped", "p50 us", "p99 us", "Max us"))
+    for route in routes:
+        print("%6d %11d %10d %10d %10s %10s %10d" % (route["source"],
+            route["destination"], route["received"], route["dropped"],
+            "<= %d" % route["p50"], "<= %d" % route["p99"], route["max"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+
+"""
+Decodes the trace records streamed by a YouMe Transformer that was built
+with -DTELEMETRY=ON, and prints them as they arrive.
+
+The records are read from the device's telemetry serial port
+(e.g. /dev/ttyACM0 or COM3, which requires pyserial), or from a file
+containing a raw capture of the stream:
+
+    ./tools/telemetry-reader.py /dev/ttyACM0
+    ./tools/telemetry-reader.py capture.bin
+"""
+
+import os
+import struct
+import sys
+
+RECORD_SYNC = 0xA5
+RECORD_FORMAT = "<BBBBII"
+RECORD_SIZE = struct.calcsize(RECORD_FORMAT)
+NO_PORT = 0x7F
+
+MESSAGE = 0x01
+DROP = 0x02
+QUEUE_DEPTH = 0x03
+LOOP_TIME = 0x04
+OVERFLOW = 0x05
+
+TYPE_NAMES = {
+    MESSAGE: "message",
+    DROP: "dropped",
+    QUEUE_DEPTH: "queue",
+    LOOP_TIME: "loop",
+    OVERFLOW: "overflow",
+}
+
+
+def describe(recordType, value):
+    if recordType == MESSAGE:
+        size = value >> 24
+        data = [(value >> (8 * i)) & 0xFF for i in range(min(size, 3))]
+        return " ".join("%02X" % b for b in data)
+    if recordType == DROP:
+        return "%d bytes in total" % value
+    if recordType == QUEUE_DEPTH:
+        return "%d messages waiting" % value
+    if recordType == LOOP_TIME:
+        return "longest iteration %d us" % value
+    if recordType == OVERFLOW:
+        return "%d records lost" % value
+    return "%08X" % value
+
+
+class StreamDecoder:
+    """Splits a byte stream into records, resynchronizing if needed."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.buffer.extend(data)
+
+        while len(self.buffer) >= RECORD_SIZE:
+            if self.buffer[0] != RECORD_SYNC or \
+                    self.buffer[1] not in TYPE_NAMES:
+                # Skip to the next possible start of a record.
+                del self.buffer[0]
+                continue
+
+            record = struct.unpack(RECORD_FORMAT,
+                bytes(self.buffer[:RECORD_SIZE]))
+            del self.buffer[:RECORD_SIZE]
+            yield record
+
+
+def openStream(path):
+    if os.path.isfile(path):
+        return open(path, "rb")
+
+    try:
+        import serial
+    except ImportError:
+        sys.exit("Reading from a serial port requires pyserial.")
+
+    return serial.Serial(path, timeout=0.1)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("Usage: %s <serial port or capture file>" % sys.argv[0])
+
+    stream = openStream(sys.argv[1])
+    decoder = StreamDecoder()
+    isFile = os.path.isfile(sys.argv[1])
+
+    try:
+        while True:
+            data = stream.read(RECORD_SIZE * 64)
+            if not data:
+                if isFile:
+                    break
+                continue
+
+            for _, recordType, port, _, timeUs, value in decoder.feed(data):
+                portName = "-" if port == NO_PORT else str(port)
+                print("%12.6f s  %-8s %4s  %s" % (timeUs / 1e6,
+                    TYPE_NAMES[recordType], portName,
+                    describe(recordType, value)), flush=True)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
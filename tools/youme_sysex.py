@@ -0,0 +1,61 @@
+"""
+Decodes replies to YouMe Transformer SysEx commands.
+"""
+
+import sys
+
+HEADER = bytes([0xF0, 0x7D, 0x59, 0x4D])
+COMMAND_GET_STATS = 0x02
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.idx = 0
+
+    def byte(self):
+        value = self.data[self.idx]
+        self.idx += 1
+        return value
+
+    # Reads a value encoded as 7-bit bytes, least significant first.
+    def uint(self, numBytes):
+        value = 0
+        for i in range(numBytes):
+            value |= self.byte() << (7 * i)
+        return value
+
+    def uint32(self):
+        return self.uint(5)
+
+    def uint64(self):
+        return self.uint(10)
+
+
+def readReplies(path, command):
+    """Returns a Reader positioned after the header of each reply
+    to the specified command, in the order they were received."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    header = HEADER + bytes([command])
+    readers = []
+    start = data.find(header)
+    while start >= 0:
+        readers.append(Reader(data[start + len(header):]))
+        start = data.find(header, start + len(header))
+
+    return readers
+
+
+def readStatsPage(path, page):
+    """Returns a Reader positioned after the header of a statistics reply."""
+    with open(path, "rb") as f:
+        data = f.read()
+
+    header = HEADER + bytes([COMMAND_GET_STATS, page])
+    start = data.find(header)
+    if start < 0:
+        sys.exit("No reply for statistics page %d found in %s." % (page, path))
+
+    return Reader(data[start + len(header):])